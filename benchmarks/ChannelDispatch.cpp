@@ -0,0 +1,80 @@
+//------------------------------------------------------------------------------
+// File: ChannelDispatch.cpp
+// Desc: Measures the cost of finding the CANChannel that a CAN Open library
+//       callback belongs to with the channel registry.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "CANChannelRegistry.h"
+
+//------------------------------------------------------------------------------
+static const S32 NUM_CHANNELS = 8;
+static const S32 NUM_LOOKUPS = 10000000;
+
+// Callbacks mostly come from SDO acks which are spread over all channels
+static const S32 LOOKUP_STRIDE = 5;
+
+//------------------------------------------------------------------------------
+static double GetTimeSeconds()
+{
+    timespec time;
+    clock_gettime( CLOCK_MONOTONIC, &time );
+    return (double)time.tv_sec + (double)time.tv_nsec*1.0e-9;
+}
+
+//------------------------------------------------------------------------------
+int main()
+{
+    // The channels and handles are never dereferenced so fake them with
+    // addresses from separate allocations, as the real ones would be
+    void* handles[ NUM_CHANNELS ];
+    CANChannel* channels[ NUM_CHANNELS ];
+
+    for ( S32 channelIdx = 0; channelIdx < NUM_CHANNELS; channelIdx++ )
+    {
+        handles[ channelIdx ] = malloc( 64 );
+        channels[ channelIdx ] = (CANChannel*)malloc( 64 );
+
+        if ( !CCR_AddChannel( channels[ channelIdx ], handles[ channelIdx ] ) )
+        {
+            fprintf( stderr, "Error: Unable to register channel %i\n", channelIdx );
+            return -1;
+        }
+    }
+
+    // Time the lookups, using the results so they can't be optimised away
+    S32 numMismatches = 0;
+    S32 handleIdx = 0;
+
+    double startTime = GetTimeSeconds();
+    for ( S32 lookupIdx = 0; lookupIdx < NUM_LOOKUPS; lookupIdx++ )
+    {
+        if ( CCR_FindChannel( handles[ handleIdx ] ) != channels[ handleIdx ] )
+        {
+            numMismatches++;
+        }
+        handleIdx = ( handleIdx + LOOKUP_STRIDE ) % NUM_CHANNELS;
+    }
+    double registryTime = GetTimeSeconds() - startTime;
+
+    printf( "Callback dispatch with %i channels, %i lookups\n", NUM_CHANNELS, NUM_LOOKUPS );
+    printf( "    Registry: %.2f ns per lookup\n", registryTime*1.0e9/NUM_LOOKUPS );
+
+    CCR_Clear();
+    for ( S32 channelIdx = 0; channelIdx < NUM_CHANNELS; channelIdx++ )
+    {
+        free( handles[ channelIdx ] );
+        free( channels[ channelIdx ] );
+    }
+
+    if ( numMismatches > 0 )
+    {
+        fprintf( stderr, "Error: %i lookups found the wrong channel\n", numMismatches );
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,350 @@
+//------------------------------------------------------------------------------
+// File: EndToEnd.cpp
+// Desc: Runs a CANChannel against the virtual CAN bus with different numbers
+//       of nodes, and measures how long setpoints take to reach the nodes,
+//       how often angles are refreshed, how much CPU time each Update takes
+//       and how many frames are sent.
+//
+//       Results are written as one JSON object per line so that they can be
+//       compared between runs. Usage: benchEndToEnd [outputFile]
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "EPOSControl/EPOSControl.h"
+#include "EPOSControl/VirtualCANBus.h"
+
+//------------------------------------------------------------------------------
+static const U8 NUM_NODES_TO_TEST[] = { 1, 18, 64, 127 };
+
+static const U32 UPDATE_PERIOD_US = 1000;
+static const U32 COMMAND_PERIOD_US = 10000;
+static const U32 MAX_BRING_UP_TIME_US = 20000000;
+static const U32 MEASUREMENT_TIME_US = 5000000;
+static const S32 COMMAND_AMPLITUDE = 5000;
+
+static const S32 MAX_NUM_LATENCY_SAMPLES = 1 << 20;
+
+//------------------------------------------------------------------------------
+struct NodeTracker
+{
+    bool mbCommandPending;
+    U64 mOldestCommandTimeUS;   // Oldest setpoint that the node hasn't taken yet
+    U32 mNumSetpoints;
+    S32 mLastAngle;
+    bool mbAngleValid;
+    U32 mNumAngleChanges;
+};
+
+//------------------------------------------------------------------------------
+struct BenchmarkResult
+{
+    U32 mNumNodes;
+    const char* mSetpointMode;
+    U32 mNumRunningNodes;
+    double mBringUpTimeMS;
+    U32 mNumLatencySamples;
+    double mLatencyP50MS;
+    double mLatencyP90MS;
+    double mLatencyP99MS;
+    double mLatencyMaxMS;
+    double mMeanAngleRefreshHz;
+    double mMinAngleRefreshHz;
+    double mMeanUpdateCpuUS;
+    double mMaxUpdateCpuUS;
+    double mFramesPerSecond;
+    double mBusLoadPercent;
+};
+
+//------------------------------------------------------------------------------
+static double GetThreadCpuTimeUS()
+{
+    timespec time;
+    clock_gettime( CLOCK_THREAD_CPUTIME_ID, &time );
+    return (double)time.tv_sec*1.0e6 + (double)time.tv_nsec*1.0e-3;
+}
+
+//------------------------------------------------------------------------------
+static int CompareU32( const void* pA, const void* pB )
+{
+    U32 a = *(const U32*)pA;
+    U32 b = *(const U32*)pB;
+    return ( a < b ? -1 : ( a > b ? 1 : 0 ) );
+}
+
+//------------------------------------------------------------------------------
+// Samples must be sorted
+static double GetPercentileMS( const U32* pSamplesUS, S32 numSamples, double percentile )
+{
+    if ( 0 == numSamples )
+    {
+        return 0.0;
+    }
+
+    S32 sampleIdx = (S32)( percentile*( numSamples - 1 )/100.0 + 0.5 );
+    return (double)pSamplesUS[ sampleIdx ]/1000.0;
+}
+
+//------------------------------------------------------------------------------
+static void RunBenchmark( U8 numNodes, CANMotorController::eSetpointMode setpointMode,
+                          U32* pLatencySamples, BenchmarkResult* pResultOut )
+{
+    memset( pResultOut, 0, sizeof( BenchmarkResult ) );
+    pResultOut->mNumNodes = numNodes;
+    pResultOut->mSetpointMode = ( CANMotorController::eSM_RPDO == setpointMode ? "rpdo" : "sdo" );
+
+    VirtualCANBusConfig config;
+    VCB_GetDefaultConfig( &config );
+    config.mNumNodes = numNodes;
+    VCB_SetConfig( config );
+
+    CANChannel* pChannel = EPOS_OpenCANChannel( "virtual", "virtual", eBR_1M );
+    if ( NULL == pChannel )
+    {
+        fprintf( stderr, "Error: Unable to open virtual channel\n" );
+        return;
+    }
+
+    pChannel->ConfigureAllMotorControllersForPositionControl();
+    pChannel->SetSetpointMode( CANChannel::ALL_MOTOR_CONTROLLERS, setpointMode );
+
+    // Angles are streamed back so that polling doesn't compete with the 
+    // setpoints for the bus
+    pChannel->SetFeedbackMode( CANChannel::ALL_MOTOR_CONTROLLERS, CANMotorController::eFM_TPDO );
+
+    MotorControllerSnapshot* pSnapshot = new MotorControllerSnapshot;
+    NodeTracker* pTrackers = new NodeTracker[ CANChannel::MAX_NUM_MOTOR_CONTROLLERS ];
+    memset( pTrackers, 0, CANChannel::MAX_NUM_MOTOR_CONTROLLERS*sizeof( NodeTracker ) );
+
+    // Wait for all of the nodes to boot and be configured
+    U32 bringUpTimeUS = 0;
+    while ( bringUpTimeUS < MAX_BRING_UP_TIME_US )
+    {
+        pChannel->Update();
+        VCB_AdvanceTime( pChannel, UPDATE_PERIOD_US );
+        bringUpTimeUS += UPDATE_PERIOD_US;
+
+        pChannel->GetMotorControllerSnapshot( pSnapshot );
+        S32 numRunningNodes = 0;
+        for ( S32 i = 0; i < pSnapshot->mNumControllers; i++ )
+        {
+            if ( CANMotorController::eS_Running == pSnapshot->mStates[ i ] )
+            {
+                numRunningNodes++;
+            }
+        }
+
+        pResultOut->mNumRunningNodes = numRunningNodes;
+        if ( numRunningNodes == numNodes )
+        {
+            break;
+        }
+    }
+    pResultOut->mBringUpTimeMS = bringUpTimeUS/1000.0;
+
+    // Give the nodes time to become Operational if needed
+    for ( U32 timeUS = 0; timeUS < 100000; timeUS += UPDATE_PERIOD_US )
+    {
+        pChannel->Update();
+        VCB_AdvanceTime( pChannel, UPDATE_PERIOD_US );
+    }
+
+    VirtualCANBusStats startStats;
+    VCB_GetStats( pChannel, &startStats );
+
+    // Send setpoints to every node at the command rate, so that they're
+    // always moving, and see when the nodes take them
+    S32 numLatencySamples = 0;
+    S32 numUpdates = 0;
+    double totalUpdateCpuUS = 0.0;
+    double maxUpdateCpuUS = 0.0;
+    S32 commandIdx = 0;
+
+    for ( U32 timeUS = 0; timeUS < MEASUREMENT_TIME_US; timeUS += UPDATE_PERIOD_US )
+    {
+        U64 busTimeUS = VCB_GetTimeUS( pChannel );
+
+        if ( 0 == timeUS%COMMAND_PERIOD_US )
+        {
+            S32 angle = ( commandIdx%2 ? COMMAND_AMPLITUDE : -COMMAND_AMPLITUDE );
+            commandIdx++;
+
+            for ( S32 nodeIdx = 0; nodeIdx < numNodes; nodeIdx++ )
+            {
+                U8 nodeId = config.mFirstNodeId + nodeIdx;
+                pChannel->SetMotorAngle( nodeId, angle + nodeId );
+
+                // Setpoints taken from now on count towards this command
+                VirtualNodeState nodeState;
+                if ( !pTrackers[ nodeId ].mbCommandPending
+                    && VCB_GetNodeState( pChannel, nodeId, &nodeState ) )
+                {
+                    pTrackers[ nodeId ].mbCommandPending = true;
+                    pTrackers[ nodeId ].mOldestCommandTimeUS = busTimeUS;
+                    pTrackers[ nodeId ].mNumSetpoints = nodeState.mNumSetpoints;
+                }
+            }
+        }
+
+        double startCpuUS = GetThreadCpuTimeUS();
+        pChannel->Update();
+        double updateCpuUS = GetThreadCpuTimeUS() - startCpuUS;
+
+        totalUpdateCpuUS += updateCpuUS;
+        if ( updateCpuUS > maxUpdateCpuUS )
+        {
+            maxUpdateCpuUS = updateCpuUS;
+        }
+        numUpdates++;
+
+        VCB_AdvanceTime( pChannel, UPDATE_PERIOD_US );
+
+        // Check for setpoints that have been taken
+        for ( S32 nodeIdx = 0; nodeIdx < numNodes; nodeIdx++ )
+        {
+            U8 nodeId = config.mFirstNodeId + nodeIdx;
+            NodeTracker& tracker = pTrackers[ nodeId ];
+
+            VirtualNodeState nodeState;
+            if ( tracker.mbCommandPending
+                && VCB_GetNodeState( pChannel, nodeId, &nodeState )
+                && nodeState.mNumSetpoints != tracker.mNumSetpoints )
+            {
+                tracker.mNumSetpoints = nodeState.mNumSetpoints;
+                tracker.mbCommandPending = false;
+
+                if ( numLatencySamples < MAX_NUM_LATENCY_SAMPLES )
+                {
+                    pLatencySamples[ numLatencySamples++ ] =
+                        (U32)( nodeState.mLastSetpointTimeUS - tracker.mOldestCommandTimeUS );
+                }
+            }
+        }
+
+        // Count how often the angles seen by the client change
+        pChannel->GetMotorControllerSnapshot( pSnapshot );
+        for ( S32 i = 0; i < pSnapshot->mNumControllers; i++ )
+        {
+            NodeTracker& tracker = pTrackers[ pSnapshot->mNodeIds[ i ] ];
+            if ( pSnapshot->mbAngleValid[ i ] )
+            {
+                if ( tracker.mbAngleValid && tracker.mLastAngle != pSnapshot->mAngles[ i ] )
+                {
+                    tracker.mNumAngleChanges++;
+                }
+                tracker.mLastAngle = pSnapshot->mAngles[ i ];
+                tracker.mbAngleValid = true;
+            }
+        }
+    }
+
+    VirtualCANBusStats endStats;
+    VCB_GetStats( pChannel, &endStats );
+
+    // Work out the results
+    double measurementTimeS = MEASUREMENT_TIME_US/1.0e6;
+
+    qsort( pLatencySamples, numLatencySamples, sizeof( U32 ), CompareU32 );
+    pResultOut->mNumLatencySamples = numLatencySamples;
+    pResultOut->mLatencyP50MS = GetPercentileMS( pLatencySamples, numLatencySamples, 50.0 );
+    pResultOut->mLatencyP90MS = GetPercentileMS( pLatencySamples, numLatencySamples, 90.0 );
+    pResultOut->mLatencyP99MS = GetPercentileMS( pLatencySamples, numLatencySamples, 99.0 );
+    pResultOut->mLatencyMaxMS = GetPercentileMS( pLatencySamples, numLatencySamples, 100.0 );
+
+    double totalRefreshHz = 0.0;
+    double minRefreshHz = -1.0;
+    for ( S32 nodeIdx = 0; nodeIdx < numNodes; nodeIdx++ )
+    {
+        double refreshHz = pTrackers[ config.mFirstNodeId + nodeIdx ].mNumAngleChanges/measurementTimeS;
+        totalRefreshHz += refreshHz;
+        if ( minRefreshHz < 0.0 || refreshHz < minRefreshHz )
+        {
+            minRefreshHz = refreshHz;
+        }
+    }
+    pResultOut->mMeanAngleRefreshHz = totalRefreshHz/numNodes;
+    pResultOut->mMinAngleRefreshHz = minRefreshHz;
+
+    pResultOut->mMeanUpdateCpuUS = totalUpdateCpuUS/numUpdates;
+    pResultOut->mMaxUpdateCpuUS = maxUpdateCpuUS;
+
+    U32 numFrames = ( endStats.mNumFramesToNodes - startStats.mNumFramesToNodes )
+        + ( endStats.mNumFramesFromNodes - startStats.mNumFramesFromNodes );
+    pResultOut->mFramesPerSecond = numFrames/measurementTimeS;
+    pResultOut->mBusLoadPercent = 100.0*( endStats.mBusBusyTimeUS - startStats.mBusBusyTimeUS )
+        /(double)MEASUREMENT_TIME_US;
+
+    delete [] pTrackers;
+    delete pSnapshot;
+    EPOS_CloseCANChannel( pChannel );
+}
+
+//------------------------------------------------------------------------------
+static void WriteResult( FILE* pFile, const BenchmarkResult& result )
+{
+    fprintf( pFile, "{ \"benchmark\": \"EndToEnd\", \"num_nodes\": %u, \"setpoint_mode\": \"%s\", "
+        "\"num_running_nodes\": %u, \"bring_up_time_ms\": %.1f, "
+        "\"num_latency_samples\": %u, \"latency_p50_ms\": %.3f, \"latency_p90_ms\": %.3f, "
+        "\"latency_p99_ms\": %.3f, \"latency_max_ms\": %.3f, "
+        "\"mean_angle_refresh_hz\": %.2f, \"min_angle_refresh_hz\": %.2f, "
+        "\"mean_update_cpu_us\": %.2f, \"max_update_cpu_us\": %.2f, "
+        "\"frames_per_second\": %.1f, \"bus_load_percent\": %.1f }\n",
+        result.mNumNodes, result.mSetpointMode,
+        result.mNumRunningNodes, result.mBringUpTimeMS,
+        result.mNumLatencySamples, result.mLatencyP50MS, result.mLatencyP90MS,
+        result.mLatencyP99MS, result.mLatencyMaxMS,
+        result.mMeanAngleRefreshHz, result.mMinAngleRefreshHz,
+        result.mMeanUpdateCpuUS, result.mMaxUpdateCpuUS,
+        result.mFramesPerSecond, result.mBusLoadPercent );
+}
+
+//------------------------------------------------------------------------------
+int main( int argc, char** argv )
+{
+    // The library prints progress to stdout, so results go to a file
+    const char* outputFilename = ( argc > 1 ? argv[ 1 ] : "EndToEnd.json" );
+    FILE* pOutputFile = fopen( outputFilename, "w" );
+    if ( NULL == pOutputFile )
+    {
+        fprintf( stderr, "Error: Unable to open %s\n", outputFilename );
+        return -1;
+    }
+
+    if ( !EPOS_InitLibrary() )
+    {
+        fprintf( stderr, "Error: Unable to open EPOSControl library\n" );
+        fclose( pOutputFile );
+        return -1;
+    }
+
+    U32* pLatencySamples = new U32[ MAX_NUM_LATENCY_SAMPLES ];
+    bool bAllNodesRunning = true;
+
+    for ( U32 testIdx = 0; testIdx < ARRAY_LENGTH( NUM_NODES_TO_TEST ); testIdx++ )
+    {
+        for ( S32 modeIdx = 0; modeIdx < 2; modeIdx++ )
+        {
+            CANMotorController::eSetpointMode setpointMode = ( 0 == modeIdx ?
+                CANMotorController::eSM_SDO : CANMotorController::eSM_RPDO );
+
+            BenchmarkResult result;
+            RunBenchmark( NUM_NODES_TO_TEST[ testIdx ], setpointMode, pLatencySamples, &result );
+            WriteResult( pOutputFile, result );
+            WriteResult( stderr, result );
+
+            if ( result.mNumRunningNodes != result.mNumNodes )
+            {
+                bAllNodesRunning = false;
+            }
+        }
+    }
+
+    delete [] pLatencySamples;
+    EPOS_DeinitLibrary();
+    fclose( pOutputFile );
+
+    return ( bAllNodesRunning ? 0 : -1 );
+}
@@ -0,0 +1,135 @@
+//------------------------------------------------------------------------------
+// File: ReplayTraffic.cpp
+// Desc: Replays a traffic capture made with CANChannel::StartTrafficRecording
+//       into a channel as fast as possible, and reports how long each
+//       Update took. The channel is opened on a virtual CAN bus with no
+//       nodes, so that the messages it sends go nowhere and the only
+//       traffic it sees is the traffic from the capture.
+//
+//       Usage: benchReplayTraffic captureFile [numRepeats]
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "EPOSControl/EPOSControl.h"
+#include "EPOSControl/TrafficRecorder.h"
+#include "EPOSControl/VirtualCANBus.h"
+
+//------------------------------------------------------------------------------
+// Limits how far the virtual bus is run forward between updates if there are
+// gaps in the capture
+static const U64 MAX_TIME_STEP_US = 1000000;
+
+//------------------------------------------------------------------------------
+static double GetTimeSeconds()
+{
+    timespec time;
+    clock_gettime( CLOCK_MONOTONIC, &time );
+    return (double)time.tv_sec + (double)time.tv_nsec*1.0e-9;
+}
+
+//------------------------------------------------------------------------------
+static bool ReplayCapture( const char* filename, S32 repeatIdx )
+{
+    bool bResult = false;
+    CANChannel* pChannel = NULL;
+    U64 startTimeUS = 0;
+    U64 lastTimeUS = 0;
+    double startTime = 0.0;
+    double replayTime = 0.0;
+
+    TrafficReplayer replayer;
+    if ( !replayer.Open( filename ) )
+    {
+        goto Finished;
+    }
+
+    pChannel = EPOS_OpenCANChannel( "virtual", "virtual", eBR_1M );
+    if ( NULL == pChannel )
+    {
+        fprintf( stderr, "Error: Unable to open a virtual CAN channel\n" );
+        goto Finished;
+    }
+
+    startTimeUS = replayer.GetTimeUS();
+    lastTimeUS = startTimeUS;
+    startTime = GetTimeSeconds();
+
+    while ( replayer.ReplayNextUpdate( pChannel ) )
+    {
+        // Let the frames sent by the update drain from the bus
+        U64 timeStepUS = ( replayer.GetTimeUS() > lastTimeUS ? replayer.GetTimeUS() - lastTimeUS : 0 );
+        if ( timeStepUS > MAX_TIME_STEP_US )
+        {
+            timeStepUS = MAX_TIME_STEP_US;
+        }
+        VCB_AdvanceTime( pChannel, (U32)timeStepUS );
+        lastTimeUS = replayer.GetTimeUS();
+    }
+
+    replayTime = GetTimeSeconds() - startTime;
+
+    {
+        const TrafficReplayStats& stats = replayer.GetStats();
+        double recordedTime = (double)( replayer.GetTimeUS() - startTimeUS )*1.0e-6;
+
+        printf( "Replay %i of %s\n", repeatIdx + 1, filename );
+        printf( "    Records: %u replayed, %u skipped, %u in capture\n",
+            stats.mNumRecordsReplayed, stats.mNumRecordsSkipped, stats.mNumRecords );
+        printf( "    Unmatched SDO completions: %u\n", stats.mNumUnmatchedCompletions );
+        printf( "    Updates: %u, mean %.2f us, max %.2f us\n", stats.mNumUpdates,
+            ( stats.mNumUpdates > 0 ? (double)stats.mTotalUpdateTimeNS*1.0e-3/stats.mNumUpdates : 0.0 ),
+            (double)stats.mMaxUpdateTimeNS*1.0e-3 );
+        printf( "    Recorded time %.3f s replayed in %.3f s (%.1fx real time)\n",
+            recordedTime, replayTime, ( replayTime > 0.0 ? recordedTime/replayTime : 0.0 ) );
+    }
+
+    bResult = true;
+
+Finished:
+    if ( NULL != pChannel )
+    {
+        EPOS_CloseCANChannel( pChannel );
+    }
+
+    return bResult;
+}
+
+//------------------------------------------------------------------------------
+int main( int argc, char** argv )
+{
+    if ( argc < 2 )
+    {
+        fprintf( stderr, "Usage: %s captureFile [numRepeats]\n", argv[ 0 ] );
+        return -1;
+    }
+
+    S32 numRepeats = ( argc > 2 ? atoi( argv[ 2 ] ) : 1 );
+
+    // No nodes, so the only traffic that the channel sees comes from the capture
+    VirtualCANBusConfig config;
+    VCB_GetDefaultConfig( &config );
+    config.mNumNodes = 0;
+    VCB_SetConfig( config );
+
+    if ( !EPOS_InitLibrary() )
+    {
+        fprintf( stderr, "Error: Unable to initialise the EPOSControl library\n" );
+        return -1;
+    }
+
+    S32 result = 0;
+    for ( S32 repeatIdx = 0; repeatIdx < numRepeats; repeatIdx++ )
+    {
+        if ( !ReplayCapture( argv[ 1 ], repeatIdx ) )
+        {
+            result = -1;
+            break;
+        }
+    }
+
+    EPOS_DeinitLibrary();
+    return result;
+}
@@ -35,7 +35,8 @@ int main()
         return -1;
     }
     
-    CANChannel* pChannel = EPOS_OpenCANChannel( "libCanUSBDriver.so", "32", eBR_1M );
+    // Let the library update the channel at 100Hz in the background
+    CANChannel* pChannel = EPOS_OpenCANChannel( "libCanUSBDriver.so", "32", eBR_1M, -1, 100 );
     if ( NULL == pChannel )
     {
         fprintf( stderr, "Error: Unable to open CAN bus channel\n" );
@@ -0,0 +1,103 @@
+//------------------------------------------------------------------------------
+// File: BusLoadEstimator.h
+// Desc: Estimates how busy a CAN bus is from the frames that a CANChannel
+//       sends and receives. Each frame is converted into the number of bits
+//       that it occupies on the bus, including worst case bit stuffing, and
+//       the bits are turned into a utilisation using the bit rate of the bus.
+//
+//       Frames are counted without taking a lock, so they can be recorded
+//       from the update routine and the CAN Open callback thread at once.
+//       The utilisation is worked out over fixed windows by the update
+//       routine, and can be read from any thread. Frames sent by other
+//       devices, or by the CAN Open library on its own behalf, aren't seen,
+//       so the estimate is a lower bound on the true load.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+#ifndef BUS_LOAD_ESTIMATOR_H
+#define BUS_LOAD_ESTIMATOR_H
+
+//------------------------------------------------------------------------------
+#include "Common.h"
+
+//------------------------------------------------------------------------------
+enum eBusFrameType
+{
+    eBFT_SdoRequest,
+    eBFT_SdoResponse,
+    eBFT_PdoSent,
+    eBFT_PdoReceived,
+    eBFT_Sync,
+    eBFT_Nmt,
+    eBFT_Emergency,
+    eBFT_Bootup,
+    eBFT_NumFrameTypes
+};
+
+//------------------------------------------------------------------------------
+struct BusLoadStats
+{
+    U32 mBitRate;
+    float mUtilisation;         // Fraction of the bus used in the last window
+    float mPeakUtilisation;     // Highest utilisation of any window
+    float mBudget;              // 0 if there's no budget
+    U32 mNumWindows;
+    U32 mNumWindowsOverBudget;
+    U64 mNumBits;               // In all of the frames counted, including stuffing
+    U32 mNumFrames[ eBFT_NumFrameTypes ];
+};
+
+//------------------------------------------------------------------------------
+class BusLoadEstimator
+{
+    //--------------------------------------------------------------------------
+    public: BusLoadEstimator();
+
+    // Clears the counts and puts the budget back to its default of 80% of
+    // the bus. The first window starts at the next update.
+    public: void Reset( eBaudRate baudRate );
+
+    //--------------------------------------------------------------------------
+    // Counts a frame that has been queued for sending or has been received
+    public: void OnFrame( eBusFrameType frameType, U32 numDataBytes );
+
+    // Called by the update routine. Closes the current window once it has
+    // lasted for WINDOW_US.
+    public: void Update( U64 timeUS );
+
+    //--------------------------------------------------------------------------
+    // The budget is the fraction of the bus that the channel should aim to
+    // use. Pass 0 for no budget. This can be called from any thread.
+    public: void SetBudget( float budget ) { mBudget = budget; }
+    public: float GetBudget() const { return mBudget; }
+
+    // True if the last window went over the budget
+    public: bool IsOverBudget() const { return mbOverBudget; }
+    public: float GetUtilisation() const { return mUtilisation; }
+    public: void GetStats( BusLoadStats* pStatsOut ) const;
+
+    //--------------------------------------------------------------------------
+    // The worst case length of a standard frame with the given amount of data
+    public: static U32 GetFrameNumBits( U32 numDataBytes );
+    public: static U32 GetBitRate( eBaudRate baudRate );
+
+    //--------------------------------------------------------------------------
+    public: static const U64 WINDOW_US = 100000;
+
+    private: U32 mBitRate;
+    private: volatile float mBudget;
+    private: volatile float mUtilisation;
+    private: volatile float mPeakUtilisation;
+    private: volatile bool mbOverBudget;
+    private: volatile U32 mNumWindows;
+    private: volatile U32 mNumWindowsOverBudget;
+    private: volatile U64 mNumBits;
+    private: volatile U32 mNumFrames[ eBFT_NumFrameTypes ];
+
+    // Only touched by the update routine
+    private: bool mbWindowStarted;
+    private: U64 mWindowStartTimeUS;
+    private: U64 mWindowStartNumBits;
+};
+
+#endif // BUS_LOAD_ESTIMATOR_H
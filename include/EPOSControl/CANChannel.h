@@ -8,8 +8,12 @@
 #define CAN_CHANNEL_H
 
 //------------------------------------------------------------------------------
+#include <pthread.h>
 #include "Common.h"
+#include "EPOSControl/BusLoadEstimator.h"
 #include "EPOSControl/CANMotorController.h"
+#include "EPOSControl/SDOLatencyStats.h"
+#include "EPOSControl/TrafficRecorder.h"
 
 //------------------------------------------------------------------------------
 struct MotorControllerData
@@ -20,6 +24,55 @@ struct MotorControllerData
     bool mbAngleValid;
 };
 
+//------------------------------------------------------------------------------
+struct MotorAngleSetpoint
+{
+    U8 mNodeId;
+    S32 mAngle;     // Angle in encoder ticks
+};
+
+//------------------------------------------------------------------------------
+// Timing statistics for a channel's update thread. Times are in microseconds.
+// The fields are updated individually so may be from different updates.
+struct UpdateThreadStats
+{
+    U32 mUpdateRateHz;
+    U32 mNumUpdates;
+    U32 mNumOverruns;       // Updates which weren't finished by the next deadline
+    U32 mLastJitterUS;      // How late the thread woke up for the last update
+    U32 mMaxJitterUS;
+    U32 mMeanJitterUS;
+    U32 mLastUpdateTimeUS;
+    U32 mMaxUpdateTimeUS;
+};
+
+//------------------------------------------------------------------------------
+// The times of the updates in which a node was first seen to have booted, 
+// and in which it then reached eS_Running, in microseconds since its 
+// channel was opened. mRunningTimeUS is 0 until the node is running. If the
+// node reboots then both times start again.
+struct NodeBringUpTimes
+{
+    bool mbPresent;
+    U64 mPresentTimeUS;
+    U64 mRunningTimeUS;
+};
+
+//------------------------------------------------------------------------------
+// A summary of how long nodes took to be brought up. Times to running are
+// measured from a node being seen to boot.
+struct BringUpStats
+{
+    U32 mNumNodesPresent;
+    U32 mNumNodesRunning;
+    U64 mMeanTimeToRunningUS;   // Over the running nodes
+    U64 mMaxTimeToRunningUS;
+    U64 mLastRunningTimeUS;     // When the last node to start running did so, since its channel was opened
+};
+
+//------------------------------------------------------------------------------
+struct MotorControllerSnapshot;
+
 //------------------------------------------------------------------------------
 class CANChannel
 {
@@ -42,40 +95,370 @@ class CANChannel
     public: void OnCANOpenPostTPDO();
     public: void OnCANOpenPostEmergency( U8 nodeId, U16 errCode, U8 errReg );
     public: void OnCANOpenPostSlaveBootup( U8 nodeId );
+    public: void OnCANOpenPDOReceived( U16 cobId, U8* pData, U32 numBytes );
     public: void OnSDOFieldWriteComplete( U8 nodeId );
     public: void OnSDOFieldReadComplete( U8 nodeId, U8* pData, U32 numBytes );
     
     //--------------------------------------------------------------------------
+    // Queues an SDO transfer with the CAN Open library, timing it for the
+    // SDO latency statistics. Used by the motor controllers.
+    public: bool ProcessSDOField( U8 nodeId, const SDOField& field );
+    public: bool QueueNMTStartNode( U8 nodeId );
+    public: bool QueuePDO( U16 cobId, const U8* pData, U8 numBytes );
+    
+    // True if the node is waiting for an SDO write, or read, to complete
+    public: bool IsSDOTransferActive( U8 nodeId, bool bWrite ) const;
+    
+    // Histograms of SDO latencies for each node and each object. These can
+    // be read from any thread.
+    public: const SDOLatencyStats& GetSDOLatencyStats() const { return mSDOLatencyStats; }
+    
+    //--------------------------------------------------------------------------
+    // Applies commands from the client and updates the motor controllers. This
+    // should not be called by the client if the channel has an update thread.
     public: void Update();
     
+    // As Update, but the time of the update is given rather than read from
+    // the clock. Used by TrafficReplayer to replay updates at their recorded
+    // times, so the bus load estimate and the status watchdogs behave in the
+    // same way as when the capture was recorded.
+    public: void Update( U64 timeUS );
+    
+    //--------------------------------------------------------------------------
+    // Starts a thread which calls Update at a fixed rate. Deadlines are
+    // absolute so that timing errors don't accumulate, and if an update
+    // overruns then the missed updates are skipped rather than run late.
+    public: bool StartUpdateThread( U32 updateRateHz );
+    public: void StopUpdateThread();
+    public: bool IsUpdateThreadRunning() const { return mbUpdateThreadRunning; }
+    public: void GetUpdateThreadStats( UpdateThreadStats* pStatsOut ) const;
+    
+    //--------------------------------------------------------------------------
+    // Records the traffic between the channel and the CAN Open library, along
+    // with the commands made by the client, into a capture file which can be
+    // replayed with a TrafficReplayer. See TrafficRecorder.h.
+    public: bool StartTrafficRecording( const char* filename, 
+                                        U32 numRecordSlots=TrafficRecorder::DEFAULT_NUM_RECORD_SLOTS );
+    public: void StopTrafficRecording();
+    public: bool IsTrafficRecording() const { return mTrafficRecorder.IsOpen(); }
+    
     //--------------------------------------------------------------------------
     public: void ConfigureAllMotorControllersForPositionControl();
     
+    // Trajectory points are streamed in PDOs, so this does nothing if the
+    // CAN Open library can't send PDOs
+    public: void ConfigureAllMotorControllersForInterpolatedPositionControl();
+    public: void ConfigureAllMotorControllersForVelocityControl();
+    public: void ConfigureAllMotorControllersForCurrentControl();
+    
     //--------------------------------------------------------------------------
-    // Gets information about all of the EPOS motor controllers
-    public: void GetMotorControllerData( MotorControllerData* pDataBuffer, S32* pBufferSizeOut );
+    // Gets information about all of the EPOS motor controllers. The data
+    // comes from the latest snapshot so this can be called from any thread.
+    public: void GetMotorControllerData( MotorControllerData* pDataBuffer, S32* pBufferSizeOut ) const;
+    
+    // Gets a consistent copy of the state of all of the active motor
+    // controllers as it was at the end of the last call to Update. This
+    // doesn't take a lock so it can be called from any number of threads
+    // without ever blocking the update routine.
+    public: void GetMotorControllerSnapshot( MotorControllerSnapshot* pSnapshotOut ) const;
     
+    // The commands below are posted to a mailbox for each node and applied at
+    // the start of the next update, so they can be called from any thread.
+    // Commands for ALL_MOTOR_CONTROLLERS are applied before per node commands.
     public: void SetMotorAngle( U8 nodeId, S32 angle );
+    
+    // Sets the angles of a number of motors at once. The whole batch is made
+    // visible to the update routine together, so normally all of the angles
+    // are applied in the same update. Entries for ALL_MOTOR_CONTROLLERS or
+    // invalid nodes are ignored.
+    public: void SetMotorAngles( const MotorAngleSetpoint* pSetpoints, S32 numSetpoints );
+    
+    // Pass ALL_MOTOR_CONTROLLERS as the nodeId to set the profile velocity
+    // for every active node
     public: void SetMotorProfileVelocity( U8 nodeId, U32 velocity );
     public: void SetMaximumFollowingError( U8 nodeId, U32 maximumFollowingError );
     public: void SendFaultReset( U8 nodeId );
     
+    // Setpoints for nodes configured for velocity, in rpm, or current, in 
+    // mA. Pass ALL_MOTOR_CONTROLLERS as the nodeId to set every active node.
+    // Repeating a setpoint that a node already has costs no bus traffic.
+    public: void SetMotorVelocity( U8 nodeId, S32 velocity );
+    public: void SetMotorCurrent( U8 nodeId, S16 current );
+    
+    // Chooses how position and status feedback is obtained from a node. 
+    // Nodes are polled with SDO reads unless TPDO feedback is chosen. Pass
+    // ALL_MOTOR_CONTROLLERS as the nodeId to set the mode for every node,
+    // including nodes that haven't been seen yet.
+    public: void SetFeedbackMode( U8 nodeId, CANMotorController::eFeedbackMode feedbackMode );
+    
+    // Chooses how desired angles are sent to a node. Pass ALL_MOTOR_CONTROLLERS
+    // as the nodeId to set the mode for every node, including nodes that
+    // haven't been seen yet.
+    public: void SetSetpointMode( U8 nodeId, CANMotorController::eSetpointMode setpointMode );
+    
+    // Sets the deadbands and minimum resend interval used to drop or 
+    // coalesce the setpoints given to a node. Pass ALL_MOTOR_CONTROLLERS as
+    // the nodeId to set the filter for every node, including nodes that 
+    // haven't been seen yet.
+    public: void SetSetpointFilter( U8 nodeId, const SetpointFilter& filter );
+    
+    // Chooses whether a node's configuration is written out in full or only
+    // where it differs from the values on the node. See eConfigurationMode.
+    // Pass ALL_MOTOR_CONTROLLERS as the nodeId to set the mode for every 
+    // node, including nodes that haven't been seen yet.
+    public: void SetConfigurationMode( U8 nodeId, CANMotorController::eConfigurationMode configurationMode );
+    
+    // Adds points to the trajectory of a node configured for interpolated
+    // position control. See CANMotorController::QueueTrajectoryPoints. This
+    // bypasses the mailbox, so it can be called from any thread, but only
+    // one thread should add points to a node at a time. Returns the number
+    // of points added, or 0 for ALL_MOTOR_CONTROLLERS or an invalid node.
+    public: S32 QueueTrajectoryPoints( U8 nodeId, const TrajectoryPoint* pPoints, S32 numPoints );
+    
+    // The number of points that have been added to a node but not yet 
+    // reached. This can be called from any thread.
+    public: U32 GetNumTrajectoryPointsPending( U8 nodeId ) const;
+    
+    // Gets the counts of the transfers made to configure a node. Pass
+    // ALL_MOTOR_CONTROLLERS as the nodeId to get the totals for every node.
+    // Returns false if the node id is out of range.
+    public: bool GetConfigurationStats( U8 nodeId, ConfigurationStats* pStatsOut ) const;
+    
+    // Gets the counts of the setpoints given to a node that were sent, 
+    // coalesced or suppressed. Pass ALL_MOTOR_CONTROLLERS as the nodeId to
+    // get the totals for every node. Returns false if the node id is out of
+    // range.
+    public: bool GetSetpointStats( U8 nodeId, SetpointStats* pStatsOut ) const;
+    
+    //--------------------------------------------------------------------------
+    // Limits how many nodes are set up at once. Nodes beyond the limit wait
+    // in eS_SettingUp until another node has finished. A few nodes setting
+    // up at once are enough to keep the bus busy, so with a limit the first
+    // nodes start running sooner without the last node being delayed, and
+    // the CAN Open library isn't given more SDO transfers than it can hold.
+    // Pass 0 for no limit. This can be called from any thread.
+    public: void SetMaxNumNodesSettingUp( U32 maxNumNodes );
+    public: U32 GetMaxNumNodesSettingUp() const { return mMaxNumNodesSettingUp; }
+    
+    // Used by the motor controllers. Returns true if the node can start to
+    // set up, in which case OnNodeSetUpFinished must be called once it has.
+    public: bool TryStartNodeSetUp();
+    public: void OnNodeSetUpFinished();
+    
+    // Polling by running nodes competes with the nodes setting up for the
+    // bus, so by default running nodes only poll for values that they don't
+    // have yet whilst any node is setting up. This can be called from any
+    // thread.
+    public: void SetDeferPollingDuringSetUp( bool bDeferPolling );
+    public: bool IsPollingDeferred() const 
+    { 
+        return ( mbDeferPollingDuringSetUp && mNumNodesSettingUpLastUpdate > 0 )
+            || mBusLoadEstimator.IsOverBudget();
+    }
+    
+    //--------------------------------------------------------------------------
+    // The load on the bus is estimated from the frames that the channel sends
+    // and receives. Whilst the load is over budget, polling is deferred in
+    // the same way as it is during set up, so low priority polling is the 
+    // first thing to be cut back. The budget is a fraction of the bus, and
+    // can be set to 0 for no budget. These can be called from any thread.
+    public: void SetBusLoadBudget( float budget );
+    public: float GetBusUtilisation() const { return mBusLoadEstimator.GetUtilisation(); }
+    public: void GetBusLoadStats( BusLoadStats* pStatsOut ) const { mBusLoadEstimator.GetStats( pStatsOut ); }
+    
     //--------------------------------------------------------------------------
-    public: static const char* GetEposErrorMessage( U16 errCode, U8 errReg );
+    // Running nodes with TPDO feedback learn about changes to their 
+    // Statusword from TPDO 1, and all nodes read it straight away when they
+    // send an emergency message. As a backup, the Statusword is also read if
+    // it hasn't been received for the watchdog interval, which isn't done
+    // whilst polling is deferred.
+    // Pass 0 to turn the watchdog off. This can be called from any thread.
+    public: void SetStatusWatchdogInterval( U32 intervalMS );
+    public: U32 GetStatusWatchdogInterval() const { return mStatusWatchdogIntervalMS; }
+    
+    //--------------------------------------------------------------------------
+    // The bring up times are recorded by the update routine and can be read 
+    // from any thread. Returns false if the node id is out of range.
+    public: bool GetNodeBringUpTimes( U8 nodeId, NodeBringUpTimes* pTimesOut ) const;
+    public: void GetBringUpStats( BringUpStats* pStatsOut ) const;
+    public: S32 GetNumRunningNodes() const { return mNumRunningNodes; }
+    
+    // Waits until at least numNodes nodes are running, or until the timeout
+    // has passed. Returns true if enough nodes are running. Nothing will
+    // change whilst waiting unless the channel has an update thread.
+    public: bool WaitForRunningNodes( S32 numNodes, U32 timeoutMS ) const;
+    
+    //--------------------------------------------------------------------------
+    // Unrecognised errors are formatted into pBuffer. See EPOSError.h for
+    // other ways of decoding errors.
+    public: static const char* GetEposErrorMessage( U16 errCode, U8 errReg, 
+                                                    char* pBuffer=NULL, U32 bufferSize=0 );
     
     //--------------------------------------------------------------------------
     public: S32 GetFrameIdx() const { return mFrameIdx; }
+    public: U64 GetUpdateTimeUS() const { return mUpdateTimeUS; }
     public: S32 GetChannelIdx() const { return mChannelIdx; }
+    
+    // The handle that the CAN Open interface uses for the channel, which is
+    // NULL whilst the channel isn't open. Only the CAN Open interface should
+    // set this.
+    public: void* GetCOIHandle() const { return mpCOIHandle; }
+    public: void SetCOIHandle( void* pHandle ) { mpCOIHandle = pHandle; }
+
+    //--------------------------------------------------------------------------
+    // Adds nodes which have become present to the list of active nodes
+    private: void UpdateActiveNodeList();
+    private: void AddActiveNode( U8 nodeId );
+    
+    // Makes the current state of the motor controllers available to other
+    // threads. Called at the end of each update.
+    private: void PublishSnapshot();
+    
+    private: void RecordTraffic( eTrafficRecordType type, U8 nodeId, U16 index=0, U8 subIndex=0,
+                                 const void* pData=NULL, U32 numBytes=0 );
+    private: void RecordClientCommand( eTrafficClientCommand command, U8 nodeId, S32 argument=0 );
+    
+    // Posts a command once its data has been written into the node's mailbox
+    private: void PostCommand( U8 nodeId, U32 commandFlag );
+    private: void ProcessCommands();
+    private: void ProcessNodeCommands( U8 nodeId );
+    private: struct CommandMailbox;
+    private: void ApplyCommands( CANMotorController& controller, U32 commands, 
+                                 const CommandMailbox& mailbox );
+    
+    private: static void* UpdateThreadMain( void* pChannel );
+    private: void RunUpdateThread();
 
     //--------------------------------------------------------------------------
     public: static const U8 ALL_MOTOR_CONTROLLERS = 0;
     public: static const U8 MAX_NUM_MOTOR_CONTROLLERS = 128;
+    public: static const U16 TPDO_1_COB_ID_BASE = 0x180;
+    public: static const U16 RPDO_1_COB_ID_BASE = 0x200;
+    
+    // Each node setting up can have MAX_NUM_QUEUED_SDO_WRITES writes queued,
+    // so this keeps at most 32 configuration writes queued with the CAN Open
+    // library. On the virtual bus 4 nodes setting up at once keep the bus 
+    // busy.
+    public: static const U32 DEFAULT_MAX_NUM_NODES_SETTING_UP = 8;
+    
+    // Emergency messages and TPDOs carry faults, so the watchdog only has to
+    // catch events that have been lost
+    public: static const U32 DEFAULT_STATUS_WATCHDOG_INTERVAL_MS = 500;
     private: CANMotorController mMotorControllers[ MAX_NUM_MOTOR_CONTROLLERS ];
     private: bool mbInitialised;
     private: U8 mStartingNodeId;    // See OnCANUpdate for explanation
     
+    // Per frame and bulk operations only look at the active nodes. These are
+    // the nodes which are known to be present, kept in ascending order.
+    private: U8 mActiveNodeIds[ MAX_NUM_MOTOR_CONTROLLERS ];
+    private: S32 mNumActiveNodes;
+    
+    // Set by the CAN Open callback thread when a node boots up, and merged
+    // into the active node list by the update routine
+    private: static const S32 NUM_NODE_MASK_WORDS = MAX_NUM_MOTOR_CONTROLLERS/32;
+    private: volatile U32 mNewlyPresentNodeMask[ NUM_NODE_MASK_WORDS ];
+    
+    // Settings made for ALL_MOTOR_CONTROLLERS which are given to nodes as
+    // they become active
+    private: CANMotorController::eConfiguration mDefaultConfiguration;
+    private: bool mbDefaultFeedbackModeSet;
+    private: CANMotorController::eFeedbackMode mDefaultFeedbackMode;
+    private: bool mbDefaultSetpointModeSet;
+    private: CANMotorController::eSetpointMode mDefaultSetpointMode;
+    private: bool mbDefaultConfigurationModeSet;
+    private: CANMotorController::eConfigurationMode mDefaultConfigurationMode;
+    private: bool mbDefaultSetpointFilterSet;
+    private: SetpointFilter mDefaultSetpointFilter;
+    
+    // Snapshots are double buffered. The update routine writes into the
+    // buffer which isn't the latest and then publishes it. Each buffer has a
+    // sequence number which is odd whilst the buffer is being written, so
+    // that readers can detect when they need to retry a copy.
+    private: MotorControllerSnapshot* mpSnapshots;
+    private: volatile U32 mSnapshotSequences[ 2 ];
+    private: volatile U32 mLatestSnapshotIdx;
+    private: U32 mSnapshotVersion;
+    
+    // Commands waiting to be applied by the update routine. Mailbox 0 holds
+    // commands for ALL_MOTOR_CONTROLLERS. A flag is set in a mailbox when its
+    // command data has been written, and a bit is set in the node mask to let
+    // the update routine know that the mailbox needs to be looked at.
+    private: enum eCommandFlag
+    {
+        eCF_DesiredAngle = (1 << 0),
+        eCF_ProfileVelocity = (1 << 1),
+        eCF_MaximumFollowingError = (1 << 2),
+        eCF_FaultReset = (1 << 3),
+        eCF_FeedbackMode = (1 << 4),
+        eCF_SetpointMode = (1 << 5),
+        eCF_ConfigurePositionControl = (1 << 6),
+        eCF_ConfigurationMode = (1 << 7),
+        eCF_ConfigureInterpolatedPositionControl = (1 << 8),
+        eCF_ConfigureVelocityControl = (1 << 9),
+        eCF_ConfigureCurrentControl = (1 << 10),
+        eCF_DesiredVelocity = (1 << 11),
+        eCF_DesiredCurrent = (1 << 12),
+        eCF_SetpointFilter = (1 << 13)
+    };
+    
+    private: struct CommandMailbox
+    {
+        volatile U32 mPendingCommands;
+        volatile S32 mDesiredAngle;
+        volatile U32 mProfileVelocity;
+        volatile U32 mMaximumFollowingError;
+        volatile CANMotorController::eFeedbackMode mFeedbackMode;
+        volatile CANMotorController::eSetpointMode mSetpointMode;
+        volatile CANMotorController::eConfigurationMode mConfigurationMode;
+        volatile S32 mDesiredVelocity;
+        volatile S16 mDesiredCurrent;
+        SetpointFilter mSetpointFilter;
+    };
+    
+    private: CommandMailbox mCommandMailboxes[ MAX_NUM_MOTOR_CONTROLLERS ];
+    private: volatile U32 mPendingCommandNodeMask[ NUM_NODE_MASK_WORDS ];
+    
+    private: pthread_t mUpdateThread;
+    private: bool mbUpdateThreadRunning;
+    private: volatile bool mbStopUpdateThread;
+    private: U32 mUpdateRateHz;
+    private: UpdateThreadStats mUpdateThreadStats;
+    
+    private: SDOLatencyStats mSDOLatencyStats;
+    private: BusLoadEstimator mBusLoadEstimator;
+    private: TrafficRecorder mTrafficRecorder;
+    
+    private: volatile U32 mMaxNumNodesSettingUp;
+    private: U32 mNumNodesSettingUp;       // Those that have started to set up
+    private: S32 mNumNodesSettingUpLastUpdate;  // Including those waiting to start
+    private: volatile bool mbDeferPollingDuringSetUp;
+    private: volatile U32 mStatusWatchdogIntervalMS;
+    
+    private: U64 mInitTimeUS;
+    private: NodeBringUpTimes mNodeBringUpTimes[ MAX_NUM_MOTOR_CONTROLLERS ];
+    private: volatile S32 mNumRunningNodes;
+    
     private: S32 mFrameIdx;
+    private: U64 mUpdateTimeUS;
     private: S32 mChannelIdx;       // Lets client code distinguish between channels
+    private: void* mpCOIHandle;
+};
+
+//------------------------------------------------------------------------------
+// The state of all of the active motor controllers on a channel, stored as a
+// struct of arrays. Only the first mNumControllers entries are valid.
+struct MotorControllerSnapshot
+{
+    U32 mVersion;       // Increases every time a new snapshot is published
+    S32 mFrameIdx;
+    S32 mNumControllers;
+    
+    U8 mNodeIds[ CANChannel::MAX_NUM_MOTOR_CONTROLLERS ];
+    S32 mStates[ CANChannel::MAX_NUM_MOTOR_CONTROLLERS ];
+    S32 mAngles[ CANChannel::MAX_NUM_MOTOR_CONTROLLERS ];  // Angle in encoder ticks
+    bool mbAngleValid[ CANChannel::MAX_NUM_MOTOR_CONTROLLERS ];
+    U16 mStatuswords[ CANChannel::MAX_NUM_MOTOR_CONTROLLERS ];
+    bool mbStatusValid[ CANChannel::MAX_NUM_MOTOR_CONTROLLERS ];
 };
 
 #endif // CAN_CHANNEL_H
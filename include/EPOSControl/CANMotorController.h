@@ -34,6 +34,56 @@
 //------------------------------------------------------------------------------
 class CANChannel;
 
+//------------------------------------------------------------------------------
+// Counts of the SDO transfers made to configure a motor controller, over all
+// of the times that it has been configured
+struct ConfigurationStats
+{
+    U32 mNumConfigurations;     // Times that a configuration has been applied
+    U32 mNumReads;              // Reads made to compare against the configuration
+    U32 mNumWrites;
+    U32 mNumWritesSkipped;      // Writes not made as the node already had the values
+    U32 mNumStores;             // Times that the configuration was stored on the node
+};
+
+//------------------------------------------------------------------------------
+// Limits the setpoints sent to a motor controller so that noise on the 
+// setpoints given to it doesn't turn into bus traffic. A setpoint within the
+// deadband of the last one sent is dropped. A setpoint given less than the
+// minimum resend interval after the last one was sent waits until the 
+// interval is up, and is replaced by any later setpoint in the meantime.
+// With everything set to 0 only setpoints equal to the last one are dropped.
+struct SetpointFilter
+{
+    U16 mAngleDeadband;         // In encoder ticks
+    U16 mVelocityDeadband;      // In rpm
+    U16 mCurrentDeadband;       // In mA
+    U16 mMinResendIntervalMS;
+};
+
+//------------------------------------------------------------------------------
+// Counts of the angle, velocity and current setpoints given to a motor 
+// controller, and what became of them
+struct SetpointStats
+{
+    U32 mNumSetpointsGiven;
+    U32 mNumSetpointsSent;
+    U32 mNumSetpointsCoalesced;     // Replaced by a later setpoint before being sent
+    U32 mNumSetpointsSuppressed;    // Dropped as they were within the deadband
+};
+
+//------------------------------------------------------------------------------
+// A point on a trajectory followed in interpolated position mode. The node 
+// moves from the previous point to this one over mTimeMS, arriving with the
+// given velocity. The path between points is a cubic which matches the
+// position and velocity at each end.
+struct TrajectoryPoint
+{
+    S32 mPosition;      // In encoder ticks
+    S32 mVelocity;      // In rpm, limited to 24 bits
+    U8 mTimeMS;         // Time from the previous point
+};
+
 //------------------------------------------------------------------------------
 class CANMotorController
 {
@@ -53,7 +103,64 @@ class CANMotorController
     public: enum eConfiguration
     {
         eC_None,
-        eC_PositionControl
+        eC_PositionControl,
+        eC_InterpolatedPositionControl,    // See QueueTrajectoryPoints
+        eC_VelocityControl,                // See SetDesiredVelocity
+        eC_CurrentControl                  // See SetDesiredCurrent
+    };
+    
+    //--------------------------------------------------------------------------
+    // A configuration can either be written out in full, or differentially.
+    // Differential configuration first reads back the objects that the 
+    // configuration writes, and then skips the writes to any group of 
+    // objects which already have the configured values. A group is a run of
+    // writes to the same object index, such as a PDO mapping, so that a
+    // partially matching group is still written in full. Writes to command
+    // objects such as the controlword are never skipped.
+    //
+    // Differential configuration costs up to a read for each object written, so
+    // it only saves bus time when nodes keep their configuration, for
+    // example when they have stored their parameters or have been 
+    // configured by a previous run.
+    //
+    // Stored configuration makes nodes keep their configuration. Once a
+    // configuration has been written in full it's saved to the non-volatile
+    // memory of the node with Store Parameters, along with a fingerprint of
+    // the configuration in Customer Storage. When the configuration is next
+    // applied, after a restart of the program or of the node, only the
+    // fingerprint is read. If it matches then only the writes to command
+    // objects are made, otherwise the configuration is written in full and
+    // stored again. This relies on nothing else changing the stored
+    // parameters or Customer Storage of the nodes.
+    public: enum eConfigurationMode
+    {
+        eCM_WriteAll,
+        eCM_Differential,
+        eCM_Stored
+    };
+    
+    //--------------------------------------------------------------------------
+    // Position and status are polled for with SDO reads unless TPDO 
+    // feedback is chosen, in which case the node is made Operational and 
+    // they're streamed back from the motor controller in TPDO 1. If TPDOs 
+    // don't arrive then SDO polling is used as a fallback. TPDO feedback 
+    // and RPDO setpoints fall back to SDO transfers if the CAN Open library
+    // can't send PDOs.
+    public: enum eFeedbackMode
+    {
+        eFM_SDOPolling,
+        eFM_TPDO
+    };
+
+    //--------------------------------------------------------------------------
+    // Desired angles can either be sent with confirmed SDO writes, or sent
+    // in RPDO 1 along with the controlword. The RPDOs are acted on at the
+    // next SYNC sent out by the CANChannel. Desired velocities and currents
+    // are sent on their own in RPDO 1, which is acted on as soon as it arrives.
+    public: enum eSetpointMode
+    {
+        eSM_SDO,
+        eSM_RPDO
     };
     
     //--------------------------------------------------------------------------
@@ -63,7 +170,12 @@ class CANMotorController
         eRT_SetDesiredAngle,
         eRT_SendFaultReset,
         eRT_SetProfileVelocity,
-        eRT_SetMaximumFollowingError
+        eRT_SetMaximumFollowingError,
+        eRT_StoreConfiguration,
+        eRT_StartInterpolation,
+        eRT_StopInterpolation,
+        eRT_SetDesiredVelocity,
+        eRT_SetDesiredCurrent
     };
     
     //--------------------------------------------------------------------------
@@ -93,85 +205,342 @@ class CANMotorController
     public: void TellAboutNMTState( eNMT_State state );
     public: eNMT_State GetLastKnownNMTState() const { return mLastKnownNMTState; }
   
-    public: void OnSDOFieldWriteComplete( S32 frameIdx );
+    public: void OnSDOFieldWriteComplete();
     public: void OnSDOFieldReadComplete( U8* pData, U32 numBytes );
-  
+    public: void OnTPDOReceived( U8* pData, U32 numBytes );
+    
+    // Called when the node sends an emergency message, which means that its
+    // Statusword has probably changed. The Statusword is read at the next
+    // update, even if polling is deferred.
+    public: void OnEmergency() { mbStatusRefreshRequested = true; }
+
+    public: void SetFeedbackMode( eFeedbackMode feedbackMode );
+    public: eFeedbackMode GetFeedbackMode() const { return mFeedbackMode; }
+    
+    public: void SetSetpointMode( eSetpointMode setpointMode );
+    public: eSetpointMode GetSetpointMode() const { return mSetpointMode; }
+    
+    // Sends the current setpoint in RPDO 1 if the node is using RPDO setpoints
+    // and there is anything to send. Returns true if a synchronous RPDO was
+    // sent, which the node will act on at the next SYNC.
+    public: bool ProcessRPDOSetpoint();
+
     public: bool IsAngleValid() const { return mbInitialised && mbAngleValid; }
     public: S32 GetAngle() const { return mAngle; }
+    public: bool IsSdoReadActive() const { return mNumSdoReadsQueued != mNumSdoReadsCompleted; }
+    public: U32 GetNumActiveSdoWrites() const { return mNumActiveSdoWrites; }
+    
+    public: bool IsStatusValid() const { return mbInitialised && mbStatusValid; }
+    public: U16 GetStatusword() const { return mEposStatusword; }
     
     // Commands for controlling the motor controller in the eS_Running state.
-    // NOTE: These routines are _not_ thread safe with the update routine
+    // These must only be called on the thread that updates the channel. The
+    // channel applies the commands posted to its mailboxes from there, so 
+    // other threads should use the CANChannel routines instead.
     public: void SetDesiredAngle( S32 desiredAngle, S32 frameIdx );
     public: void SetProfileVelocity( U32 profileVelocity );
     public: void SetMaximumFollowingError( U32 maximumFollowingError );
     public: void SendFaultReset();
     
+    // Setpoints for velocity and current control, which are ignored by nodes
+    // in other configurations. A setpoint is only sent when it differs from
+    // the last one, so a steady setpoint costs no bus traffic. After the
+    // node is configured it's stationary until it's given a setpoint.
+    public: void SetDesiredVelocity( S32 desiredVelocity );    // In rpm
+    public: void SetDesiredCurrent( S16 desiredCurrent );      // In mA
+    
+    // Angles, velocities and currents all pass through the setpoint filter
+    public: void SetSetpointFilter( const SetpointFilter& filter ) { mSetpointFilter = filter; }
+    public: const SetpointFilter& GetSetpointFilter() const { return mSetpointFilter; }
+    
+    // Can be called from any thread
+    public: void GetSetpointStats( SetpointStats* pStatsOut ) const;
+    
     //--------------------------------------------------------------------------
-    // The SDO communication state machine is used to keep track of an SDO read
-    // or write
-    public: enum eSdoCommunicationState
+    // Adds points to the end of the trajectory followed by a node that has
+    // been configured for interpolated position control. The points are 
+    // kept in a ring and streamed to the buffer of the node in RPDO 1, one
+    // point per RPDO, topping the buffer up as the node works through it.
+    // The node starts to move once a few points have been buffered, and 
+    // stops when it runs out of points, so a trajectory should end with a
+    // point of zero velocity. If points are added after the node has 
+    // stopped then it starts again from where it is.
+    //
+    // Unlike the other commands, this can be called from any thread whilst
+    // the node is being updated, as long as only one thread adds points to
+    // the node at a time. Returns the number of points that were added, 
+    // which is less than numPoints if the ring is full.
+    public: S32 QueueTrajectoryPoints( const TrajectoryPoint* pPoints, S32 numPoints );
+    
+    // The number of points that have been added but not yet reached. This
+    // can be called from any thread.
+    public: U32 GetNumTrajectoryPointsPending() const 
+        { return mNumTrajectoryPointsQueued - mNumTrajectoryPointsReached; }
+    
+    // Packs a point into the PVT format used by the Interpolation Data
+    // Record, which has PVT_RPDO_NUM_BYTES bytes
+    public: static void PackTrajectoryPoint( const TrajectoryPoint& point, U8* pDataOut );
+    public: static TrajectoryPoint UnpackTrajectoryPoint( const U8* pData );
+    
+    //--------------------------------------------------------------------------
+    // The values that can be polled for with SDO reads. Each read that is 
+    // queued carries its target, and when it completes the data is decoded 
+    // straight into the state of the controller. SDO writes are tracked by 
+    // counting how many are outstanding.
+    public: enum eSdoReadTarget
     {
-        eSCS_Inactive,
-        eSCS_Active,
-        eSCS_NumSdoCommunicationStates
+        eSRT_Angle,
+        eSRT_Statusword,
+        eSRT_ConfigurationValue,    // Compared against a differential configuration
+        eSRT_ConfigurationFingerprint,  // Compared against a stored configuration
+        eSRT_NumReadTargets
     };
   
     //--------------------------------------------------------------------------
+    // The configuration is applied again if the node reboots
     public: void SetConfiguration( eConfiguration configuration );
     
-    //--------------------------------------------------------------------------
-    private: bool ProcessSDOWrite( const SDOField& sdoField, bool bDebug=false );
+    // Takes effect the next time that a configuration is applied
+    public: void SetConfigurationMode( eConfigurationMode configurationMode );
+    public: eConfigurationMode GetConfigurationMode() const { return mConfigurationMode; }
+    
+    public: void GetConfigurationStats( ConfigurationStats* pStatsOut ) const;
     
     //--------------------------------------------------------------------------
-    private: static void HandleSDOReadComplete( SDOField& field );
+    private: bool ProcessSDOWrite( const SDOCommand& command, bool bDebug=false );
+    
+    // Queues the remaining configuration setup writes until 
+    // MAX_NUM_QUEUED_SDO_WRITES are outstanding
+    private: void QueueConfigurationSetupWrites();
+    private: bool IsUsingRPDOSetpoints() const;
+    
+    // Works out which points the node has reached, tops up its buffer, and
+    // starts or stops the interpolation as needed
+    private: void ProcessTrajectory();
+    private: void OnInterpolationStarted();
+    
+    // Starts applying the current configuration from the beginning
+    private: void StartConfiguration();
+    
+    // Starts the configuration again, waiting first for any outstanding 
+    // writes from the old configuration to complete
+    private: void RequestConfigurationRestart();
+    
+    // Queues reads of the objects in the configuration for a differential
+    // configuration, or of the fingerprint for a stored configuration.
+    // Returns true once all of the reads have completed.
+    private: bool QueueConfigurationReads();
+    private: void OnConfigurationValueRead( U8 commandIdx, U8 groupStartIdx, U32 value );
+    private: void OnConfigurationFingerprintRead( U32 value );
+    
+    // The commands of a configuration are TPDO1_FEEDBACK_COMMANDS followed by
+    // the commands for its control mode. Returns the list end marker once 
+    // commandIdx is past the last command.
+    private: const SDOCommand& GetConfigurationCommand( S32 commandIdx ) const;
+    private: S32 GetConfigurationGroupStartIdx( S32 commandIdx ) const;
+    private: bool IsConfigurationWriteNeeded( S32 commandIdx ) const;
+    
+    // Returns false if the read couldn't be queued. For configuration reads
+    // commandIdx is the configuration command that the value is checked
+    // against and groupStartIdx is the first command in its group.
+    private: bool QueueSdoRead( eSdoReadTarget target, eSDOObject object,
+                                U8 commandIdx=0, U8 groupStartIdx=0 );
     
     //--------------------------------------------------------------------------
+    // The maximum number of commands in a configuration, limited by the 
+    // size of the mask of mismatched groups
     public: static const S32 CONFIGURATION_ACTION_LIST_LENGTH = 64;
     public: static const S32 EXTRA_ACTION_LIST_LENGTH = 16;
     
+    // The maximum number of configuration writes that are queued with the 
+    // CAN Open library at once for a node. The writes still go out on the 
+    // bus one at a time, but the library can send the next write as soon as
+    // the previous one is acknowledged rather than waiting for the next 
+    // update to queue it.
+    public: static const U32 MAX_NUM_QUEUED_SDO_WRITES = 4;
+    
+    // The maximum number of SDO reads that can be outstanding for a node.
+    // Must be a power of 2.
+    public: static const U32 MAX_NUM_QUEUED_SDO_READS = 4;
+    
+    // The number of times a configuration read that gets a short reply is 
+    // made again before the value is treated as differing
+    public: static const U32 MAX_NUM_CONFIGURATION_READ_RETRIES = 3;
+    
+    // TPDOs are only sent when the mapped values change, so once a TPDO has
+    // been seen we only fall back to an SDO read of the angle if the stream
+    // has been silent for this long, whatever the update rate.
+    public: static const U32 TPDO_SILENCE_POLL_INTERVAL_US = 100000;
+    
+    // RPDO 1 contains Target Position (S32) followed by Controlword (U16)
+    public: static const U32 RPDO_1_NUM_BYTES = 6;
+    
+    // In velocity control RPDO 1 contains Target Velocity (S32), and in
+    // current control it contains Current Mode Setting Value (S16)
+    public: static const U32 VELOCITY_RPDO_NUM_BYTES = 4;
+    public: static const U32 CURRENT_RPDO_NUM_BYTES = 2;
+    
+    // In interpolated position mode RPDO 1 instead contains a PVT point,
+    // packed as Position (S32), Velocity (S24) and Time (U8)
+    public: static const U32 PVT_RPDO_NUM_BYTES = 8;
+    
+    // The number of trajectory points that can be waiting to be reached by
+    // a node. Must be a power of 2.
+    public: static const U32 TRAJECTORY_RING_LENGTH = 256;
+    
+    // The buffer of an EPOS holds 64 points. Keeping it no more than half
+    // full leaves room for the error in the estimate of how full it is.
+    public: static const U32 MAX_NUM_TRAJECTORY_POINTS_ON_NODE = 32;
+    public: static const U32 MIN_NUM_TRAJECTORY_POINTS_TO_START = 4;
+    public: static const U32 MAX_NUM_TRAJECTORY_POINTS_SENT_PER_UPDATE = 4;
+    
     private: bool mbInitialised;
     private: CANChannel* mpOwner;
     private: U8 mNodeId;
     private: bool mbPresent;
     
     private: eNMT_State mLastKnownNMTState;
-    private: eSdoCommunicationState mSdoReadState;
-    private: eSdoCommunicationState mSdoWriteState;
-    private: SDOField* mpActiveSdoReadField;
-    private: SDOField mReadAction;
-    private: SDOField mReadStatusAction;
+    private: volatile U32 mNumActiveSdoWrites;
+    
+    // Reads complete in the order that they were queued, so the targets of
+    // the outstanding reads are kept in a ring. Only the update routine
+    // queues reads and only the CAN Open callback thread completes them.
+    private: struct QueuedSdoRead
+    {
+        U8 mTarget;
+        U8 mObject;
+        U8 mCommandIdx;
+        U8 mGroupStartIdx;
+    };
+    
+    private: QueuedSdoRead mQueuedSdoReads[ MAX_NUM_QUEUED_SDO_READS ];
+    private: volatile U32 mNumSdoReadsQueued;
+    private: volatile U32 mNumSdoReadsCompleted;
+    private: volatile bool mbSdoReadActive[ eSRT_NumReadTargets ];
+    
+    // Called for a read reply that is too short for the data type of the
+    // object. Arranges for the read to be made again.
+    private: void OnShortSdoReadReply( const QueuedSdoRead& read );
+    
     private: eState mState;
+    private: volatile bool mbSetUpStarted;      // The channel has let the node start setting up
     private: eConfiguration mConfiguration;
     private: eRunningTask mRunningTask;
     private: bool mbAngleValid;
     private: S32 mAngle;
     
     private: bool mbFaultResetRequested;
-    private: bool mbNewDesiredAngleRequested;
     private: bool mbNewProfileVelocityRequested;
     private: bool mbNewMaximumFollowingErrorRequested;
     
     private: bool mbStatusValid;
     private: U16 mEposStatusword;
-    private: S32 mLastStatusPollFrameIdx;
+    private: volatile bool mbStatusReceived;            // Since the last update
+    private: volatile bool mbStatusRefreshRequested;
+    private: volatile bool mbAngleRefreshRequested;
+    private: U64 mLastStatusTimeUS;     // The update time when the Statusword was last received
+
+    private: eFeedbackMode mFeedbackMode;
+    private: bool mbNMTStartRequired;
+    private: bool mbTPDOReceived;
+    private: volatile bool mbTPDOArrived;               // Since the last update
+    private: U64 mLastTPDOTimeUS;       // The update time when a TPDO last arrived
+    private: U64 mLastAnglePollTimeUS;
     
-    private: S32 mNewDesiredAngle;
-    private: S32 mNewProfileVelocity;
+    private: eSetpointMode mSetpointMode;
+    private: bool mbRPDONewSetpointBitSet;
+    private: S32 mRPDOTargetAngle;
+
+    private: U32 mNewProfileVelocity;
     private: U32 mNewMaximumFollowingError;
-    private: S32 mSDOWriteFrameIdx;
     
-    private: const SDOField* mpConfigurationSetupCommands;
+    // Setpoints are held here whilst they wait to be sent, and compared 
+    // against the last value sent to decide whether they need to be sent
+    private: struct SetpointTracker
+    {
+        bool mbRequested;       // mNewValue is waiting to be sent
+        bool mbSentValid;       // A value has been sent since the node was configured
+        S32 mNewValue;
+        S32 mSentValue;
+        U64 mSentTimeUS;
+    };
+    
+    private: void ResetSetpointTracker( SetpointTracker* pTracker );
+    private: void RequestSetpoint( SetpointTracker* pTracker, S32 value, U32 deadband );
+    private: bool IsSetpointDue( const SetpointTracker& tracker ) const;
+    private: void OnSetpointSent( SetpointTracker* pTracker );
+    private: void CheckRPDOAngleReached();
+    
+    private: SetpointTracker mDesiredAngle;
+    private: SetpointTracker mDesiredVelocity;
+    private: SetpointTracker mDesiredCurrent;
+    private: SetpointFilter mSetpointFilter;
+    private: SetpointStats mSetpointStats;
+    
+    private: const SDOCommand* mpConfigurationSetupCommands;  // The commands for the mode
     private: S32 mCurConfigurationSetupCommandIdx;
+    private: eConfigurationMode mConfigurationMode;
+    private: volatile bool mbReconfigurationRequested;    // Set when the node reboots
+    private: volatile bool mbConfigurationRestartRequested;   // Waiting for writes to complete
+    
+    // Whilst reading for a differential configuration, the reads are made
+    // before any of the writes. A bit is set for each group that has a value
+    // which differs from the configuration, indexed by the first command in
+    // the group.
+    private: volatile bool mbReadingConfiguration;
+    private: S32 mCurConfigurationReadCommandIdx;
+    private: volatile U64 mMismatchedConfigurationGroups;
+    private: ConfigurationStats mConfigurationStats;
+    
+    // A configuration read with a short reply is made again from the start
+    // of its group, up to MAX_NUM_CONFIGURATION_READ_RETRIES times
+    private: volatile bool mbConfigurationReadRetryRequested;
+    private: volatile U8 mConfigurationReadRetryCommandIdx;
+    private: volatile U32 mNumConfigurationReadRetries;
+    
+    // For a stored configuration, the fingerprint is read instead of the
+    // objects. If it doesn't match, the configuration is stored once it has
+    // been written.
+    private: bool mbVerifyingStoredConfiguration;
+    private: volatile bool mbConfigurationFingerprintReadQueued;
+    private: volatile bool mbConfigurationStoreRequired;
+    private: bool mbStoreConfigurationRequested;
+    private: U16 mConfigurationFingerprint;
+    
+    // Trajectory points are added by the client and sent by the update
+    // routine. Points stay in the ring until the node has reached them, 
+    // which is judged from the times of the points, starting from when the
+    // interpolation was started. This overestimates how full the buffer of
+    // the node is, as the node starts before the host hears that it has.
+    private: TrajectoryPoint mTrajectoryPoints[ TRAJECTORY_RING_LENGTH ];
+    private: volatile U32 mNumTrajectoryPointsQueued;
+    private: U32 mNumTrajectoryPointsSent;
+    private: volatile U32 mNumTrajectoryPointsReached;
+    private: bool mbInterpolationActive;
+    private: bool mbInterpolationSeenActive;    // In the statusword of the node
+    private: bool mbStartInterpolationRequested;
+    private: bool mbStopInterpolationRequested;
+    private: U64 mNextTrajectoryPointTimeUS;
     
-    private: const SDOField* mpRunningTaskCommands;
+    private: const SDOCommand* mpRunningTaskCommands;
     private: S32 mCurRunningTaskCommandIdx;
     
-    private: SDOField mSetDesiredAngleCommands[ 2 + 1 ];
-    private: SDOField mSetProfileVelocityCommands[ 1 + 1 ];
-    private: SDOField mSetMaxFollowingErrorCommands[ 1 + 1 ];
+    private: SDOCommand mSetDesiredAngleCommands[ 2 + 1 ];
+    private: SDOCommand mSetProfileVelocityCommands[ 1 + 1 ];
+    private: SDOCommand mSetMaxFollowingErrorCommands[ 1 + 1 ];
+    private: SDOCommand mStoreConfigurationCommands[ 2 + 1 ];
+    private: SDOCommand mSetDesiredVelocityCommands[ 1 + 1 ];
+    private: SDOCommand mSetDesiredCurrentCommands[ 1 + 1 ];
     
-    private: static const SDOField POSITION_CONTROL_SETUP_COMMANDS[];
-    private: static const SDOField FAULT_RESET_COMMANDS[];
+    private: static const SDOCommand TPDO1_FEEDBACK_COMMANDS[];
+    private: static const S32 NUM_TPDO1_FEEDBACK_COMMANDS;
+    private: static const SDOCommand POSITION_CONTROL_SETUP_COMMANDS[];
+    private: static const SDOCommand INTERPOLATED_POSITION_CONTROL_SETUP_COMMANDS[];
+    private: static const SDOCommand VELOCITY_CONTROL_SETUP_COMMANDS[];
+    private: static const SDOCommand CURRENT_CONTROL_SETUP_COMMANDS[];
+    private: static const SDOCommand FAULT_RESET_COMMANDS[];
+    private: static const SDOCommand START_INTERPOLATION_COMMANDS[];
+    private: static const SDOCommand STOP_INTERPOLATION_COMMANDS[];
 };
 
 #endif // CAN_MOTOR_CONTROLLER_H
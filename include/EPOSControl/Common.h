@@ -18,6 +18,8 @@ typedef unsigned int U32;
 typedef char S8;
 typedef short S16;
 typedef int S32;
+typedef unsigned long long U64;
+typedef long long S64;
 
 //------------------------------------------------------------------------------
 enum eBaudRate
@@ -35,7 +37,6 @@ enum eBaudRate
 };
 
 //------------------------------------------------------------------------------
-#define MAX_NUM_CAN_CHANNELS 2
 #define MASTER_NODE_ID 25
 
 //------------------------------------------------------------------------------
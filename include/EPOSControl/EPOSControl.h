@@ -11,17 +11,37 @@
 //------------------------------------------------------------------------------
 #include "Common.h"
 #include "CANChannel.h"
+#include "EPOSError.h"
 
 //------------------------------------------------------------------------------
 bool EPOS_InitLibrary();
 void EPOS_DeinitLibrary();
 
 // Opens a channel. If channelIdx is greater than or equal to 0 then the library attempts
-// to open at channel at that slot
+// to open at channel at that slot, otherwise the first free slot is used. There
+// is no fixed limit on the number of slots, but at most 16 channels can be 
+// open on CanOpenMaster at once.
+//
+// If updateRateHz is greater than 0 then the channel is given its own thread
+// which updates it at that rate, and the client shouldn't call Update.
 CANChannel* EPOS_OpenCANChannel( const char* driverLibraryName, const char* canDevice,
-                                 eBaudRate baudRate, S32 channelIdx=-1 );
+                                 eBaudRate baudRate, S32 channelIdx=-1, U32 updateRateHz=0 );
 void EPOS_CloseCANChannel( CANChannel* pChannel );
 
+//------------------------------------------------------------------------------
+// Bring up of the nodes on all of the open channels. The channels set up
+// their nodes independently, each keeping its own bus busy. These shouldn't 
+// be called whilst channels are being opened or closed.
+
+// Mean and maximum times are taken over the running nodes of every channel
+void EPOS_GetBringUpStats( BringUpStats* pStatsOut );
+
+// Waits until at least numNodes nodes are running, summed over all of the
+// channels, or until the timeout has passed. Returns true if enough nodes
+// are running. Nothing will change whilst waiting unless the channels have
+// update threads.
+bool EPOS_WaitForRunningNodes( S32 numNodes, U32 timeoutMS );
+
 #endif // EPOS_CONTROL_H
 
 
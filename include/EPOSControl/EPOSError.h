@@ -0,0 +1,56 @@
+//------------------------------------------------------------------------------
+// File: EPOSError.h
+// Desc: Decoding of the error codes that EPOS motor controllers report in
+//       their emergency (EMCY) messages.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+#ifndef EPOS_ERROR_H
+#define EPOS_ERROR_H
+
+//------------------------------------------------------------------------------
+#include "Common.h"
+
+//------------------------------------------------------------------------------
+// Broad classes of error so that client code can decide how to react to an
+// error without comparing strings
+enum eEPOSErrorClass
+{
+    eEEC_None,
+    eEEC_Generic,
+    eEEC_Current,
+    eEEC_Voltage,
+    eEEC_Temperature,
+    eEEC_Communication,
+    eEEC_Software,
+    eEEC_Sensor,
+    eEEC_Motion,        // Following errors and position limits
+    eEEC_Unknown,       // The error code wasn't recognised
+    eEEC_NumErrorClasses
+};
+
+//------------------------------------------------------------------------------
+struct EPOSErrorInfo
+{
+    U16 mErrCode;
+    U8 mErrReg;
+    eEPOSErrorClass mErrorClass;
+    const char* mpMessage;
+};
+
+//------------------------------------------------------------------------------
+// Returns the table of known errors, sorted by error code and then error 
+// register
+const EPOSErrorInfo* EPOS_GetErrorTable( S32* pNumEntriesOut );
+
+// Returns NULL if the error isn't recognised
+const EPOSErrorInfo* EPOS_FindErrorInfo( U16 errCode, U8 errReg );
+
+eEPOSErrorClass EPOS_GetErrorClass( U16 errCode, U8 errReg );
+
+// Returns a message describing the error. Unrecognised errors are formatted
+// into pBuffer, so this is safe to call from multiple threads at once as long
+// as they use different buffers.
+const char* EPOS_GetErrorMessage( U16 errCode, U8 errReg, char* pBuffer, U32 bufferSize );
+
+#endif // EPOS_ERROR_H
@@ -1,7 +1,8 @@
 //------------------------------------------------------------------------------
 // File: SDOField.h
 // Desc: An object that configures either a read or a write of an SDO field
-//       from a CAN Open node
+//       from a CAN Open node. Fields are built on the stack as transfers are
+//       queued, so they're kept small and are cheap to construct.
 //------------------------------------------------------------------------------
 
 //------------------------------------------------------------------------------
@@ -11,10 +12,7 @@
 //------------------------------------------------------------------------------
 #include <stdlib.h>
 #include "Common.h"
-
-//------------------------------------------------------------------------------
-struct SDOField;
-typedef void (*SDOReadCallback)( SDOField& field );
+#include "SDOObjects.h"
 
 //------------------------------------------------------------------------------
 struct SDOField
@@ -30,8 +28,11 @@ struct SDOField
     
     //--------------------------------------------------------------------------
     SDOField();
-    SDOField( eType type, const char* pDescription, U16 mIndex, U8 mSubIndex,
-              SDOReadCallback readCallback = NULL, void* pUserData = NULL );
+    SDOField( eType type, const char* pDescription, U16 mIndex, U8 mSubIndex );
+    
+    //--------------------------------------------------------------------------
+    static SDOField CreateRead( eSDOObject object );
+    static SDOField CreateWrite( const SDOCommand& command );
     
     //--------------------------------------------------------------------------
     static SDOField CreateWrite_U8( const char* pDescription, U16 mIndex, U8 mSubIndex, U8 data ) 
@@ -79,9 +80,13 @@ struct SDOField
         mNumBytes = 2;
     }
     
+    // Data is sent little endian, whatever the byte order of the host
     void SetU32( U32 data ) 
     { 
-        ((U32*)mData)[ 0 ] = data;
+        for ( U32 byteIdx = 0; byteIdx < 4; byteIdx++ )
+        {
+            mData[ byteIdx ] = (U8)( data >> ( 8*byteIdx ) );
+        }
         mNumBytes = 4;
     }
     
@@ -91,18 +96,15 @@ struct SDOField
     }
     
     //--------------------------------------------------------------------------
-    static const S32 MAX_DESC_LENGTH = 31;
-    
     eType mType;
-    
-    char mDescription[ MAX_DESC_LENGTH + 1 ];  // A printable string for debug purposes
     U16 mIndex;
     U8 mSubIndex;
+    U8 mNumBytes;
     U8 mData[ 8 ];
-    U32 mNumBytes;
     
-    SDOReadCallback mReadCallback;
-    void* mpUserData;   // Mainly present so that the field can be identified in a read callback    
+    // A printable string for debug purposes. This isn't copied, so must
+    // point to a string that outlives the field, such as a literal.
+    const char* mpDescription;
 };
 
 #endif // SDO_FIELD_H
\ No newline at end of file
@@ -0,0 +1,134 @@
+//------------------------------------------------------------------------------
+// File: SDOLatencyStats.h
+// Desc: Histograms of how long SDO transfers take, kept for each node and for
+//       each object (index and subindex) that is accessed. A transfer is
+//       timed from when it's queued with the CAN Open library to when its
+//       completion callback arrives, so the times include any wait for the
+//       bus as well as the time taken by the node to answer.
+//
+//       Recording doesn't take a lock. The histograms are updated with atomic
+//       operations and can be read from any thread, although a copy made
+//       whilst a transfer is being recorded may only include part of it.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+#ifndef SDO_LATENCY_STATS_H
+#define SDO_LATENCY_STATS_H
+
+//------------------------------------------------------------------------------
+#include "Common.h"
+#include "SDOField.h"
+
+//------------------------------------------------------------------------------
+struct SDOLatencyHistogram
+{
+    // Bucket 0 counts latencies of less than 2us, and bucket i counts
+    // latencies from 2^i us up to 2^(i+1) us. The last bucket also counts
+    // everything longer.
+    static const S32 NUM_BUCKETS = 24;
+
+    U32 mNumSamples;
+    U32 mMaxLatencyUS;
+    U64 mTotalLatencyUS;
+    U32 mBucketCounts[ NUM_BUCKETS ];
+};
+
+//------------------------------------------------------------------------------
+struct SDOObjectLatencyHistogram
+{
+    U16 mIndex;
+    U8 mSubIndex;
+    SDOLatencyHistogram mHistogram;
+};
+
+//------------------------------------------------------------------------------
+// Estimates a percentile (0 to 100) of the latencies in a histogram. The
+// estimate is the upper bound of the bucket that the percentile falls in,
+// so it's never lower than the true value. Returns 0 for an empty histogram.
+U32 SLS_GetLatencyPercentileUS( const SDOLatencyHistogram& histogram, float percentile );
+
+//------------------------------------------------------------------------------
+class SDOLatencyStats
+{
+    //--------------------------------------------------------------------------
+    public: SDOLatencyStats();
+
+    // Forgets all transfers and latencies. No transfers should complete
+    // whilst this is running.
+    public: void Reset();
+
+    //--------------------------------------------------------------------------
+    // Called just before a transfer is given to the CAN Open library, as the
+    // completion callback may arrive before the library returns. If the
+    // library won't take the transfer then OnTransferNotQueued must be
+    // called to forget it again.
+    public: void OnTransferQueued( U8 nodeId, const SDOField& field, U64 timeUS );
+    public: void OnTransferNotQueued( U8 nodeId, const SDOField& field );
+
+    // Called from the CAN Open callback thread when a transfer completes.
+    // The writes to a node, and the reads from a node, are each assumed to
+    // complete in the order they were queued.
+    public: void OnWriteComplete( U8 nodeId, U64 timeUS );
+    public: void OnReadComplete( U8 nodeId, U64 timeUS );
+
+    //--------------------------------------------------------------------------
+    // Returns false if the node id is out of range or nothing has been
+    // recorded for the object
+    public: bool GetNodeHistogram( U8 nodeId, SDOLatencyHistogram* pHistogramOut ) const;
+    public: bool GetObjectHistogram( U16 index, U8 subIndex, SDOLatencyHistogram* pHistogramOut ) const;
+
+    // Copies out the histograms of up to maxNumHistograms objects and
+    // returns the number copied
+    public: S32 GetObjectHistograms( SDOObjectLatencyHistogram* pHistogramsOut, S32 maxNumHistograms ) const;
+
+    // Transfers to objects which couldn't be given a histogram because the
+    // object table was full. They are still counted in the node histograms.
+    public: U32 GetNumUntrackedObjectSamples() const { return mNumUntrackedObjectSamples; }
+
+    //--------------------------------------------------------------------------
+    private: void OnTransferComplete( U8 nodeId, bool bWrite, U64 timeUS );
+    private: void RecordLatency( U8 nodeId, U32 objectKey, U64 queueTimeUS, U64 completionTimeUS );
+
+    // Both return -1 if there's no slot for the object
+    private: S32 FindObjectSlot( U32 objectKey ) const;
+    private: S32 ClaimObjectSlot( U32 objectKey );
+
+    //--------------------------------------------------------------------------
+    public: static const S32 MAX_NUM_NODES = 128;
+    public: static const S32 MAX_NUM_OBJECTS = 64;     // Must be a power of 2
+
+    // More writes or reads than this can't be outstanding for a node at
+    // once. Must be a power of 2.
+    private: static const U32 TRANSFER_RING_SIZE = 8;
+
+    private: struct PendingTransfer
+    {
+        U64 mQueueTimeUS;
+        U32 mObjectKey;
+    };
+
+    // Transfers are held in a ring in the order they were queued
+    private: struct TransferRing
+    {
+        PendingTransfer mTransfers[ TRANSFER_RING_SIZE ];
+        volatile U32 mNumQueued;
+        volatile U32 mNumCompleted;
+    };
+
+    private: struct NodeTransfers
+    {
+        TransferRing mWrites;
+        TransferRing mReads;
+    };
+
+    private: NodeTransfers mNodeTransfers[ MAX_NUM_NODES ];
+    private: SDOLatencyHistogram mNodeHistograms[ MAX_NUM_NODES ];
+
+    // Open addressed hash table of objects. A key of 0 marks an empty slot,
+    // and once a slot is claimed for an object it's never given up.
+    private: volatile U32 mObjectKeys[ MAX_NUM_OBJECTS ];
+    private: SDOLatencyHistogram mObjectHistograms[ MAX_NUM_OBJECTS ];
+    private: volatile U32 mNumUntrackedObjectSamples;
+};
+
+#endif // SDO_LATENCY_STATS_H
@@ -0,0 +1,122 @@
+//------------------------------------------------------------------------------
+// File: SDOObjects.h
+// Desc: Compact descriptions of the CiA-402 and EPOS objects that are accessed
+//       with SDO transfers, and the commands that write to them.
+//
+//       Each object is identified by an eSDOObject, which also serves as the
+//       id of its interned name, so command lists can be built as tightly
+//       packed tables of constants that need no initialisation at startup.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+#ifndef SDO_OBJECTS_H
+#define SDO_OBJECTS_H
+
+//------------------------------------------------------------------------------
+#include <stdlib.h>
+#include "Common.h"
+
+//------------------------------------------------------------------------------
+enum eSDODataType
+{
+    eSDT_U8,
+    eSDT_U16,
+    eSDT_U32,
+    eSDT_S8,
+    eSDT_S16,
+    eSDT_S32,
+    eSDT_NumDataTypes
+};
+
+//------------------------------------------------------------------------------
+enum eSDOObject
+{
+    eSO_None = 0,       // Marks the end of a command list
+
+    // Communication profile
+    eSO_StoreParameters,
+    eSO_RPDO1TransmissionType,
+    eSO_RPDO1NumMappedObjects,
+    eSO_RPDO1MappedObject1,
+    eSO_RPDO1MappedObject2,
+    eSO_TPDO1TransmissionType,
+    eSO_TPDO1InhibitTime,
+    eSO_TPDO1NumMappedObjects,
+    eSO_TPDO1MappedObject1,
+    eSO_TPDO1MappedObject2,
+
+    // Device profile
+    eSO_Controlword,
+    eSO_Statusword,
+    eSO_ModeOfOperation,
+    eSO_PositionActual,
+    eSO_MaximumFollowingError,
+    eSO_TargetPosition,
+    eSO_ProfileVelocity,
+    eSO_ProfileAcceleration,
+    eSO_ProfileDeceleration,
+    eSO_MotionProfileType,
+    eSO_InterpolationBufferClear,
+    eSO_TargetVelocity,
+
+    // Manufacturer specific
+    eSO_CurrentModeSettingValue,
+    eSO_InterpolationSubMode,
+    eSO_CustomerStorage,
+
+    eSO_NumObjects
+};
+
+//------------------------------------------------------------------------------
+enum eSDOObjectFlag
+{
+    // Writing to the object has an effect beyond setting its value, so a
+    // write can't be skipped just because the object already has the value
+    eSOF_Command = (1 << 0)
+};
+
+//------------------------------------------------------------------------------
+struct SDOObjectDescriptor
+{
+    U16 mIndex;
+    U8 mSubIndex;
+    U8 mDataType;       // An eSDODataType
+    U8 mFlags;          // eSDOObjectFlags
+};
+
+//------------------------------------------------------------------------------
+// A write of a value to an object. Lists of commands are ended by a command
+// to eSO_None.
+struct SDOCommand
+{
+    U8 mObject;         // An eSDOObject
+    U32 mData;
+};
+
+//------------------------------------------------------------------------------
+// Written to eSO_StoreParameters to save all parameters to non-volatile memory
+static const U32 SDO_STORE_PARAMETERS_SIGNATURE = 0x65766173;     // 'save'
+
+//------------------------------------------------------------------------------
+// Indexed by eSDOObject
+extern const SDOObjectDescriptor SDO_OBJECT_DESCRIPTORS[ eSO_NumObjects ];
+
+inline const SDOObjectDescriptor& SDO_GetObjectDescriptor( eSDOObject object )
+{
+    return SDO_OBJECT_DESCRIPTORS[ object ];
+}
+
+// Returns a printable name for the object, for debug purposes
+const char* SDO_GetObjectName( eSDOObject object );
+
+U32 SDO_GetDataTypeNumBytes( eSDODataType dataType );
+bool SDO_IsDataTypeSigned( eSDODataType dataType );
+
+// Returns a CRC of the objects and values written by a command list, which
+// changes if any command in the list is changed. It's never 0, which is the
+// default value of eSO_CustomerStorage. If pMoreCommands is given, the CRC 
+// is the same as for that list appended to pCommands.
+U16 SDO_GetCommandListFingerprint( const SDOCommand* pCommands, 
+                                   const SDOCommand* pMoreCommands=NULL );
+
+#endif // SDO_OBJECTS_H
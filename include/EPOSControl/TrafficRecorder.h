@@ -0,0 +1,211 @@
+//------------------------------------------------------------------------------
+// File: TrafficRecorder.h
+// Desc: Records the traffic between a CANChannel and the CAN Open library into
+//       a capture file, and replays captures back into a CANChannel.
+//
+//       A capture is a memory mapped file holding a header followed by a ring
+//       of fixed size records. Once the ring is full the oldest records are
+//       overwritten, so a recorder can be left running indefinitely and the
+//       file will always hold the most recent traffic, even if the process
+//       crashes.
+//
+//       As well as the messages going to and from the bus, the commands made
+//       by the client and the start of each update are recorded. When a
+//       capture is replayed the client commands and the messages received
+//       from the bus are fed back into a channel, and it's updated at the
+//       same points as the recorded channel was. Messages sent by the
+//       recorded channel are skipped, as the channel being replayed into
+//       will send them itself. Replays are most faithful when recording was
+//       started before the nodes booted and the ring hasn't wrapped, as
+//       otherwise the channel won't know about nodes which are already up.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+#ifndef TRAFFIC_RECORDER_H
+#define TRAFFIC_RECORDER_H
+
+//------------------------------------------------------------------------------
+#include "Common.h"
+
+//------------------------------------------------------------------------------
+class CANChannel;
+
+//------------------------------------------------------------------------------
+enum eTrafficRecordType
+{
+    eTRT_Invalid = 0,
+
+    // Sent to the bus
+    eTRT_SdoWriteRequest,
+    eTRT_SdoReadRequest,
+    eTRT_NmtStartNode,
+    eTRT_PdoSent,
+    eTRT_Sync,
+
+    // Received from the bus
+    eTRT_SdoWriteComplete,
+    eTRT_SdoReadComplete,
+    eTRT_Emergency,
+    eTRT_Bootup,
+    eTRT_PdoReceived,
+
+    // Made by the client and the channel
+    eTRT_ClientCommand,
+    eTRT_Update,
+
+    eTRT_NumTypes
+};
+
+//------------------------------------------------------------------------------
+// Stored in the index field of client command records
+enum eTrafficClientCommand
+{
+    eTCC_SetMotorAngle,
+    eTCC_SetMotorProfileVelocity,
+    eTCC_SetMaximumFollowingError,
+    eTCC_SendFaultReset,
+    eTCC_SetFeedbackMode,
+    eTCC_SetSetpointMode,
+    eTCC_ConfigurePositionControl,
+    eTCC_SetConfigurationMode,
+    eTCC_SetMaxNumNodesSettingUp,
+    eTCC_SetDeferPollingDuringSetUp,
+    eTCC_ConfigureInterpolatedPositionControl,
+    eTCC_QueueTrajectoryPoint,
+    eTCC_ConfigureVelocityControl,
+    eTCC_ConfigureCurrentControl,
+    eTCC_SetMotorVelocity,
+    eTCC_SetMotorCurrent,
+    eTCC_SetSetpointFilter,
+    eTCC_SetBusLoadBudget,
+    eTCC_SetStatusWatchdogInterval,
+    eTCC_NumClientCommands
+};
+
+//------------------------------------------------------------------------------
+// The meaning of mIndex and mData depends on the type of the record
+//
+//      SDO requests and completions - mIndex and mSubIndex give the object,
+//          mData holds the data written or read
+//      PDOs - mIndex is the COB-ID, mData holds the payload
+//      Emergency - mIndex is the error code, mData[ 0 ] is the error register
+//      Client commands - mIndex is the eTrafficClientCommand, mData holds the
+//          S32 or U32 argument of the command. For eTCC_QueueTrajectoryPoint
+//          mData holds the point packed as it's sent to the node, for
+//          eTCC_SetSetpointFilter it holds the SetpointFilter, and for
+//          eTCC_SetBusLoadBudget it holds the float budget.
+//      Update - mData holds the S32 frame index of the update
+struct TrafficRecord
+{
+    U64 mTimeUS;
+    U32 mSequence;      // Position in the capture + 1. Written last, so a
+                        // record that doesn't match its slot is incomplete
+    U8 mType;
+    U8 mNodeId;
+    U8 mSubIndex;
+    U8 mNumBytes;
+    U16 mIndex;
+    U8 mReserved[ 6 ];
+    U8 mData[ 8 ];
+};
+
+//------------------------------------------------------------------------------
+struct TrafficCaptureHeader
+{
+    U32 mMagic;
+    U32 mVersion;
+    U32 mRecordSize;
+    U32 mNumRecordSlots;
+    volatile U64 mNumRecordsWritten;    // Including any that have been overwritten
+    U64 mStartTimeUS;
+    U8 mReserved[ 32 ];
+};
+
+//------------------------------------------------------------------------------
+class TrafficRecorder
+{
+    //--------------------------------------------------------------------------
+    public: TrafficRecorder();
+    public: ~TrafficRecorder();
+
+    //--------------------------------------------------------------------------
+    // Creates the capture file, replacing any existing file
+    public: bool Open( const char* filename, U32 numRecordSlots, U64 startTimeUS );
+
+    // Waits for any records that are being written to finish before closing
+    // the capture, so it's safe to call whilst other threads are recording
+    public: void Close();
+    public: bool IsOpen() const { return mbRecording; }
+
+    //--------------------------------------------------------------------------
+    // Adds a record to the capture. This doesn't take a lock so can be called
+    // from any number of threads at once. Data beyond 8 bytes is dropped.
+    public: void Record( eTrafficRecordType type, U8 nodeId, U16 index, U8 subIndex,
+                         const void* pData, U32 numBytes, U64 timeUS );
+
+    //--------------------------------------------------------------------------
+    public: static const U32 CAPTURE_MAGIC = 0x43545045;   // 'EPTC'
+    public: static const U32 CAPTURE_VERSION = 1;
+    public: static const U32 DEFAULT_NUM_RECORD_SLOTS = 1 << 20;
+
+    private: volatile bool mbRecording;
+    private: volatile U32 mNumActiveWriters;
+    private: TrafficCaptureHeader* mpHeader;
+    private: TrafficRecord* mpRecords;
+    private: U32 mNumRecordSlots;
+    private: U32 mMappedSize;
+};
+
+//------------------------------------------------------------------------------
+struct TrafficReplayStats
+{
+    U32 mNumRecords;            // The complete records in the capture
+    U32 mNumRecordsReplayed;    // Fed into the channel or used to update it
+    U32 mNumRecordsSkipped;     // Sent by the recorded channel, or incomplete
+    U32 mNumUnmatchedCompletions;   // SDO completions that the channel wasn't waiting for
+    U32 mNumUpdates;
+    U64 mTotalUpdateTimeNS;
+    U64 mMaxUpdateTimeNS;
+};
+
+//------------------------------------------------------------------------------
+class TrafficReplayer
+{
+    //--------------------------------------------------------------------------
+    public: TrafficReplayer();
+    public: ~TrafficReplayer();
+
+    //--------------------------------------------------------------------------
+    public: bool Open( const char* filename );
+    public: void Close();
+
+    //--------------------------------------------------------------------------
+    // Feeds records into the channel up to and including the next recorded
+    // update, which is run straight away rather than at the recorded time.
+    // Returns false once the end of the capture has been reached.
+    //
+    // The channel shouldn't have an update thread. It will send its own
+    // messages to the bus as it runs, so it would normally be opened on a
+    // virtual CAN bus with no nodes.
+    public: bool ReplayNextUpdate( CANChannel* pChannel );
+
+    // The recorded time of the last record replayed
+    public: U64 GetTimeUS() const { return mTimeUS; }
+    public: const TrafficReplayStats& GetStats() const { return mStats; }
+
+    //--------------------------------------------------------------------------
+    private: void ReplayRecord( CANChannel* pChannel, const TrafficRecord& record );
+    private: void ReplayClientCommand( CANChannel* pChannel, const TrafficRecord& record );
+
+    //--------------------------------------------------------------------------
+    private: const TrafficCaptureHeader* mpHeader;
+    private: const TrafficRecord* mpRecords;
+    private: U32 mMappedSize;
+    private: U64 mFirstSequenceIdx;
+    private: U64 mEndSequenceIdx;
+    private: U64 mNextSequenceIdx;
+    private: U64 mTimeUS;
+    private: TrafficReplayStats mStats;
+};
+
+#endif // TRAFFIC_RECORDER_H
@@ -0,0 +1,120 @@
+//------------------------------------------------------------------------------
+// File: VirtualCANBus.h
+// Desc: An in-process CAN bus with simulated EPOS motor controllers on it.
+//       This is an alternative backend for the CAN Open interface which is
+//       found in the EPOSControlVirtual library. It lets CANChannel be run
+//       without any hardware, or the CanOpenMaster library.
+//
+//       Nothing happens on a virtual bus until its clock is advanced, and all
+//       callbacks to the CANChannel are made from the thread that advances
+//       the clock. Running the same sequence of updates and clock advances
+//       therefore always gives the same results.
+//
+//       The simulated nodes boot up when reset, answer SDO reads and writes,
+//       follow the CiA 402 state machine driven by the Controlword and move
+//       in profile position mode, along PVT points in interpolated
+//       position mode, or at a target velocity in profile velocity mode.
+//       Current mode setpoints are accepted but the motor isn't moved by
+//       them. PDOs are mapped and sent using the mappings written to their
+//       communication and mapping objects.
+//       Faults can be injected into the nodes, which then send emergency
+//       messages.
+//       Parameters saved with Store Parameters (0x1010) are kept across
+//       resets of the nodes, and across virtual buses being closed and
+//       opened again, until VCB_ClearStoredParameters is called.
+//
+//       Frames are sent one at a time at the bit rate of the channel, with
+//       the lowest COB-ID winning arbitration, so a busy bus delays frames
+//       in the same way that a real one would.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+#ifndef VIRTUAL_CAN_BUS_H
+#define VIRTUAL_CAN_BUS_H
+
+//------------------------------------------------------------------------------
+#include "Common.h"
+
+//------------------------------------------------------------------------------
+class CANChannel;
+
+//------------------------------------------------------------------------------
+struct VirtualCANBusConfig
+{
+    U8 mFirstNodeId;            // Nodes are given consecutive ids from here
+    U8 mNumNodes;
+    U32 mTransmitLatencyUS;     // Time between a frame being queued and it being ready to send
+    U32 mSdoProcessingTimeUS;   // Time taken by a node to answer an SDO request
+    U32 mBootupTimeUS;          // Time taken by a node to boot up after a reset
+    U32 mMotionStepUS;          // How often the motion of the nodes is simulated
+    U32 mCountsPerRevolution;   // Encoder counts, used to convert velocities
+};
+
+//------------------------------------------------------------------------------
+struct VirtualCANBusStats
+{
+    U64 mTimeUS;
+    U32 mNumFramesToNodes;
+    U32 mNumFramesFromNodes;
+    U32 mNumSdoTransfers;
+    U32 mNumRejectedMessages;   // Messages which couldn't be queued
+    U64 mBusBusyTimeUS;         // Total time that frames have been on the bus
+};
+
+//------------------------------------------------------------------------------
+struct VirtualNodeState
+{
+    eNMT_State mNMTState;
+    U16 mStatusword;
+    S32 mPosition;
+    S32 mTargetPosition;
+    U64 mLastSetpointTimeUS;    // When the node last accepted a new setpoint
+    U32 mNumSetpoints;          // Number of setpoints accepted since bootup
+    
+    // Interpolated position mode
+    bool mbInterpolationActive;
+    S32 mNumInterpolationPoints;        // In the buffer
+    U32 mNumInterpolationPointsReached; // Since bootup
+    U16 mInterpolationBufferStatus;
+    
+    // Profile velocity and current modes
+    S32 mVelocity;              // In rpm
+    S32 mTargetVelocity;
+    S16 mCurrentSetting;        // In mA
+};
+
+//------------------------------------------------------------------------------
+void VCB_GetDefaultConfig( VirtualCANBusConfig* pConfigOut );
+
+// Sets the configuration used for channels that are opened afterwards
+void VCB_SetConfig( const VirtualCANBusConfig& config );
+
+// Forgets the parameters stored by the nodes, so that they reset to their
+// defaults
+void VCB_ClearStoredParameters();
+
+//------------------------------------------------------------------------------
+// Runs the simulation forward, delivering any messages that become due.
+// Returns false if the channel isn't using a virtual bus.
+bool VCB_AdvanceTime( CANChannel* pChannel, U32 microseconds );
+U64 VCB_GetTimeUS( CANChannel* pChannel );
+
+//------------------------------------------------------------------------------
+bool VCB_GetStats( CANChannel* pChannel, VirtualCANBusStats* pStatsOut );
+bool VCB_GetNodeState( CANChannel* pChannel, U8 nodeId, VirtualNodeState* pStateOut );
+
+// Puts a node into the Fault state, stopping its motor, and sends an
+// emergency message with the given error. The fault is cleared with a fault
+// reset as on a real node. Returns false if the node isn't present.
+bool VCB_InjectFault( CANChannel* pChannel, U8 nodeId, U16 errCode, U8 errReg );
+
+// Resets a node as though its power had been cycled. The node boots up 
+// again after the boot up time. Returns false if the node isn't present.
+bool VCB_ResetNode( CANChannel* pChannel, U8 nodeId );
+
+// Makes the next numReplies replies of a node to SDO reads one byte shorter
+// than the object being read, as a corrupted reply might be. The count is 
+// cleared when the node resets. Returns false if the node isn't present.
+bool VCB_ShortenSdoReadReplies( CANChannel* pChannel, U8 nodeId, U32 numReplies );
+
+#endif // VIRTUAL_CAN_BUS_H
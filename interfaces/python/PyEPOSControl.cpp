@@ -7,13 +7,26 @@
 #include "structmember.h"
 
 #include <math.h>
+#include <string.h>
 #include "EPOSControl/EPOSControl.h"
 
-#define NUM_CHANNELS 2
+// Channel i is opened on /dev/can<i>. The number of channels is given when
+// the module is initialised, up to MAX_NUM_CHANNELS.
+#define DEFAULT_NUM_CHANNELS 2
+#define MAX_NUM_CHANNELS 16
+
+// Each record written by getMotorControllerDataArray is made up of
+//      ( channelIdx, nodeId, controllerState, angleValid, angle )
+#define MOTOR_CONTROLLER_RECORD_NUM_FIELDS 5
 
 //------------------------------------------------------------------------------
+// The channels belong to the one EPOSControl object that opened them, and are
+// closed when it's deallocated. Methods that release the GIL whilst using 
+// the channels hold a reference to the object so that it can't be 
+// deallocated by another Python thread until they're done.
 static bool gbActive = false;
-static CANChannel* gpChannels[ NUM_CHANNELS ] = { NULL };
+static S32 gNumChannels = 0;
+static CANChannel* gpChannels[ MAX_NUM_CHANNELS ] = { NULL };
 
 //------------------------------------------------------------------------------
 typedef struct 
@@ -25,6 +38,12 @@ typedef struct
     S32 MCS_SETTING_UP;
     S32 MCS_RUNNING;
     S32 MCS_HOMING;
+    
+    // Layout of the buffers used by getMotorControllerDataArray
+    S32 MCD_NUM_FIELDS;
+    S32 MCD_MAX_NUM_RECORDS;
+    
+    bool mbOwnsChannels;
 } EPOSControlObject;
 
 //------------------------------------------------------------------------------
@@ -39,7 +58,7 @@ static PyObject* getMotorControllerData( PyObject* pSelf, PyObject* args )
     // Get the information from the EPOS control library
     PyObject* pChannelDict = PyDict_New();
     
-    for ( S32 channelIdx = 0; channelIdx < NUM_CHANNELS; channelIdx++ )
+    for ( S32 channelIdx = 0; channelIdx < gNumChannels; channelIdx++ )
     {
         if ( NULL == gpChannels[ channelIdx ] )
         {
@@ -73,6 +92,124 @@ static PyObject* getMotorControllerData( PyObject* pSelf, PyObject* args )
     return pChannelDict;
 }
 
+//------------------------------------------------------------------------------
+// Returns true if a buffer holds 32 bit integers, or is just raw bytes
+static bool IsS32Buffer( const Py_buffer& buffer )
+{
+    if ( 1 == buffer.itemsize )
+    {
+        return true;
+    }
+    
+    if ( (Py_ssize_t)sizeof( S32 ) != buffer.itemsize )
+    {
+        return false;
+    }
+    
+    // Skip any byte order character
+    const char* pFormat = ( NULL != buffer.format ? buffer.format : "i" );
+    if ( '@' == *pFormat || '=' == *pFormat || '<' == *pFormat )
+    {
+        pFormat++;
+    }
+    
+    return ( 'i' == *pFormat || 'l' == *pFormat );
+}
+
+//------------------------------------------------------------------------------
+// Gets a contiguous buffer of 32 bit integers from an object. If this
+// returns true then the buffer must be released with PyBuffer_Release,
+// otherwise a Python error has been set.
+static bool GetS32Buffer( PyObject* pObject, bool bWritable, Py_buffer* pBufferOut )
+{
+    S32 flags = PyBUF_C_CONTIGUOUS | PyBUF_FORMAT;
+    if ( bWritable )
+    {
+        flags |= PyBUF_WRITABLE;
+    }
+    
+    if ( PyObject_GetBuffer( pObject, pBufferOut, flags ) < 0 )
+    {
+        // The error has already been set
+        return false;
+    }
+    
+    if ( !IsS32Buffer( *pBufferOut ) )
+    {
+        PyBuffer_Release( pBufferOut );
+        PyErr_SetString( PyExc_Exception, "Buffer must hold 32 bit integers" );
+        return false;
+    }
+    
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// A version of getMotorControllerData which doesn't create any Python 
+// objects. The data is copied into a preallocated writable buffer of 32 bit
+// integers such as an array.array( 'i' ), a numpy int32 array or a bytearray.
+// Each motor controller gets a record of MCD_NUM_FIELDS integers
+//
+//         ( channelIdx, nodeId, controllerState, angleValid, angle )
+//
+// The number of records written is returned. Records stop being written when
+// the buffer is full, but a buffer with space for MCD_MAX_NUM_RECORDS records
+// is always big enough.
+static PyObject* getMotorControllerDataArray( PyObject* pSelf, PyObject* args )
+{
+    PyObject* pBufferObject = NULL;
+    if ( !PyArg_ParseTuple( args, "O", &pBufferObject ) )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid arguments" );
+        return NULL;
+    }
+    
+    Py_buffer buffer;
+    if ( !GetS32Buffer( pBufferObject, true, &buffer ) )
+    {
+        return NULL;
+    }
+    
+    const S32 RECORD_SIZE = MOTOR_CONTROLLER_RECORD_NUM_FIELDS*sizeof( S32 );
+    S32 maxNumRecords = (S32)( buffer.len/RECORD_SIZE );
+    S32 numRecords = 0;
+    U8* pRecordData = (U8*)buffer.buf;
+    
+    for ( S32 channelIdx = 0; channelIdx < gNumChannels && numRecords < maxNumRecords; channelIdx++ )
+    {
+        if ( NULL == gpChannels[ channelIdx ] )
+        {
+            continue;
+        }
+
+        MotorControllerData controllerData[ CANChannel::MAX_NUM_MOTOR_CONTROLLERS ];
+        S32 numControllers = 0;
+        gpChannels[ channelIdx ]->GetMotorControllerData( controllerData, &numControllers );
+        
+        for ( S32 i = 0; i < numControllers && numRecords < maxNumRecords; i++ )
+        {
+            S32 record[ MOTOR_CONTROLLER_RECORD_NUM_FIELDS ] =
+            {
+                channelIdx + 1,
+                controllerData[ i ].mNodeId,
+                controllerData[ i ].mState,
+                controllerData[ i ].mbAngleValid,
+                controllerData[ i ].mAngle
+            };
+            
+            // The buffer may not be aligned if it's made of bytes
+            memcpy( pRecordData, record, RECORD_SIZE );
+            pRecordData += RECORD_SIZE;
+            numRecords++;
+        }
+    }
+    
+    PyBuffer_Release( &buffer );
+    
+    // Small integers are cached by Python so this doesn't allocate either
+    return PyInt_FromLong( numRecords );
+}
+
 //------------------------------------------------------------------------------
 // Sets the joint angles of a number of the motor controllers on the CAN bus.
 // Joint angles are passed in a list of tuples of the form
@@ -118,7 +255,7 @@ static PyObject* setJointAngles( PyObject* pSelf, PyObject* args )
         
         channelIdx--;   // Convert to 0 indexed
 
-        if ( channelIdx >= 0 && channelIdx < NUM_CHANNELS
+        if ( channelIdx >= 0 && channelIdx < gNumChannels
             && NULL != gpChannels[ channelIdx ] )
         {
             gpChannels[ channelIdx ]->SetMotorAngle( (U8)nodeId, angle );
@@ -128,6 +265,170 @@ static PyObject* setJointAngles( PyObject* pSelf, PyObject* args )
     Py_RETURN_NONE;
 }
 
+//------------------------------------------------------------------------------
+// Passes joint angles stored as ( channelIdx, nodeId, position ) records to 
+// the channels in batches. This doesn't touch any Python objects so can be
+// run with the GIL released.
+static void SetJointAnglesFromRecords( const U8* pRecordData, S32 numRecords )
+{
+    const S32 RECORD_SIZE = 3*sizeof( S32 );
+    
+    MotorAngleSetpoint setpoints[ MAX_NUM_CHANNELS ][ CANChannel::MAX_NUM_MOTOR_CONTROLLERS ];
+    S32 numSetpoints[ MAX_NUM_CHANNELS ] = { 0 };
+    
+    for ( S32 recordIdx = 0; recordIdx < numRecords; recordIdx++ )
+    {
+        // The buffer may not be aligned if it's made of bytes
+        S32 record[ 3 ];
+        memcpy( record, pRecordData + recordIdx*RECORD_SIZE, RECORD_SIZE );
+        
+        S32 channelIdx = record[ 0 ] - 1;   // Convert to 0 indexed
+        if ( channelIdx < 0 || channelIdx >= gNumChannels
+            || NULL == gpChannels[ channelIdx ] )
+        {
+            continue;
+        }
+        
+        MotorAngleSetpoint& setpoint = setpoints[ channelIdx ][ numSetpoints[ channelIdx ] ];
+        setpoint.mNodeId = (U8)record[ 1 ];
+        setpoint.mAngle = record[ 2 ];
+        numSetpoints[ channelIdx ]++;
+        
+        if ( CANChannel::MAX_NUM_MOTOR_CONTROLLERS == numSetpoints[ channelIdx ] )
+        {
+            gpChannels[ channelIdx ]->SetMotorAngles( setpoints[ channelIdx ], numSetpoints[ channelIdx ] );
+            numSetpoints[ channelIdx ] = 0;
+        }
+    }
+    
+    for ( S32 channelIdx = 0; channelIdx < gNumChannels; channelIdx++ )
+    {
+        if ( numSetpoints[ channelIdx ] > 0 )
+        {
+            gpChannels[ channelIdx ]->SetMotorAngles( setpoints[ channelIdx ], numSetpoints[ channelIdx ] );
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// A faster version of setJointAngles. The joint angles are passed in a buffer
+// of 32 bit integers, such as an array.array( 'i' ) or a numpy int32 array,
+// made up of records of the form
+//      ( channelIdx, nodeIdx, position )
+static PyObject* setJointAnglesArray( PyObject* pSelf, PyObject* args )
+{
+    PyObject* pBufferObject = NULL;
+    if ( !PyArg_ParseTuple( args, "O", &pBufferObject ) )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid arguments" );
+        return NULL;
+    }
+    
+    Py_buffer buffer;
+    if ( !GetS32Buffer( pBufferObject, false, &buffer ) )
+    {
+        return NULL;
+    }
+    
+    S32 numRecords = (S32)( buffer.len/( 3*sizeof( S32 ) ) );
+    
+    // The buffer can't be resized or freed whilst we hold it
+    Py_INCREF( pSelf );
+    Py_BEGIN_ALLOW_THREADS
+    SetJointAnglesFromRecords( (const U8*)buffer.buf, numRecords );
+    Py_END_ALLOW_THREADS
+    Py_DECREF( pSelf );
+    
+    PyBuffer_Release( &buffer );
+    
+    Py_RETURN_NONE;
+}
+
+//------------------------------------------------------------------------------
+// Sets the joint angles of a number of motor controllers on one channel. The
+// node ids and angles are passed as two buffers of 32 bit integers which 
+// must be the same length.
+static PyObject* setChannelJointAnglesArray( PyObject* pSelf, PyObject* args )
+{
+    S32 channelIdx;
+    PyObject* pNodeIdsObject = NULL;
+    PyObject* pAnglesObject = NULL;
+    if ( !PyArg_ParseTuple( args, "iOO", &channelIdx, &pNodeIdsObject, &pAnglesObject ) )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid arguments" );
+        return NULL;
+    }
+    
+    channelIdx--;   // Convert to 0 indexed
+
+    if ( channelIdx < 0 || channelIdx >= gNumChannels )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid channel index" );
+        return NULL;
+    }
+    
+    Py_buffer nodeIdsBuffer;
+    if ( !GetS32Buffer( pNodeIdsObject, false, &nodeIdsBuffer ) )
+    {
+        return NULL;
+    }
+    
+    Py_buffer anglesBuffer;
+    if ( !GetS32Buffer( pAnglesObject, false, &anglesBuffer ) )
+    {
+        PyBuffer_Release( &nodeIdsBuffer );
+        return NULL;
+    }
+    
+    if ( nodeIdsBuffer.len != anglesBuffer.len )
+    {
+        PyBuffer_Release( &nodeIdsBuffer );
+        PyBuffer_Release( &anglesBuffer );
+        PyErr_SetString( PyExc_Exception, "Node ids and angles must be the same length" );
+        return NULL;
+    }
+    
+    CANChannel* pChannel = gpChannels[ channelIdx ];
+    S32 numAngles = (S32)( anglesBuffer.len/sizeof( S32 ) );
+    
+    if ( NULL != pChannel )
+    {
+        Py_INCREF( pSelf );
+        Py_BEGIN_ALLOW_THREADS
+        
+        MotorAngleSetpoint setpoints[ CANChannel::MAX_NUM_MOTOR_CONTROLLERS ];
+        S32 numSetpoints = 0;
+        for ( S32 angleIdx = 0; angleIdx < numAngles; angleIdx++ )
+        {
+            S32 nodeId;
+            memcpy( &nodeId, (const U8*)nodeIdsBuffer.buf + angleIdx*sizeof( S32 ), sizeof( S32 ) );
+            setpoints[ numSetpoints ].mNodeId = (U8)nodeId;
+            memcpy( &setpoints[ numSetpoints ].mAngle, 
+                (const U8*)anglesBuffer.buf + angleIdx*sizeof( S32 ), sizeof( S32 ) );
+            numSetpoints++;
+            
+            if ( CANChannel::MAX_NUM_MOTOR_CONTROLLERS == numSetpoints )
+            {
+                pChannel->SetMotorAngles( setpoints, numSetpoints );
+                numSetpoints = 0;
+            }
+        }
+        
+        if ( numSetpoints > 0 )
+        {
+            pChannel->SetMotorAngles( setpoints, numSetpoints );
+        }
+        
+        Py_END_ALLOW_THREADS
+        Py_DECREF( pSelf );
+    }
+    
+    PyBuffer_Release( &nodeIdsBuffer );
+    PyBuffer_Release( &anglesBuffer );
+    
+    Py_RETURN_NONE;
+}
+
 //------------------------------------------------------------------------------
 // Sets the speed in encoder ticks per second at which the motors move
 static PyObject* setMotorProfileVelocity( PyObject* pSelf, PyObject* args )
@@ -143,6 +444,12 @@ static PyObject* setMotorProfileVelocity( PyObject* pSelf, PyObject* args )
     
     channelIdx--;   // Convert to 0 indexed
 
+    if ( channelIdx < 0 || channelIdx >= gNumChannels )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid channel index" );
+        return NULL;
+    }
+
     if ( NULL != gpChannels[ channelIdx ] )
     {
         gpChannels[ channelIdx ]->SetMotorProfileVelocity( (U8)nodeId, (U32)profileVelocity );
@@ -162,16 +469,14 @@ static PyObject* setMotorProfileVelocityForAll( PyObject* pSelf, PyObject* args
         return NULL;
     }
 
-    for ( S32 channelIdx = 0; channelIdx < NUM_CHANNELS; channelIdx++ )
-   {
-       if ( NULL != gpChannels[ channelIdx ] )
-       {
-           for ( U8 nodeId = 0; nodeId < CANChannel::MAX_NUM_MOTOR_CONTROLLERS; nodeId++ )
-           {
-               gpChannels[ channelIdx ]->SetMotorProfileVelocity( nodeId, (U32)profileVelocity );
-           }
-       }
-   }
+    for ( S32 channelIdx = 0; channelIdx < gNumChannels; channelIdx++ )
+    {
+        if ( NULL != gpChannels[ channelIdx ] )
+        {
+            gpChannels[ channelIdx ]->SetMotorProfileVelocity( 
+                CANChannel::ALL_MOTOR_CONTROLLERS, (U32)profileVelocity );
+        }
+    }
 
 
     Py_RETURN_NONE;
@@ -197,7 +502,7 @@ static PyObject* setMaximumFollowingError( PyObject* pSelf, PyObject* args )
 
     channelIdx--;   // Convert to 0 indexed
 
-    if ( channelIdx < 0 || channelIdx >= NUM_CHANNELS )
+    if ( channelIdx < 0 || channelIdx >= gNumChannels )
     {
         PyErr_SetString( PyExc_Exception, "Invalid channel index" );
         return NULL;
@@ -211,6 +516,120 @@ static PyObject* setMaximumFollowingError( PyObject* pSelf, PyObject* args )
     Py_RETURN_NONE;
 }
 
+//------------------------------------------------------------------------------
+// Sets the velocity in rpm of a motor controller configured for velocity control
+static PyObject* setMotorVelocity( PyObject* pSelf, PyObject* args )
+{
+    S32 channelIdx;
+    S32 nodeId;
+    S32 velocity;
+    if ( !PyArg_ParseTuple( args, "iii", &channelIdx, &nodeId, &velocity ) )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid arguments" );
+        return NULL;
+    }
+
+    channelIdx--;   // Convert to 0 indexed
+
+    if ( channelIdx < 0 || channelIdx >= gNumChannels )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid channel index" );
+        return NULL;
+    }
+
+    if ( NULL != gpChannels[ channelIdx ] )
+    {
+        gpChannels[ channelIdx ]->SetMotorVelocity( (U8)nodeId, velocity );
+    }
+
+    Py_RETURN_NONE;
+}
+
+//------------------------------------------------------------------------------
+// Sets the current in mA of a motor controller configured for current control
+static PyObject* setMotorCurrent( PyObject* pSelf, PyObject* args )
+{
+    S32 channelIdx;
+    S32 nodeId;
+    S32 current;
+    if ( !PyArg_ParseTuple( args, "iii", &channelIdx, &nodeId, &current ) )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid arguments" );
+        return NULL;
+    }
+
+    if ( current < -32768 || current > 32767 )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid current" );
+        return NULL;
+    }
+
+    channelIdx--;   // Convert to 0 indexed
+
+    if ( channelIdx < 0 || channelIdx >= gNumChannels )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid channel index" );
+        return NULL;
+    }
+
+    if ( NULL != gpChannels[ channelIdx ] )
+    {
+        gpChannels[ channelIdx ]->SetMotorCurrent( (U8)nodeId, (S16)current );
+    }
+
+    Py_RETURN_NONE;
+}
+
+//------------------------------------------------------------------------------
+// Sets the deadbands for angles ( encoder ticks ), velocities ( rpm ) and 
+// currents ( mA ), and the minimum resend interval in milliseconds, used to
+// drop or coalesce the setpoints given to a motor controller. Pass a node 
+// id of 0 to set the filter for all of the motor controllers on a channel.
+static PyObject* setSetpointFilter( PyObject* pSelf, PyObject* args )
+{
+    S32 channelIdx;
+    S32 nodeId;
+    S32 angleDeadband;
+    S32 velocityDeadband;
+    S32 currentDeadband;
+    S32 minResendIntervalMS;
+    if ( !PyArg_ParseTuple( args, "iiiiii", &channelIdx, &nodeId, &angleDeadband,
+                            &velocityDeadband, &currentDeadband, &minResendIntervalMS ) )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid arguments" );
+        return NULL;
+    }
+    
+    if ( angleDeadband < 0 || angleDeadband > 0xFFFF
+        || velocityDeadband < 0 || velocityDeadband > 0xFFFF
+        || currentDeadband < 0 || currentDeadband > 0xFFFF
+        || minResendIntervalMS < 0 || minResendIntervalMS > 0xFFFF )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid filter settings" );
+        return NULL;
+    }
+
+    channelIdx--;   // Convert to 0 indexed
+
+    if ( channelIdx < 0 || channelIdx >= gNumChannels )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid channel index" );
+        return NULL;
+    }
+
+    if ( NULL != gpChannels[ channelIdx ] )
+    {
+        SetpointFilter filter;
+        filter.mAngleDeadband = (U16)angleDeadband;
+        filter.mVelocityDeadband = (U16)velocityDeadband;
+        filter.mCurrentDeadband = (U16)currentDeadband;
+        filter.mMinResendIntervalMS = (U16)minResendIntervalMS;
+        gpChannels[ channelIdx ]->SetSetpointFilter( (U8)nodeId, filter );
+    }
+
+    Py_RETURN_NONE;
+}
+
 //------------------------------------------------------------------------------
 // Tries to bring a halted EPOS node back to life
 static PyObject* sendFaultReset( PyObject* pSelf, PyObject* args )
@@ -225,7 +644,7 @@ static PyObject* sendFaultReset( PyObject* pSelf, PyObject* args )
     
     channelIdx--;   // Convert to 0 indexed
 
-    if ( channelIdx < 0 || channelIdx >= NUM_CHANNELS )
+    if ( channelIdx < 0 || channelIdx >= gNumChannels )
     {
         PyErr_SetString( PyExc_Exception, "Invalid channel index" );
         return NULL;
@@ -240,7 +659,8 @@ static PyObject* sendFaultReset( PyObject* pSelf, PyObject* args )
 }
 
 //------------------------------------------------------------------------------
-// Updates a given channel
+// Updates a given channel. This does nothing if the channel has an update
+// thread, as the thread is already updating it.
 static PyObject* updateChannel( PyObject* pSelf, PyObject* args )
 {
     S32 channelIdx;
@@ -252,86 +672,707 @@ static PyObject* updateChannel( PyObject* pSelf, PyObject* args )
     
     channelIdx--;   // Convert to 0 indexed
 
-    if ( channelIdx < 0 || channelIdx >= NUM_CHANNELS )
+    if ( channelIdx < 0 || channelIdx >= gNumChannels )
     {
         PyErr_SetString( PyExc_Exception, "Invalid channel index" );
         return NULL;
     }
     
-    if ( NULL != gpChannels[ channelIdx ] )
+    CANChannel* pChannel = gpChannels[ channelIdx ];
+    if ( NULL != pChannel && !pChannel->IsUpdateThreadRunning() )
     {
-        gpChannels[ channelIdx ]->Update();
+        // Other Python threads can run whilst the update talks to the bus
+        Py_INCREF( pSelf );
+        Py_BEGIN_ALLOW_THREADS
+        pChannel->Update();
+        Py_END_ALLOW_THREADS
+        Py_DECREF( pSelf );
     }
 
     Py_RETURN_NONE;
 }
 
 //------------------------------------------------------------------------------
-static void EPOSControlObject_dealloc( EPOSControlObject* self )
+// Gives each open channel a native thread which updates it at a fixed rate,
+// so that the bus keeps being serviced however busy Python gets. Whilst the
+// threads run, commands are passed to the channels through their lock free
+// mailboxes, data is read from their snapshots and updateChannel does
+// nothing. Returns True if every open channel has an update thread.
+static PyObject* startUpdateThread( PyObject* pSelf, PyObject* args )
 {
-    // Shut down the EPOSControl library
-    for ( S32 channelIdx = 0; channelIdx < NUM_CHANNELS; channelIdx++ )
+    S32 updateRateHz;
+    if ( !PyArg_ParseTuple( args, "i", &updateRateHz ) 
+        || updateRateHz <= 0 )
     {
-        if ( NULL != gpChannels[ channelIdx ] )
+        PyErr_SetString( PyExc_Exception, "Invalid arguments" );
+        return NULL;
+    }
+    
+    bool bAllStarted = true;
+    for ( S32 channelIdx = 0; channelIdx < gNumChannels; channelIdx++ )
+    {
+        CANChannel* pChannel = gpChannels[ channelIdx ];
+        if ( NULL != pChannel && !pChannel->IsUpdateThreadRunning() )
         {
-            EPOS_CloseCANChannel( gpChannels[ channelIdx ] );
-            gpChannels[ channelIdx ] = NULL;
+            if ( !pChannel->StartUpdateThread( (U32)updateRateHz ) )
+            {
+                bAllStarted = false;
+            }
         }
     }
-    EPOS_DeinitLibrary();
     
-    self->ob_type->tp_free((PyObject*)self);
+    return PyBool_FromLong( bAllStarted );
 }
 
 //------------------------------------------------------------------------------
-static PyObject* EPOSControlObject_new( PyTypeObject *type, 
-                                         PyObject *args, PyObject *kwds )
+// Stops the update threads, after which updateChannel must be called again
+static PyObject* stopUpdateThread( PyObject* pSelf, PyObject* args )
 {
-    EPOSControlObject *self = (EPOSControlObject *)type->tp_alloc(type, 0);
-    return (PyObject *)self;
+    // The threads may take up to an update period to finish
+    Py_INCREF( pSelf );
+    Py_BEGIN_ALLOW_THREADS
+    for ( S32 channelIdx = 0; channelIdx < gNumChannels; channelIdx++ )
+    {
+        if ( NULL != gpChannels[ channelIdx ] )
+        {
+            gpChannels[ channelIdx ]->StopUpdateThread();
+        }
+    }
+    Py_END_ALLOW_THREADS
+    Py_DECREF( pSelf );
+    
+    Py_RETURN_NONE;
 }
 
 //------------------------------------------------------------------------------
-static int EPOSControlObject_init( EPOSControlObject *self, 
-                                   PyObject *args, PyObject *kwds )
+// Returns timing statistics for the update thread of a channel as a
+// dictionary, or None if the channel has no update thread
+static PyObject* getUpdateThreadStats( PyObject* pSelf, PyObject* args )
 {
-    // Setup 'constants'
-    self->MCS_INACTIVE = CANMotorController::eS_Inactive;
-    self->MCS_SETTING_UP = CANMotorController::eS_SettingUp;
-    self->MCS_RUNNING = CANMotorController::eS_Running;
-    self->MCS_HOMING = CANMotorController::eS_Homing;
-    
+    S32 channelIdx;
+    if ( !PyArg_ParseTuple( args, "i", &channelIdx ) )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid arguments" );
+        return NULL;
+    }
+    
+    channelIdx--;   // Convert to 0 indexed
+
+    if ( channelIdx < 0 || channelIdx >= gNumChannels )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid channel index" );
+        return NULL;
+    }
+    
+    CANChannel* pChannel = gpChannels[ channelIdx ];
+    if ( NULL == pChannel || !pChannel->IsUpdateThreadRunning() )
+    {
+        Py_RETURN_NONE;
+    }
+    
+    UpdateThreadStats stats;
+    pChannel->GetUpdateThreadStats( &stats );
+    
+    return Py_BuildValue( "{s:I,s:I,s:I,s:I,s:I,s:I,s:I,s:I}",
+        "updateRateHz", stats.mUpdateRateHz,
+        "numUpdates", stats.mNumUpdates,
+        "numOverruns", stats.mNumOverruns,
+        "lastJitterUS", stats.mLastJitterUS,
+        "maxJitterUS", stats.mMaxJitterUS,
+        "meanJitterUS", stats.mMeanJitterUS,
+        "lastUpdateTimeUS", stats.mLastUpdateTimeUS,
+        "maxUpdateTimeUS", stats.mMaxUpdateTimeUS );
+}
+
+//------------------------------------------------------------------------------
+// Reads a ( position, velocity, timeMS ) tuple into a trajectory point. 
+// Returns false and sets the Python error if the tuple is invalid.
+static bool ParseTrajectoryPoint( PyObject* pInputTuple, TrajectoryPoint* pPointOut )
+{
+    if ( !PyTuple_Check( pInputTuple ) 
+        || PyTuple_Size( pInputTuple ) < 3 )
+    {
+        PyErr_SetString( PyExc_Exception, "Found list item which isn't a tuple with 3 items" );
+        return false;
+    }
+    
+    S32 position = PyInt_AsLong( PyTuple_GetItem( pInputTuple, 0 ) );
+    bool bDataInvalid = ( -1 == position && PyErr_Occurred() );
+    S32 velocity = PyInt_AsLong( PyTuple_GetItem( pInputTuple, 1 ) );
+    bDataInvalid = ( bDataInvalid || ( -1 == velocity && PyErr_Occurred() ) );
+    S32 timeMS = PyInt_AsLong( PyTuple_GetItem( pInputTuple, 2 ) );
+    bDataInvalid = ( bDataInvalid || ( -1 == timeMS && PyErr_Occurred() ) );
+    
+    if ( bDataInvalid || timeMS < 0 || timeMS > 255 )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid data in tuple" );
+        return false;
+    }
+    
+    pPointOut->mPosition = position;
+    pPointOut->mVelocity = velocity;
+    pPointOut->mTimeMS = (U8)timeMS;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Adds points to the trajectory of a motor controller when the channels have
+// been configured for interpolated position control. Points are passed in a
+// list of tuples of the form
+//      ( position, velocity, timeMS )
+// where velocity is in rpm and timeMS is the time from the previous point.
+// Returns the number of points added, which is less than the number passed
+// if the motor controller already has too many points waiting. If any of 
+// the points are invalid then an exception is raised and none are added.
+static PyObject* queueTrajectoryPoints( PyObject* pSelf, PyObject* args )
+{
+    S32 channelIdx;
+    S32 nodeId;
+    PyObject* pList = NULL;
+    if ( !PyArg_ParseTuple( args, "iiO", &channelIdx, &nodeId, &pList )
+        || !PyList_Check( pList ) )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid arguments" );
+        return NULL;
+    }
+    
+    if ( nodeId < 1 || nodeId >= CANChannel::MAX_NUM_MOTOR_CONTROLLERS )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid node id" );
+        return NULL;
+    }
+    
+    // Check all of the points before any are queued, so that a bad point 
+    // doesn't leave part of the trajectory queued
+    Py_ssize_t listLength = PyList_Size( pList );
+    for ( Py_ssize_t listIdx = 0; listIdx < listLength; listIdx++ )
+    {
+        TrajectoryPoint point;
+        if ( !ParseTrajectoryPoint( PyList_GetItem( pList, listIdx ), &point ) )
+        {
+            return NULL;
+        }
+    }
+    
+    channelIdx--;   // Convert to 0 indexed
+
+    if ( channelIdx < 0 || channelIdx >= gNumChannels
+        || NULL == gpChannels[ channelIdx ] )
+    {
+        return PyInt_FromLong( 0 );
+    }
+    
+    // Points are passed on in batches, stopping once the ring is full
+    const S32 MAX_NUM_POINTS_PER_BATCH = 64;
+    TrajectoryPoint points[ MAX_NUM_POINTS_PER_BATCH ];
+    S32 numPointsInBatch = 0;
+    S32 numPointsAdded = 0;
+    
+    for ( Py_ssize_t listIdx = 0; listIdx < listLength; listIdx++ )
+    {
+        ParseTrajectoryPoint( PyList_GetItem( pList, listIdx ), &points[ numPointsInBatch ] );
+        numPointsInBatch++;
+        
+        if ( MAX_NUM_POINTS_PER_BATCH == numPointsInBatch
+            || listIdx == listLength - 1 )
+        {
+            S32 numBatchPointsAdded = gpChannels[ channelIdx ]->QueueTrajectoryPoints( 
+                (U8)nodeId, points, numPointsInBatch );
+            numPointsAdded += numBatchPointsAdded;
+            if ( numBatchPointsAdded < numPointsInBatch )
+            {
+                break;
+            }
+            
+            numPointsInBatch = 0;
+        }
+    }
+    
+    return PyInt_FromLong( numPointsAdded );
+}
+
+//------------------------------------------------------------------------------
+// Returns the counts of the SDO transfers made to configure the motor 
+// controllers on a channel as a dictionary
+static PyObject* getConfigurationStats( PyObject* pSelf, PyObject* args )
+{
+    S32 channelIdx;
+    if ( !PyArg_ParseTuple( args, "i", &channelIdx ) )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid arguments" );
+        return NULL;
+    }
+    
+    channelIdx--;   // Convert to 0 indexed
+
+    if ( channelIdx < 0 || channelIdx >= gNumChannels )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid channel index" );
+        return NULL;
+    }
+    
+    CANChannel* pChannel = gpChannels[ channelIdx ];
+    if ( NULL == pChannel )
+    {
+        Py_RETURN_NONE;
+    }
+    
+    ConfigurationStats stats;
+    pChannel->GetConfigurationStats( CANChannel::ALL_MOTOR_CONTROLLERS, &stats );
+    
+    return Py_BuildValue( "{s:I,s:I,s:I,s:I,s:I}",
+        "numConfigurations", stats.mNumConfigurations,
+        "numReads", stats.mNumReads,
+        "numWrites", stats.mNumWrites,
+        "numWritesSkipped", stats.mNumWritesSkipped,
+        "numStores", stats.mNumStores );
+}
+
+//------------------------------------------------------------------------------
+// Returns the counts of the setpoints given to the motor controllers on a
+// channel that were sent, coalesced or suppressed, as a dictionary
+static PyObject* getSetpointStats( PyObject* pSelf, PyObject* args )
+{
+    S32 channelIdx;
+    if ( !PyArg_ParseTuple( args, "i", &channelIdx ) )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid arguments" );
+        return NULL;
+    }
+    
+    channelIdx--;   // Convert to 0 indexed
+
+    if ( channelIdx < 0 || channelIdx >= gNumChannels )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid channel index" );
+        return NULL;
+    }
+    
+    CANChannel* pChannel = gpChannels[ channelIdx ];
+    if ( NULL == pChannel )
+    {
+        Py_RETURN_NONE;
+    }
+    
+    SetpointStats stats;
+    pChannel->GetSetpointStats( CANChannel::ALL_MOTOR_CONTROLLERS, &stats );
+    
+    return Py_BuildValue( "{s:I,s:I,s:I,s:I}",
+        "numSetpointsGiven", stats.mNumSetpointsGiven,
+        "numSetpointsSent", stats.mNumSetpointsSent,
+        "numSetpointsCoalesced", stats.mNumSetpointsCoalesced,
+        "numSetpointsSuppressed", stats.mNumSetpointsSuppressed );
+}
+
+//------------------------------------------------------------------------------
+// Returns the estimated load on the bus of a channel as a dictionary. The
+// utilisation, peak utilisation and budget are fractions of the bus.
+static PyObject* getBusLoadStats( PyObject* pSelf, PyObject* args )
+{
+    S32 channelIdx;
+    if ( !PyArg_ParseTuple( args, "i", &channelIdx ) )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid arguments" );
+        return NULL;
+    }
+    
+    channelIdx--;   // Convert to 0 indexed
+
+    if ( channelIdx < 0 || channelIdx >= gNumChannels )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid channel index" );
+        return NULL;
+    }
+    
+    CANChannel* pChannel = gpChannels[ channelIdx ];
+    if ( NULL == pChannel )
+    {
+        Py_RETURN_NONE;
+    }
+    
+    BusLoadStats stats;
+    pChannel->GetBusLoadStats( &stats );
+    
+    U32 numFrames = 0;
+    for ( S32 frameTypeIdx = 0; frameTypeIdx < eBFT_NumFrameTypes; frameTypeIdx++ )
+    {
+        numFrames += stats.mNumFrames[ frameTypeIdx ];
+    }
+    
+    return Py_BuildValue( "{s:I,s:d,s:d,s:d,s:I,s:I,s:K,s:I}",
+        "bitRate", stats.mBitRate,
+        "utilisation", (double)stats.mUtilisation,
+        "peakUtilisation", (double)stats.mPeakUtilisation,
+        "budget", (double)stats.mBudget,
+        "numWindows", stats.mNumWindows,
+        "numWindowsOverBudget", stats.mNumWindowsOverBudget,
+        "numBits", (unsigned long long)stats.mNumBits,
+        "numFrames", numFrames );
+}
+
+//------------------------------------------------------------------------------
+// Sets the fraction of the bus that a channel aims to use before it cuts back
+// on polling. A budget of 0 means that there's no budget.
+static PyObject* setBusLoadBudget( PyObject* pSelf, PyObject* args )
+{
+    S32 channelIdx;
+    float budget;
+    if ( !PyArg_ParseTuple( args, "if", &channelIdx, &budget ) )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid arguments" );
+        return NULL;
+    }
+    
+    channelIdx--;   // Convert to 0 indexed
+
+    if ( channelIdx < 0 || channelIdx >= gNumChannels )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid channel index" );
+        return NULL;
+    }
+    
+    if ( NULL != gpChannels[ channelIdx ] )
+    {
+        gpChannels[ channelIdx ]->SetBusLoadBudget( budget < 0.0f ? 0.0f : budget );
+    }
+    
+    Py_RETURN_NONE;
+}
+
+//------------------------------------------------------------------------------
+// Sets how long a motor controller's statusword can go without being received
+// before it's read as a backup. An interval of 0 turns the watchdog off.
+static PyObject* setStatusWatchdogInterval( PyObject* pSelf, PyObject* args )
+{
+    S32 channelIdx;
+    S32 intervalMS;
+    if ( !PyArg_ParseTuple( args, "ii", &channelIdx, &intervalMS ) 
+        || intervalMS < 0 )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid arguments" );
+        return NULL;
+    }
+    
+    channelIdx--;   // Convert to 0 indexed
+
+    if ( channelIdx < 0 || channelIdx >= gNumChannels )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid channel index" );
+        return NULL;
+    }
+    
+    if ( NULL != gpChannels[ channelIdx ] )
+    {
+        gpChannels[ channelIdx ]->SetStatusWatchdogInterval( (U32)intervalMS );
+    }
+    
+    Py_RETURN_NONE;
+}
+
+//------------------------------------------------------------------------------
+// Returns how long the motor controllers on a channel took to be brought up
+// as a dictionary. Times are in microseconds.
+static PyObject* getBringUpStats( PyObject* pSelf, PyObject* args )
+{
+    S32 channelIdx;
+    if ( !PyArg_ParseTuple( args, "i", &channelIdx ) )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid arguments" );
+        return NULL;
+    }
+    
+    channelIdx--;   // Convert to 0 indexed
+
+    if ( channelIdx < 0 || channelIdx >= gNumChannels )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid channel index" );
+        return NULL;
+    }
+    
+    CANChannel* pChannel = gpChannels[ channelIdx ];
+    if ( NULL == pChannel )
+    {
+        Py_RETURN_NONE;
+    }
+    
+    BringUpStats stats;
+    pChannel->GetBringUpStats( &stats );
+    
+    return Py_BuildValue( "{s:I,s:I,s:K,s:K,s:K}",
+        "numNodesPresent", stats.mNumNodesPresent,
+        "numNodesRunning", stats.mNumNodesRunning,
+        "meanTimeToRunningUS", stats.mMeanTimeToRunningUS,
+        "maxTimeToRunningUS", stats.mMaxTimeToRunningUS,
+        "lastRunningTimeUS", stats.mLastRunningTimeUS );
+}
+
+//------------------------------------------------------------------------------
+// Waits until at least numNodes motor controllers are running over all of 
+// the channels, or until timeoutMS milliseconds have passed. The channels 
+// need update threads for anything to happen whilst waiting. Returns True 
+// if enough motor controllers are running.
+static PyObject* waitForRunningNodes( PyObject* pSelf, PyObject* args )
+{
+    S32 numNodes;
+    S32 timeoutMS;
+    if ( !PyArg_ParseTuple( args, "ii", &numNodes, &timeoutMS )
+        || timeoutMS < 0 )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid arguments" );
+        return NULL;
+    }
+    
+    bool bRunning;
+    Py_INCREF( pSelf );
+    Py_BEGIN_ALLOW_THREADS
+    bRunning = EPOS_WaitForRunningNodes( numNodes, (U32)timeoutMS );
+    Py_END_ALLOW_THREADS
+    Py_DECREF( pSelf );
+    
+    return PyBool_FromLong( bRunning );
+}
+
+//------------------------------------------------------------------------------
+// Converts an SDO latency histogram into a dictionary
+static PyObject* CreateSDOLatencyHistogramDict( const SDOLatencyHistogram& histogram )
+{
+    PyObject* pBucketList = PyList_New( SDOLatencyHistogram::NUM_BUCKETS );
+    for ( S32 bucketIdx = 0; bucketIdx < SDOLatencyHistogram::NUM_BUCKETS; bucketIdx++ )
+    {
+        PyList_SetItem( pBucketList, bucketIdx, 
+            PyInt_FromLong( histogram.mBucketCounts[ bucketIdx ] ) );
+    }
+    
+    double meanLatencyUS = 0.0;
+    if ( histogram.mNumSamples > 0 )
+    {
+        meanLatencyUS = (double)histogram.mTotalLatencyUS/(double)histogram.mNumSamples;
+    }
+    
+    PyObject* pDict = Py_BuildValue( "{s:I,s:d,s:I,s:I,s:I,s:N}",
+        "numSamples", histogram.mNumSamples,
+        "meanUS", meanLatencyUS,
+        "maxUS", histogram.mMaxLatencyUS,
+        "p50US", SLS_GetLatencyPercentileUS( histogram, 50.0f ),
+        "p99US", SLS_GetLatencyPercentileUS( histogram, 99.0f ),
+        "buckets", pBucketList );
+        
+    return pDict;
+}
+
+//------------------------------------------------------------------------------
+// Returns histograms of SDO round trip times for a channel as a dictionary
+//
+//      { "nodes" : { nodeId : histogram },
+//        "objects" : { ( index, subIndex ) : histogram } }
+//
+// Each histogram is a dictionary with the keys numSamples, meanUS, maxUS,
+// p50US, p99US and buckets. Bucket 0 counts latencies of less than 2us and
+// bucket i counts latencies from 2^i us up to 2^(i+1) us.
+static PyObject* getSDOLatencyStats( PyObject* pSelf, PyObject* args )
+{
+    S32 channelIdx;
+    if ( !PyArg_ParseTuple( args, "i", &channelIdx ) )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid arguments" );
+        return NULL;
+    }
+    
+    channelIdx--;   // Convert to 0 indexed
+
+    if ( channelIdx < 0 || channelIdx >= gNumChannels
+        || NULL == gpChannels[ channelIdx ] )
+    {
+        PyErr_SetString( PyExc_Exception, "Invalid channel index" );
+        return NULL;
+    }
+    
+    const SDOLatencyStats& stats = gpChannels[ channelIdx ]->GetSDOLatencyStats();
+    
+    PyObject* pNodeDict = PyDict_New();
+    for ( S32 nodeId = 1; nodeId < CANChannel::MAX_NUM_MOTOR_CONTROLLERS; nodeId++ )
+    {
+        SDOLatencyHistogram histogram;
+        if ( stats.GetNodeHistogram( (U8)nodeId, &histogram )
+            && histogram.mNumSamples > 0 )
+        {
+            PyObject* pKey = PyInt_FromLong( nodeId );
+            PyObject* pHistogramDict = CreateSDOLatencyHistogramDict( histogram );
+            PyDict_SetItem( pNodeDict, pKey, pHistogramDict );
+            Py_DECREF( pKey );
+            Py_DECREF( pHistogramDict );
+        }
+    }
+    
+    SDOObjectLatencyHistogram objectHistograms[ SDOLatencyStats::MAX_NUM_OBJECTS ];
+    S32 numObjects = stats.GetObjectHistograms( objectHistograms, SDOLatencyStats::MAX_NUM_OBJECTS );
+    
+    PyObject* pObjectDict = PyDict_New();
+    for ( S32 objectIdx = 0; objectIdx < numObjects; objectIdx++ )
+    {
+        PyObject* pKey = Py_BuildValue( "(ii)", 
+            objectHistograms[ objectIdx ].mIndex, objectHistograms[ objectIdx ].mSubIndex );
+        PyObject* pHistogramDict = CreateSDOLatencyHistogramDict( objectHistograms[ objectIdx ].mHistogram );
+        PyDict_SetItem( pObjectDict, pKey, pHistogramDict );
+        Py_DECREF( pKey );
+        Py_DECREF( pHistogramDict );
+    }
+    
+    return Py_BuildValue( "{s:N,s:N}", "nodes", pNodeDict, "objects", pObjectDict );
+}
+
+//------------------------------------------------------------------------------
+static void EPOSControlObject_dealloc( EPOSControlObject* self )
+{
+    // Shut down the EPOSControl library, unless this object failed to start
+    // it because another object was already using it. Closing a channel 
+    // stops and joins its update thread first.
+    if ( self->mbOwnsChannels )
+    {
+        for ( S32 channelIdx = 0; channelIdx < gNumChannels; channelIdx++ )
+        {
+            if ( NULL != gpChannels[ channelIdx ] )
+            {
+                EPOS_CloseCANChannel( gpChannels[ channelIdx ] );
+                gpChannels[ channelIdx ] = NULL;
+            }
+        }
+        gNumChannels = 0;
+        EPOS_DeinitLibrary();
+        
+        self->mbOwnsChannels = false;
+        gbActive = false;
+    }
+    
+    self->ob_type->tp_free((PyObject*)self);
+}
+
+//------------------------------------------------------------------------------
+static PyObject* EPOSControlObject_new( PyTypeObject *type, 
+                                         PyObject *args, PyObject *kwds )
+{
+    EPOSControlObject *self = (EPOSControlObject *)type->tp_alloc(type, 0);
+    return (PyObject *)self;
+}
+
+//------------------------------------------------------------------------------
+// Takes an optional updateRateHz argument. If this is greater than 0 then
+// each channel is given an update thread, as with startUpdateThread. If the
+// optional differentialConfiguration argument is true then the motor 
+// controllers are only written to where their configuration differs. If the
+// optional storedConfiguration argument is true then the configuration is 
+// stored on the motor controllers, and is only checked on later runs. If the
+// optional interpolatedPositionControl argument is true then the motor 
+// controllers follow trajectories given to queueTrajectoryPoints instead of
+// moving to joint angles. Likewise the optional velocityControl and
+// currentControl arguments configure the motor controllers to be driven by
+// setMotorVelocity and setMotorCurrent. The optional numChannels argument
+// gives the number of CAN channels to open, from /dev/can0 upwards, and 
+// defaults to 2.
+static int EPOSControlObject_init( EPOSControlObject *self, 
+                                   PyObject *args, PyObject *kwds )
+{
+    static char* keywords[] = { (char*)"updateRateHz", (char*)"differentialConfiguration", 
+                                (char*)"storedConfiguration", 
+                                (char*)"interpolatedPositionControl", 
+                                (char*)"velocityControl", (char*)"currentControl", 
+                                (char*)"numChannels", NULL };
+    S32 updateRateHz = 0;
+    S32 bDifferentialConfiguration = 0;
+    S32 bStoredConfiguration = 0;
+    S32 bInterpolatedPositionControl = 0;
+    S32 bVelocityControl = 0;
+    S32 bCurrentControl = 0;
+    S32 numChannels = DEFAULT_NUM_CHANNELS;
+    if ( !PyArg_ParseTupleAndKeywords( args, kwds, "|iiiiiii", keywords, 
+                                       &updateRateHz, &bDifferentialConfiguration,
+                                       &bStoredConfiguration, &bInterpolatedPositionControl,
+                                       &bVelocityControl, &bCurrentControl, &numChannels ) )
+    {
+        return -1;
+    }
+    
+    if ( numChannels < 1 || numChannels > MAX_NUM_CHANNELS )
+    {
+        PyErr_Format( PyExc_Exception, "numChannels must be between 1 and %i", MAX_NUM_CHANNELS );
+        return -1;
+    }
+    
+    if ( updateRateHz < 0 )
+    {
+        updateRateHz = 0;
+    }
+    
+    // Setup 'constants'
+    self->MCS_INACTIVE = CANMotorController::eS_Inactive;
+    self->MCS_SETTING_UP = CANMotorController::eS_SettingUp;
+    self->MCS_RUNNING = CANMotorController::eS_Running;
+    self->MCS_HOMING = CANMotorController::eS_Homing;
+    self->MCD_NUM_FIELDS = MOTOR_CONTROLLER_RECORD_NUM_FIELDS;
+    self->MCD_MAX_NUM_RECORDS = numChannels*CANChannel::MAX_NUM_MOTOR_CONTROLLERS;
+    
     if ( gbActive )
     {
-        fprintf( stderr, "Error: Module already in use\n" );
+        PyErr_SetString( PyExc_Exception, "Module already in use" );
         return -1;
     }
     
     // Start up the EPOSControl library
     if ( !EPOS_InitLibrary() )
     {
-        fprintf( stderr, "Error: Unable to open EPOSControl library\n" );
+        PyErr_SetString( PyExc_Exception, "Unable to open EPOSControl library" );
         return -1;
     }
     
+    gbActive = true;
+    self->mbOwnsChannels = true;
+    
     // Initialise the channels
-    gpChannels[ 0 ] = EPOS_OpenCANChannel( "libCan4LinuxDriver.so", "/dev/can0", eBR_1M, 0 );
-    if ( NULL == gpChannels[ 0 ] )
-    {
-        fprintf( stderr, "Warning: Unable to open CAN bus channel 1\n" );
-    }
-
-    gpChannels[ 1 ] = EPOS_OpenCANChannel( "libCan4LinuxDriver.so", "/dev/can1", eBR_1M, 1 );
-    if ( NULL == gpChannels[ 1 ] )
+    gNumChannels = numChannels;
+    for ( S32 channelIdx = 0; channelIdx < gNumChannels; channelIdx++ )
     {
-        fprintf( stderr, "Warning: Unable to open CAN bus channel 2\n" );
+        char canDevice[ 32 ];
+        snprintf( canDevice, sizeof( canDevice ), "/dev/can%i", channelIdx );
+        
+        gpChannels[ channelIdx ] = EPOS_OpenCANChannel( "libCan4LinuxDriver.so", canDevice, 
+                                                        eBR_1M, channelIdx, (U32)updateRateHz );
+        if ( NULL == gpChannels[ channelIdx ] )
+        {
+            fprintf( stderr, "Warning: Unable to open CAN bus channel %i\n", channelIdx + 1 );
+        }
     }
 
-    for ( S32 channelIdx = 0; channelIdx < NUM_CHANNELS; channelIdx++ )
+    for ( S32 channelIdx = 0; channelIdx < gNumChannels; channelIdx++ )
     {
         if ( NULL != gpChannels[ channelIdx ] )
         {
-            gpChannels[ channelIdx ]->ConfigureAllMotorControllersForPositionControl();
+            if ( bStoredConfiguration )
+            {
+                gpChannels[ channelIdx ]->SetConfigurationMode( 
+                    CANChannel::ALL_MOTOR_CONTROLLERS, CANMotorController::eCM_Stored );
+            }
+            else if ( bDifferentialConfiguration )
+            {
+                gpChannels[ channelIdx ]->SetConfigurationMode( 
+                    CANChannel::ALL_MOTOR_CONTROLLERS, CANMotorController::eCM_Differential );
+            }
+            
+            if ( bInterpolatedPositionControl )
+            {
+                gpChannels[ channelIdx ]->ConfigureAllMotorControllersForInterpolatedPositionControl();
+            }
+            else if ( bVelocityControl )
+            {
+                gpChannels[ channelIdx ]->ConfigureAllMotorControllersForVelocityControl();
+            }
+            else if ( bCurrentControl )
+            {
+                gpChannels[ channelIdx ]->ConfigureAllMotorControllersForCurrentControl();
+            }
+            else
+            {
+                gpChannels[ channelIdx ]->ConfigureAllMotorControllersForPositionControl();
+            }
         }
     }
     
@@ -342,12 +1383,30 @@ static int EPOSControlObject_init( EPOSControlObject *self,
 static PyMethodDef EPOSControlObjectMethods[] = 
 {
     { "getMotorControllerData", getMotorControllerData, METH_VARARGS, "Get data about the motor controllers" },
+    { "getMotorControllerDataArray", getMotorControllerDataArray, METH_VARARGS, "Copy data about the motor controllers into a preallocated buffer" },
     { "setJointAngles", setJointAngles, METH_VARARGS, "Set one or more motor controller joint angles" },
+    { "setJointAnglesArray", setJointAnglesArray, METH_VARARGS, "Set motor controller joint angles from a buffer of ( channel, node, angle ) records" },
+    { "setChannelJointAnglesArray", setChannelJointAnglesArray, METH_VARARGS, "Set motor controller joint angles on a channel from buffers of node ids and angles" },
     { "setMotorProfileVelocity", setMotorProfileVelocity, METH_VARARGS, "Sets the speed in encoder ticks per second at which the motors move" },
     { "setMotorProfileVelocityForAll", setMotorProfileVelocityForAll, METH_VARARGS, "Sets the speed in encoder ticks per second at which the motors move" },
     { "setMaximumFollowingError", setMaximumFollowingError, METH_VARARGS, "Sets the maximum following error for a motor" },
     { "sendFaultReset", sendFaultReset, METH_VARARGS, "Tries to reset a halted EPOS node" },
+    { "setMotorVelocity", setMotorVelocity, METH_VARARGS, "Sets the velocity in rpm of a motor controller configured for velocity control" },
+    { "setMotorCurrent", setMotorCurrent, METH_VARARGS, "Sets the current in mA of a motor controller configured for current control" },
+    { "setSetpointFilter", setSetpointFilter, METH_VARARGS, "Sets the deadbands and minimum resend interval used to filter the setpoints of a motor controller" },
+    { "queueTrajectoryPoints", queueTrajectoryPoints, METH_VARARGS, "Adds ( position, velocity, timeMS ) points to the trajectory of a motor controller" },
     { "updateChannel", updateChannel, METH_VARARGS, "Updates a given channel" },
+    { "startUpdateThread", startUpdateThread, METH_VARARGS, "Starts native threads which update the channels at a fixed rate" },
+    { "stopUpdateThread", stopUpdateThread, METH_VARARGS, "Stops the native update threads" },
+    { "getUpdateThreadStats", getUpdateThreadStats, METH_VARARGS, "Gets timing statistics for the update thread of a channel" },
+    { "getSDOLatencyStats", getSDOLatencyStats, METH_VARARGS, "Gets histograms of SDO round trip times for a channel" },
+    { "getConfigurationStats", getConfigurationStats, METH_VARARGS, "Gets counts of the SDO transfers made to configure the motor controllers on a channel" },
+    { "getSetpointStats", getSetpointStats, METH_VARARGS, "Gets counts of the setpoints given to the motor controllers on a channel that were sent, coalesced or suppressed" },
+    { "getBusLoadStats", getBusLoadStats, METH_VARARGS, "Gets the estimated load on the bus of a channel" },
+    { "setBusLoadBudget", setBusLoadBudget, METH_VARARGS, "Sets the fraction of the bus that a channel aims to use before it cuts back on polling" },
+    { "setStatusWatchdogInterval", setStatusWatchdogInterval, METH_VARARGS, "Sets how long in milliseconds a motor controller's statusword can go unreceived before it's read" },
+    { "getBringUpStats", getBringUpStats, METH_VARARGS, "Gets how long the motor controllers on a channel took to start running" },
+    { "waitForRunningNodes", waitForRunningNodes, METH_VARARGS, "Waits until a number of motor controllers are running, with a timeout in milliseconds" },
     {NULL}  /* Sentinel */
 };
 
@@ -358,6 +1417,8 @@ static PyMemberDef EPOSControlObjectMembers[] =
     { (char*)"MCS_SETTING_UP", T_INT, offsetof(EPOSControlObject, MCS_SETTING_UP), 0, (char*)"'Setting Up' Motor Controller state"},
     { (char*)"MCS_RUNNING", T_INT, offsetof(EPOSControlObject, MCS_RUNNING), 0, (char*)"'Running' Motor Controller state"},
     { (char*)"MCS_HOMING", T_INT, offsetof(EPOSControlObject, MCS_HOMING), 0, (char*)"'Homing' Motor Controller state"},
+    { (char*)"MCD_NUM_FIELDS", T_INT, offsetof(EPOSControlObject, MCD_NUM_FIELDS), 0, (char*)"Number of integers in each motor controller data record"},
+    { (char*)"MCD_MAX_NUM_RECORDS", T_INT, offsetof(EPOSControlObject, MCD_MAX_NUM_RECORDS), 0, (char*)"Maximum number of motor controller data records"},
 
     {NULL}  /* Sentinel */
 };
@@ -0,0 +1,80 @@
+//------------------------------------------------------------------------------
+// File: Atomic.h
+// Desc: Atomic operations for sharing data between the update routine and the
+//       CAN Open callback thread without taking a lock.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+#ifndef ATOMIC_H
+#define ATOMIC_H
+
+//------------------------------------------------------------------------------
+#include "EPOSControl/Common.h"
+
+//------------------------------------------------------------------------------
+inline void AtomicOr( volatile U32* pValue, U32 bits )
+{
+    __sync_fetch_and_or( pValue, bits );
+}
+
+//------------------------------------------------------------------------------
+// Sets the value to 0 and returns what it was before
+inline U32 AtomicFetchAndClear( volatile U32* pValue )
+{
+    return __sync_fetch_and_and( pValue, 0 );
+}
+
+//------------------------------------------------------------------------------
+// Returns the new value
+inline U32 AtomicIncrement( volatile U32* pValue )
+{
+    return __sync_add_and_fetch( pValue, 1 );
+}
+
+//------------------------------------------------------------------------------
+// Returns the new value
+inline U32 AtomicDecrement( volatile U32* pValue )
+{
+    return __sync_sub_and_fetch( pValue, 1 );
+}
+
+//------------------------------------------------------------------------------
+// Returns the new value
+inline U64 AtomicAdd( volatile U64* pValue, U64 amount )
+{
+    return __sync_add_and_fetch( pValue, amount );
+}
+
+//------------------------------------------------------------------------------
+// Only sets the value if it currently equals expectedValue. Returns the value
+// from before the call, so the swap happened if this equals expectedValue.
+inline U32 AtomicCompareAndSwap( volatile U32* pValue, U32 expectedValue, U32 newValue )
+{
+    return __sync_val_compare_and_swap( pValue, expectedValue, newValue );
+}
+
+//------------------------------------------------------------------------------
+// Raises the value to newValue if it's currently lower
+inline void AtomicMax( volatile U32* pValue, U32 newValue )
+{
+    U32 curValue = *pValue;
+    while ( newValue > curValue )
+    {
+        U32 prevValue = AtomicCompareAndSwap( pValue, curValue, newValue );
+        if ( prevValue == curValue )
+        {
+            break;
+        }
+        curValue = prevValue;
+    }
+}
+
+//------------------------------------------------------------------------------
+// Stops both the compiler and the CPU from reordering memory accesses across
+// the barrier
+inline void AtomicMemoryBarrier()
+{
+    __sync_synchronize();
+}
+
+#endif // ATOMIC_H
@@ -0,0 +1,141 @@
+//------------------------------------------------------------------------------
+// File: BusLoadEstimator.cpp
+// Desc: Estimates how busy a CAN bus is from the frames that a CANChannel
+//       sends and receives.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+#include <assert.h>
+#include <string.h>
+#include "EPOSControl/BusLoadEstimator.h"
+#include "Atomic.h"
+
+//------------------------------------------------------------------------------
+static const U32 BIT_RATES[] =
+{
+    1000000,
+    500000,
+    250000,
+    125000,
+    100000,
+    50000,
+    20000,
+    10000,
+    5000
+};
+COMPILE_TIME_ASSERT( ARRAY_LENGTH( BIT_RATES ) == eBR_NumBaudRates );
+
+static const float DEFAULT_BUDGET = 0.8f;
+
+//------------------------------------------------------------------------------
+BusLoadEstimator::BusLoadEstimator()
+{
+    Reset( eBR_1M );
+}
+
+//------------------------------------------------------------------------------
+void BusLoadEstimator::Reset( eBaudRate baudRate )
+{
+    mBitRate = GetBitRate( baudRate );
+    mBudget = DEFAULT_BUDGET;
+    mUtilisation = 0.0f;
+    mPeakUtilisation = 0.0f;
+    mbOverBudget = false;
+    mNumWindows = 0;
+    mNumWindowsOverBudget = 0;
+    mNumBits = 0;
+    for ( S32 frameTypeIdx = 0; frameTypeIdx < eBFT_NumFrameTypes; frameTypeIdx++ )
+    {
+        mNumFrames[ frameTypeIdx ] = 0;
+    }
+
+    mbWindowStarted = false;
+    mWindowStartTimeUS = 0;
+    mWindowStartNumBits = 0;
+}
+
+//------------------------------------------------------------------------------
+void BusLoadEstimator::OnFrame( eBusFrameType frameType, U32 numDataBytes )
+{
+    assert( frameType >= 0 && frameType < eBFT_NumFrameTypes );
+
+    AtomicAdd( &mNumBits, GetFrameNumBits( numDataBytes ) );
+    AtomicIncrement( &mNumFrames[ frameType ] );
+}
+
+//------------------------------------------------------------------------------
+void BusLoadEstimator::Update( U64 timeUS )
+{
+    U64 numBits = AtomicAdd( &mNumBits, 0 );
+
+    if ( !mbWindowStarted )
+    {
+        mbWindowStarted = true;
+        mWindowStartTimeUS = timeUS;
+        mWindowStartNumBits = numBits;
+        return;
+    }
+
+    U64 windowLengthUS = timeUS - mWindowStartTimeUS;
+    if ( timeUS < mWindowStartTimeUS || windowLengthUS < WINDOW_US )
+    {
+        return;
+    }
+
+    // The bits are counted when frames are queued, so a burst can briefly
+    // add up to more than the bus can carry
+    float utilisation = (float)( (double)( numBits - mWindowStartNumBits )*1000000.0
+        /( (double)mBitRate*(double)windowLengthUS ) );
+
+    mUtilisation = utilisation;
+    if ( utilisation > mPeakUtilisation )
+    {
+        mPeakUtilisation = utilisation;
+    }
+
+    float budget = mBudget;
+    mbOverBudget = ( budget > 0.0f && utilisation > budget );
+    if ( mbOverBudget )
+    {
+        mNumWindowsOverBudget++;
+    }
+    mNumWindows++;
+
+    mWindowStartTimeUS = timeUS;
+    mWindowStartNumBits = numBits;
+}
+
+//------------------------------------------------------------------------------
+void BusLoadEstimator::GetStats( BusLoadStats* pStatsOut ) const
+{
+    AtomicMemoryBarrier();
+
+    pStatsOut->mBitRate = mBitRate;
+    pStatsOut->mUtilisation = mUtilisation;
+    pStatsOut->mPeakUtilisation = mPeakUtilisation;
+    pStatsOut->mBudget = mBudget;
+    pStatsOut->mNumWindows = mNumWindows;
+    pStatsOut->mNumWindowsOverBudget = mNumWindowsOverBudget;
+    pStatsOut->mNumBits = mNumBits;
+    for ( S32 frameTypeIdx = 0; frameTypeIdx < eBFT_NumFrameTypes; frameTypeIdx++ )
+    {
+        pStatsOut->mNumFrames[ frameTypeIdx ] = mNumFrames[ frameTypeIdx ];
+    }
+}
+
+//------------------------------------------------------------------------------
+U32 BusLoadEstimator::GetFrameNumBits( U32 numDataBytes )
+{
+    // A standard frame has 47 bits of framing, plus the data, plus worst case
+    // stuff bits over the 34 + data bits from the start of frame to the end
+    // of the CRC, where a stuff bit can follow every 4 bits after the first
+    assert( numDataBytes <= 8 );
+    return 47 + 8*numDataBytes + ( 34 + 8*numDataBytes - 1 )/4;
+}
+
+//------------------------------------------------------------------------------
+U32 BusLoadEstimator::GetBitRate( eBaudRate baudRate )
+{
+    assert( baudRate >= 0 && baudRate < eBR_NumBaudRates );
+    return BIT_RATES[ baudRate ];
+}
@@ -0,0 +1,38 @@
+//------------------------------------------------------------------------------
+// File: ByteOrder.h
+// Desc: Conversion of values to and from the little endian byte order used
+//       for the data of CAN Open messages, whatever the byte order of the host.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+#ifndef BYTE_ORDER_H
+#define BYTE_ORDER_H
+
+//------------------------------------------------------------------------------
+#include "EPOSControl/Common.h"
+
+//------------------------------------------------------------------------------
+// Writes the low numBytes bytes of the value
+inline void PackLittleEndian( U32 value, U8* pDataOut, U32 numBytes )
+{
+    for ( U32 byteIdx = 0; byteIdx < numBytes; byteIdx++ )
+    {
+        pDataOut[ byteIdx ] = (U8)( value >> ( 8*byteIdx ) );
+    }
+}
+
+//------------------------------------------------------------------------------
+// Reads numBytes bytes into the low bytes of the value, without sign
+// extending it
+inline U32 UnpackLittleEndian( const U8* pData, U32 numBytes )
+{
+    U32 value = 0;
+    for ( U32 byteIdx = 0; byteIdx < numBytes; byteIdx++ )
+    {
+        value |= (U32)pData[ byteIdx ] << ( 8*byteIdx );
+    }
+
+    return value;
+}
+
+#endif // BYTE_ORDER_H
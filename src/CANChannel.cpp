@@ -9,20 +9,65 @@
 
 //------------------------------------------------------------------------------
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 #include "EPOSControl/CANChannel.h"
+#include "EPOSControl/EPOSError.h"
 #include "CANOpenInterface.h"
+#include "Atomic.h"
+
+//------------------------------------------------------------------------------
+static const S64 NANOSECONDS_PER_SECOND = 1000000000;
+
+//------------------------------------------------------------------------------
+static S64 TimespecToNanoseconds( const timespec& time )
+{
+    return (S64)time.tv_sec*NANOSECONDS_PER_SECOND + (S64)time.tv_nsec;
+}
+
+//------------------------------------------------------------------------------
+static timespec NanosecondsToTimespec( S64 nanoseconds )
+{
+    timespec time;
+    time.tv_sec = (time_t)( nanoseconds/NANOSECONDS_PER_SECOND );
+    time.tv_nsec = (long)( nanoseconds%NANOSECONDS_PER_SECOND );
+    return time;
+}
+
+//------------------------------------------------------------------------------
+static S64 GetMonotonicTimeNanoseconds()
+{
+    timespec time;
+    clock_gettime( CLOCK_MONOTONIC, &time );
+    return TimespecToNanoseconds( time );
+}
 
 //------------------------------------------------------------------------------
 CANChannel::CANChannel()
-    : mbInitialised( false )
+    : mbInitialised( false ),
+    mLatestSnapshotIdx( 0 ),
+    mSnapshotVersion( 0 ),
+    mbUpdateThreadRunning( false ),
+    mbStopUpdateThread( false ),
+    mUpdateRateHz( 0 ),
+    mpCOIHandle( NULL )
 {
+    mpSnapshots = new MotorControllerSnapshot[ 2 ];
+    memset( mpSnapshots, 0, 2*sizeof( MotorControllerSnapshot ) );
+    mSnapshotSequences[ 0 ] = 0;
+    mSnapshotSequences[ 1 ] = 0;
 }
 
 //------------------------------------------------------------------------------
 CANChannel::~CANChannel()
 {
+    StopUpdateThread();
     Deinit();
+    
+    delete [] mpSnapshots;
+    mpSnapshots = NULL;
 }
     
 //------------------------------------------------------------------------------
@@ -70,96 +115,721 @@ void CANChannel::OnCANOpenPostTPDO()
 //------------------------------------------------------------------------------
 void CANChannel::OnCANOpenPostEmergency( U8 nodeId, U16 errCode, U8 errReg )
 {
+    RecordTraffic( eTRT_Emergency, nodeId, errCode, 0, &errReg, sizeof( errReg ) );
+    mBusLoadEstimator.OnFrame( eBFT_Emergency, 8 );
+    
+    char messageBuffer[ 128 ];
     printf( "Channel %i: PostEmergency called for node %i - Error: %s\n",
-        mChannelIdx, nodeId, GetEposErrorMessage( errCode, errReg ) );
+        mChannelIdx, nodeId, 
+        GetEposErrorMessage( errCode, errReg, messageBuffer, sizeof( messageBuffer ) ) );
+    
+    if ( nodeId < MAX_NUM_MOTOR_CONTROLLERS )
+    {
+        mMotorControllers[ nodeId ].OnEmergency();
+    }
 }
 
 //------------------------------------------------------------------------------
 void CANChannel::OnCANOpenPostSlaveBootup( U8 nodeId )
 {
+    RecordTraffic( eTRT_Bootup, nodeId );
+    mBusLoadEstimator.OnFrame( eBFT_Bootup, 1 );
+    
     printf( "Channel %i: PostSlaveBootup for node %i called at frame %i\n",
         mChannelIdx, nodeId, mFrameIdx );
     
+    if ( nodeId >= MAX_NUM_MOTOR_CONTROLLERS )
+    {
+        return;
+    }
+    
     mMotorControllers[ nodeId ].TellAboutNMTState( eNMTS_PreOperational );
+    AtomicOr( &mNewlyPresentNodeMask[ nodeId/32 ], 1U << (nodeId%32) );
+}
+
+//------------------------------------------------------------------------------
+void CANChannel::OnCANOpenPDOReceived( U16 cobId, U8* pData, U32 numBytes )
+{
+    RecordTraffic( eTRT_PdoReceived, 0, cobId, 0, pData, numBytes );
+    mBusLoadEstimator.OnFrame( eBFT_PdoReceived, numBytes );
+    
+    // TPDO 1 of each node uses the default COB-ID of 0x180 + nodeId
+    if ( cobId > TPDO_1_COB_ID_BASE 
+        && cobId < TPDO_1_COB_ID_BASE + MAX_NUM_MOTOR_CONTROLLERS )
+    {
+        mMotorControllers[ cobId - TPDO_1_COB_ID_BASE ].OnTPDOReceived( pData, numBytes );
+    }
 }
 
 //------------------------------------------------------------------------------
 void CANChannel::OnSDOFieldWriteComplete( U8 nodeId )
 {
-    mMotorControllers[ nodeId ].OnSDOFieldWriteComplete( mFrameIdx );
+    mSDOLatencyStats.OnWriteComplete( nodeId, COI_GetTimeUS( this ) );
+    RecordTraffic( eTRT_SdoWriteComplete, nodeId );
+    mBusLoadEstimator.OnFrame( eBFT_SdoResponse, 8 );
+    mMotorControllers[ nodeId ].OnSDOFieldWriteComplete();
 }
 
 //------------------------------------------------------------------------------
 void CANChannel::OnSDOFieldReadComplete( U8 nodeId, U8* pData, U32 numBytes )
 {
+    mSDOLatencyStats.OnReadComplete( nodeId, COI_GetTimeUS( this ) );
+    RecordTraffic( eTRT_SdoReadComplete, nodeId, 0, 0, pData, numBytes );
+    mBusLoadEstimator.OnFrame( eBFT_SdoResponse, 8 );
     mMotorControllers[ nodeId ].OnSDOFieldReadComplete( pData, numBytes );
 }
+
+//------------------------------------------------------------------------------
+bool CANChannel::ProcessSDOField( U8 nodeId, const SDOField& field )
+{
+    // The transfer is timed before it's queued as the completion callback
+    // may arrive before COI_ProcessSDOField returns
+    mSDOLatencyStats.OnTransferQueued( nodeId, field, COI_GetTimeUS( this ) );
+    
+    bool bFieldProcessed = COI_ProcessSDOField( this, nodeId, field );
+    if ( bFieldProcessed )
+    {
+        bool bWrite = ( SDOField::eT_Write == field.mType );
+        RecordTraffic( bWrite ? eTRT_SdoWriteRequest : eTRT_SdoReadRequest, 
+            nodeId, field.mIndex, field.mSubIndex, 
+            field.mData, ( bWrite ? field.mNumBytes : 0 ) );
+        mBusLoadEstimator.OnFrame( eBFT_SdoRequest, 8 );
+    }
+    else
+    {
+        mSDOLatencyStats.OnTransferNotQueued( nodeId, field );
+    }
+    
+    return bFieldProcessed;
+}
+
+//------------------------------------------------------------------------------
+bool CANChannel::QueueNMTStartNode( U8 nodeId )
+{
+    bool bMsgQueued = COI_QueueNMTStartNode( this, nodeId );
+    if ( bMsgQueued )
+    {
+        RecordTraffic( eTRT_NmtStartNode, nodeId );
+        mBusLoadEstimator.OnFrame( eBFT_Nmt, 2 );
+    }
+    
+    return bMsgQueued;
+}
+
+//------------------------------------------------------------------------------
+bool CANChannel::QueuePDO( U16 cobId, const U8* pData, U8 numBytes )
+{
+    bool bMsgQueued = COI_QueuePDO( this, cobId, pData, numBytes );
+    if ( bMsgQueued )
+    {
+        RecordTraffic( eTRT_PdoSent, 0, cobId, 0, pData, numBytes );
+        mBusLoadEstimator.OnFrame( eBFT_PdoSent, numBytes );
+    }
+    
+    return bMsgQueued;
+}
+
+//------------------------------------------------------------------------------
+bool CANChannel::IsSDOTransferActive( U8 nodeId, bool bWrite ) const
+{
+    bool bActive = false;
+    
+    if ( nodeId < MAX_NUM_MOTOR_CONTROLLERS )
+    {
+        const CANMotorController& controller = mMotorControllers[ nodeId ];
+        bActive = ( bWrite ? controller.GetNumActiveSdoWrites() > 0 : controller.IsSdoReadActive() );
+    }
+    
+    return bActive;
+}
+
+//------------------------------------------------------------------------------
+bool CANChannel::StartTrafficRecording( const char* filename, U32 numRecordSlots )
+{
+    return mTrafficRecorder.Open( filename, numRecordSlots, COI_GetTimeUS( this ) );
+}
+
+//------------------------------------------------------------------------------
+void CANChannel::StopTrafficRecording()
+{
+    mTrafficRecorder.Close();
+}
+
+//------------------------------------------------------------------------------
+void CANChannel::RecordTraffic( eTrafficRecordType type, U8 nodeId, U16 index, U8 subIndex,
+                                const void* pData, U32 numBytes )
+{
+    // Avoid reading the clock when nothing is being recorded
+    if ( mTrafficRecorder.IsOpen() )
+    {
+        mTrafficRecorder.Record( type, nodeId, index, subIndex, 
+            pData, numBytes, COI_GetTimeUS( this ) );
+    }
+}
+
+//------------------------------------------------------------------------------
+void CANChannel::RecordClientCommand( eTrafficClientCommand command, U8 nodeId, S32 argument )
+{
+    RecordTraffic( eTRT_ClientCommand, nodeId, (U16)command, 0, &argument, sizeof( argument ) );
+}
    
 //------------------------------------------------------------------------------
 void CANChannel::Update()
 {
-    S32 nodeId = mStartingNodeId;
-    S32 numNodesUpdated = 0;
-    bool bNewStartingNodeChosen = false;
+    Update( COI_GetTimeUS( this ) );
+}
+
+//------------------------------------------------------------------------------
+void CANChannel::Update( U64 timeUS )
+{
+    bool bRPDOSent = false;
     
     //printf( "Update called\n" );
     mFrameIdx++;
+    mUpdateTimeUS = timeUS;
+    
+    RecordTraffic( eTRT_Update, 0, 0, 0, &mFrameIdx, sizeof( mFrameIdx ) );
+    mBusLoadEstimator.Update( timeUS );
+    
+    UpdateActiveNodeList();
+    ProcessCommands();
+    
+    // There are only a limited number of slots available for sending
+    // SDO messages. By constantly changing the starting order for updates
+    // we ensure that all nodes get a fair chance of sending an SDO message
+    S32 startingListIdx = 0;
+    while ( startingListIdx < mNumActiveNodes 
+        && mActiveNodeIds[ startingListIdx ] < mStartingNodeId )
+    {
+        startingListIdx++;
+    }
+    
+    if ( startingListIdx >= mNumActiveNodes )
+    {
+        startingListIdx = 0;
+    }
     
-    while ( numNodesUpdated < MAX_NUM_MOTOR_CONTROLLERS )
+    S32 numRunningNodes = 0;
+    S32 numSettingUpNodes = 0;
+    for ( S32 i = 0; i < mNumActiveNodes; i++ )
     {    
-        mMotorControllers[ nodeId ].Update( mFrameIdx );
+        U8 nodeId = mActiveNodeIds[ (startingListIdx + i)%mNumActiveNodes ];
+        CANMotorController& controller = mMotorControllers[ nodeId ];
+        controller.Update( mFrameIdx );
         
-        // There are only a limited number of slots available for sending
-        // SDO messages. By constantly changing the starting order for updates
-        // we ensure that all nodes get a fair chance of sending an SDO message
-        if ( mMotorControllers[ nodeId ].GetLastKnownNMTState() != eNMTS_Unknown
-            && nodeId != mStartingNodeId
-            && false == bNewStartingNodeChosen )
+        if ( controller.ProcessRPDOSetpoint() )
         {
-            mStartingNodeId = nodeId;
-            bNewStartingNodeChosen = true;
+            bRPDOSent = true;
         }
         
-        nodeId = (nodeId + 1)%MAX_NUM_MOTOR_CONTROLLERS;
-        numNodesUpdated++;
+        if ( CANMotorController::eS_SettingUp == controller.GetState() )
+        {
+            numSettingUpNodes++;
+        }
+        else if ( CANMotorController::eS_Running == controller.GetState() )
+        {
+            numRunningNodes++;
+            if ( 0 == mNodeBringUpTimes[ nodeId ].mRunningTimeUS
+                && mNodeBringUpTimes[ nodeId ].mbPresent )
+            {
+                mNodeBringUpTimes[ nodeId ].mRunningTimeUS = timeUS - mInitTimeUS;
+            }
+        }
+    }
+    mNumRunningNodes = numRunningNodes;
+    mNumNodesSettingUpLastUpdate = numSettingUpNodes;
+    
+    if ( mNumActiveNodes > 0 )
+    {
+        mStartingNodeId = mActiveNodeIds[ (startingListIdx + 1)%mNumActiveNodes ];
+    }
+    
+    // The RPDOs are synchronous, so the nodes act on them when they receive
+    // the SYNC that follows
+    if ( bRPDOSent )
+    {
+        if ( COI_QueueSync( this ) )
+        {
+            RecordTraffic( eTRT_Sync, 0 );
+            mBusLoadEstimator.OnFrame( eBFT_Sync, 0 );
+        }
     }
+    
+    PublishSnapshot();
 }
-   
+
 //------------------------------------------------------------------------------
-void CANChannel::ConfigureAllMotorControllersForPositionControl()
+void CANChannel::SetMaxNumNodesSettingUp( U32 maxNumNodes )
 {
-    for ( S32 nodeId = 0; nodeId < MAX_NUM_MOTOR_CONTROLLERS; nodeId++ )
+    RecordClientCommand( eTCC_SetMaxNumNodesSettingUp, ALL_MOTOR_CONTROLLERS, (S32)maxNumNodes );
+    mMaxNumNodesSettingUp = maxNumNodes;
+}
+
+//------------------------------------------------------------------------------
+bool CANChannel::TryStartNodeSetUp()
+{
+    if ( 0 != mMaxNumNodesSettingUp 
+        && mNumNodesSettingUp >= mMaxNumNodesSettingUp )
     {
-        mMotorControllers[ nodeId ].SetConfiguration( CANMotorController::eC_PositionControl ); 
+        return false;
     }
+    
+    mNumNodesSettingUp++;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+void CANChannel::OnNodeSetUpFinished()
+{
+    assert( mNumNodesSettingUp > 0 );
+    mNumNodesSettingUp--;
 }
 
 //------------------------------------------------------------------------------
-void CANChannel::GetMotorControllerData( MotorControllerData* pDataBuffer, S32* pBufferSizeOut )
+void CANChannel::SetBusLoadBudget( float budget )
 {
-    S32 bufferSize = 0;
+    S32 argument;
+    memcpy( &argument, &budget, sizeof( argument ) );
+    RecordClientCommand( eTCC_SetBusLoadBudget, ALL_MOTOR_CONTROLLERS, argument );
+    mBusLoadEstimator.SetBudget( budget );
+}
+
+//------------------------------------------------------------------------------
+void CANChannel::SetDeferPollingDuringSetUp( bool bDeferPolling )
+{
+    RecordClientCommand( eTCC_SetDeferPollingDuringSetUp, ALL_MOTOR_CONTROLLERS, bDeferPolling );
+    mbDeferPollingDuringSetUp = bDeferPolling;
+}
+
+//------------------------------------------------------------------------------
+void CANChannel::SetStatusWatchdogInterval( U32 intervalMS )
+{
+    RecordClientCommand( eTCC_SetStatusWatchdogInterval, ALL_MOTOR_CONTROLLERS, (S32)intervalMS );
+    mStatusWatchdogIntervalMS = intervalMS;
+}
+
+//------------------------------------------------------------------------------
+bool CANChannel::GetNodeBringUpTimes( U8 nodeId, NodeBringUpTimes* pTimesOut ) const
+{
+    if ( nodeId >= MAX_NUM_MOTOR_CONTROLLERS )
+    {
+        return false;
+    }
     
-    for ( S32 nodeId = 0; nodeId < MAX_NUM_MOTOR_CONTROLLERS; nodeId++ )
+    AtomicMemoryBarrier();
+    *pTimesOut = mNodeBringUpTimes[ nodeId ];
+    return true;
+}
+
+//------------------------------------------------------------------------------
+void CANChannel::GetBringUpStats( BringUpStats* pStatsOut ) const
+{
+    memset( pStatsOut, 0, sizeof( BringUpStats ) );
+    
+    U64 totalTimeToRunningUS = 0;
+    AtomicMemoryBarrier();
+    for ( S32 nodeId = 1; nodeId < MAX_NUM_MOTOR_CONTROLLERS; nodeId++ )
+    {
+        NodeBringUpTimes times = mNodeBringUpTimes[ nodeId ];
+        if ( !times.mbPresent )
+        {
+            continue;
+        }
+        
+        pStatsOut->mNumNodesPresent++;
+        if ( 0 != times.mRunningTimeUS )
+        {
+            U64 timeToRunningUS = times.mRunningTimeUS - times.mPresentTimeUS;
+            
+            pStatsOut->mNumNodesRunning++;
+            totalTimeToRunningUS += timeToRunningUS;
+            if ( timeToRunningUS > pStatsOut->mMaxTimeToRunningUS )
+            {
+                pStatsOut->mMaxTimeToRunningUS = timeToRunningUS;
+            }
+            if ( times.mRunningTimeUS > pStatsOut->mLastRunningTimeUS )
+            {
+                pStatsOut->mLastRunningTimeUS = times.mRunningTimeUS;
+            }
+        }
+    }
+    
+    if ( pStatsOut->mNumNodesRunning > 0 )
+    {
+        pStatsOut->mMeanTimeToRunningUS = totalTimeToRunningUS/pStatsOut->mNumNodesRunning;
+    }
+}
+
+//------------------------------------------------------------------------------
+bool CANChannel::WaitForRunningNodes( S32 numNodes, U32 timeoutMS ) const
+{
+    const S64 pollPeriodNS = NANOSECONDS_PER_SECOND/1000;
+    S64 deadlineNS = GetMonotonicTimeNanoseconds() + (S64)timeoutMS*1000000;
+    
+    while ( mNumRunningNodes < numNodes
+        && GetMonotonicTimeNanoseconds() < deadlineNS )
+    {
+        timespec pollPeriod = NanosecondsToTimespec( pollPeriodNS );
+        nanosleep( &pollPeriod, NULL );
+    }
+    
+    return ( mNumRunningNodes >= numNodes );
+}
+
+//------------------------------------------------------------------------------
+bool CANChannel::StartUpdateThread( U32 updateRateHz )
+{
+    bool bResult = false;
+    
+    if ( !mbInitialised || mbUpdateThreadRunning || 0 == updateRateHz )
+    {
+        fprintf( stderr, "Error: Unable to start update thread for channel %i\n", mChannelIdx );
+        goto Finished;
+    }
+    
+    mUpdateRateHz = updateRateHz;
+    memset( &mUpdateThreadStats, 0, sizeof( mUpdateThreadStats ) );
+    mUpdateThreadStats.mUpdateRateHz = updateRateHz;
+    mbStopUpdateThread = false;
+    
+    if ( 0 != pthread_create( &mUpdateThread, NULL, UpdateThreadMain, this ) )
+    {
+        fprintf( stderr, "Error: Unable to create update thread for channel %i\n", mChannelIdx );
+        goto Finished;
+    }
+    
+    mbUpdateThreadRunning = true;
+    bResult = true;
+    
+Finished:
+    return bResult;
+}
+
+//------------------------------------------------------------------------------
+void CANChannel::StopUpdateThread()
+{
+    if ( mbUpdateThreadRunning )
+    {
+        mbStopUpdateThread = true;
+        pthread_join( mUpdateThread, NULL );
+        mbUpdateThreadRunning = false;
+    }
+}
+
+//------------------------------------------------------------------------------
+void CANChannel::GetUpdateThreadStats( UpdateThreadStats* pStatsOut ) const
+{
+    AtomicMemoryBarrier();
+    *pStatsOut = mUpdateThreadStats;
+}
+
+//------------------------------------------------------------------------------
+void* CANChannel::UpdateThreadMain( void* pChannel )
+{
+    ((CANChannel*)pChannel)->RunUpdateThread();
+    return NULL;
+}
+
+//------------------------------------------------------------------------------
+void CANChannel::RunUpdateThread()
+{
+    const S64 periodNS = NANOSECONDS_PER_SECOND/mUpdateRateHz;
+    S64 deadlineNS = GetMonotonicTimeNanoseconds();
+    U64 totalJitterUS = 0;
+    
+    while ( !mbStopUpdateThread )
+    {
+        deadlineNS += periodNS;
+        
+        // Sleep until an absolute time so that the time taken by the update
+        // doesn't push back the following updates
+        timespec deadline = NanosecondsToTimespec( deadlineNS );
+        while ( EINTR == clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL ) )
+        {
+        }
+        
+        if ( mbStopUpdateThread )
+        {
+            break;
+        }
+        
+        S64 startTimeNS = GetMonotonicTimeNanoseconds();
+        Update();
+        S64 endTimeNS = GetMonotonicTimeNanoseconds();
+        
+        UpdateThreadStats& stats = mUpdateThreadStats;
+        U32 jitterUS = (U32)( ( startTimeNS - deadlineNS )/1000 );
+        U32 updateTimeUS = (U32)( ( endTimeNS - startTimeNS )/1000 );
+        
+        stats.mNumUpdates++;
+        stats.mLastJitterUS = jitterUS;
+        if ( jitterUS > stats.mMaxJitterUS )
+        {
+            stats.mMaxJitterUS = jitterUS;
+        }
+        totalJitterUS += jitterUS;
+        stats.mMeanJitterUS = (U32)( totalJitterUS/stats.mNumUpdates );
+        stats.mLastUpdateTimeUS = updateTimeUS;
+        if ( updateTimeUS > stats.mMaxUpdateTimeUS )
+        {
+            stats.mMaxUpdateTimeUS = updateTimeUS;
+        }
+        
+        // If we've missed the next deadline then skip to the first deadline
+        // that's still in the future, rather than running a burst of late 
+        // updates to catch up
+        if ( endTimeNS >= deadlineNS + periodNS )
+        {
+            S64 numMissedUpdates = ( endTimeNS - deadlineNS )/periodNS;
+            stats.mNumOverruns++;
+            deadlineNS += numMissedUpdates*periodNS;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+void CANChannel::PublishSnapshot()
+{
+    // Only the update routine writes snapshots, so the buffer that isn't the
+    // latest is free for us to write to
+    U32 snapshotIdx = 1 - mLatestSnapshotIdx;
+    MotorControllerSnapshot& snapshot = mpSnapshots[ snapshotIdx ];
+    
+    mSnapshotSequences[ snapshotIdx ]++;    // Now odd, marking the buffer as being written
+    AtomicMemoryBarrier();
+    
+    mSnapshotVersion++;
+    snapshot.mVersion = mSnapshotVersion;
+    snapshot.mFrameIdx = mFrameIdx;
+    snapshot.mNumControllers = mNumActiveNodes;
+    for ( S32 i = 0; i < mNumActiveNodes; i++ )
+    {
+        const CANMotorController& controller = mMotorControllers[ mActiveNodeIds[ i ] ];
+        snapshot.mNodeIds[ i ] = mActiveNodeIds[ i ];
+        snapshot.mStates[ i ] = controller.GetState();
+        snapshot.mAngles[ i ] = controller.GetAngle();
+        snapshot.mbAngleValid[ i ] = controller.IsAngleValid();
+        snapshot.mStatuswords[ i ] = controller.GetStatusword();
+        snapshot.mbStatusValid[ i ] = controller.IsStatusValid();
+    }
+    
+    AtomicMemoryBarrier();
+    mSnapshotSequences[ snapshotIdx ]++;    // Even again, the buffer is complete
+    AtomicMemoryBarrier();
+    mLatestSnapshotIdx = snapshotIdx;
+}
+
+//------------------------------------------------------------------------------
+void CANChannel::GetMotorControllerSnapshot( MotorControllerSnapshot* pSnapshotOut ) const
+{
+    // If the update routine writes to the buffer whilst we're copying it then
+    // the sequence number will have changed and we try again.
+    while ( true )
     {
-        if ( mMotorControllers[ nodeId ].IsPresent() )
+        U32 snapshotIdx = mLatestSnapshotIdx;
+        AtomicMemoryBarrier();
+        
+        U32 startSequence = mSnapshotSequences[ snapshotIdx ];
+        if ( startSequence & 1 )
+        {
+            continue;   // Buffer is being written
+        }
+        AtomicMemoryBarrier();
+        
+        const MotorControllerSnapshot& snapshot = mpSnapshots[ snapshotIdx ];
+        S32 numControllers = snapshot.mNumControllers;
+        if ( numControllers < 0 || numControllers > MAX_NUM_MOTOR_CONTROLLERS )
         {
-            pDataBuffer[ bufferSize ].mNodeId = nodeId;
-            pDataBuffer[ bufferSize ].mState = mMotorControllers[ nodeId ].GetState();
-            pDataBuffer[ bufferSize ].mAngle = mMotorControllers[ nodeId ].GetAngle();
-            pDataBuffer[ bufferSize ].mbAngleValid = mMotorControllers[ nodeId ].IsAngleValid();
-            bufferSize++;
+            continue;   // Torn read
         }
+        
+        pSnapshotOut->mVersion = snapshot.mVersion;
+        pSnapshotOut->mFrameIdx = snapshot.mFrameIdx;
+        pSnapshotOut->mNumControllers = numControllers;
+        memcpy( pSnapshotOut->mNodeIds, snapshot.mNodeIds, numControllers*sizeof( snapshot.mNodeIds[ 0 ] ) );
+        memcpy( pSnapshotOut->mStates, snapshot.mStates, numControllers*sizeof( snapshot.mStates[ 0 ] ) );
+        memcpy( pSnapshotOut->mAngles, snapshot.mAngles, numControllers*sizeof( snapshot.mAngles[ 0 ] ) );
+        memcpy( pSnapshotOut->mbAngleValid, snapshot.mbAngleValid, numControllers*sizeof( snapshot.mbAngleValid[ 0 ] ) );
+        memcpy( pSnapshotOut->mStatuswords, snapshot.mStatuswords, numControllers*sizeof( snapshot.mStatuswords[ 0 ] ) );
+        memcpy( pSnapshotOut->mbStatusValid, snapshot.mbStatusValid, numControllers*sizeof( snapshot.mbStatusValid[ 0 ] ) );
+        
+        // The buffer must also still be the latest. Otherwise the update
+        // routine may have filled it but not yet published it, and the next
+        // snapshot could then have an older version.
+        AtomicMemoryBarrier();
+        if ( mSnapshotSequences[ snapshotIdx ] == startSequence
+            && mLatestSnapshotIdx == snapshotIdx )
+        {
+            break;  // Copy is consistent
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+void CANChannel::UpdateActiveNodeList()
+{
+    for ( S32 wordIdx = 0; wordIdx < NUM_NODE_MASK_WORDS; wordIdx++ )
+    {
+        U32 nodeMask = AtomicFetchAndClear( &mNewlyPresentNodeMask[ wordIdx ] );
+        for ( S32 bitIdx = 0; 0 != nodeMask; bitIdx++ )
+        {
+            if ( nodeMask & ( 1U << bitIdx ) )
+            {
+                U8 nodeId = wordIdx*32 + bitIdx;
+                AddActiveNode( nodeId );
+                nodeMask &= ~( 1U << bitIdx );
+                
+                // The node has booted, or rebooted, so its bring up starts.
+                // Bring up is timed with the update time, so that it comes
+                // out the same when traffic is replayed.
+                NodeBringUpTimes& times = mNodeBringUpTimes[ nodeId ];
+                times.mRunningTimeUS = 0;
+                times.mPresentTimeUS = mUpdateTimeUS - mInitTimeUS;
+                AtomicMemoryBarrier();
+                times.mbPresent = true;
+            }
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+void CANChannel::AddActiveNode( U8 nodeId )
+{
+    // Find where the node should go in the list
+    S32 insertIdx = 0;
+    while ( insertIdx < mNumActiveNodes 
+        && mActiveNodeIds[ insertIdx ] < nodeId )
+    {
+        insertIdx++;
+    }
+    
+    if ( insertIdx < mNumActiveNodes 
+        && mActiveNodeIds[ insertIdx ] == nodeId )
+    {
+        // Node is already active, it has probably just been rebooted
+        return;
+    }
+    
+    for ( S32 i = mNumActiveNodes; i > insertIdx; i-- )
+    {
+        mActiveNodeIds[ i ] = mActiveNodeIds[ i - 1 ];
     }
+    mActiveNodeIds[ insertIdx ] = nodeId;
+    mNumActiveNodes++;
     
-    *pBufferSizeOut = bufferSize;
+    // Bring the node into line with the settings that have been applied to 
+    // all of the nodes
+    CANMotorController& controller = mMotorControllers[ nodeId ];
+    if ( mbDefaultFeedbackModeSet )
+    {
+        controller.SetFeedbackMode( mDefaultFeedbackMode );
+    }
+    if ( mbDefaultSetpointModeSet )
+    {
+        controller.SetSetpointMode( mDefaultSetpointMode );
+    }
+    if ( mbDefaultConfigurationModeSet )
+    {
+        controller.SetConfigurationMode( mDefaultConfigurationMode );
+    }
+    if ( mbDefaultSetpointFilterSet )
+    {
+        controller.SetSetpointFilter( mDefaultSetpointFilter );
+    }
+    if ( CANMotorController::eC_None != mDefaultConfiguration )
+    {
+        controller.SetConfiguration( mDefaultConfiguration );
+    }
+}
+   
+//------------------------------------------------------------------------------
+void CANChannel::ConfigureAllMotorControllersForPositionControl()
+{
+    RecordClientCommand( eTCC_ConfigurePositionControl, ALL_MOTOR_CONTROLLERS );
+    PostCommand( ALL_MOTOR_CONTROLLERS, eCF_ConfigurePositionControl );
+}
+
+//------------------------------------------------------------------------------
+void CANChannel::ConfigureAllMotorControllersForInterpolatedPositionControl()
+{
+    if ( !COI_ArePDOsSupported() )
+    {
+        fprintf( stderr, "Error: Interpolated position control needs PDOs, "
+            "which the CAN Open library can't send\n" );
+        return;
+    }
+    
+    RecordClientCommand( eTCC_ConfigureInterpolatedPositionControl, ALL_MOTOR_CONTROLLERS );
+    PostCommand( ALL_MOTOR_CONTROLLERS, eCF_ConfigureInterpolatedPositionControl );
+}
+
+//------------------------------------------------------------------------------
+void CANChannel::ConfigureAllMotorControllersForVelocityControl()
+{
+    RecordClientCommand( eTCC_ConfigureVelocityControl, ALL_MOTOR_CONTROLLERS );
+    PostCommand( ALL_MOTOR_CONTROLLERS, eCF_ConfigureVelocityControl );
+}
+
+//------------------------------------------------------------------------------
+void CANChannel::ConfigureAllMotorControllersForCurrentControl()
+{
+    RecordClientCommand( eTCC_ConfigureCurrentControl, ALL_MOTOR_CONTROLLERS );
+    PostCommand( ALL_MOTOR_CONTROLLERS, eCF_ConfigureCurrentControl );
+}
+
+//------------------------------------------------------------------------------
+void CANChannel::GetMotorControllerData( MotorControllerData* pDataBuffer, S32* pBufferSizeOut ) const
+{
+    MotorControllerSnapshot snapshot;
+    GetMotorControllerSnapshot( &snapshot );
+    
+    for ( S32 i = 0; i < snapshot.mNumControllers; i++ )
+    {
+        pDataBuffer[ i ].mNodeId = snapshot.mNodeIds[ i ];
+        pDataBuffer[ i ].mState = snapshot.mStates[ i ];
+        pDataBuffer[ i ].mAngle = snapshot.mAngles[ i ];
+        pDataBuffer[ i ].mbAngleValid = snapshot.mbAngleValid[ i ];
+    }
+    
+    *pBufferSizeOut = snapshot.mNumControllers;
 }
 
 //------------------------------------------------------------------------------
 void CANChannel::SetMotorAngle( U8 nodeId, S32 angle )
 {
-    if ( nodeId < MAX_NUM_MOTOR_CONTROLLERS )
+    if ( ALL_MOTOR_CONTROLLERS != nodeId && nodeId < MAX_NUM_MOTOR_CONTROLLERS )
     {
-         mMotorControllers[ nodeId ].SetDesiredAngle( angle, mFrameIdx );
+        RecordClientCommand( eTCC_SetMotorAngle, nodeId, angle );
+        mCommandMailboxes[ nodeId ].mDesiredAngle = angle;
+        PostCommand( nodeId, eCF_DesiredAngle );
+    }
+}
+
+//------------------------------------------------------------------------------
+void CANChannel::SetMotorAngles( const MotorAngleSetpoint* pSetpoints, S32 numSetpoints )
+{
+    // Flags are posted to the mailboxes as we go, but the nodes are only
+    // added to the pending mask at the end, once for each word of the mask
+    U32 nodeMask[ NUM_NODE_MASK_WORDS ] = { 0 };
+    
+    for ( S32 setpointIdx = 0; setpointIdx < numSetpoints; setpointIdx++ )
+    {
+        U8 nodeId = pSetpoints[ setpointIdx ].mNodeId;
+        if ( ALL_MOTOR_CONTROLLERS != nodeId && nodeId < MAX_NUM_MOTOR_CONTROLLERS )
+        {
+            RecordClientCommand( eTCC_SetMotorAngle, nodeId, pSetpoints[ setpointIdx ].mAngle );
+            mCommandMailboxes[ nodeId ].mDesiredAngle = pSetpoints[ setpointIdx ].mAngle;
+            AtomicOr( &mCommandMailboxes[ nodeId ].mPendingCommands, eCF_DesiredAngle );
+            nodeMask[ nodeId/32 ] |= 1U << (nodeId%32);
+        }
+    }
+    
+    for ( S32 wordIdx = 0; wordIdx < NUM_NODE_MASK_WORDS; wordIdx++ )
+    {
+        if ( 0 != nodeMask[ wordIdx ] )
+        {
+            AtomicOr( &mPendingCommandNodeMask[ wordIdx ], nodeMask[ wordIdx ] );
+        }
     }
 }
 
@@ -168,7 +838,9 @@ void CANChannel::SetMotorProfileVelocity( U8 nodeId, U32 velocity )
 {
     if ( nodeId < MAX_NUM_MOTOR_CONTROLLERS )
     {
-        mMotorControllers[ nodeId ].SetProfileVelocity( velocity );
+        RecordClientCommand( eTCC_SetMotorProfileVelocity, nodeId, (S32)velocity );
+        mCommandMailboxes[ nodeId ].mProfileVelocity = velocity;
+        PostCommand( nodeId, eCF_ProfileVelocity );
     }
 }
 
@@ -177,7 +849,9 @@ void CANChannel::SetMaximumFollowingError( U8 nodeId, U32 maximumFollowingError
 {
     if ( nodeId < MAX_NUM_MOTOR_CONTROLLERS )
     {
-        mMotorControllers[ nodeId ].SetMaximumFollowingError( maximumFollowingError );
+        RecordClientCommand( eTCC_SetMaximumFollowingError, nodeId, (S32)maximumFollowingError );
+        mCommandMailboxes[ nodeId ].mMaximumFollowingError = maximumFollowingError;
+        PostCommand( nodeId, eCF_MaximumFollowingError );
     }
 }
 
@@ -186,156 +860,358 @@ void CANChannel::SendFaultReset( U8 nodeId )
 {
     if ( nodeId < MAX_NUM_MOTOR_CONTROLLERS )
     {
-         mMotorControllers[ nodeId ].SendFaultReset();
+        RecordClientCommand( eTCC_SendFaultReset, nodeId );
+        PostCommand( nodeId, eCF_FaultReset );
     }
 }
 
 //------------------------------------------------------------------------------
-const char* CANChannel::GetEposErrorMessage( U16 errCode, U8 errReg )
+void CANChannel::SetMotorVelocity( U8 nodeId, S32 velocity )
 {
-    if ( 0x0000 == errCode && 0x00 == errReg )
+    if ( nodeId < MAX_NUM_MOTOR_CONTROLLERS )
     {
-        return "No Error";
+        RecordClientCommand( eTCC_SetMotorVelocity, nodeId, velocity );
+        mCommandMailboxes[ nodeId ].mDesiredVelocity = velocity;
+        PostCommand( nodeId, eCF_DesiredVelocity );
     }
-    else if ( 0x1000 == errCode && 0x01 == errReg )
+}
+
+//------------------------------------------------------------------------------
+void CANChannel::SetMotorCurrent( U8 nodeId, S16 current )
+{
+    if ( nodeId < MAX_NUM_MOTOR_CONTROLLERS )
     {
-        return "Generic Error";
+        RecordClientCommand( eTCC_SetMotorCurrent, nodeId, current );
+        mCommandMailboxes[ nodeId ].mDesiredCurrent = current;
+        PostCommand( nodeId, eCF_DesiredCurrent );
     }
-    else if ( 0x2310 == errCode && 0x02 == errReg )
+}
+
+//------------------------------------------------------------------------------
+void CANChannel::SetFeedbackMode( U8 nodeId, CANMotorController::eFeedbackMode feedbackMode )
+{
+    if ( nodeId < MAX_NUM_MOTOR_CONTROLLERS )
     {
-        return "Over Current Error";
+        RecordClientCommand( eTCC_SetFeedbackMode, nodeId, feedbackMode );
+        mCommandMailboxes[ nodeId ].mFeedbackMode = feedbackMode;
+        PostCommand( nodeId, eCF_FeedbackMode );
     }
-    else if ( 0x3210 == errCode && 0x04 == errReg )
+}
+
+//------------------------------------------------------------------------------
+void CANChannel::SetSetpointMode( U8 nodeId, CANMotorController::eSetpointMode setpointMode )
+{
+    if ( nodeId < MAX_NUM_MOTOR_CONTROLLERS )
     {
-        return "Over Voltage Error";
+        RecordClientCommand( eTCC_SetSetpointMode, nodeId, setpointMode );
+        mCommandMailboxes[ nodeId ].mSetpointMode = setpointMode;
+        PostCommand( nodeId, eCF_SetpointMode );
     }
-    else if ( 0x3220 == errCode && 0x04 == errReg )
+}
+
+//------------------------------------------------------------------------------
+void CANChannel::SetSetpointFilter( U8 nodeId, const SetpointFilter& filter )
+{
+    if ( nodeId < MAX_NUM_MOTOR_CONTROLLERS )
     {
-        return "Under Voltage";
+        RecordTraffic( eTRT_ClientCommand, nodeId, (U16)eTCC_SetSetpointFilter, 0, &filter, sizeof( filter ) );
+        mCommandMailboxes[ nodeId ].mSetpointFilter = filter;
+        PostCommand( nodeId, eCF_SetpointFilter );
     }
-    else if ( 0x4210 == errCode && 0x08 == errReg )
+}
+
+//------------------------------------------------------------------------------
+void CANChannel::SetConfigurationMode( U8 nodeId, CANMotorController::eConfigurationMode configurationMode )
+{
+    if ( nodeId < MAX_NUM_MOTOR_CONTROLLERS )
     {
-        return "Over Temperature";
+        RecordClientCommand( eTCC_SetConfigurationMode, nodeId, configurationMode );
+        mCommandMailboxes[ nodeId ].mConfigurationMode = configurationMode;
+        PostCommand( nodeId, eCF_ConfigurationMode );
     }
-    else if ( 0x5113 == errCode && 0x04 == errReg )
+}
+
+//------------------------------------------------------------------------------
+S32 CANChannel::QueueTrajectoryPoints( U8 nodeId, const TrajectoryPoint* pPoints, S32 numPoints )
+{
+    if ( ALL_MOTOR_CONTROLLERS == nodeId || nodeId >= MAX_NUM_MOTOR_CONTROLLERS )
     {
-        return "Supply Voltage (+5V) too low";
+        return 0;
     }
-    else if ( 0x6100 == errCode && 0x20 == errReg )
+    
+    S32 numPointsAdded = mMotorControllers[ nodeId ].QueueTrajectoryPoints( pPoints, numPoints );
+    
+    // Only the points that were added are recorded, each packed as it's
+    // sent to the node
+    for ( S32 pointIdx = 0; pointIdx < numPointsAdded && mTrafficRecorder.IsOpen(); pointIdx++ )
     {
-        return "Internal Software Error";
+        U8 data[ CANMotorController::PVT_RPDO_NUM_BYTES ];
+        CANMotorController::PackTrajectoryPoint( pPoints[ pointIdx ], data );
+        RecordTraffic( eTRT_ClientCommand, nodeId, (U16)eTCC_QueueTrajectoryPoint, 0, data, sizeof( data ) );
     }
-    else if ( 0x6320 == errCode && 0x20 == errReg )
+    
+    return numPointsAdded;
+}
+
+//------------------------------------------------------------------------------
+U32 CANChannel::GetNumTrajectoryPointsPending( U8 nodeId ) const
+{
+    if ( ALL_MOTOR_CONTROLLERS == nodeId || nodeId >= MAX_NUM_MOTOR_CONTROLLERS )
     {
-        return "Software Parameter Error";
+        return 0;
     }
-    else if ( 0x7320 == errCode && 0x20 == errReg )
+    
+    return mMotorControllers[ nodeId ].GetNumTrajectoryPointsPending();
+}
+
+//------------------------------------------------------------------------------
+bool CANChannel::GetConfigurationStats( U8 nodeId, ConfigurationStats* pStatsOut ) const
+{
+    if ( nodeId >= MAX_NUM_MOTOR_CONTROLLERS )
     {
-        return "Sensor Position Error";
+        return false;
     }
-    else if ( 0x8110 == errCode && 0x10 == errReg )
+    
+    if ( ALL_MOTOR_CONTROLLERS == nodeId )
     {
-        return "CAN Overrun Error (Objects Lost)";
+        memset( pStatsOut, 0, sizeof( ConfigurationStats ) );
+        for ( S32 controllerIdx = 1; controllerIdx < MAX_NUM_MOTOR_CONTROLLERS; controllerIdx++ )
+        {
+            ConfigurationStats stats;
+            mMotorControllers[ controllerIdx ].GetConfigurationStats( &stats );
+            pStatsOut->mNumConfigurations += stats.mNumConfigurations;
+            pStatsOut->mNumReads += stats.mNumReads;
+            pStatsOut->mNumWrites += stats.mNumWrites;
+            pStatsOut->mNumWritesSkipped += stats.mNumWritesSkipped;
+            pStatsOut->mNumStores += stats.mNumStores;
+        }
     }
-    else if ( 0x8111 == errCode && 0x10 == errReg )
+    else
     {
-        return "CAN Overrun Error";
+        mMotorControllers[ nodeId ].GetConfigurationStats( pStatsOut );
     }
-    else if ( 0x8120 == errCode && 0x10 == errReg )
+    
+    return true;
+}
+
+//------------------------------------------------------------------------------
+bool CANChannel::GetSetpointStats( U8 nodeId, SetpointStats* pStatsOut ) const
+{
+    if ( nodeId >= MAX_NUM_MOTOR_CONTROLLERS )
+    {
+        return false;
+    }
+    
+    if ( ALL_MOTOR_CONTROLLERS == nodeId )
     {
-        return "CAN Passive Mode Error";
+        memset( pStatsOut, 0, sizeof( SetpointStats ) );
+        for ( S32 controllerIdx = 1; controllerIdx < MAX_NUM_MOTOR_CONTROLLERS; controllerIdx++ )
+        {
+            SetpointStats stats;
+            mMotorControllers[ controllerIdx ].GetSetpointStats( &stats );
+            pStatsOut->mNumSetpointsGiven += stats.mNumSetpointsGiven;
+            pStatsOut->mNumSetpointsSent += stats.mNumSetpointsSent;
+            pStatsOut->mNumSetpointsCoalesced += stats.mNumSetpointsCoalesced;
+            pStatsOut->mNumSetpointsSuppressed += stats.mNumSetpointsSuppressed;
+        }
     }
-    else if ( 0x8130 == errCode && 0x10 == errReg )
+    else
     {
-        return "CAN Life Guard Error";
+        mMotorControllers[ nodeId ].GetSetpointStats( pStatsOut );
     }
-    else if ( 0x8150 == errCode && 0x10 == errReg )
+    
+    return true;
+}
+
+//------------------------------------------------------------------------------
+void CANChannel::PostCommand( U8 nodeId, U32 commandFlag )
+{
+    // The atomic operations act as barriers so the command data is visible
+    // to the update routine before the flags are
+    AtomicOr( &mCommandMailboxes[ nodeId ].mPendingCommands, commandFlag );
+    AtomicOr( &mPendingCommandNodeMask[ nodeId/32 ], 1U << (nodeId%32) );
+}
+
+//------------------------------------------------------------------------------
+void CANChannel::ProcessCommands()
+{
+    // Node 0 is ALL_MOTOR_CONTROLLERS so it's processed first
+    for ( S32 wordIdx = 0; wordIdx < NUM_NODE_MASK_WORDS; wordIdx++ )
     {
-        return "CAN Tansmit COB-ID collision";
+        U32 nodeMask = AtomicFetchAndClear( &mPendingCommandNodeMask[ wordIdx ] );
+        for ( S32 bitIdx = 0; 0 != nodeMask; bitIdx++ )
+        {
+            if ( nodeMask & ( 1U << bitIdx ) )
+            {
+                ProcessNodeCommands( wordIdx*32 + bitIdx );
+                nodeMask &= ~( 1U << bitIdx );
+            }
+        }
     }
-    else if ( 0x81FD == errCode && 0x10 == errReg )
+}
+
+//------------------------------------------------------------------------------
+void CANChannel::ProcessNodeCommands( U8 nodeId )
+{
+    const CommandMailbox& mailbox = mCommandMailboxes[ nodeId ];
+    U32 commands = AtomicFetchAndClear( &mCommandMailboxes[ nodeId ].mPendingCommands );
+    
+    if ( ALL_MOTOR_CONTROLLERS == nodeId )
     {
-        return "CAN Bus Off";
+        // Remember the settings so that they can be given to nodes which
+        // become active later
+        if ( commands & eCF_ConfigurePositionControl )
+        {
+            mDefaultConfiguration = CANMotorController::eC_PositionControl;
+        }
+        if ( commands & eCF_ConfigureInterpolatedPositionControl )
+        {
+            mDefaultConfiguration = CANMotorController::eC_InterpolatedPositionControl;
+        }
+        if ( commands & eCF_ConfigureVelocityControl )
+        {
+            mDefaultConfiguration = CANMotorController::eC_VelocityControl;
+        }
+        if ( commands & eCF_ConfigureCurrentControl )
+        {
+            mDefaultConfiguration = CANMotorController::eC_CurrentControl;
+        }
+        if ( commands & eCF_FeedbackMode )
+        {
+            mDefaultFeedbackMode = mailbox.mFeedbackMode;
+            mbDefaultFeedbackModeSet = true;
+        }
+        if ( commands & eCF_SetpointMode )
+        {
+            mDefaultSetpointMode = mailbox.mSetpointMode;
+            mbDefaultSetpointModeSet = true;
+        }
+        if ( commands & eCF_ConfigurationMode )
+        {
+            mDefaultConfigurationMode = mailbox.mConfigurationMode;
+            mbDefaultConfigurationModeSet = true;
+        }
+        if ( commands & eCF_SetpointFilter )
+        {
+            mDefaultSetpointFilter = mailbox.mSetpointFilter;
+            mbDefaultSetpointFilterSet = true;
+        }
+        
+        for ( S32 i = 0; i < mNumActiveNodes; i++ )
+        {
+            ApplyCommands( mMotorControllers[ mActiveNodeIds[ i ] ], commands, mailbox );
+        }
     }
-    else if ( 0x81FE == errCode && 0x10 == errReg )
+    else
     {
-        return "CAN Rx Queue Overrun";
+        ApplyCommands( mMotorControllers[ nodeId ], commands, mailbox );
     }
-    else if ( 0x81FF == errCode && 0x10 == errReg )
+}
+
+//------------------------------------------------------------------------------
+void CANChannel::ApplyCommands( CANMotorController& controller, U32 commands, 
+                                const CommandMailbox& mailbox )
+{
+    // The mode is applied first so that it's used by a configuration posted
+    // at the same time
+    if ( commands & eCF_ConfigurationMode )
     {
-        return "CAN Tx Queue Overrun";
+        controller.SetConfigurationMode( mailbox.mConfigurationMode );
     }
-    else if ( 0x8210 == errCode && 0x10 == errReg )
+    if ( commands & eCF_ConfigurePositionControl )
     {
-        return "CAN PDO Length Error";
+        controller.SetConfiguration( CANMotorController::eC_PositionControl );
     }
-    else if ( 0x8611 == errCode && 0x20 == errReg )
+    if ( commands & eCF_ConfigureInterpolatedPositionControl )
     {
-        return "Following Error";
+        controller.SetConfiguration( CANMotorController::eC_InterpolatedPositionControl );
     }
-    else if ( 0xFF01 == errCode && 0x80 == errReg )
+    if ( commands & eCF_ConfigureVelocityControl )
     {
-        return "Hall Sensor Error";
+        controller.SetConfiguration( CANMotorController::eC_VelocityControl );
     }
-    else if ( 0xFF02 == errCode && 0x80 == errReg )
+    if ( commands & eCF_ConfigureCurrentControl )
     {
-        return "Index Processing Error";
+        controller.SetConfiguration( CANMotorController::eC_CurrentControl );
     }
-    else if ( 0xFF03 == errCode && 0x80 == errReg )
+    if ( commands & eCF_FeedbackMode )
     {
-        return "Encoder Resolution Error";
+        controller.SetFeedbackMode( mailbox.mFeedbackMode );
     }
-    else if ( 0xFF04 == errCode && 0x80 == errReg )
+    if ( commands & eCF_SetpointMode )
     {
-        return "Hallsensor not found Error";
+        controller.SetSetpointMode( mailbox.mSetpointMode );
     }
-    else if ( 0xFF06 == errCode && 0x80 == errReg )
+    if ( commands & eCF_SetpointFilter )
     {
-        return "Negative Limit Error";
+        controller.SetSetpointFilter( mailbox.mSetpointFilter );
     }
-    else if ( 0xFF07 == errCode && 0x80 == errReg )
+    if ( commands & eCF_ProfileVelocity )
     {
-        return "Positive Limit Error";
+        controller.SetProfileVelocity( mailbox.mProfileVelocity );
     }
-    else if ( 0xFF08 == errCode && 0x80 == errReg )
+    if ( commands & eCF_MaximumFollowingError )
     {
-        return "Hall Angle detection Error";
+        controller.SetMaximumFollowingError( mailbox.mMaximumFollowingError );
     }
-    else if ( 0xFF09 == errCode && 0x80 == errReg )
+    if ( commands & eCF_FaultReset )
     {
-        return "Software Position Limit Error";
+        controller.SendFaultReset();
     }
-    else if ( 0xFF0A == errCode && 0x80 == errReg )
+    if ( commands & eCF_DesiredAngle )
     {
-        return "Position Sensor Breach";
+        controller.SetDesiredAngle( mailbox.mDesiredAngle, mFrameIdx );
     }
-    else if ( 0xFF0B == errCode && 0x20 == errReg )
+    if ( commands & eCF_DesiredVelocity )
     {
-        return "System Overloaded";
+        controller.SetDesiredVelocity( mailbox.mDesiredVelocity );
     }
-    else
+    if ( commands & eCF_DesiredCurrent )
     {
-        static char buffer[ 128 ];
-        
-        snprintf( buffer, sizeof( buffer ), 
-                  "Unrecognised error message 0x%X - 0x%X", errCode, errReg );
-        buffer[ sizeof( buffer ) - 1 ] = '\0';
-        
-        return buffer;
+        controller.SetDesiredCurrent( mailbox.mDesiredCurrent );
     }
 }
+
+//------------------------------------------------------------------------------
+const char* CANChannel::GetEposErrorMessage( U16 errCode, U8 errReg, char* pBuffer, U32 bufferSize )
+{
+    return EPOS_GetErrorMessage( errCode, errReg, pBuffer, bufferSize );
+}
    
 //------------------------------------------------------------------------------
 bool CANChannel::Init( const char* driverLibraryName, const char* canDevice, eBaudRate baudRate, S32 channelIdx )
 {
     if ( !mbInitialised )
     {
-        if ( !COI_InitCANChannel( this, driverLibraryName, canDevice, baudRate ) )
+        // Clear the active nodes before the nodes are reset and start to 
+        // report that they're present
+        mNumActiveNodes = 0;
+        for ( S32 wordIdx = 0; wordIdx < NUM_NODE_MASK_WORDS; wordIdx++ )
         {
-            fprintf( stderr, "Error: Unable set up CAN bus\n" );
-            goto Finished;
+            mNewlyPresentNodeMask[ wordIdx ] = 0;
+        }
+        
+        mDefaultConfiguration = CANMotorController::eC_None;
+        mbDefaultFeedbackModeSet = false;
+        mbDefaultSetpointModeSet = false;
+        mbDefaultConfigurationModeSet = false;
+        mbDefaultSetpointFilterSet = false;
+        
+        memset( mCommandMailboxes, 0, sizeof( mCommandMailboxes ) );
+        for ( S32 wordIdx = 0; wordIdx < NUM_NODE_MASK_WORDS; wordIdx++ )
+        {
+            mPendingCommandNodeMask[ wordIdx ] = 0;
         }
         
+        // Reset before the bus is opened so that they count the first frames
+        // and transfers, rather than keeping those of the last time the
+        // channel was open
+        mBusLoadEstimator.Reset( baudRate );
+        mSDOLatencyStats.Reset();
+        
+        // Opening the bus resets the nodes, and the CAN Open library can 
+        // call back as soon as it's open, so everything the callbacks use
+        // must be set up first or bootups may be lost
         for ( S32 nodeId = 0; nodeId < MAX_NUM_MOTOR_CONTROLLERS; nodeId++ )
         {
             mMotorControllers[ nodeId ].Init( this, nodeId );
@@ -345,6 +1221,28 @@ bool CANChannel::Init( const char* driverLibraryName, const char* canDevice, eBa
         mFrameIdx = 0;
         mChannelIdx = channelIdx;
         
+        mMaxNumNodesSettingUp = DEFAULT_MAX_NUM_NODES_SETTING_UP;
+        mNumNodesSettingUp = 0;
+        mNumNodesSettingUpLastUpdate = 0;
+        mbDeferPollingDuringSetUp = true;
+        mStatusWatchdogIntervalMS = DEFAULT_STATUS_WATCHDOG_INTERVAL_MS;
+        memset( mNodeBringUpTimes, 0, sizeof( mNodeBringUpTimes ) );
+        mNumRunningNodes = 0;
+        
+        if ( !COI_InitCANChannel( this, driverLibraryName, canDevice, baudRate ) )
+        {
+            fprintf( stderr, "Error: Unable set up CAN bus\n" );
+            for ( S32 nodeId = 0; nodeId < MAX_NUM_MOTOR_CONTROLLERS; nodeId++ )
+            {
+                mMotorControllers[ nodeId ].Deinit();
+            }
+            goto Finished;
+        }
+        
+        // The clock of a virtual bus is only available once it's open
+        mUpdateTimeUS = COI_GetTimeUS( this );
+        mInitTimeUS = mUpdateTimeUS;
+        
         mbInitialised = true;
     }
     
@@ -355,6 +1253,9 @@ Finished:
 //------------------------------------------------------------------------------
 void CANChannel::Deinit()
 {
+    StopUpdateThread();
+    StopTrafficRecording();
+    
     for ( S32 nodeId = 0; nodeId < MAX_NUM_MOTOR_CONTROLLERS; nodeId++ )
     {
         mMotorControllers[ nodeId ].Deinit();
@@ -362,5 +1263,8 @@ void CANChannel::Deinit()
     
     COI_DeinitCANChannel( this );
     
+    mNumActiveNodes = 0;
+    PublishSnapshot();      // Let readers know that the nodes have gone
+    
     mbInitialised = false;
 }
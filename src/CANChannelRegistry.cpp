@@ -0,0 +1,85 @@
+//------------------------------------------------------------------------------
+// File: CANChannelRegistry.cpp
+// Desc: Keeps track of which CANChannel each CAN Open library channel handle
+//       belongs to so that callbacks can be dispatched to the right channel.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+#include <assert.h>
+#include <stdlib.h>
+#include "CANChannelRegistry.h"
+#include "Atomic.h"
+
+//------------------------------------------------------------------------------
+// A reader matches the handle of a slot before it reads the channel, so the
+// channel is set before the handle when a slot is filled, and the handle is
+// cleared first when it's emptied.
+//------------------------------------------------------------------------------
+struct ChannelSlot
+{
+    void* volatile mpChannelHandle;
+    CANChannel* volatile mpChannel;
+};
+
+static ChannelSlot gChannelSlots[ CCR_MAX_NUM_CHANNELS ];
+
+//------------------------------------------------------------------------------
+void CCR_Clear()
+{
+    for ( S32 slotIdx = 0; slotIdx < CCR_MAX_NUM_CHANNELS; slotIdx++ )
+    {
+        gChannelSlots[ slotIdx ].mpChannelHandle = NULL;
+        gChannelSlots[ slotIdx ].mpChannel = NULL;
+    }
+}
+
+//------------------------------------------------------------------------------
+bool CCR_AddChannel( CANChannel* pChannel, void* channelHandle )
+{
+    assert( NULL != pChannel && NULL != channelHandle );
+
+    for ( S32 slotIdx = 0; slotIdx < CCR_MAX_NUM_CHANNELS; slotIdx++ )
+    {
+        ChannelSlot& slot = gChannelSlots[ slotIdx ];
+        if ( NULL == slot.mpChannelHandle )
+        {
+            slot.mpChannel = pChannel;
+            AtomicMemoryBarrier();
+            slot.mpChannelHandle = channelHandle;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//------------------------------------------------------------------------------
+void CCR_RemoveChannel( void* channelHandle )
+{
+    for ( S32 slotIdx = 0; slotIdx < CCR_MAX_NUM_CHANNELS; slotIdx++ )
+    {
+        ChannelSlot& slot = gChannelSlots[ slotIdx ];
+        if ( channelHandle == slot.mpChannelHandle )
+        {
+            slot.mpChannelHandle = NULL;
+            AtomicMemoryBarrier();
+            slot.mpChannel = NULL;
+            break;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+CANChannel* CCR_FindChannel( void* channelHandle )
+{
+    for ( S32 slotIdx = 0; slotIdx < CCR_MAX_NUM_CHANNELS; slotIdx++ )
+    {
+        if ( channelHandle == gChannelSlots[ slotIdx ].mpChannelHandle )
+        {
+            AtomicMemoryBarrier();
+            return gChannelSlots[ slotIdx ].mpChannel;
+        }
+    }
+
+    return NULL;
+}
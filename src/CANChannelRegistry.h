@@ -0,0 +1,39 @@
+//------------------------------------------------------------------------------
+// File: CANChannelRegistry.h
+// Desc: Keeps track of which CANChannel each CAN Open library channel handle
+//       belongs to so that callbacks can be dispatched to the right channel.
+//       The other direction doesn't need looking up as each CANChannel holds
+//       its own handle.
+//
+//       Channels are only added and removed from one thread at a time, but
+//       lookups can be done from the CAN Open callback thread whilst channels
+//       are being added or removed.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+#ifndef CAN_CHANNEL_REGISTRY_H
+#define CAN_CHANNEL_REGISTRY_H
+
+//------------------------------------------------------------------------------
+#include "EPOSControl/Common.h"
+
+//------------------------------------------------------------------------------
+class CANChannel;
+
+//------------------------------------------------------------------------------
+static const S32 CCR_MAX_NUM_CHANNELS = 16;
+
+//------------------------------------------------------------------------------
+// Removes all channels. No lookups should be in progress.
+void CCR_Clear();
+
+//------------------------------------------------------------------------------
+// Returns false if CCR_MAX_NUM_CHANNELS channels have already been added
+bool CCR_AddChannel( CANChannel* pChannel, void* channelHandle );
+void CCR_RemoveChannel( void* channelHandle );
+
+//------------------------------------------------------------------------------
+// Returns NULL if the handle can't be found
+CANChannel* CCR_FindChannel( void* channelHandle );
+
+#endif // CAN_CHANNEL_REGISTRY_H
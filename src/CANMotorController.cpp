@@ -9,24 +9,151 @@
 #include <string.h>
 #include "EPOSControl/CANMotorController.h"
 #include "CANOpenInterface.h"
+#include "Atomic.h"
+#include "ByteOrder.h"
 
 //------------------------------------------------------------------------------
-const SDOField CANMotorController::POSITION_CONTROL_SETUP_COMMANDS[] = {
-    SDOField::CreateWrite_U8( "Mode of Operation", 0x6060, 0, 1 ),      // Use profile position mode
-    SDOField::CreateWrite_U32( "Profile Velocity", 0x6081, 0, 500 ),    // Default to a slow speed
-    SDOField::CreateWrite_U16( "Motion profile type", 0x6086, 0, 1 ),   // Use a sinusoidal profile
-    SDOField::CreateWrite_U16( "Controlword", 0x6040, 0, 0x0006 ),      // Shutdown
-    SDOField::CreateWrite_U16( "Controlword", 0x6040, 0, 0x000F ),      // Switch On
+COMPILE_TIME_ASSERT( ( CANMotorController::MAX_NUM_QUEUED_SDO_READS 
+    & ( CANMotorController::MAX_NUM_QUEUED_SDO_READS - 1 ) ) == 0 );
+
+COMPILE_TIME_ASSERT( CANMotorController::CONFIGURATION_ACTION_LIST_LENGTH <= 64 );
+
+COMPILE_TIME_ASSERT( ( CANMotorController::TRAJECTORY_RING_LENGTH 
+    & ( CANMotorController::TRAJECTORY_RING_LENGTH - 1 ) ) == 0 );
+
+//------------------------------------------------------------------------------
+// Set in interpolated position mode whilst the node is following the points
+// in its buffer
+static const U16 STATUSWORD_IP_MODE_ACTIVE = 0x1000;
+
+// Set in profile position mode once the node has reached its target
+static const U16 STATUSWORD_TARGET_REACHED = 0x0400;
+
+// How long a node is given to act on an RPDO setpoint, and report that it
+// has, before its position is checked against the setpoint
+static const U64 RPDO_SETPOINT_SETTLE_TIME_US = 200000;
+
+//------------------------------------------------------------------------------
+static const SDOObjectDescriptor& GetCommandObjectDescriptor( const SDOCommand& command )
+{
+    return SDO_GetObjectDescriptor( (eSDOObject)command.mObject );
+}
+
+//------------------------------------------------------------------------------
+// Every configuration starts with these commands, followed by the commands
+// for its control mode
+const SDOCommand CANMotorController::TPDO1_FEEDBACK_COMMANDS[] = {
+    // Map Position Actual and Statusword into TPDO 1 so that they can be 
+    // streamed back once the node is Operational. TPDO 1 keeps its default
+    // COB-ID of 0x180 + nodeId.
+    { eSO_TPDO1NumMappedObjects, 0 },               // Disable PDO whilst mapping
+    { eSO_TPDO1MappedObject1, 0x60640020 },         // Position Actual
+    { eSO_TPDO1MappedObject2, 0x60410010 },         // Statusword
+    { eSO_TPDO1NumMappedObjects, 2 },               // Reenable PDO
+    { eSO_TPDO1TransmissionType, 255 },             // Asynchronous transfer
+    { eSO_TPDO1InhibitTime, 100 },                  // Limit transfer to once every 10ms
+    
+    { eSO_None, 0 }     // List end marker
+};
+
+const S32 CANMotorController::NUM_TPDO1_FEEDBACK_COMMANDS = 
+    sizeof( TPDO1_FEEDBACK_COMMANDS )/sizeof( TPDO1_FEEDBACK_COMMANDS[ 0 ] ) - 1;
+
+const SDOCommand CANMotorController::POSITION_CONTROL_SETUP_COMMANDS[] = {
+    { eSO_ModeOfOperation, 1 },         // Use profile position mode
+    { eSO_ProfileVelocity, 500 },       // Default to a slow speed
+    { eSO_MotionProfileType, 1 },       // Use a sinusoidal profile
+    
+    // Map Target Position and Controlword into RPDO 1 so that setpoints can
+    // be sent without SDO round trips. RPDO 1 keeps its default COB-ID of
+    // 0x200 + nodeId.
+    { eSO_RPDO1NumMappedObjects, 0 },               // Disable PDO whilst mapping
+    { eSO_RPDO1MappedObject1, 0x607A0020 },         // Target Position
+    { eSO_RPDO1MappedObject2, 0x60400010 },         // Controlword
+    { eSO_RPDO1NumMappedObjects, 2 },               // Reenable PDO
+    { eSO_RPDO1TransmissionType, 1 },               // Act on the RPDO at the next SYNC
+    
+    { eSO_Controlword, 0x0006 },        // Shutdown
+    { eSO_Controlword, 0x000F },        // Switch On
+    
+    { eSO_None, 0 }     // List end marker
+};
+
+const SDOCommand CANMotorController::INTERPOLATED_POSITION_CONTROL_SETUP_COMMANDS[] = {
+    { eSO_ModeOfOperation, 7 },         // Use interpolated position mode
+    { eSO_InterpolationSubMode, (U32)-1 },      // Interpolate between PVT points
+    { eSO_InterpolationBufferClear, 0 },        // Clear the buffer and disable access
+    { eSO_InterpolationBufferClear, 1 },        // Enable access to the buffer
+    
+    // Map the Interpolation Data Record into RPDO 1 so that each RPDO adds
+    // a PVT point to the buffer as soon as it arrives
+    { eSO_RPDO1NumMappedObjects, 0 },               // Disable PDO whilst mapping
+    { eSO_RPDO1MappedObject1, 0x20C10040 },         // Interpolation Data Record
+    { eSO_RPDO1NumMappedObjects, 1 },               // Reenable PDO
+    { eSO_RPDO1TransmissionType, 255 },             // Asynchronous transfer
+    
+    { eSO_Controlword, 0x0006 },        // Shutdown
+    { eSO_Controlword, 0x000F },        // Switch On
+    
+    { eSO_None, 0 }     // List end marker
+};
+
+const SDOCommand CANMotorController::VELOCITY_CONTROL_SETUP_COMMANDS[] = {
+    { eSO_ModeOfOperation, 3 },         // Use profile velocity mode
+    { eSO_ProfileAcceleration, 10000 },     // In rpm/s
+    { eSO_ProfileDeceleration, 10000 },
+    { eSO_MotionProfileType, 1 },       // Use a sinusoidal profile
+    { eSO_TargetVelocity, 0 },          // Stay still once enabled
+    
+    // Map Target Velocity into RPDO 1. The node starts to change speed as
+    // soon as it has the new value, so no controlword or SYNC is needed.
+    { eSO_RPDO1NumMappedObjects, 0 },               // Disable PDO whilst mapping
+    { eSO_RPDO1MappedObject1, 0x60FF0020 },         // Target Velocity
+    { eSO_RPDO1NumMappedObjects, 1 },               // Reenable PDO
+    { eSO_RPDO1TransmissionType, 255 },             // Asynchronous transfer
+    
+    { eSO_Controlword, 0x0006 },        // Shutdown
+    { eSO_Controlword, 0x000F },        // Switch On
+    
+    { eSO_None, 0 }     // List end marker
+};
+
+const SDOCommand CANMotorController::CURRENT_CONTROL_SETUP_COMMANDS[] = {
+    { eSO_ModeOfOperation, (U32)-3 },   // Use current mode
+    { eSO_CurrentModeSettingValue, 0 },     // No current once enabled
+    
+    // Map Current Mode Setting Value into RPDO 1
+    { eSO_RPDO1NumMappedObjects, 0 },               // Disable PDO whilst mapping
+    { eSO_RPDO1MappedObject1, 0x20300010 },         // Current Mode Setting Value
+    { eSO_RPDO1NumMappedObjects, 1 },               // Reenable PDO
+    { eSO_RPDO1TransmissionType, 255 },             // Asynchronous transfer
     
-    SDOField( SDOField::eT_Invalid, "LIST END MARKER", 0, 0 )
+    { eSO_Controlword, 0x0006 },        // Shutdown
+    { eSO_Controlword, 0x000F },        // Switch On
+    
+    { eSO_None, 0 }     // List end marker
+};
+
+const SDOCommand CANMotorController::FAULT_RESET_COMMANDS[] = {
+    { eSO_Controlword, 0x0080 },        // Reset
+    { eSO_Controlword, 0x0006 },        // Shutdown
+    { eSO_Controlword, 0x000F },        // Switch On
+    
+    { eSO_None, 0 }     // List end marker
 };
 
-const SDOField CANMotorController::FAULT_RESET_COMMANDS[] = {
-    SDOField::CreateWrite_U16( "Controlword", 0x6040, 0, 0x0080 ),      // Reset
-    SDOField::CreateWrite_U16( "Controlword", 0x6040, 0, 0x0006 ),      // Shutdown
-    SDOField::CreateWrite_U16( "Controlword", 0x6040, 0, 0x000F ),      // Switch On
+const SDOCommand CANMotorController::START_INTERPOLATION_COMMANDS[] = {
+    { eSO_Controlword, 0x001F },        // Enable IP mode
     
-    SDOField( SDOField::eT_Invalid, "LIST END MARKER", 0, 0 )
+    { eSO_None, 0 }     // List end marker
+};
+
+const SDOCommand CANMotorController::STOP_INTERPOLATION_COMMANDS[] = {
+    { eSO_Controlword, 0x000F },        // Disable IP mode
+    { eSO_InterpolationBufferClear, 0 },        // Throw away any points left
+    { eSO_InterpolationBufferClear, 1 },
+    
+    { eSO_None, 0 }     // List end marker
 };
 
 //------------------------------------------------------------------------------
@@ -38,17 +165,44 @@ CANMotorController::CANMotorController()
     // Fill in command buffers
     
     // Set desired angle
-    mSetDesiredAngleCommands[ 0 ] = SDOField::CreateWrite_S32( "Target Position", 0x607A, 0, 0 );
-    mSetDesiredAngleCommands[ 1 ] = SDOField::CreateWrite_U16( "Controlword", 0x6040, 0, 0x003F );  // Start positioning
-    mSetDesiredAngleCommands[ 2 ] = SDOField( SDOField::eT_Invalid, "LIST END MARKER", 0, 0 );
+    mSetDesiredAngleCommands[ 0 ].mObject = eSO_TargetPosition;
+    mSetDesiredAngleCommands[ 0 ].mData = 0;
+    mSetDesiredAngleCommands[ 1 ].mObject = eSO_Controlword;
+    mSetDesiredAngleCommands[ 1 ].mData = 0x003F;   // Start positioning
+    mSetDesiredAngleCommands[ 2 ].mObject = eSO_None;
+    mSetDesiredAngleCommands[ 2 ].mData = 0;
 
     // Set profile velocity
-    mSetProfileVelocityCommands[ 0 ] = SDOField::CreateWrite_U32( "Profile Velocity", 0x6081, 0, 500 ),
-    mSetProfileVelocityCommands[ 1 ] = SDOField( SDOField::eT_Invalid, "LIST END MARKER", 0, 0 );
+    mSetProfileVelocityCommands[ 0 ].mObject = eSO_ProfileVelocity;
+    mSetProfileVelocityCommands[ 0 ].mData = 500;
+    mSetProfileVelocityCommands[ 1 ].mObject = eSO_None;
+    mSetProfileVelocityCommands[ 1 ].mData = 0;
 
     // Set maximum following error
-    mSetMaxFollowingErrorCommands[ 0 ] = SDOField::CreateWrite_U32( "Maximum Following Error", 0x6065, 0, 2000 ),
-    mSetMaxFollowingErrorCommands[ 1 ] = SDOField( SDOField::eT_Invalid, "LIST END MARKER", 0, 0 );
+    mSetMaxFollowingErrorCommands[ 0 ].mObject = eSO_MaximumFollowingError;
+    mSetMaxFollowingErrorCommands[ 0 ].mData = 2000;
+    mSetMaxFollowingErrorCommands[ 1 ].mObject = eSO_None;
+    mSetMaxFollowingErrorCommands[ 1 ].mData = 0;
+    
+    // Store configuration
+    mStoreConfigurationCommands[ 0 ].mObject = eSO_CustomerStorage;
+    mStoreConfigurationCommands[ 0 ].mData = 0;     // Configuration fingerprint
+    mStoreConfigurationCommands[ 1 ].mObject = eSO_StoreParameters;
+    mStoreConfigurationCommands[ 1 ].mData = SDO_STORE_PARAMETERS_SIGNATURE;
+    mStoreConfigurationCommands[ 2 ].mObject = eSO_None;
+    mStoreConfigurationCommands[ 2 ].mData = 0;
+    
+    // Set desired velocity
+    mSetDesiredVelocityCommands[ 0 ].mObject = eSO_TargetVelocity;
+    mSetDesiredVelocityCommands[ 0 ].mData = 0;
+    mSetDesiredVelocityCommands[ 1 ].mObject = eSO_None;
+    mSetDesiredVelocityCommands[ 1 ].mData = 0;
+    
+    // Set desired current
+    mSetDesiredCurrentCommands[ 0 ].mObject = eSO_CurrentModeSettingValue;
+    mSetDesiredCurrentCommands[ 0 ].mData = 0;
+    mSetDesiredCurrentCommands[ 1 ].mObject = eSO_None;
+    mSetDesiredCurrentCommands[ 1 ].mData = 0;
 }
 
 //------------------------------------------------------------------------------
@@ -69,28 +223,68 @@ bool CANMotorController::Init( CANChannel* pOwner, U8 nodeId )
         mNodeId = nodeId;
     
         mLastKnownNMTState = eNMTS_Unknown;
-        mSdoReadState = eSCS_Inactive;
-        mSdoWriteState = eSCS_Inactive;
-        mpActiveSdoReadField = NULL;
+        mNumActiveSdoWrites = 0;
+        mNumSdoReadsQueued = 0;
+        mNumSdoReadsCompleted = 0;
+        memset( (void*)mbSdoReadActive, 0, sizeof( mbSdoReadActive ) );
         mState = eS_Inactive;
+        mbSetUpStarted = false;
         mConfiguration = eC_None;
         mpConfigurationSetupCommands = NULL;
+        mCurConfigurationSetupCommandIdx = 0;
+        mConfigurationMode = eCM_WriteAll;
+        mbReconfigurationRequested = false;
+        mbConfigurationRestartRequested = false;
+        mbReadingConfiguration = false;
+        mCurConfigurationReadCommandIdx = 0;
+        mMismatchedConfigurationGroups = 0;
+        memset( &mConfigurationStats, 0, sizeof( mConfigurationStats ) );
+        mbConfigurationReadRetryRequested = false;
+        mConfigurationReadRetryCommandIdx = 0;
+        mNumConfigurationReadRetries = 0;
+        mbVerifyingStoredConfiguration = false;
+        mbConfigurationFingerprintReadQueued = false;
+        mbConfigurationStoreRequired = false;
+        mbStoreConfigurationRequested = false;
+        mConfigurationFingerprint = 0;
         mRunningTask = eRT_None;
         mpRunningTaskCommands = NULL;
         mbPresent = false;
         mbAngleValid = false;
         mbStatusValid = false;
-        mLastStatusPollFrameIdx = 0;
+        mbStatusReceived = false;
+        mbStatusRefreshRequested = false;
+        mbAngleRefreshRequested = false;
+        mLastStatusTimeUS = 0;
+        
+        mFeedbackMode = eFM_SDOPolling;
+        mbNMTStartRequired = false;
+        mbTPDOReceived = false;
+        mbTPDOArrived = false;
+        mLastTPDOTimeUS = 0;
+        mLastAnglePollTimeUS = 0;
+        
+        mSetpointMode = eSM_SDO;
+        mbRPDONewSetpointBitSet = false;
+        mRPDOTargetAngle = 0;
         
         mbFaultResetRequested = false;
-        mbNewDesiredAngleRequested = false;
         mbNewProfileVelocityRequested = false;
         mbNewMaximumFollowingErrorRequested = false;
+        ResetSetpointTracker( &mDesiredAngle );
+        ResetSetpointTracker( &mDesiredVelocity );
+        ResetSetpointTracker( &mDesiredCurrent );
+        memset( &mSetpointFilter, 0, sizeof( mSetpointFilter ) );
+        memset( &mSetpointStats, 0, sizeof( mSetpointStats ) );
         
-        mReadAction = SDOField( SDOField::eT_Read, 
-            "Position Actual", 0x6064, 0, HandleSDOReadComplete, this );
-        mReadStatusAction = SDOField( SDOField::eT_Read, 
-            "Statusword", 0x6041, 0, HandleSDOReadComplete, this );
+        mNumTrajectoryPointsQueued = 0;
+        mNumTrajectoryPointsSent = 0;
+        mNumTrajectoryPointsReached = 0;
+        mbInterpolationActive = false;
+        mbInterpolationSeenActive = false;
+        mbStartInterpolationRequested = false;
+        mbStopInterpolationRequested = false;
+        mNextTrajectoryPointTimeUS = 0;
         
         mbInitialised = true;
     }
@@ -101,9 +295,10 @@ bool CANMotorController::Init( CANChannel* pOwner, U8 nodeId )
 //------------------------------------------------------------------------------
 void CANMotorController::Deinit()
 {
-    mpActiveSdoReadField = NULL;
-    mSdoReadState = eSCS_Inactive;
-    mSdoWriteState = eSCS_Inactive;
+    mNumActiveSdoWrites = 0;
+    mNumSdoReadsQueued = 0;
+    mNumSdoReadsCompleted = 0;
+    memset( (void*)mbSdoReadActive, 0, sizeof( mbSdoReadActive ) );
     mLastKnownNMTState = eNMTS_Unknown;
     mbInitialised = false;
 }
@@ -111,19 +306,29 @@ void CANMotorController::Deinit()
 //------------------------------------------------------------------------------
 void CANMotorController::Update( S32 frameIdx )
 {
-    static U16 oldStatusWord = 0;
-    if ( mbStatusValid && 3 == mNodeId )
-        //&& ( ( mEposStatusword & 0x0008 ) ) ) //|| 3 == mNodeId ) )
+    if ( mbPresent )
     {
-        if ( oldStatusWord != mEposStatusword )
+        if ( mbReconfigurationRequested )
+        {
+            // The node has rebooted so it may have lost its configuration
+            mbReconfigurationRequested = false;
+            if ( eS_SettingUp == mState || eS_Running == mState )
+            {
+                RequestConfigurationRestart();
+            }
+        }
+        
+        if ( mbConfigurationRestartRequested )
         {
-            printf( "Node %i status is 0x%X\n", mNodeId, mEposStatusword );
-            oldStatusWord = mEposStatusword;
+            if ( 0 != mNumActiveSdoWrites )
+            {
+                // Wait for the outstanding writes to complete
+                return;
+            }
+            
+            StartConfiguration();
         }
-    }
-    
-    if ( mbPresent )
-    {
+        
         /*if ( GetNodeId() == 15 )
         {
             switch ( mState )
@@ -156,36 +361,65 @@ void CANMotorController::Update( S32 frameIdx )
             {
                 if ( eC_None != mConfiguration )
                 {
-                    mState = eS_SettingUp;
+                    StartConfiguration();
                 }
                 
                 break;
             }
             case eS_SettingUp:
             {
-                // Process the current SDO write
-                const SDOField* pCurCommand = &mpConfigurationSetupCommands[ mCurConfigurationSetupCommandIdx ];
-                if ( SDOField::eT_Invalid != pCurCommand->mType )
+                // The channel limits how many nodes set up at once
+                if ( !mbSetUpStarted )
+                {
+                    if ( !mpOwner->TryStartNodeSetUp() )
+                    {
+                        break;
+                    }
+                    
+                    mbSetUpStarted = true;
+                }
+                
+                if ( mbReadingConfiguration )
                 {
-                    if ( ProcessSDOWrite( *pCurCommand ) )
+                    if ( !QueueConfigurationReads() )
                     {
-                        mCurConfigurationSetupCommandIdx++;
-                        pCurCommand = &mpConfigurationSetupCommands[ mCurConfigurationSetupCommandIdx ];
+                        // Wait for the reads to complete before writing
+                        break;
                     }
+                    
+                    mbReadingConfiguration = false;
                 }
                 
-                if ( SDOField::eT_Invalid == pCurCommand->mType
-                    && eSCS_Inactive == mSdoWriteState )
+                // Top up the writes queued with the CAN Open library
+                QueueConfigurationSetupWrites();
+                
+                const SDOCommand* pCurCommand = &GetConfigurationCommand( mCurConfigurationSetupCommandIdx );
+                if ( eSO_None == pCurCommand->mObject
+                    && 0 == mNumActiveSdoWrites )
                 {
                     // All setup commands have been sent and received
                     
                     // Switch to the Running state
                     mbFaultResetRequested = false;
-                    mbNewDesiredAngleRequested = false;
                     mbNewProfileVelocityRequested = false;
                     mbNewMaximumFollowingErrorRequested = false;
+                    ResetSetpointTracker( &mDesiredAngle );
+                    ResetSetpointTracker( &mDesiredVelocity );
+                    ResetSetpointTracker( &mDesiredCurrent );
+                    mbStoreConfigurationRequested = mbConfigurationStoreRequired;
+                    mbConfigurationStoreRequired = false;
                     mRunningTask = eRT_None;
                     mState = eS_Running;
+                    
+                    mbSetUpStarted = false;
+                    mpOwner->OnNodeSetUpFinished();
+                    
+                    // PDOs are only processed by Operational nodes, so nodes
+                    // which don't use them are left PreOperational
+                    mbNMTStartRequired = COI_ArePDOsSupported()
+                        && ( eFM_TPDO == mFeedbackMode || eSM_RPDO == mSetpointMode
+                            || eC_InterpolatedPositionControl == mConfiguration );
+                    mbRPDONewSetpointBitSet = false;
                 }
                 break;
             }
@@ -202,9 +436,32 @@ void CANMotorController::Update( S32 frameIdx )
                         mbFaultResetRequested = false;
                         mRunningTask = eRT_SendFaultReset;
                     }
+                    else if ( mbStoreConfigurationRequested )
+                    {
+                        mStoreConfigurationCommands[ 0 ].mData = mConfigurationFingerprint;
+                        mpRunningTaskCommands = mStoreConfigurationCommands;
+                        mCurRunningTaskCommandIdx = 0;
+                        mbStoreConfigurationRequested = false;
+                        mRunningTask = eRT_StoreConfiguration;
+                        AtomicIncrement( &mConfigurationStats.mNumStores );
+                    }
+                    else if ( mbStopInterpolationRequested )
+                    {
+                        mpRunningTaskCommands = STOP_INTERPOLATION_COMMANDS;
+                        mCurRunningTaskCommandIdx = 0;
+                        mbStopInterpolationRequested = false;
+                        mRunningTask = eRT_StopInterpolation;
+                    }
+                    else if ( mbStartInterpolationRequested )
+                    {
+                        mpRunningTaskCommands = START_INTERPOLATION_COMMANDS;
+                        mCurRunningTaskCommandIdx = 0;
+                        mbStartInterpolationRequested = false;
+                        mRunningTask = eRT_StartInterpolation;
+                    }
                     else if ( mbNewProfileVelocityRequested )
                     {
-                        mSetProfileVelocityCommands[ 0 ].SetU32( mNewProfileVelocity );
+                        mSetProfileVelocityCommands[ 0 ].mData = mNewProfileVelocity;
                         mpRunningTaskCommands = mSetProfileVelocityCommands;
                         mCurRunningTaskCommandIdx = 0;
                         mbNewProfileVelocityRequested = false;
@@ -212,18 +469,37 @@ void CANMotorController::Update( S32 frameIdx )
                     }
                     else if ( mbNewMaximumFollowingErrorRequested )
                     {
-                        mSetMaxFollowingErrorCommands[ 0 ].SetU32( mNewMaximumFollowingError );
+                        mSetMaxFollowingErrorCommands[ 0 ].mData = mNewMaximumFollowingError;
                         mpRunningTaskCommands = mSetMaxFollowingErrorCommands;
                         mCurRunningTaskCommandIdx = 0;
                         mbNewMaximumFollowingErrorRequested = false;
                         mRunningTask = eRT_SetMaximumFollowingError;
                     }
-                    else if ( mbNewDesiredAngleRequested )
+                    else if ( IsSetpointDue( mDesiredVelocity )
+                        && !IsUsingRPDOSetpoints() )
                     {
-                        mSetDesiredAngleCommands[ 0 ].SetS32( mNewDesiredAngle );
+                        mSetDesiredVelocityCommands[ 0 ].mData = (U32)mDesiredVelocity.mNewValue;
+                        mpRunningTaskCommands = mSetDesiredVelocityCommands;
+                        mCurRunningTaskCommandIdx = 0;
+                        OnSetpointSent( &mDesiredVelocity );
+                        mRunningTask = eRT_SetDesiredVelocity;
+                    }
+                    else if ( IsSetpointDue( mDesiredCurrent )
+                        && !IsUsingRPDOSetpoints() )
+                    {
+                        mSetDesiredCurrentCommands[ 0 ].mData = (U32)mDesiredCurrent.mNewValue;
+                        mpRunningTaskCommands = mSetDesiredCurrentCommands;
+                        mCurRunningTaskCommandIdx = 0;
+                        OnSetpointSent( &mDesiredCurrent );
+                        mRunningTask = eRT_SetDesiredCurrent;
+                    }
+                    else if ( IsSetpointDue( mDesiredAngle )
+                        && !IsUsingRPDOSetpoints() )   // RPDO setpoints are sent by ProcessRPDOSetpoint
+                    {
+                        mSetDesiredAngleCommands[ 0 ].mData = (U32)mDesiredAngle.mNewValue;
                         mpRunningTaskCommands = mSetDesiredAngleCommands;
                         mCurRunningTaskCommandIdx = 0;
-                        mbNewDesiredAngleRequested = false;
+                        OnSetpointSent( &mDesiredAngle );
                         mRunningTask = eRT_SetDesiredAngle;
                     }
                 }
@@ -239,10 +515,15 @@ void CANMotorController::Update( S32 frameIdx )
                     case eRT_SendFaultReset:
                     case eRT_SetProfileVelocity:
                     case eRT_SetMaximumFollowingError:
+                    case eRT_StoreConfiguration:
+                    case eRT_StartInterpolation:
+                    case eRT_StopInterpolation:
+                    case eRT_SetDesiredVelocity:
+                    case eRT_SetDesiredCurrent:
                     {
                         // Process the current SDO write
-                        const SDOField* pCurCommand = &mpRunningTaskCommands[ mCurRunningTaskCommandIdx ];                        
-                        if ( SDOField::eT_Invalid != pCurCommand->mType )
+                        const SDOCommand* pCurCommand = &mpRunningTaskCommands[ mCurRunningTaskCommandIdx ];                        
+                        if ( eSO_None != pCurCommand->mObject )
                         {
                             if ( ProcessSDOWrite( *pCurCommand ) )
                             {
@@ -253,8 +534,8 @@ void CANMotorController::Update( S32 frameIdx )
                             }
                         }
                         
-                        if ( SDOField::eT_Invalid == pCurCommand->mType
-                            && eSCS_Inactive == mSdoWriteState )
+                        if ( eSO_None == pCurCommand->mObject
+                            && 0 == mNumActiveSdoWrites )
                         {
 //                             if ( eRT_SetDesiredAngle == mRunningTask )
 //                             {
@@ -262,6 +543,17 @@ void CANMotorController::Update( S32 frameIdx )
 //                             }
                             
                             // All commands have been sent and received
+                            if ( eRT_StartInterpolation == mRunningTask )
+                            {
+                                OnInterpolationStarted();
+                            }
+                            else if ( eRT_SendFaultReset == mRunningTask )
+                            {
+                                // Nodes being polled with SDO reads don't
+                                // send a TPDO when the fault clears
+                                mbStatusRefreshRequested = true;
+                            }
+                            
                             mRunningTask = eRT_None;
                         }
                         break;
@@ -272,6 +564,9 @@ void CANMotorController::Update( S32 frameIdx )
                     }
                     
                 }
+                
+                ProcessTrajectory();
+                CheckRPDOAngleReached();
                 break;
             }
             case eS_Homing:
@@ -284,59 +579,65 @@ void CANMotorController::Update( S32 frameIdx )
             }
         }
         
+        if ( mbNMTStartRequired )
+        {
+            if ( mpOwner->QueueNMTStartNode( mNodeId ) )
+            {
+                mbNMTStartRequired = false;
+            }
+        }
+        
         if ( eS_Running == mState || eS_Homing == mState )
         {
-            // Handle communications that poll for information
-            switch ( mSdoReadState )
+            // Poll for information. Status and angle reads can be
+            // outstanding at the same time, but each is only polled for
+            // once the previous read of it has completed. Whilst other nodes
+            // are setting up the bus is left to them, and only values which
+            // have never been read are polled for.
+            bool bPollingDeferred = mpOwner->IsPollingDeferred();
+            
+            // Changes to the Statusword normally arrive in TPDO 1, or are
+            // read after an emergency message, so the watchdog is only a
+            // backup for when those have been lost
+            U64 updateTimeUS = mpOwner->GetUpdateTimeUS();
+            if ( mbStatusReceived )
             {
-                case eSCS_Inactive:
-                {
-                    assert( NULL == mpActiveSdoReadField );
-                    
-                    // We can poll for either position or status
-                    if ( !mbStatusValid
-                        || ( frameIdx - mLastStatusPollFrameIdx > 100 ) )    // Poll for status periodically TODO: Make this nicer
-                    {
-                        mpActiveSdoReadField = &mReadStatusAction;
-                        mSdoReadState =  eSCS_Active;
-                        if ( COI_ProcessSDOField( mpOwner, mNodeId, mReadStatusAction ) )
-                        {
-                            mLastStatusPollFrameIdx = frameIdx;
-                        }
-                        else
-                        {
-                            // Reset
-                            mpActiveSdoReadField = NULL;
-                            mSdoReadState = eSCS_Inactive;
-                        }
-                    }
-                    else
-                    {
-                        // Poll for angle
-                        mpActiveSdoReadField = &mReadAction;
-                        mSdoReadState =  eSCS_Active;
-                        if ( COI_ProcessSDOField( mpOwner, mNodeId, mReadAction ) )
-                        {
-                            // Poll complete
-                        }
-                        else
-                        {
-                            // Reset
-                            mpActiveSdoReadField = NULL;
-                            mSdoReadState = eSCS_Inactive;
-                        }
-                    }
-                    
-                    break;
-                }
-                case eSCS_Active:
+                mbStatusReceived = false;
+                mLastStatusTimeUS = updateTimeUS;
+            }
+            if ( mbTPDOArrived )
+            {
+                mbTPDOArrived = false;
+                mLastTPDOTimeUS = updateTimeUS;
+            }
+            
+            U64 watchdogIntervalUS = (U64)mpOwner->GetStatusWatchdogInterval()*1000;
+            bool bStatusWatchdogExpired = ( 0 != watchdogIntervalUS
+                && updateTimeUS - mLastStatusTimeUS >= watchdogIntervalUS );
+            
+            if ( !mbSdoReadActive[ eSRT_Statusword ]
+                && ( !mbStatusValid
+                    || mbStatusRefreshRequested
+                    || ( !bPollingDeferred && bStatusWatchdogExpired ) ) )
+            {
+                if ( QueueSdoRead( eSRT_Statusword, eSO_Statusword ) )
                 {
-                    // Nothing to do
-                    break;
+                    mbStatusRefreshRequested = false;
                 }
-                default:
+            }
+            
+            if ( !mbSdoReadActive[ eSRT_Angle ]
+                && ( !mbAngleValid || !bPollingDeferred )
+                && ( eFM_SDOPolling == mFeedbackMode
+                    || !mbTPDOReceived
+                    || mbAngleRefreshRequested
+                    || ( updateTimeUS - mLastTPDOTimeUS > TPDO_SILENCE_POLL_INTERVAL_US
+                        && updateTimeUS - mLastAnglePollTimeUS > TPDO_SILENCE_POLL_INTERVAL_US ) ) )
+            {
+                if ( QueueSdoRead( eSRT_Angle, eSO_PositionActual ) )
                 {
-                    assert( false && "Unhandled communication state" );
+                    mbAngleRefreshRequested = false;
+                    mLastAnglePollTimeUS = updateTimeUS;
                 }
             }
         }
@@ -351,45 +652,294 @@ void CANMotorController::TellAboutNMTState( eNMT_State state )
         mLastKnownNMTState = state;
         if ( eNMTS_PreOperational == state )
         {
+            if ( mbPresent )
+            {
+                // The node has rebooted so its configuration must be checked
+                mbReconfigurationRequested = true;
+            }
+            
             mbPresent = true;
+            
+            // The node has (re)booted so it won't be sending TPDOs until
+            // it's made Operational again
+            mbTPDOReceived = false;
         }
     }
 }
 
 //------------------------------------------------------------------------------
-void CANMotorController::OnSDOFieldWriteComplete( S32 frameIdx )
+void CANMotorController::OnSDOFieldWriteComplete()
 {
-    assert( eSCS_Active == mSdoWriteState );
-       
-    mSdoWriteState = eSCS_Inactive;
+    assert( mNumActiveSdoWrites > 0 );
+    
+    // Only the count is changed here. Further writes are queued by the 
+    // update routine.
+    AtomicDecrement( &mNumActiveSdoWrites );
 }
 
 //------------------------------------------------------------------------------
 void CANMotorController::OnSDOFieldReadComplete( U8* pData, U32 numBytes )
 {
-    assert( eSCS_Active == mSdoReadState );
-    assert( mpActiveSdoReadField != NULL );
+    assert( mNumSdoReadsQueued != mNumSdoReadsCompleted );
+    if ( mNumSdoReadsQueued == mNumSdoReadsCompleted )
+    {
+        return;     // Not waiting for a read
+    }
+    
+    const QueuedSdoRead& read = 
+        mQueuedSdoReads[ mNumSdoReadsCompleted & ( MAX_NUM_QUEUED_SDO_READS - 1 ) ];
+    eSdoReadTarget target = (eSdoReadTarget)read.mTarget;
+    eSDODataType dataType = (eSDODataType)SDO_GetObjectDescriptor( 
+        (eSDOObject)read.mObject ).mDataType;
+    
+    U32 dataTypeNumBytes = SDO_GetDataTypeNumBytes( dataType );
+    if ( numBytes < dataTypeNumBytes )
+    {
+        // The reply is too short to decode, so the value is left as it was
+        // and the read is made again
+        OnShortSdoReadReply( read );
+    }
+    else
+    {
+        // Decode the little endian value, sign extending it if needed
+        U32 value = UnpackLittleEndian( pData, dataTypeNumBytes );
+        
+        if ( SDO_IsDataTypeSigned( dataType ) && dataTypeNumBytes < 4
+            && ( pData[ dataTypeNumBytes - 1 ] & 0x80 ) )
+        {
+            value |= 0xFFFFFFFF << ( 8*dataTypeNumBytes );
+        }
+        
+        switch ( target )
+        {
+            case eSRT_Angle:
+            {
+                mAngle = (S32)value;
+                mbAngleValid = true;
+                break;
+            }
+            case eSRT_Statusword:
+            {
+                mEposStatusword = (U16)value;
+                mbStatusValid = true;
+                mbStatusReceived = true;
+                break;
+            }
+            case eSRT_ConfigurationValue:
+            {
+                OnConfigurationValueRead( read.mCommandIdx, read.mGroupStartIdx, value );
+                mNumConfigurationReadRetries = 0;
+                break;
+            }
+            case eSRT_ConfigurationFingerprint:
+            {
+                OnConfigurationFingerprintRead( value );
+                mNumConfigurationReadRetries = 0;
+                break;
+            }
+            default:
+            {
+                assert( false && "Unhandled SDO read target" );
+            }
+        }
+    }
+    
+    // Let the update routine poll for the target again
+    mbSdoReadActive[ target ] = false;
+    AtomicMemoryBarrier();
+    AtomicIncrement( &mNumSdoReadsCompleted );
+}
+
+//------------------------------------------------------------------------------
+void CANMotorController::OnShortSdoReadReply( const QueuedSdoRead& read )
+{
+    // The flags set here are seen by the update routine before the read is
+    // removed from the ring
+    switch ( (eSdoReadTarget)read.mTarget )
+    {
+        case eSRT_Angle:
+        {
+            mbAngleRefreshRequested = true;
+            break;
+        }
+        case eSRT_Statusword:
+        {
+            mbStatusRefreshRequested = true;
+            break;
+        }
+        case eSRT_ConfigurationValue:
+        {
+            if ( mNumConfigurationReadRetries < MAX_NUM_CONFIGURATION_READ_RETRIES )
+            {
+                mNumConfigurationReadRetries++;
+                mConfigurationReadRetryCommandIdx = read.mGroupStartIdx;
+                AtomicMemoryBarrier();
+                mbConfigurationReadRetryRequested = true;
+            }
+            else
+            {
+                // Give up and write the group
+                mMismatchedConfigurationGroups |= ( (U64)1 << read.mGroupStartIdx );
+                mNumConfigurationReadRetries = 0;
+            }
+            break;
+        }
+        case eSRT_ConfigurationFingerprint:
+        {
+            if ( mNumConfigurationReadRetries < MAX_NUM_CONFIGURATION_READ_RETRIES )
+            {
+                mNumConfigurationReadRetries++;
+                mbConfigurationFingerprintReadQueued = false;
+            }
+            else
+            {
+                // Give up and write and store the whole configuration
+                mbConfigurationStoreRequired = true;
+                mNumConfigurationReadRetries = 0;
+            }
+            break;
+        }
+        default:
+        {
+            assert( false && "Unhandled SDO read target" );
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+void CANMotorController::OnTPDOReceived( U8* pData, U32 numBytes )
+{
+    // TPDO 1 contains Position Actual (S32) followed by Statusword (U16)
+    if ( numBytes < sizeof( S32 ) + sizeof( U16 ) )
+    {
+        return;
+    }
+    
+    mAngle = (S32)UnpackLittleEndian( &pData[ 0 ], sizeof( S32 ) );
+    mEposStatusword = (U16)UnpackLittleEndian( &pData[ sizeof( S32 ) ], sizeof( U16 ) );
+    mbAngleValid = true;
+    mbStatusValid = true;
+    mbStatusReceived = true;
+    
+    mbTPDOReceived = true;
+    mbTPDOArrived = true;
+}
+
+//------------------------------------------------------------------------------
+void CANMotorController::SetFeedbackMode( eFeedbackMode feedbackMode )
+{
+    mFeedbackMode = feedbackMode;
+    if ( eS_Running == mState && eFM_TPDO == feedbackMode && COI_ArePDOsSupported() )
+    {
+        // Make sure that the node is Operational so that it sends TPDOs
+        mbNMTStartRequired = true;
+    }
+}
+
+//------------------------------------------------------------------------------
+void CANMotorController::SetSetpointMode( eSetpointMode setpointMode )
+{
+    mSetpointMode = setpointMode;
+    if ( eS_Running == mState && eSM_RPDO == setpointMode && COI_ArePDOsSupported() )
+    {
+        // Make sure that the node is Operational so that it acts on RPDOs
+        mbNMTStartRequired = true;
+        mbRPDONewSetpointBitSet = false;
+    }
+}
+
+//------------------------------------------------------------------------------
+bool CANMotorController::ProcessRPDOSetpoint()
+{
+    bool bRPDOSent = false;
+    
+    if ( !mbPresent
+        || eS_Running != mState
+        || !IsUsingRPDOSetpoints() )
+    {
+        return false;
+    }
+    
+    // Velocities and currents are acted on as soon as they're written, so
+    // they're sent on their own in asynchronous RPDOs that need no SYNC
+    if ( eC_VelocityControl == mConfiguration
+        || eC_CurrentControl == mConfiguration )
+    {
+        SetpointTracker* pTracker = ( eC_VelocityControl == mConfiguration ? 
+            &mDesiredVelocity : &mDesiredCurrent );
+        if ( !IsSetpointDue( *pTracker ) )
+        {
+            // Nothing to send
+            return false;
+        }
+        
+        // A current is sent as the low 16 bits of the setpoint
+        U8 data[ VELOCITY_RPDO_NUM_BYTES ];
+        U8 numBytes = (U8)( eC_VelocityControl == mConfiguration ? 
+            VELOCITY_RPDO_NUM_BYTES : CURRENT_RPDO_NUM_BYTES );
+        PackLittleEndian( (U32)pTracker->mNewValue, data, numBytes );
+        
+        if ( mpOwner->QueuePDO( CANChannel::RPDO_1_COB_ID_BASE + mNodeId, data, numBytes ) )
+        {
+            OnSetpointSent( pTracker );
+        }
+        
+        return false;
+    }
+    
+    // A new setpoint is started by a rising edge on bit 4 of the controlword
+    // so after sending a setpoint, the following RPDO clears the bit again.
+    S32 targetAngle;
+    U16 controlword;
+    if ( mbRPDONewSetpointBitSet )
+    {
+        targetAngle = mRPDOTargetAngle;
+        controlword = 0x002F;
+    }
+    else if ( IsSetpointDue( mDesiredAngle ) )
+    {
+        targetAngle = mDesiredAngle.mNewValue;
+        controlword = 0x003F;   // Start positioning
+    }
+    else
+    {
+        // Nothing to send
+        return false;
+    }
+    
+    U8 data[ RPDO_1_NUM_BYTES ];
+    PackLittleEndian( (U32)targetAngle, &data[ 0 ], sizeof( S32 ) );
+    PackLittleEndian( controlword, &data[ sizeof( S32 ) ], sizeof( U16 ) );
     
-    memcpy( mpActiveSdoReadField->mData, pData, numBytes );
-    mpActiveSdoReadField->mReadCallback( *mpActiveSdoReadField );
+    if ( mpOwner->QueuePDO( CANChannel::RPDO_1_COB_ID_BASE + mNodeId, data, sizeof( data ) ) )
+    {
+        if ( mbRPDONewSetpointBitSet )
+        {
+            mbRPDONewSetpointBitSet = false;
+        }
+        else
+        {
+            mRPDOTargetAngle = targetAngle;
+            OnSetpointSent( &mDesiredAngle );
+            mbRPDONewSetpointBitSet = true;
+        }
+        
+        bRPDOSent = true;
+    }
     
-    mpActiveSdoReadField = NULL;
-    mSdoReadState = eSCS_Inactive;
+    return bRPDOSent;
 }
 
 //------------------------------------------------------------------------------
 void CANMotorController::SetDesiredAngle( S32 desiredAngle, S32 frameIdx )
 {
-    if ( (eRT_SetDesiredAngle == mRunningTask || mbNewDesiredAngleRequested)
-        && desiredAngle == mNewDesiredAngle )
+    if ( eC_PositionControl != mConfiguration )
     {
-        // We're already trying to set the desired angle so ignore the request
-        //printf( "Ignoring request\n" );
+        // Only position control moves to angles
         return;
     }
     
-    mNewDesiredAngle = desiredAngle;
-    mbNewDesiredAngleRequested = true;
+    RequestSetpoint( &mDesiredAngle, desiredAngle, mSetpointFilter.mAngleDeadband );
     //printf( "Got new angle of %i encoder ticks\n", desiredAngle );
 }
 
@@ -424,24 +974,62 @@ void CANMotorController::SetMaximumFollowingError( U32 maximumFollowingError )
 }
 
 //------------------------------------------------------------------------------
-void CANMotorController::SendFaultReset()
+void CANMotorController::SetDesiredVelocity( S32 desiredVelocity )
 {
-    mbFaultResetRequested = true;
+    if ( eC_VelocityControl != mConfiguration )
+    {
+        return;
+    }
+    
+    RequestSetpoint( &mDesiredVelocity, desiredVelocity, mSetpointFilter.mVelocityDeadband );
 }
 
 //------------------------------------------------------------------------------
-void CANMotorController::SetConfiguration( eConfiguration configuration )
+void CANMotorController::SetDesiredCurrent( S16 desiredCurrent )
 {
-    if ( eC_None != configuration 
-        && (eS_Inactive == mState || eS_Running == mState)  // Only want to debug a couple of states for now
-        && configuration != mConfiguration )
+    if ( eC_CurrentControl != mConfiguration )
     {
-        const SDOField* pConfigSetupCommands = NULL;
-        
-        if ( eC_PositionControl == configuration )
+        return;
+    }
+    
+    RequestSetpoint( &mDesiredCurrent, desiredCurrent, mSetpointFilter.mCurrentDeadband );
+}
+
+//------------------------------------------------------------------------------
+void CANMotorController::SendFaultReset()
+{
+    mbFaultResetRequested = true;
+    
+    // The node may no longer be at the last angle sent, so the same angle
+    // mustn't be dropped if it's given again
+    mDesiredAngle.mbSentValid = false;
+}
+
+//------------------------------------------------------------------------------
+void CANMotorController::SetConfiguration( eConfiguration configuration )
+{
+    if ( eC_None != configuration 
+        && (eS_Inactive == mState || eS_Running == mState)  // Only want to debug a couple of states for now
+        && configuration != mConfiguration )
+    {
+        const SDOCommand* pConfigSetupCommands = NULL;
+        
+        if ( eC_PositionControl == configuration )
         {
             pConfigSetupCommands = POSITION_CONTROL_SETUP_COMMANDS;
         }
+        else if ( eC_InterpolatedPositionControl == configuration )
+        {
+            pConfigSetupCommands = INTERPOLATED_POSITION_CONTROL_SETUP_COMMANDS;
+        }
+        else if ( eC_VelocityControl == configuration )
+        {
+            pConfigSetupCommands = VELOCITY_CONTROL_SETUP_COMMANDS;
+        }
+        else if ( eC_CurrentControl == configuration )
+        {
+            pConfigSetupCommands = CURRENT_CONTROL_SETUP_COMMANDS;
+        }
         
         if ( NULL == pConfigSetupCommands )
         {
@@ -449,83 +1037,628 @@ void CANMotorController::SetConfiguration( eConfiguration configuration )
             return;
         }
         
+        // The mask of mismatched groups has a bit for every command
+        S32 numModeCommands = 0;
+        while ( eSO_None != pConfigSetupCommands[ numModeCommands ].mObject )
+        {
+            numModeCommands++;
+        }
+        assert( NUM_TPDO1_FEEDBACK_COMMANDS + numModeCommands <= CONFIGURATION_ACTION_LIST_LENGTH );
+        
         mpConfigurationSetupCommands = pConfigSetupCommands;
         mCurConfigurationSetupCommandIdx = 0;
+        mConfigurationFingerprint = SDO_GetCommandListFingerprint( 
+            TPDO1_FEEDBACK_COMMANDS, pConfigSetupCommands );
         mConfiguration = configuration;
         
         if ( eS_Inactive != mState )
         {
             // We can start setting up straight away
-            mState = eS_SettingUp;
+            RequestConfigurationRestart();
         }
     }
 }
 
 //------------------------------------------------------------------------------
-bool CANMotorController::ProcessSDOWrite( const SDOField& sdoField, bool bDebug )
+void CANMotorController::SetConfigurationMode( eConfigurationMode configurationMode )
+{
+    mConfigurationMode = configurationMode;
+}
+
+//------------------------------------------------------------------------------
+void CANMotorController::GetConfigurationStats( ConfigurationStats* pStatsOut ) const
+{
+    AtomicMemoryBarrier();
+    memcpy( pStatsOut, &mConfigurationStats, sizeof( ConfigurationStats ) );
+}
+
+//------------------------------------------------------------------------------
+void CANMotorController::GetSetpointStats( SetpointStats* pStatsOut ) const
+{
+    AtomicMemoryBarrier();
+    memcpy( pStatsOut, &mSetpointStats, sizeof( SetpointStats ) );
+}
+
+//------------------------------------------------------------------------------
+void CANMotorController::ResetSetpointTracker( SetpointTracker* pTracker )
+{
+    pTracker->mbRequested = false;
+    pTracker->mbSentValid = false;
+    pTracker->mNewValue = 0;
+    pTracker->mSentValue = 0;
+    pTracker->mSentTimeUS = 0;
+}
+
+//------------------------------------------------------------------------------
+void CANMotorController::RequestSetpoint( SetpointTracker* pTracker, S32 value, U32 deadband )
 {
-    assert( SDOField::eT_Write == sdoField.mType );
+    mSetpointStats.mNumSetpointsGiven++;
     
-    bool bWriteComplete = false;
+    // The latest setpoint wins, so one that's still waiting to be sent is
+    // replaced
+    if ( pTracker->mbRequested )
+    {
+        pTracker->mbRequested = false;
+        mSetpointStats.mNumSetpointsCoalesced++;
+    }
     
-    switch ( mSdoWriteState )
+    if ( pTracker->mbSentValid )
     {
-        case eSCS_Inactive:
-        {   
-            bWriteComplete = true;
-            mSdoWriteState = eSCS_Active;
-            if ( COI_ProcessSDOField( mpOwner, mNodeId, sdoField ) )
-            {    
-                mSDOWriteFrameIdx = mpOwner->GetFrameIdx();
+        S64 difference = (S64)value - (S64)pTracker->mSentValue;
+        if ( difference <= (S64)deadband && difference >= -(S64)deadband )
+        {
+            // Close enough to what the node already has
+            mSetpointStats.mNumSetpointsSuppressed++;
+            return;
+        }
+    }
+    
+    pTracker->mNewValue = value;
+    pTracker->mbRequested = true;
+}
+
+//------------------------------------------------------------------------------
+bool CANMotorController::IsSetpointDue( const SetpointTracker& tracker ) const
+{
+    if ( !tracker.mbRequested )
+    {
+        return false;
+    }
+    
+    if ( !tracker.mbSentValid || 0 == mSetpointFilter.mMinResendIntervalMS )
+    {
+        return true;
+    }
+    
+    return mpOwner->GetUpdateTimeUS() - tracker.mSentTimeUS 
+        >= 1000*(U64)mSetpointFilter.mMinResendIntervalMS;
+}
+
+//------------------------------------------------------------------------------
+void CANMotorController::OnSetpointSent( SetpointTracker* pTracker )
+{
+    pTracker->mbRequested = false;
+    pTracker->mbSentValid = true;
+    pTracker->mSentValue = pTracker->mNewValue;
+    pTracker->mSentTimeUS = mpOwner->GetUpdateTimeUS();
+    mSetpointStats.mNumSetpointsSent++;
+}
+
+//------------------------------------------------------------------------------
+void CANMotorController::CheckRPDOAngleReached()
+{
+    // RPDO setpoints aren't confirmed, and a node can miss one if it's 
+    // replaced by the following RPDO before the SYNC arrives. If the node
+    // settles somewhere other than the last angle sent, the angle is no
+    // longer treated as sent, so it isn't dropped when it's given again.
+    if ( !IsUsingRPDOSetpoints()
+        || eC_PositionControl != mConfiguration
+        || !mDesiredAngle.mbSentValid
+        || mDesiredAngle.mbRequested
+        || mbRPDONewSetpointBitSet
+        || !IsAngleValid() || !IsStatusValid()
+        || !( mEposStatusword & STATUSWORD_TARGET_REACHED ) )
+    {
+        return;
+    }
+    
+    S64 error = (S64)mAngle - (S64)mDesiredAngle.mSentValue;
+    if ( error <= (S64)mSetpointFilter.mAngleDeadband 
+        && error >= -(S64)mSetpointFilter.mAngleDeadband )
+    {
+        return;
+    }
+    
+    if ( mpOwner->GetUpdateTimeUS() - mDesiredAngle.mSentTimeUS >= RPDO_SETPOINT_SETTLE_TIME_US )
+    {
+        mDesiredAngle.mbSentValid = false;
+    }
+}
+
+//------------------------------------------------------------------------------
+bool CANMotorController::IsUsingRPDOSetpoints() const
+{
+    // Setpoints go by SDO until the node has been made Operational, or 
+    // always if PDOs can't be sent. RPDO 1 carries trajectory points rather
+    // than setpoints in interpolated position control.
+    return ( eSM_RPDO == mSetpointMode && !mbNMTStartRequired 
+        && COI_ArePDOsSupported()
+        && eC_InterpolatedPositionControl != mConfiguration );
+}
+
+//------------------------------------------------------------------------------
+S32 CANMotorController::QueueTrajectoryPoints( const TrajectoryPoint* pPoints, S32 numPoints )
+{
+    U32 numPointsQueued = mNumTrajectoryPointsQueued;
+    S32 numPointsAdded = 0;
+    
+    while ( numPointsAdded < numPoints
+        && numPointsQueued - mNumTrajectoryPointsReached < TRAJECTORY_RING_LENGTH )
+    {
+        mTrajectoryPoints[ numPointsQueued & ( TRAJECTORY_RING_LENGTH - 1 ) ] = pPoints[ numPointsAdded ];
+        numPointsQueued++;
+        numPointsAdded++;
+    }
+    
+    // Make sure that the points are visible to the update routine before 
+    // the count is
+    AtomicMemoryBarrier();
+    mNumTrajectoryPointsQueued = numPointsQueued;
+    
+    return numPointsAdded;
+}
+
+//------------------------------------------------------------------------------
+void CANMotorController::PackTrajectoryPoint( const TrajectoryPoint& point, U8* pDataOut )
+{
+    // The velocity is truncated to its low 24 bits
+    PackLittleEndian( (U32)point.mPosition, &pDataOut[ 0 ], sizeof( S32 ) );
+    PackLittleEndian( (U32)point.mVelocity, &pDataOut[ sizeof( S32 ) ], 3 );
+    pDataOut[ 7 ] = point.mTimeMS;
+}
+
+//------------------------------------------------------------------------------
+TrajectoryPoint CANMotorController::UnpackTrajectoryPoint( const U8* pData )
+{
+    TrajectoryPoint point;
+    point.mPosition = (S32)UnpackLittleEndian( &pData[ 0 ], sizeof( S32 ) );
+    
+    // Sign extend the velocity
+    point.mVelocity = (S32)UnpackLittleEndian( &pData[ sizeof( S32 ) ], 3 );
+    if ( pData[ 6 ] & 0x80 )
+    {
+        point.mVelocity |= (S32)0xFF000000;
+    }
+    
+    point.mTimeMS = pData[ 7 ];
+    return point;
+}
+
+//------------------------------------------------------------------------------
+void CANMotorController::ProcessTrajectory()
+{
+    if ( eC_InterpolatedPositionControl != mConfiguration )
+    {
+        return;
+    }
+    
+    U32 numPointsQueued = mNumTrajectoryPointsQueued;
+    AtomicMemoryBarrier();      // Read the points after the count
+    
+    bool bStopping = ( mbStopInterpolationRequested || eRT_StopInterpolation == mRunningTask );
+    
+    if ( mbInterpolationActive )
+    {
+        // The node stops early if it has a fault, or if it ran out of 
+        // points before the host expected. Either way it drops IP Mode
+        // Active from its statusword.
+        bool bNodeStopped = false;
+        if ( mbStatusValid )
+        {
+            if ( mEposStatusword & STATUSWORD_IP_MODE_ACTIVE )
+            {
+                mbInterpolationSeenActive = true;
             }
-            else 
+            else if ( mbInterpolationSeenActive )
             {
-                // Reset
-                bWriteComplete = false;
-                mSdoWriteState = eSCS_Inactive;
-                
-                if ( bDebug )
-                {
-                    printf( "Couldn't send action\n" );
-                }
+                bNodeStopped = true;
+            }
+        }
+        
+        U64 timeUS = mpOwner->GetUpdateTimeUS();
+        while ( mNumTrajectoryPointsReached != mNumTrajectoryPointsSent
+            && ( timeUS >= mNextTrajectoryPointTimeUS || bNodeStopped ) )
+        {
+            AtomicIncrement( &mNumTrajectoryPointsReached );
+            if ( mNumTrajectoryPointsReached != mNumTrajectoryPointsSent )
+            {
+                const TrajectoryPoint& point = 
+                    mTrajectoryPoints[ mNumTrajectoryPointsReached & ( TRAJECTORY_RING_LENGTH - 1 ) ];
+                mNextTrajectoryPointTimeUS += 1000*(U64)point.mTimeMS;
+            }
+        }
+        
+        if ( mNumTrajectoryPointsReached == mNumTrajectoryPointsSent )
+        {
+            // The buffer of the node is empty. IP mode is disabled so that
+            // the next points start it again with a rising edge, and the
+            // buffer is cleared in case the node stopped with points left.
+            mbInterpolationActive = false;
+            mbStopInterpolationRequested = true;
+            bStopping = true;
+        }
+    }
+    
+    // Top up the buffer of the node. Nothing is sent whilst stopping as
+    // the buffer is about to be cleared.
+    if ( !bStopping && !mbNMTStartRequired )
+    {
+        U32 numPointsSent = 0;
+        while ( mNumTrajectoryPointsSent != numPointsQueued
+            && mNumTrajectoryPointsSent - mNumTrajectoryPointsReached < MAX_NUM_TRAJECTORY_POINTS_ON_NODE
+            && numPointsSent < MAX_NUM_TRAJECTORY_POINTS_SENT_PER_UPDATE )
+        {
+            const TrajectoryPoint& point = 
+                mTrajectoryPoints[ mNumTrajectoryPointsSent & ( TRAJECTORY_RING_LENGTH - 1 ) ];
+            
+            U8 data[ PVT_RPDO_NUM_BYTES ];
+            PackTrajectoryPoint( point, data );
+            
+            if ( !mpOwner->QueuePDO( CANChannel::RPDO_1_COB_ID_BASE + mNodeId, data, sizeof( data ) ) )
+            {
+                break;
             }
             
+            mNumTrajectoryPointsSent++;
+            numPointsSent++;
+        }
+    }
+    
+    // Start once there are enough points buffered to keep the node busy
+    // whilst it's topped up, or once all of the points have been sent
+    U32 numPointsOnNode = mNumTrajectoryPointsSent - mNumTrajectoryPointsReached;
+    if ( !mbInterpolationActive 
+        && !bStopping
+        && !mbStartInterpolationRequested
+        && eRT_StartInterpolation != mRunningTask
+        && numPointsOnNode > 0
+        && ( numPointsOnNode >= MIN_NUM_TRAJECTORY_POINTS_TO_START
+            || mNumTrajectoryPointsSent == numPointsQueued ) )
+    {
+        mbStartInterpolationRequested = true;
+    }
+}
+
+//------------------------------------------------------------------------------
+void CANMotorController::OnInterpolationStarted()
+{
+    // The node started moving towards the first point in its buffer before
+    // its write was acknowledged, so the points are judged to be reached
+    // slightly later than they really are
+    const TrajectoryPoint& point = 
+        mTrajectoryPoints[ mNumTrajectoryPointsReached & ( TRAJECTORY_RING_LENGTH - 1 ) ];
+    mNextTrajectoryPointTimeUS = mpOwner->GetUpdateTimeUS() + 1000*(U64)point.mTimeMS;
+    mbInterpolationActive = true;
+    mbInterpolationSeenActive = false;
+}
+
+//------------------------------------------------------------------------------
+bool CANMotorController::ProcessSDOWrite( const SDOCommand& command, bool bDebug )
+{
+    assert( eSO_None != command.mObject );
+    
+    bool bWriteComplete = false;
+    
+    if ( 0 == mNumActiveSdoWrites )
+    {
+        // Count the write before it's queued as the completion callback
+        // may arrive before ProcessSDOField returns
+        AtomicIncrement( &mNumActiveSdoWrites );
+        if ( mpOwner->ProcessSDOField( mNodeId, SDOField::CreateWrite( command ) ) )
+        {    
+            bWriteComplete = true;
+        }
+        else 
+        {
+            // Reset
+            AtomicDecrement( &mNumActiveSdoWrites );
+            
+            if ( bDebug )
+            {
+                printf( "Couldn't send action\n" );
+            }
+        }
+    }
+    
+    return bWriteComplete;
+}
+
+//------------------------------------------------------------------------------
+void CANMotorController::QueueConfigurationSetupWrites()
+{
+    while ( mNumActiveSdoWrites < MAX_NUM_QUEUED_SDO_WRITES )
+    {
+        while ( eSO_None != GetConfigurationCommand( mCurConfigurationSetupCommandIdx ).mObject
+            && !IsConfigurationWriteNeeded( mCurConfigurationSetupCommandIdx ) )
+        {
+            mCurConfigurationSetupCommandIdx++;
+            AtomicIncrement( &mConfigurationStats.mNumWritesSkipped );
+        }
+        
+        if ( eSO_None == GetConfigurationCommand( mCurConfigurationSetupCommandIdx ).mObject )
+        {
             break;
         }
-        case eSCS_Active:
+        
+        const SDOCommand& command = GetConfigurationCommand( mCurConfigurationSetupCommandIdx );
+        
+        // Count the write before it's queued as the completion callback
+        // may arrive before ProcessSDOField returns
+        AtomicIncrement( &mNumActiveSdoWrites );
+        
+        if ( !mpOwner->ProcessSDOField( mNodeId, SDOField::CreateWrite( command ) ) )
         {
-            // Already performing an SDO write so wait
+            // The CAN Open library is full, try again later
+            AtomicDecrement( &mNumActiveSdoWrites );
             break;
         }
-        default:
+        
+        mCurConfigurationSetupCommandIdx++;
+        AtomicIncrement( &mConfigurationStats.mNumWrites );
+    }
+}
+
+//------------------------------------------------------------------------------
+void CANMotorController::StartConfiguration()
+{
+    mCurConfigurationSetupCommandIdx = 0;
+    mCurConfigurationReadCommandIdx = 0;
+    AtomicIncrement( &mConfigurationStats.mNumConfigurations );
+    mbConfigurationRestartRequested = false;
+    mbVerifyingStoredConfiguration = false;
+    mbConfigurationStoreRequired = false;
+    mbConfigurationReadRetryRequested = false;
+    mNumConfigurationReadRetries = 0;
+    
+    // The configuration clears the buffer of the node, so any points that 
+    // the node hasn't reached are sent again
+    mNumTrajectoryPointsSent = mNumTrajectoryPointsReached;
+    mbInterpolationActive = false;
+    mbStartInterpolationRequested = false;
+    mbStopInterpolationRequested = false;
+    
+    if ( eCM_Differential == mConfigurationMode )
+    {
+        mMismatchedConfigurationGroups = 0;
+        mbReadingConfiguration = true;
+    }
+    else if ( eCM_Stored == mConfigurationMode )
+    {
+        // Everything is written unless the fingerprint matches
+        mMismatchedConfigurationGroups = ~(U64)0;
+        mbReadingConfiguration = true;
+        mbVerifyingStoredConfiguration = true;
+        mbConfigurationFingerprintReadQueued = false;
+    }
+    else
+    {
+        // Treat every group as differing so that everything is written
+        mMismatchedConfigurationGroups = ~(U64)0;
+        mbReadingConfiguration = false;
+    }
+    
+    mState = eS_SettingUp;
+}
+
+//------------------------------------------------------------------------------
+void CANMotorController::RequestConfigurationRestart()
+{
+    // Writes from the old configuration that are still outstanding have to
+    // complete before the new configuration starts, so that they aren't
+    // counted against it
+    if ( 0 == mNumActiveSdoWrites )
+    {
+        StartConfiguration();
+    }
+    else
+    {
+        // The node is shown as setting up straight away, but nothing more 
+        // is sent to it until the writes have completed
+        mState = eS_SettingUp;
+        mbConfigurationRestartRequested = true;
+    }
+}
+
+//------------------------------------------------------------------------------
+bool CANMotorController::QueueConfigurationReads()
+{
+    if ( mbVerifyingStoredConfiguration )
+    {
+        if ( !mbConfigurationFingerprintReadQueued )
         {
-            assert( false && "Unhandled communication state" );
+            if ( QueueSdoRead( eSRT_ConfigurationFingerprint, eSO_CustomerStorage ) )
+            {
+                mbConfigurationFingerprintReadQueued = true;
+                AtomicIncrement( &mConfigurationStats.mNumReads );
+            }
+            
+            return false;
         }
+        
+        // The fingerprint read may have been rejected just before it was 
+        // removed from the ring, in which case it's made again
+        bool bReadsComplete = ( mNumSdoReadsQueued == mNumSdoReadsCompleted );
+        AtomicMemoryBarrier();
+        return ( bReadsComplete && mbConfigurationFingerprintReadQueued );
     }
     
-    return bWriteComplete;
+    if ( mbConfigurationReadRetryRequested )
+    {
+        mbConfigurationReadRetryRequested = false;
+        if ( mCurConfigurationReadCommandIdx > mConfigurationReadRetryCommandIdx )
+        {
+            mCurConfigurationReadCommandIdx = mConfigurationReadRetryCommandIdx;
+        }
+    }
+    
+    bool bReadsQueued = true;
+    
+    while ( eSO_None != GetConfigurationCommand( mCurConfigurationReadCommandIdx ).mObject )
+    {
+        S32 commandIdx = mCurConfigurationReadCommandIdx;
+        assert( commandIdx < CONFIGURATION_ACTION_LIST_LENGTH );
+        
+        const SDOCommand& command = GetConfigurationCommand( commandIdx );
+        const SDOObjectDescriptor& descriptor = GetCommandObjectDescriptor( command );
+        S32 groupStartIdx = GetConfigurationGroupStartIdx( commandIdx );
+        
+        // There's no need to read objects that will be written anyway
+        bool bReadNeeded = ( 0 == ( descriptor.mFlags & eSOF_Command )
+            && 0 == ( mMismatchedConfigurationGroups & ( (U64)1 << groupStartIdx ) ) );
+        
+        // Only the first write to an object in a group is read, and the 
+        // value read is checked against the last write to the object
+        for ( S32 otherIdx = groupStartIdx; otherIdx < commandIdx && bReadNeeded; otherIdx++ )
+        {
+            if ( GetConfigurationCommand( otherIdx ).mObject == command.mObject )
+            {
+                bReadNeeded = false;
+            }
+        }
+        
+        S32 lastWriteIdx = commandIdx;
+        for ( S32 otherIdx = commandIdx + 1; 
+            eSO_None != GetConfigurationCommand( otherIdx ).mObject
+            && GetCommandObjectDescriptor( GetConfigurationCommand( otherIdx ) ).mIndex == descriptor.mIndex;
+            otherIdx++ )
+        {
+            if ( GetConfigurationCommand( otherIdx ).mObject == command.mObject )
+            {
+                lastWriteIdx = otherIdx;
+            }
+        }
+        
+        if ( bReadNeeded )
+        {
+            // Reads are made one at a time, so that the rest of a group 
+            // doesn't need to be read once it's known to differ. The nodes
+            // share the bus, so this costs little when configuring many 
+            // nodes at once.
+            if ( mNumSdoReadsQueued != mNumSdoReadsCompleted
+                || !QueueSdoRead( eSRT_ConfigurationValue, (eSDOObject)command.mObject,
+                                (U8)lastWriteIdx, (U8)groupStartIdx ) )
+            {
+                // Try again on the next update
+                bReadsQueued = false;
+                break;
+            }
+            
+            AtomicIncrement( &mConfigurationStats.mNumReads );
+        }
+        
+        mCurConfigurationReadCommandIdx++;
+    }
+    
+    // A read that completes from here on may still ask to be made again
+    bool bReadsComplete = ( mNumSdoReadsQueued == mNumSdoReadsCompleted );
+    AtomicMemoryBarrier();
+    return ( bReadsQueued && bReadsComplete && !mbConfigurationReadRetryRequested );
+}
+
+//------------------------------------------------------------------------------
+void CANMotorController::OnConfigurationValueRead( U8 commandIdx, U8 groupStartIdx, U32 value )
+{
+    const SDOCommand& command = GetConfigurationCommand( commandIdx );
+    U32 numBytes = SDO_GetDataTypeNumBytes( 
+        (eSDODataType)GetCommandObjectDescriptor( command ).mDataType );
+    U32 mask = ( numBytes >= 4 ? 0xFFFFFFFF : ( 1U << ( 8*numBytes ) ) - 1 );
+    
+    if ( ( value & mask ) != ( command.mData & mask ) )
+    {
+        mMismatchedConfigurationGroups |= ( (U64)1 << groupStartIdx );
+    }
+}
+
+//------------------------------------------------------------------------------
+void CANMotorController::OnConfigurationFingerprintRead( U32 value )
+{
+    if ( ( value & 0xFFFF ) == mConfigurationFingerprint )
+    {
+        // The node still has the stored configuration
+        mMismatchedConfigurationGroups = 0;
+    }
+    else
+    {
+        mbConfigurationStoreRequired = true;
+    }
 }
 
 //------------------------------------------------------------------------------
-void CANMotorController::HandleSDOReadComplete( SDOField& field )
+const SDOCommand& CANMotorController::GetConfigurationCommand( S32 commandIdx ) const
 {
-    CANMotorController* pThis = (CANMotorController*)field.mpUserData;
+    if ( commandIdx < NUM_TPDO1_FEEDBACK_COMMANDS )
+    {
+        return TPDO1_FEEDBACK_COMMANDS[ commandIdx ];
+    }
     
-    if ( &(pThis->mReadAction) == pThis->mpActiveSdoReadField )
+    return mpConfigurationSetupCommands[ commandIdx - NUM_TPDO1_FEEDBACK_COMMANDS ];
+}
+
+//------------------------------------------------------------------------------
+S32 CANMotorController::GetConfigurationGroupStartIdx( S32 commandIdx ) const
+{
+    U16 index = GetCommandObjectDescriptor( GetConfigurationCommand( commandIdx ) ).mIndex;
+    
+    S32 groupStartIdx = commandIdx;
+    while ( groupStartIdx > 0
+        && GetCommandObjectDescriptor( GetConfigurationCommand( groupStartIdx - 1 ) ).mIndex == index )
     {
-        pThis->mAngle = *((S32*)field.mData);
-        pThis->mbAngleValid = true;
+        groupStartIdx--;
     }
-    else if ( &(pThis->mReadStatusAction) == pThis->mpActiveSdoReadField )
+    
+    return groupStartIdx;
+}
+
+//------------------------------------------------------------------------------
+bool CANMotorController::IsConfigurationWriteNeeded( S32 commandIdx ) const
+{
+    const SDOCommand& command = GetConfigurationCommand( commandIdx );
+    S32 groupStartIdx = GetConfigurationGroupStartIdx( commandIdx );
+    
+    return ( 0 != ( GetCommandObjectDescriptor( command ).mFlags & eSOF_Command )
+        || 0 != ( mMismatchedConfigurationGroups & ( (U64)1 << groupStartIdx ) ) );
+}
+
+//------------------------------------------------------------------------------
+bool CANMotorController::QueueSdoRead( eSdoReadTarget target, eSDOObject object,
+                                      U8 commandIdx, U8 groupStartIdx )
+{
+    if ( mNumSdoReadsQueued - mNumSdoReadsCompleted >= MAX_NUM_QUEUED_SDO_READS )
     {
-        pThis->mEposStatusword = *((U16*)field.mData);
-        pThis->mbStatusValid = true;
+        return false;
     }
     
-    /*if ( pThis->GetNodeId() == 15 )
+    SDOField field = SDOField::CreateRead( object );
+    
+    // The read is put in the ring before it's queued, as the completion 
+    // callback may arrive before the CAN Open library returns
+    QueuedSdoRead& read = mQueuedSdoReads[ mNumSdoReadsQueued & ( MAX_NUM_QUEUED_SDO_READS - 1 ) ];
+    read.mTarget = (U8)target;
+    read.mObject = (U8)object;
+    read.mCommandIdx = commandIdx;
+    read.mGroupStartIdx = groupStartIdx;
+    mbSdoReadActive[ target ] = true;
+    AtomicIncrement( &mNumSdoReadsQueued );
+    
+    if ( !mpOwner->ProcessSDOField( mNodeId, field ) )
     {
-        printf( "Angle from node %i read as %i\n", pThis->GetNodeId(), pThis->mAngle );
-    }*/
+        // The CAN Open library is full, try again later
+        AtomicDecrement( &mNumSdoReadsQueued );
+        mbSdoReadActive[ target ] = false;
+        return false;
+    }
+    
+    return true;
 }
 
 //------------------------------------------------------------------------------
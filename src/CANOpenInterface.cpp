@@ -7,23 +7,14 @@
 //------------------------------------------------------------------------------
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 #include "CANOpenInterface.h"
+#include "CANChannelRegistry.h"
 #include "CanOpenMaster/CanOpenMaster.h"
 
 //------------------------------------------------------------------------------
-struct ChannelMapping
-{
-    CANChannel* mpChannel;
-    COM_CanChannelHandle mChannelHandle;
-};
-
 static bool gbCANOpenStarted = false;
-static ChannelMapping gChannelMappings[] = 
-{ 
-    { NULL, NULL }, 
-    { NULL, NULL }
-};
-COMPILE_TIME_ASSERT( ARRAY_LENGTH( gChannelMappings ) == MAX_NUM_CAN_CHANNELS );
 
 static const char* BAUD_RATES[] = 
 {
@@ -40,37 +31,15 @@ static const char* BAUD_RATES[] =
 COMPILE_TIME_ASSERT( ARRAY_LENGTH( BAUD_RATES ) == eBR_NumBaudRates );
 
 //------------------------------------------------------------------------------
-static ChannelMapping* FindMapping( CANChannel* pChannel )
+static CANChannel* FindChannel( COM_CanChannelHandle channelHandle )
 {
-    ChannelMapping* pResult = NULL;
-    
-    for ( S32 mappingIdx = 0; mappingIdx < MAX_NUM_CAN_CHANNELS; mappingIdx++ )
-    {
-        if ( gChannelMappings[ mappingIdx ].mpChannel == pChannel )
-        {
-            pResult = &gChannelMappings[ mappingIdx ];
-            break;
-        }
-    }
-    
-    return pResult;
+    return CCR_FindChannel( (void*)channelHandle );
 }
 
 //------------------------------------------------------------------------------
-static ChannelMapping* FindMapping( COM_CanChannelHandle channelHandle )
+static COM_CanChannelHandle FindChannelHandle( CANChannel* pChannel )
 {
-    ChannelMapping* pResult = NULL;
-    
-    for ( S32 mappingIdx = 0; mappingIdx < MAX_NUM_CAN_CHANNELS; mappingIdx++ )
-    {
-        if ( gChannelMappings[ mappingIdx ].mChannelHandle == channelHandle )
-        {
-            pResult = &gChannelMappings[ mappingIdx ];
-            break;
-        }
-    }
-    
-    return pResult;
+    return (COM_CanChannelHandle)pChannel->GetCOIHandle();
 }
 
 //------------------------------------------------------------------------------
@@ -78,71 +47,83 @@ static ChannelMapping* FindMapping( COM_CanChannelHandle channelHandle )
 //------------------------------------------------------------------------------
 void MasterHeartbeatError( COM_CanChannelHandle handle, U8 error )
 {
-    ChannelMapping* pMapping = FindMapping( handle );
-    if ( NULL != pMapping )
+    CANChannel* pChannel = FindChannel( handle );
+    if ( NULL != pChannel )
     {
-        pMapping->mpChannel->OnCANOpenHeartbeatError( error );
+        pChannel->OnCANOpenHeartbeatError( error );
     }
 }
 
 //------------------------------------------------------------------------------
 void MasterPostSync( COM_CanChannelHandle handle )
 {
-    ChannelMapping* pMapping = FindMapping( handle );
-    if ( NULL != pMapping )
+    CANChannel* pChannel = FindChannel( handle );
+    if ( NULL != pChannel )
     {
-        pMapping->mpChannel->OnCANOpenPostSync();
+        pChannel->OnCANOpenPostSync();
     }
 }
 
 //------------------------------------------------------------------------------
 void MasterPostTPDO( COM_CanChannelHandle handle )
 {
-    ChannelMapping* pMapping = FindMapping( handle );
-    if ( NULL != pMapping )
+    CANChannel* pChannel = FindChannel( handle );
+    if ( NULL != pChannel )
     {
-        pMapping->mpChannel->OnCANOpenPostTPDO();
+        pChannel->OnCANOpenPostTPDO();
     }
 }
 
 //------------------------------------------------------------------------------
 void MasterPostEmergency( COM_CanChannelHandle handle, U8 nodeId, U16 errCode, U8 errReg )
 {
-    ChannelMapping* pMapping = FindMapping( handle );
-    if ( NULL != pMapping )
+    CANChannel* pChannel = FindChannel( handle );
+    if ( NULL != pChannel )
     {
-        pMapping->mpChannel->OnCANOpenPostEmergency( nodeId, errCode, errReg );
+        pChannel->OnCANOpenPostEmergency( nodeId, errCode, errReg );
     }
 }
 
 //------------------------------------------------------------------------------
 void MasterPostSlaveBootup( COM_CanChannelHandle handle, U8 nodeId )
 {
-    ChannelMapping* pMapping = FindMapping( handle );
-    if ( NULL != pMapping )
+    CANChannel* pChannel = FindChannel( handle );
+    if ( NULL != pChannel )
     {
-        pMapping->mpChannel->OnCANOpenPostSlaveBootup( nodeId );
+        pChannel->OnCANOpenPostSlaveBootup( nodeId );
     }
 }
 
+//------------------------------------------------------------------------------
+#ifdef CAN_OPEN_MASTER_HAS_PDOS
+void MasterPdoReceived( COM_CanChannelHandle handle, U16 cobId, U8* pData, U8 numBytes )
+{
+    CANChannel* pChannel = FindChannel( handle );
+    if ( NULL != pChannel )
+    {
+        pChannel->OnCANOpenPDOReceived( cobId, pData, numBytes );
+    }
+}
+#endif // CAN_OPEN_MASTER_HAS_PDOS
+
 //------------------------------------------------------------------------------
 void ReadSDOFieldCallback( COM_CanChannelHandle handle, U8 nodeId,
                            U8* pData, U8 numBytes )
 { 
-    ChannelMapping* pMapping = FindMapping( handle );
-    if ( NULL != pMapping )
+    CANChannel* pChannel = FindChannel( handle );
+    if ( NULL != pChannel )
     {
-        pMapping->mpChannel->OnSDOFieldReadComplete( nodeId, pData, numBytes );
+        pChannel->OnSDOFieldReadComplete( nodeId, pData, numBytes );
     }
 }
 
 //------------------------------------------------------------------------------
 void WriteSDOFieldCallback( COM_CanChannelHandle handle, U8 nodeId )
 {   
-    ChannelMapping* pMapping = FindMapping( handle );
-    if ( NULL != pMapping )
+    CANChannel* pChannel = FindChannel( handle );
+    if ( NULL != pChannel )
     {
-        pMapping->mpChannel->OnSDOFieldWriteComplete( nodeId );
+        pChannel->OnSDOFieldWriteComplete( nodeId );
     }
 }
         
@@ -168,6 +149,7 @@ Finished:
 void COI_DeinitCANOpenInterface()
 {
     COM_Deinit();
+    CCR_Clear();
     gbCANOpenStarted = false;
 }
 
@@ -181,29 +163,24 @@ bool COI_InitCANChannel( CANChannel* pChannel, const char* driverLibraryName, co
     
     if ( gbCANOpenStarted )
     {
-        ChannelMapping* pMapping = NULL;
-        for ( S32 mappingIdx = 0; mappingIdx < MAX_NUM_CAN_CHANNELS; mappingIdx++ )
+        if ( NULL != FindChannelHandle( pChannel ) )
         {
-            if ( NULL == gChannelMappings[ mappingIdx ].mpChannel )
-            {
-                pMapping = &gChannelMappings[ mappingIdx ];
-                break;
-            }
-        }
-        
-        if ( NULL == pMapping )
-        {
-            fprintf( stderr, "Error: No more CAN mappings available\n" );
+            fprintf( stderr, "Error: Channel is already open\n" );
             goto Finished;
         }
         
-        // Specify the callbacks for the channel
+        // Specify the callbacks for the channel. Any that we don't set, such
+        // as the PDO callback when PDOs aren't used, are left as NULL
         COM_CanChannelCallbacks callbacks;
+        memset( &callbacks, 0, sizeof( callbacks ) );
         callbacks.mHeartbeatErrorCB = MasterHeartbeatError;
         callbacks.mPostSyncCB = MasterPostSync;
         callbacks.mPostTpdoCB = MasterPostTPDO;
         callbacks.mPostEmergencyCB = MasterPostEmergency;
         callbacks.mPostSlaveBootupCB = MasterPostSlaveBootup;
+#ifdef CAN_OPEN_MASTER_HAS_PDOS
+        callbacks.mPdoReceivedCB = MasterPdoReceived;
+#endif
         
         COM_CanChannelHandle channelHandle = COM_OpenChannel(
             driverLibraryName, canDevice, BAUD_RATES[ baudRate ], callbacks );
@@ -213,12 +190,25 @@ bool COI_InitCANChannel( CANChannel* pChannel, const char* driverLibraryName, co
             goto Finished;
         }
         
+        // Register the channel before the nodes are reset so that we don't
+        // miss their bootup messages
+        if ( !CCR_AddChannel( pChannel, (void*)channelHandle ) )
+        {
+            fprintf( stderr, "Error: Unable to register CAN channel, at most %i can be open\n",
+                CCR_MAX_NUM_CHANNELS );
+            COM_CloseChannel( &channelHandle );
+            goto Finished;
+        }
+        pChannel->SetCOIHandle( (void*)channelHandle );
+        
         // Reset the nodes on the channel
         // TODO: Move out of here once we have an interface for sending NMT messages
         COM_QueueNmtResetNode( channelHandle, 0 );
         
-        pMapping->mpChannel = pChannel;
-        pMapping->mChannelHandle = channelHandle;
+#ifndef CAN_OPEN_MASTER_HAS_PDOS
+        fprintf( stderr, "Warning: Built without EPOS_USE_CAN_OPEN_MASTER_PDOS, so SDO transfers will be used instead of PDOs\n" );
+#endif
+        
         bResult = true;
     }
     
@@ -229,11 +219,12 @@ Finished:
 //------------------------------------------------------------------------------
 void COI_DeinitCANChannel( CANChannel* pChannel )
 {
-    ChannelMapping* pMapping = FindMapping( pChannel );
-    if ( NULL != pMapping )
+    COM_CanChannelHandle channelHandle = FindChannelHandle( pChannel );
+    if ( NULL != channelHandle )
     {
-        COM_CloseChannel( &(pMapping->mChannelHandle) );
-        pMapping->mpChannel = NULL;
+        CCR_RemoveChannel( (void*)channelHandle );
+        pChannel->SetCOIHandle( NULL );
+        COM_CloseChannel( &channelHandle );
     }
 }
 
@@ -242,15 +233,15 @@ bool COI_ProcessSDOField( CANChannel* pChannel, U8 nodeId, const SDOField& field
 {   
     bool bFieldProcessed = false;
     
-    ChannelMapping* pMapping = FindMapping( pChannel );
-    if ( NULL != pMapping )
+    COM_CanChannelHandle channelHandle = FindChannelHandle( pChannel );
+    if ( NULL != channelHandle )
     {
         switch ( field.mType )
         {
             case SDOField::eT_Write:
             {
                 bFieldProcessed = COM_QueueSdoWriteMsg( 
-                    pMapping->mChannelHandle, nodeId, 
+                    channelHandle, nodeId, 
                     field.mIndex, field.mSubIndex, 
                     WriteSDOFieldCallback,
                     field.mData, field.mNumBytes );
@@ -260,7 +251,7 @@ bool COI_ProcessSDOField( CANChannel* pChannel, U8 nodeId, const SDOField& field
             case SDOField::eT_Read:
             {   
                 bFieldProcessed = COM_QueueSdoReadMsg( 
-                    pMapping->mChannelHandle, nodeId, 
+                    channelHandle, nodeId, 
                     field.mIndex, field.mSubIndex, 
                     ReadSDOFieldCallback );
                     
@@ -275,3 +266,92 @@ bool COI_ProcessSDOField( CANChannel* pChannel, U8 nodeId, const SDOField& field
     
     return bFieldProcessed;
 }
+
+//------------------------------------------------------------------------------
+U64 COI_GetTimeUS( CANChannel* /*pChannel*/ )
+{
+    timespec time;
+    clock_gettime( CLOCK_MONOTONIC, &time );
+    return (U64)time.tv_sec*1000000 + (U64)( time.tv_nsec/1000 );
+}
+
+#ifdef CAN_OPEN_MASTER_HAS_PDOS
+
+//------------------------------------------------------------------------------
+bool COI_ArePDOsSupported()
+{
+    return true;
+}
+
+//------------------------------------------------------------------------------
+bool COI_QueueNMTStartNode( CANChannel* pChannel, U8 nodeId )
+{
+    bool bMsgQueued = false;
+    
+    COM_CanChannelHandle channelHandle = FindChannelHandle( pChannel );
+    if ( NULL != channelHandle )
+    {
+        bMsgQueued = COM_QueueNmtStartNode( channelHandle, nodeId );
+    }
+    
+    return bMsgQueued;
+}
+
+//------------------------------------------------------------------------------
+bool COI_QueuePDO( CANChannel* pChannel, U16 cobId, const U8* pData, U8 numBytes )
+{
+    bool bMsgQueued = false;
+    
+    COM_CanChannelHandle channelHandle = FindChannelHandle( pChannel );
+    if ( NULL != channelHandle )
+    {
+        bMsgQueued = COM_QueuePdoMsg( channelHandle, cobId, pData, numBytes );
+    }
+    
+    return bMsgQueued;
+}
+
+//------------------------------------------------------------------------------
+bool COI_QueueSync( CANChannel* pChannel )
+{
+    bool bMsgQueued = false;
+    
+    COM_CanChannelHandle channelHandle = FindChannelHandle( pChannel );
+    if ( NULL != channelHandle )
+    {
+        bMsgQueued = COM_QueueSyncMsg( channelHandle );
+    }
+    
+    return bMsgQueued;
+}
+
+#else
+
+//------------------------------------------------------------------------------
+// Built without EPOS_USE_CAN_OPEN_MASTER_PDOS, so NMT start, PDO and SYNC 
+// messages aren't sent
+//------------------------------------------------------------------------------
+bool COI_ArePDOsSupported()
+{
+    return false;
+}
+
+//------------------------------------------------------------------------------
+bool COI_QueueNMTStartNode( CANChannel* /*pChannel*/, U8 /*nodeId*/ )
+{
+    return false;
+}
+
+//------------------------------------------------------------------------------
+bool COI_QueuePDO( CANChannel* /*pChannel*/, U16 /*cobId*/, const U8* /*pData*/, U8 /*numBytes*/ )
+{
+    return false;
+}
+
+//------------------------------------------------------------------------------
+bool COI_QueueSync( CANChannel* /*pChannel*/ )
+{
+    return false;
+}
+
+#endif // CAN_OPEN_MASTER_HAS_PDOS
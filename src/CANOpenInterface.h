@@ -25,4 +25,24 @@ void COI_DeinitCANChannel( CANChannel* pChannel );
 //------------------------------------------------------------------------------
 bool COI_ProcessSDOField( CANChannel* pChannel, U8 nodeId, const SDOField& field );
 
+//------------------------------------------------------------------------------
+// Returns the time in microseconds from a monotonic clock, used for timing
+// messages on the channel
+U64 COI_GetTimeUS( CANChannel* pChannel );
+
+//------------------------------------------------------------------------------
+// Returns false if the CAN Open library can't send NMT start, PDO or SYNC
+// messages, or pass received PDOs on. Queuing them will then always fail, so
+// nodes are never made Operational and PDO feedback and setpoints fall back 
+// to SDO transfers.
+bool COI_ArePDOsSupported();
+
+//------------------------------------------------------------------------------
+// Moves a node into the NMT Operational state so that it starts sending PDOs
+bool COI_QueueNMTStartNode( CANChannel* pChannel, U8 nodeId );
+
+//------------------------------------------------------------------------------
+bool COI_QueuePDO( CANChannel* pChannel, U16 cobId, const U8* pData, U8 numBytes );
+bool COI_QueueSync( CANChannel* pChannel );
+
 #endif // CAN_OPEN_INTERFACE_h
@@ -8,6 +8,8 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 
 #include "EPOSControl/EPOSControl.h"
 #include "CANOpenInterface.h"
@@ -20,8 +22,57 @@
 // Library globals
 //------------------------------------------------------------------------------
 static bool gbInitialised = false;
-static CANChannel gCANChannels[ MAX_NUM_CAN_CHANNELS ];
-static bool gbChannelInUse[ MAX_NUM_CAN_CHANNELS ] = { false };
+
+// Channels are allocated individually so that the pointers given out to
+// client code stay valid when the slot array grows
+struct ChannelSlot
+{
+    CANChannel* mpChannel;
+    bool mbInUse;
+};
+
+static ChannelSlot* gpChannelSlots = NULL;
+static S32 gNumChannelSlots = 0;
+
+static const S32 INITIAL_NUM_CHANNEL_SLOTS = 4;
+
+static const U32 RUNNING_NODES_POLL_PERIOD_MS = 1;
+
+//------------------------------------------------------------------------------
+// Makes sure that there are at least numSlots channel slots
+static bool ReserveChannelSlots( S32 numSlots )
+{
+    bool bResult = true;
+    
+    if ( numSlots > gNumChannelSlots )
+    {
+        S32 newNumSlots = ( gNumChannelSlots > 0 ? gNumChannelSlots : INITIAL_NUM_CHANNEL_SLOTS );
+        while ( newNumSlots < numSlots )
+        {
+            newNumSlots *= 2;
+        }
+        
+        ChannelSlot* pNewSlots = (ChannelSlot*)realloc( 
+            gpChannelSlots, newNumSlots*sizeof( ChannelSlot ) );
+        if ( NULL == pNewSlots )
+        {
+            bResult = false;
+        }
+        else
+        {
+            for ( S32 slotIdx = gNumChannelSlots; slotIdx < newNumSlots; slotIdx++ )
+            {
+                pNewSlots[ slotIdx ].mpChannel = NULL;
+                pNewSlots[ slotIdx ].mbInUse = false;
+            }
+            
+            gpChannelSlots = pNewSlots;
+            gNumChannelSlots = newNumSlots;
+        }
+    }
+    
+    return bResult;
+}
 
 //------------------------------------------------------------------------------
 bool EPOS_InitLibrary()
@@ -42,24 +93,33 @@ Finished:
 //------------------------------------------------------------------------------
 void EPOS_DeinitLibrary()
 {
-    for ( S32 channelIdx = 0; channelIdx < MAX_NUM_CAN_CHANNELS; channelIdx++ )
+    for ( S32 channelIdx = 0; channelIdx < gNumChannelSlots; channelIdx++ )
     {
-        gCANChannels[ channelIdx ].Deinit();
-        gbChannelInUse[ channelIdx ] = false;
+        if ( NULL != gpChannelSlots[ channelIdx ].mpChannel )
+        {
+            gpChannelSlots[ channelIdx ].mpChannel->Deinit();
+            delete gpChannelSlots[ channelIdx ].mpChannel;
+        }
     }
+    
+    free( gpChannelSlots );
+    gpChannelSlots = NULL;
+    gNumChannelSlots = 0;
 }
 
 //------------------------------------------------------------------------------
 CANChannel* EPOS_OpenCANChannel( const char* driverLibraryName, const char* canDevice,
-                                 eBaudRate baudRate, S32 channelIdx )
+                                 eBaudRate baudRate, S32 channelIdx, U32 updateRateHz )
 {
     CANChannel* pResult = NULL;
     
-    if ( -1 == channelIdx )
+    if ( channelIdx < 0 )
     {
-        for ( S32 i = 0; i < MAX_NUM_CAN_CHANNELS; i++ )
+        // Use the first free slot, or a new one if all of the slots are in use
+        channelIdx = gNumChannelSlots;
+        for ( S32 i = 0; i < gNumChannelSlots; i++ )
         {
-            if ( !gbChannelInUse[ i ] )
+            if ( !gpChannelSlots[ i ].mbInUse )
             {
                 channelIdx = i;
                 break;          // Found a free channel
@@ -67,35 +127,129 @@ CANChannel* EPOS_OpenCANChannel( const char* driverLibraryName, const char* canD
         }
     }
     
-    if ( -1 == channelIdx )
+    if ( !ReserveChannelSlots( channelIdx + 1 ) )
     {
-        fprintf( stderr, "Error: No free slot for channel\n" );
+        fprintf( stderr, "Error: Unable to allocate slot for channel\n" );
+        goto Finished;
     }
-    else if ( gbChannelInUse[ channelIdx ] )
+    
+    if ( gpChannelSlots[ channelIdx ].mbInUse )
     {
         fprintf( stderr, "Error: Slot %i already in use\n", channelIdx );
+        goto Finished;
+    }
+    
+    if ( NULL == gpChannelSlots[ channelIdx ].mpChannel )
+    {
+        gpChannelSlots[ channelIdx ].mpChannel = new CANChannel();
     }
 
-    if ( gCANChannels[ channelIdx ].Init( driverLibraryName, canDevice, baudRate, channelIdx + 1 ) )
+    if ( !gpChannelSlots[ channelIdx ].mpChannel->Init( 
+        driverLibraryName, canDevice, baudRate, channelIdx + 1 ) )
+    {
+        goto Finished;
+    }
+    
+    if ( updateRateHz > 0
+        && !gpChannelSlots[ channelIdx ].mpChannel->StartUpdateThread( updateRateHz ) )
     {
-        // A channel has been found and initialised
-        pResult = &gCANChannels[ channelIdx ];
-        gbChannelInUse[ channelIdx ] = true;
+        gpChannelSlots[ channelIdx ].mpChannel->Deinit();
+        goto Finished;
     }
+    
+    // A channel has been found and initialised
+    pResult = gpChannelSlots[ channelIdx ].mpChannel;
+    gpChannelSlots[ channelIdx ].mbInUse = true;
 
+Finished:
     return pResult;
 }
 
 //------------------------------------------------------------------------------
 void EPOS_CloseCANChannel( CANChannel* pChannel )
 {
-    for ( S32 channelIdx = 0; channelIdx < MAX_NUM_CAN_CHANNELS; channelIdx++ )
+    for ( S32 channelIdx = 0; channelIdx < gNumChannelSlots; channelIdx++ )
     {
-        if ( &gCANChannels[ channelIdx ] == pChannel )
+        if ( gpChannelSlots[ channelIdx ].mpChannel == pChannel )
         {
-            gCANChannels[ channelIdx ].Deinit();
-            gbChannelInUse[ channelIdx ] = false;
+            gpChannelSlots[ channelIdx ].mpChannel->Deinit();
+            gpChannelSlots[ channelIdx ].mbInUse = false;
             break;
         }
     }
 }
+
+//------------------------------------------------------------------------------
+void EPOS_GetBringUpStats( BringUpStats* pStatsOut )
+{
+    memset( pStatsOut, 0, sizeof( BringUpStats ) );
+    
+    U64 totalTimeToRunningUS = 0;
+    for ( S32 channelIdx = 0; channelIdx < gNumChannelSlots; channelIdx++ )
+    {
+        if ( !gpChannelSlots[ channelIdx ].mbInUse )
+        {
+            continue;
+        }
+        
+        BringUpStats channelStats;
+        gpChannelSlots[ channelIdx ].mpChannel->GetBringUpStats( &channelStats );
+        
+        pStatsOut->mNumNodesPresent += channelStats.mNumNodesPresent;
+        pStatsOut->mNumNodesRunning += channelStats.mNumNodesRunning;
+        totalTimeToRunningUS += channelStats.mMeanTimeToRunningUS*channelStats.mNumNodesRunning;
+        if ( channelStats.mMaxTimeToRunningUS > pStatsOut->mMaxTimeToRunningUS )
+        {
+            pStatsOut->mMaxTimeToRunningUS = channelStats.mMaxTimeToRunningUS;
+        }
+        if ( channelStats.mLastRunningTimeUS > pStatsOut->mLastRunningTimeUS )
+        {
+            pStatsOut->mLastRunningTimeUS = channelStats.mLastRunningTimeUS;
+        }
+    }
+    
+    if ( pStatsOut->mNumNodesRunning > 0 )
+    {
+        pStatsOut->mMeanTimeToRunningUS = totalTimeToRunningUS/pStatsOut->mNumNodesRunning;
+    }
+}
+
+//------------------------------------------------------------------------------
+static U64 GetMonotonicTimeMS()
+{
+    timespec time;
+    clock_gettime( CLOCK_MONOTONIC, &time );
+    return (U64)time.tv_sec*1000 + (U64)time.tv_nsec/1000000;
+}
+
+//------------------------------------------------------------------------------
+bool EPOS_WaitForRunningNodes( S32 numNodes, U32 timeoutMS )
+{
+    U64 deadlineMS = GetMonotonicTimeMS() + timeoutMS;
+    while ( true )
+    {
+        S32 numRunningNodes = 0;
+        for ( S32 channelIdx = 0; channelIdx < gNumChannelSlots; channelIdx++ )
+        {
+            if ( gpChannelSlots[ channelIdx ].mbInUse )
+            {
+                numRunningNodes += gpChannelSlots[ channelIdx ].mpChannel->GetNumRunningNodes();
+            }
+        }
+        
+        if ( numRunningNodes >= numNodes )
+        {
+            return true;
+        }
+        
+        if ( GetMonotonicTimeMS() >= deadlineMS )
+        {
+            return false;
+        }
+        
+        timespec pollPeriod;
+        pollPeriod.tv_sec = 0;
+        pollPeriod.tv_nsec = RUNNING_NODES_POLL_PERIOD_MS*1000000;
+        nanosleep( &pollPeriod, NULL );
+    }
+}
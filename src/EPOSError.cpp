@@ -0,0 +1,113 @@
+//------------------------------------------------------------------------------
+// File: EPOSError.cpp
+// Desc: Decoding of the error codes that EPOS motor controllers report in
+//       their emergency (EMCY) messages.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+#include <stdio.h>
+#include "EPOSControl/EPOSError.h"
+
+//------------------------------------------------------------------------------
+// NOTE: This table must be kept sorted by error code and then error register
+// as it's searched with a binary search.
+static const EPOSErrorInfo ERROR_TABLE[] =
+{
+    { 0x0000, 0x00, eEEC_None, "No Error" },
+    { 0x1000, 0x01, eEEC_Generic, "Generic Error" },
+    { 0x2310, 0x02, eEEC_Current, "Over Current Error" },
+    { 0x3210, 0x04, eEEC_Voltage, "Over Voltage Error" },
+    { 0x3220, 0x04, eEEC_Voltage, "Under Voltage" },
+    { 0x4210, 0x08, eEEC_Temperature, "Over Temperature" },
+    { 0x5113, 0x04, eEEC_Voltage, "Supply Voltage (+5V) too low" },
+    { 0x6100, 0x20, eEEC_Software, "Internal Software Error" },
+    { 0x6320, 0x20, eEEC_Software, "Software Parameter Error" },
+    { 0x7320, 0x20, eEEC_Sensor, "Sensor Position Error" },
+    { 0x8110, 0x10, eEEC_Communication, "CAN Overrun Error (Objects Lost)" },
+    { 0x8111, 0x10, eEEC_Communication, "CAN Overrun Error" },
+    { 0x8120, 0x10, eEEC_Communication, "CAN Passive Mode Error" },
+    { 0x8130, 0x10, eEEC_Communication, "CAN Life Guard Error" },
+    { 0x8150, 0x10, eEEC_Communication, "CAN Tansmit COB-ID collision" },
+    { 0x81FD, 0x10, eEEC_Communication, "CAN Bus Off" },
+    { 0x81FE, 0x10, eEEC_Communication, "CAN Rx Queue Overrun" },
+    { 0x81FF, 0x10, eEEC_Communication, "CAN Tx Queue Overrun" },
+    { 0x8210, 0x10, eEEC_Communication, "CAN PDO Length Error" },
+    { 0x8611, 0x20, eEEC_Motion, "Following Error" },
+    { 0xFF01, 0x80, eEEC_Sensor, "Hall Sensor Error" },
+    { 0xFF02, 0x80, eEEC_Sensor, "Index Processing Error" },
+    { 0xFF03, 0x80, eEEC_Sensor, "Encoder Resolution Error" },
+    { 0xFF04, 0x80, eEEC_Sensor, "Hallsensor not found Error" },
+    { 0xFF06, 0x80, eEEC_Motion, "Negative Limit Error" },
+    { 0xFF07, 0x80, eEEC_Motion, "Positive Limit Error" },
+    { 0xFF08, 0x80, eEEC_Sensor, "Hall Angle detection Error" },
+    { 0xFF09, 0x80, eEEC_Motion, "Software Position Limit Error" },
+    { 0xFF0A, 0x80, eEEC_Sensor, "Position Sensor Breach" },
+    { 0xFF0B, 0x20, eEEC_Software, "System Overloaded" },
+};
+
+static const S32 NUM_ERROR_TABLE_ENTRIES = ARRAY_LENGTH( ERROR_TABLE );
+
+//------------------------------------------------------------------------------
+const EPOSErrorInfo* EPOS_GetErrorTable( S32* pNumEntriesOut )
+{
+    *pNumEntriesOut = NUM_ERROR_TABLE_ENTRIES;
+    return ERROR_TABLE;
+}
+
+//------------------------------------------------------------------------------
+const EPOSErrorInfo* EPOS_FindErrorInfo( U16 errCode, U8 errReg )
+{
+    // Combine the code and register into a single key to search on
+    U32 key = ( (U32)errCode << 8 ) | errReg;
+    
+    S32 low = 0;
+    S32 high = NUM_ERROR_TABLE_ENTRIES - 1;
+    while ( low <= high )
+    {
+        S32 mid = ( low + high )/2;
+        U32 midKey = ( (U32)ERROR_TABLE[ mid ].mErrCode << 8 ) | ERROR_TABLE[ mid ].mErrReg;
+        
+        if ( midKey == key )
+        {
+            return &ERROR_TABLE[ mid ];
+        }
+        else if ( midKey < key )
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid - 1;
+        }
+    }
+    
+    return NULL;
+}
+
+//------------------------------------------------------------------------------
+eEPOSErrorClass EPOS_GetErrorClass( U16 errCode, U8 errReg )
+{
+    const EPOSErrorInfo* pInfo = EPOS_FindErrorInfo( errCode, errReg );
+    return ( NULL != pInfo ? pInfo->mErrorClass : eEEC_Unknown );
+}
+
+//------------------------------------------------------------------------------
+const char* EPOS_GetErrorMessage( U16 errCode, U8 errReg, char* pBuffer, U32 bufferSize )
+{
+    const EPOSErrorInfo* pInfo = EPOS_FindErrorInfo( errCode, errReg );
+    if ( NULL != pInfo )
+    {
+        return pInfo->mpMessage;
+    }
+    
+    if ( NULL == pBuffer || 0 == bufferSize )
+    {
+        return "Unrecognised error message";
+    }
+    
+    snprintf( pBuffer, bufferSize, 
+              "Unrecognised error message 0x%X - 0x%X", errCode, errReg );
+    pBuffer[ bufferSize - 1 ] = '\0';
+    
+    return pBuffer;
+}
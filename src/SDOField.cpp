@@ -14,22 +14,43 @@ SDOField::SDOField()
     : mType( eT_Write ),
     mIndex( 0 ),
     mSubIndex( 0 ),
-    mReadCallback( NULL ),
-    mpUserData( NULL )
+    mNumBytes( 0 ),
+    mpDescription( "" )
 {
-    mDescription[ 0 ] = '\0';
 }        
 
 //------------------------------------------------------------------------------
-SDOField::SDOField( eType type, const char* pDescription, U16 index, U8 subIndex,
-              SDOReadCallback readCallback, void* pUserData )
+SDOField::SDOField( eType type, const char* pDescription, U16 index, U8 subIndex )
     : mType( type ),
     mIndex( index ),
     mSubIndex( subIndex ),
-    mReadCallback( readCallback ),
-    mpUserData( pUserData )
+    mNumBytes( 0 ),
+    mpDescription( pDescription )
 {
-    // Copy description into buffer and make sure that it's NUL terminated.
-    strncpy( mDescription, pDescription, sizeof( mDescription ) );
-    mDescription[ sizeof( mDescription ) - 1 ] = '\0';
+}
+
+//------------------------------------------------------------------------------
+SDOField SDOField::CreateRead( eSDOObject object )
+{
+    const SDOObjectDescriptor& descriptor = SDO_GetObjectDescriptor( object );
+    return SDOField( eT_Read, SDO_GetObjectName( object ), 
+        descriptor.mIndex, descriptor.mSubIndex );
+}
+
+//------------------------------------------------------------------------------
+SDOField SDOField::CreateWrite( const SDOCommand& command )
+{
+    eSDOObject object = (eSDOObject)command.mObject;
+    assert( eSO_None != object );
+    
+    const SDOObjectDescriptor& descriptor = SDO_GetObjectDescriptor( object );
+    SDOField field( eT_Write, SDO_GetObjectName( object ), 
+        descriptor.mIndex, descriptor.mSubIndex );
+    
+    // Objects are sent little endian, so only the low bytes of the data 
+    // are written
+    field.SetU32( command.mData );
+    field.mNumBytes = (U8)SDO_GetDataTypeNumBytes( (eSDODataType)descriptor.mDataType );
+    
+    return field;
 }
@@ -0,0 +1,299 @@
+//------------------------------------------------------------------------------
+// File: SDOLatencyStats.cpp
+// Desc: Histograms of how long SDO transfers take, kept for each node and for
+//       each object that is accessed.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+#include <string.h>
+#include "EPOSControl/SDOLatencyStats.h"
+#include "Atomic.h"
+
+//------------------------------------------------------------------------------
+COMPILE_TIME_ASSERT( ( SDOLatencyStats::MAX_NUM_OBJECTS & ( SDOLatencyStats::MAX_NUM_OBJECTS - 1 ) ) == 0 );
+
+//------------------------------------------------------------------------------
+// Keys are offset by 1 so that 0 can mark an empty slot
+static U32 GetObjectKey( U16 index, U8 subIndex )
+{
+    return ( ( (U32)index << 8 ) | subIndex ) + 1;
+}
+
+//------------------------------------------------------------------------------
+static U32 HashObjectKey( U32 objectKey )
+{
+    return ( objectKey*0x9E3779B1 ) >> 16;
+}
+
+//------------------------------------------------------------------------------
+static S32 GetBucketIdx( U64 latencyUS )
+{
+    S32 bucketIdx = 0;
+    while ( latencyUS >= 2 && bucketIdx < SDOLatencyHistogram::NUM_BUCKETS - 1 )
+    {
+        latencyUS >>= 1;
+        bucketIdx++;
+    }
+
+    return bucketIdx;
+}
+
+//------------------------------------------------------------------------------
+static void AddSample( SDOLatencyHistogram* pHistogram, U64 latencyUS )
+{
+    U32 clampedLatencyUS = ( latencyUS > 0xFFFFFFFF ? 0xFFFFFFFF : (U32)latencyUS );
+
+    AtomicIncrement( &pHistogram->mBucketCounts[ GetBucketIdx( latencyUS ) ] );
+    AtomicAdd( &pHistogram->mTotalLatencyUS, latencyUS );
+    AtomicMax( &pHistogram->mMaxLatencyUS, clampedLatencyUS );
+
+    // Counted last so that a reader never sees more samples than are in the
+    // buckets
+    AtomicMemoryBarrier();
+    AtomicIncrement( &pHistogram->mNumSamples );
+}
+
+//------------------------------------------------------------------------------
+static void CopyHistogram( const SDOLatencyHistogram& histogram, SDOLatencyHistogram* pHistogramOut )
+{
+    AtomicMemoryBarrier();
+    memcpy( pHistogramOut, &histogram, sizeof( SDOLatencyHistogram ) );
+}
+
+//------------------------------------------------------------------------------
+U32 SLS_GetLatencyPercentileUS( const SDOLatencyHistogram& histogram, float percentile )
+{
+    if ( 0 == histogram.mNumSamples )
+    {
+        return 0;
+    }
+
+    if ( percentile < 0.0f )
+    {
+        percentile = 0.0f;
+    }
+    else if ( percentile > 100.0f )
+    {
+        percentile = 100.0f;
+    }
+
+    U32 targetCount = (U32)( percentile*histogram.mNumSamples/100.0f + 0.5f );
+    if ( targetCount < 1 )
+    {
+        targetCount = 1;
+    }
+
+    U32 latencyUS = histogram.mMaxLatencyUS;
+    U32 count = 0;
+    for ( S32 bucketIdx = 0; bucketIdx < SDOLatencyHistogram::NUM_BUCKETS - 1; bucketIdx++ )
+    {
+        count += histogram.mBucketCounts[ bucketIdx ];
+        if ( count >= targetCount )
+        {
+            U32 bucketUpperBoundUS = ( 2U << bucketIdx ) - 1;
+            if ( bucketUpperBoundUS < latencyUS )
+            {
+                latencyUS = bucketUpperBoundUS;
+            }
+            break;
+        }
+    }
+
+    return latencyUS;
+}
+
+//------------------------------------------------------------------------------
+SDOLatencyStats::SDOLatencyStats()
+{
+    Reset();
+}
+
+//------------------------------------------------------------------------------
+void SDOLatencyStats::Reset()
+{
+    memset( mNodeTransfers, 0, sizeof( mNodeTransfers ) );
+    memset( mNodeHistograms, 0, sizeof( mNodeHistograms ) );
+    memset( (void*)mObjectKeys, 0, sizeof( mObjectKeys ) );
+    memset( mObjectHistograms, 0, sizeof( mObjectHistograms ) );
+    mNumUntrackedObjectSamples = 0;
+}
+
+//------------------------------------------------------------------------------
+void SDOLatencyStats::OnTransferQueued( U8 nodeId, const SDOField& field, U64 timeUS )
+{
+    if ( nodeId >= MAX_NUM_NODES )
+    {
+        return;
+    }
+
+    NodeTransfers& transfers = mNodeTransfers[ nodeId ];
+    TransferRing& ring = ( SDOField::eT_Write == field.mType ? transfers.mWrites : transfers.mReads );
+    U32 transferIdx = AtomicIncrement( &ring.mNumQueued ) - 1;
+    PendingTransfer* pTransfer = &ring.mTransfers[ transferIdx & ( TRANSFER_RING_SIZE - 1 ) ];
+
+    pTransfer->mQueueTimeUS = timeUS;
+    pTransfer->mObjectKey = GetObjectKey( field.mIndex, field.mSubIndex );
+
+    // Make sure that the callback thread sees the transfer
+    AtomicMemoryBarrier();
+}
+
+//------------------------------------------------------------------------------
+void SDOLatencyStats::OnTransferNotQueued( U8 nodeId, const SDOField& field )
+{
+    if ( nodeId < MAX_NUM_NODES )
+    {
+        NodeTransfers& transfers = mNodeTransfers[ nodeId ];
+        TransferRing& ring = ( SDOField::eT_Write == field.mType ? transfers.mWrites : transfers.mReads );
+        AtomicDecrement( &ring.mNumQueued );
+    }
+}
+
+//------------------------------------------------------------------------------
+void SDOLatencyStats::OnWriteComplete( U8 nodeId, U64 timeUS )
+{
+    OnTransferComplete( nodeId, true, timeUS );
+}
+
+//------------------------------------------------------------------------------
+void SDOLatencyStats::OnReadComplete( U8 nodeId, U64 timeUS )
+{
+    OnTransferComplete( nodeId, false, timeUS );
+}
+
+//------------------------------------------------------------------------------
+bool SDOLatencyStats::GetNodeHistogram( U8 nodeId, SDOLatencyHistogram* pHistogramOut ) const
+{
+    if ( nodeId >= MAX_NUM_NODES )
+    {
+        return false;
+    }
+
+    CopyHistogram( mNodeHistograms[ nodeId ], pHistogramOut );
+    return true;
+}
+
+//------------------------------------------------------------------------------
+bool SDOLatencyStats::GetObjectHistogram( U16 index, U8 subIndex, SDOLatencyHistogram* pHistogramOut ) const
+{
+    S32 slotIdx = FindObjectSlot( GetObjectKey( index, subIndex ) );
+    if ( slotIdx < 0 )
+    {
+        return false;
+    }
+
+    CopyHistogram( mObjectHistograms[ slotIdx ], pHistogramOut );
+    return true;
+}
+
+//------------------------------------------------------------------------------
+S32 SDOLatencyStats::GetObjectHistograms( SDOObjectLatencyHistogram* pHistogramsOut, S32 maxNumHistograms ) const
+{
+    S32 numHistograms = 0;
+    for ( S32 slotIdx = 0; slotIdx < MAX_NUM_OBJECTS && numHistograms < maxNumHistograms; slotIdx++ )
+    {
+        U32 objectKey = mObjectKeys[ slotIdx ];
+        if ( 0 != objectKey )
+        {
+            SDOObjectLatencyHistogram* pHistogram = &pHistogramsOut[ numHistograms ];
+            pHistogram->mIndex = (U16)( ( objectKey - 1 ) >> 8 );
+            pHistogram->mSubIndex = (U8)( ( objectKey - 1 ) & 0xFF );
+            CopyHistogram( mObjectHistograms[ slotIdx ], &pHistogram->mHistogram );
+            numHistograms++;
+        }
+    }
+
+    return numHistograms;
+}
+
+//------------------------------------------------------------------------------
+void SDOLatencyStats::OnTransferComplete( U8 nodeId, bool bWrite, U64 timeUS )
+{
+    if ( nodeId >= MAX_NUM_NODES )
+    {
+        return;
+    }
+
+    NodeTransfers& transfers = mNodeTransfers[ nodeId ];
+    TransferRing& ring = ( bWrite ? transfers.mWrites : transfers.mReads );
+    if ( ring.mNumCompleted != ring.mNumQueued )
+    {
+        const PendingTransfer& transfer =
+            ring.mTransfers[ ring.mNumCompleted & ( TRANSFER_RING_SIZE - 1 ) ];
+        RecordLatency( nodeId, transfer.mObjectKey, transfer.mQueueTimeUS, timeUS );
+
+        ring.mNumCompleted++;
+    }
+}
+
+//------------------------------------------------------------------------------
+void SDOLatencyStats::RecordLatency( U8 nodeId, U32 objectKey, U64 queueTimeUS, U64 completionTimeUS )
+{
+    // Guard against a clock that has gone backwards
+    U64 latencyUS = ( completionTimeUS > queueTimeUS ? completionTimeUS - queueTimeUS : 0 );
+
+    AddSample( &mNodeHistograms[ nodeId ], latencyUS );
+
+    S32 slotIdx = ClaimObjectSlot( objectKey );
+    if ( slotIdx >= 0 )
+    {
+        AddSample( &mObjectHistograms[ slotIdx ], latencyUS );
+    }
+    else
+    {
+        AtomicIncrement( &mNumUntrackedObjectSamples );
+    }
+}
+
+//------------------------------------------------------------------------------
+S32 SDOLatencyStats::FindObjectSlot( U32 objectKey ) const
+{
+    U32 mask = MAX_NUM_OBJECTS - 1;
+    U32 slotIdx = HashObjectKey( objectKey ) & mask;
+
+    for ( S32 probeIdx = 0; probeIdx < MAX_NUM_OBJECTS; probeIdx++ )
+    {
+        U32 slotKey = mObjectKeys[ slotIdx ];
+        if ( slotKey == objectKey )
+        {
+            return (S32)slotIdx;
+        }
+        else if ( 0 == slotKey )
+        {
+            break;
+        }
+
+        slotIdx = ( slotIdx + 1 ) & mask;
+    }
+
+    return -1;
+}
+
+//------------------------------------------------------------------------------
+S32 SDOLatencyStats::ClaimObjectSlot( U32 objectKey )
+{
+    U32 mask = MAX_NUM_OBJECTS - 1;
+    U32 slotIdx = HashObjectKey( objectKey ) & mask;
+
+    for ( S32 probeIdx = 0; probeIdx < MAX_NUM_OBJECTS; probeIdx++ )
+    {
+        U32 slotKey = mObjectKeys[ slotIdx ];
+        if ( 0 == slotKey )
+        {
+            slotKey = AtomicCompareAndSwap( &mObjectKeys[ slotIdx ], 0, objectKey );
+            if ( 0 == slotKey )
+            {
+                return (S32)slotIdx;
+            }
+        }
+
+        if ( slotKey == objectKey )
+        {
+            return (S32)slotIdx;
+        }
+
+        slotIdx = ( slotIdx + 1 ) & mask;
+    }
+
+    return -1;
+}
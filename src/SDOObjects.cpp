@@ -0,0 +1,154 @@
+//------------------------------------------------------------------------------
+// File: SDOObjects.cpp
+// Desc: Compact descriptions of the CiA-402 and EPOS objects that are accessed
+//       with SDO transfers, and the commands that write to them.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+#include <assert.h>
+#include "EPOSControl/SDOObjects.h"
+
+//------------------------------------------------------------------------------
+// NOTE: These tables must be kept in the same order as eSDOObject
+const SDOObjectDescriptor SDO_OBJECT_DESCRIPTORS[ eSO_NumObjects ] =
+{
+    { 0x0000, 0, eSDT_U8, 0 },          // eSO_None
+
+    { 0x1010, 1, eSDT_U32, eSOF_Command },     // eSO_StoreParameters
+    { 0x1400, 2, eSDT_U8, 0 },          // eSO_RPDO1TransmissionType
+    { 0x1600, 0, eSDT_U8, 0 },          // eSO_RPDO1NumMappedObjects
+    { 0x1600, 1, eSDT_U32, 0 },         // eSO_RPDO1MappedObject1
+    { 0x1600, 2, eSDT_U32, 0 },         // eSO_RPDO1MappedObject2
+    { 0x1800, 2, eSDT_U8, 0 },          // eSO_TPDO1TransmissionType
+    { 0x1800, 3, eSDT_U16, 0 },         // eSO_TPDO1InhibitTime
+    { 0x1A00, 0, eSDT_U8, 0 },          // eSO_TPDO1NumMappedObjects
+    { 0x1A00, 1, eSDT_U32, 0 },         // eSO_TPDO1MappedObject1
+    { 0x1A00, 2, eSDT_U32, 0 },         // eSO_TPDO1MappedObject2
+
+    { 0x6040, 0, eSDT_U16, eSOF_Command },     // eSO_Controlword
+    { 0x6041, 0, eSDT_U16, 0 },         // eSO_Statusword
+    { 0x6060, 0, eSDT_S8, 0 },          // eSO_ModeOfOperation
+    { 0x6064, 0, eSDT_S32, 0 },         // eSO_PositionActual
+    { 0x6065, 0, eSDT_U32, 0 },         // eSO_MaximumFollowingError
+    { 0x607A, 0, eSDT_S32, 0 },         // eSO_TargetPosition
+    { 0x6081, 0, eSDT_U32, 0 },         // eSO_ProfileVelocity
+    { 0x6083, 0, eSDT_U32, 0 },         // eSO_ProfileAcceleration
+    { 0x6084, 0, eSDT_U32, 0 },         // eSO_ProfileDeceleration
+    { 0x6086, 0, eSDT_S16, 0 },         // eSO_MotionProfileType
+    { 0x60C4, 6, eSDT_U8, eSOF_Command },      // eSO_InterpolationBufferClear
+    { 0x60FF, 0, eSDT_S32, 0 },         // eSO_TargetVelocity
+
+    { 0x2030, 0, eSDT_S16, 0 },         // eSO_CurrentModeSettingValue
+    { 0x20C0, 0, eSDT_S16, 0 },         // eSO_InterpolationSubMode
+    { 0x210C, 0, eSDT_U16, 0 },         // eSO_CustomerStorage
+};
+
+// Names are only needed for debugging, so they're kept apart from the
+// descriptors
+static const char* OBJECT_NAMES[ eSO_NumObjects ] =
+{
+    "None",
+
+    "Store Parameters",
+    "RPDO 1 Transmission Type",
+    "RPDO 1 Num Mapped Objects",
+    "RPDO 1 Mapped Object 1",
+    "RPDO 1 Mapped Object 2",
+    "TPDO 1 Transmission Type",
+    "TPDO 1 Inhibit Time",
+    "TPDO 1 Num Mapped Objects",
+    "TPDO 1 Mapped Object 1",
+    "TPDO 1 Mapped Object 2",
+
+    "Controlword",
+    "Statusword",
+    "Mode of Operation",
+    "Position Actual",
+    "Maximum Following Error",
+    "Target Position",
+    "Profile Velocity",
+    "Profile Acceleration",
+    "Profile Deceleration",
+    "Motion Profile Type",
+    "Interpolation Buffer Clear",
+    "Target Velocity",
+
+    "Current Mode Setting Value",
+    "Interpolation Sub Mode",
+    "Customer Storage",
+};
+
+//------------------------------------------------------------------------------
+const char* SDO_GetObjectName( eSDOObject object )
+{
+    assert( object >= 0 && object < eSO_NumObjects );
+    return OBJECT_NAMES[ object ];
+}
+
+//------------------------------------------------------------------------------
+U32 SDO_GetDataTypeNumBytes( eSDODataType dataType )
+{
+    switch ( dataType )
+    {
+        case eSDT_U8:
+        case eSDT_S8:
+        {
+            return 1;
+        }
+        case eSDT_U16:
+        case eSDT_S16:
+        {
+            return 2;
+        }
+        case eSDT_U32:
+        case eSDT_S32:
+        {
+            return 4;
+        }
+        default:
+        {
+            assert( false && "Unhandled data type" );
+            return 0;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+bool SDO_IsDataTypeSigned( eSDODataType dataType )
+{
+    return ( eSDT_S8 == dataType || eSDT_S16 == dataType || eSDT_S32 == dataType );
+}
+
+//------------------------------------------------------------------------------
+U16 SDO_GetCommandListFingerprint( const SDOCommand* pCommands, const SDOCommand* pMoreCommands )
+{
+    // CRC-16-CCITT over the index, sub index and value of each command
+    U16 crc = 0xFFFF;
+    const SDOCommand* commandLists[ 2 ] = { pCommands, pMoreCommands };
+    for ( U32 listIdx = 0; listIdx < 2 && NULL != commandLists[ listIdx ]; listIdx++ )
+    {
+        const SDOCommand* pList = commandLists[ listIdx ];
+        for ( S32 commandIdx = 0; eSO_None != pList[ commandIdx ].mObject; commandIdx++ )
+        {
+            const SDOCommand& command = pList[ commandIdx ];
+            const SDOObjectDescriptor& descriptor = 
+                SDO_GetObjectDescriptor( (eSDOObject)command.mObject );
+            
+            U8 bytes[ 7 ] = {
+                (U8)( descriptor.mIndex >> 8 ), (U8)descriptor.mIndex, descriptor.mSubIndex,
+                (U8)( command.mData >> 24 ), (U8)( command.mData >> 16 ), 
+                (U8)( command.mData >> 8 ), (U8)command.mData };
+            
+            for ( U32 byteIdx = 0; byteIdx < sizeof( bytes ); byteIdx++ )
+            {
+                crc ^= (U16)bytes[ byteIdx ] << 8;
+                for ( S32 bitIdx = 0; bitIdx < 8; bitIdx++ )
+                {
+                    crc = ( crc & 0x8000 ? (U16)( ( crc << 1 ) ^ 0x1021 ) : (U16)( crc << 1 ) );
+                }
+            }
+        }
+    }
+    
+    return ( 0 != crc ? crc : 1 );
+}
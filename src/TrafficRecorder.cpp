@@ -0,0 +1,529 @@
+//------------------------------------------------------------------------------
+// File: TrafficRecorder.cpp
+// Desc: Records the traffic between a CANChannel and the CAN Open library into
+//       a capture file, and replays captures back into a CANChannel.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "EPOSControl/TrafficRecorder.h"
+#include "EPOSControl/CANChannel.h"
+#include "Atomic.h"
+
+//------------------------------------------------------------------------------
+COMPILE_TIME_ASSERT( sizeof( TrafficRecord ) == 32 );
+COMPILE_TIME_ASSERT( sizeof( TrafficCaptureHeader ) == 64 );
+
+// Keeps the mapped size within a U32
+static const U32 MAX_NUM_RECORD_SLOTS = ( 0xFFFFFFFF - sizeof( TrafficCaptureHeader ) )/sizeof( TrafficRecord );
+
+//------------------------------------------------------------------------------
+static U64 GetMonotonicTimeNanoseconds()
+{
+    timespec time;
+    clock_gettime( CLOCK_MONOTONIC, &time );
+    return (U64)time.tv_sec*1000000000 + (U64)time.tv_nsec;
+}
+
+//------------------------------------------------------------------------------
+static S32 ReadS32( const U8* pData )
+{
+    S32 value;
+    memcpy( &value, pData, sizeof( value ) );
+    return value;
+}
+
+//------------------------------------------------------------------------------
+// TrafficRecorder
+//------------------------------------------------------------------------------
+TrafficRecorder::TrafficRecorder()
+    : mbRecording( false ),
+    mNumActiveWriters( 0 ),
+    mpHeader( NULL ),
+    mpRecords( NULL ),
+    mNumRecordSlots( 0 ),
+    mMappedSize( 0 )
+{
+}
+
+//------------------------------------------------------------------------------
+TrafficRecorder::~TrafficRecorder()
+{
+    Close();
+}
+
+//------------------------------------------------------------------------------
+bool TrafficRecorder::Open( const char* filename, U32 numRecordSlots, U64 startTimeUS )
+{
+    bool bResult = false;
+    S32 fileDescriptor = -1;
+    void* pMapping = MAP_FAILED;
+
+    Close();
+
+    if ( 0 == numRecordSlots || numRecordSlots > MAX_NUM_RECORD_SLOTS )
+    {
+        fprintf( stderr, "Error: Invalid number of traffic record slots\n" );
+        goto Finished;
+    }
+
+    mMappedSize = sizeof( TrafficCaptureHeader ) + numRecordSlots*sizeof( TrafficRecord );
+
+    fileDescriptor = open( filename, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    if ( fileDescriptor < 0 )
+    {
+        fprintf( stderr, "Error: Unable to create traffic capture %s\n", filename );
+        goto Finished;
+    }
+
+    // The file is zero filled, so every slot starts off as an incomplete record
+    if ( 0 != ftruncate( fileDescriptor, mMappedSize ) )
+    {
+        fprintf( stderr, "Error: Unable to size traffic capture %s\n", filename );
+        goto Finished;
+    }
+
+    pMapping = mmap( NULL, mMappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fileDescriptor, 0 );
+    if ( MAP_FAILED == pMapping )
+    {
+        fprintf( stderr, "Error: Unable to map traffic capture %s\n", filename );
+        goto Finished;
+    }
+
+    mpHeader = (TrafficCaptureHeader*)pMapping;
+    mpRecords = (TrafficRecord*)( mpHeader + 1 );
+    mNumRecordSlots = numRecordSlots;
+
+    mpHeader->mMagic = CAPTURE_MAGIC;
+    mpHeader->mVersion = CAPTURE_VERSION;
+    mpHeader->mRecordSize = sizeof( TrafficRecord );
+    mpHeader->mNumRecordSlots = numRecordSlots;
+    mpHeader->mNumRecordsWritten = 0;
+    mpHeader->mStartTimeUS = startTimeUS;
+
+    AtomicMemoryBarrier();
+    mbRecording = true;
+    bResult = true;
+
+Finished:
+    // The mapping keeps the file open
+    if ( fileDescriptor >= 0 )
+    {
+        close( fileDescriptor );
+    }
+
+    return bResult;
+}
+
+//------------------------------------------------------------------------------
+void TrafficRecorder::Close()
+{
+    if ( NULL != mpHeader )
+    {
+        mbRecording = false;
+        AtomicMemoryBarrier();
+
+        // Writers check the flag after registering themselves, so once the
+        // count drops to 0 nobody can be using the mapping
+        while ( 0 != mNumActiveWriters )
+        {
+            sched_yield();
+        }
+
+        munmap( mpHeader, mMappedSize );
+        mpHeader = NULL;
+        mpRecords = NULL;
+        mNumRecordSlots = 0;
+        mMappedSize = 0;
+    }
+}
+
+//------------------------------------------------------------------------------
+void TrafficRecorder::Record( eTrafficRecordType type, U8 nodeId, U16 index, U8 subIndex,
+                              const void* pData, U32 numBytes, U64 timeUS )
+{
+    if ( !mbRecording )
+    {
+        return;
+    }
+
+    AtomicIncrement( &mNumActiveWriters );
+    if ( mbRecording )
+    {
+        U64 sequenceIdx = AtomicAdd( &mpHeader->mNumRecordsWritten, 1 ) - 1;
+        TrafficRecord* pRecord = &mpRecords[ sequenceIdx % mNumRecordSlots ];
+
+        // Mark the slot as incomplete whilst it's being overwritten
+        pRecord->mSequence = 0;
+        AtomicMemoryBarrier();
+
+        if ( numBytes > sizeof( pRecord->mData ) )
+        {
+            numBytes = sizeof( pRecord->mData );
+        }
+
+        pRecord->mTimeUS = timeUS;
+        pRecord->mType = (U8)type;
+        pRecord->mNodeId = nodeId;
+        pRecord->mSubIndex = subIndex;
+        pRecord->mNumBytes = (U8)numBytes;
+        pRecord->mIndex = index;
+        memset( pRecord->mReserved, 0, sizeof( pRecord->mReserved ) );
+        memset( pRecord->mData, 0, sizeof( pRecord->mData ) );
+        if ( NULL != pData )
+        {
+            memcpy( pRecord->mData, pData, numBytes );
+        }
+
+        AtomicMemoryBarrier();
+        pRecord->mSequence = (U32)( sequenceIdx + 1 );
+    }
+    AtomicDecrement( &mNumActiveWriters );
+}
+
+//------------------------------------------------------------------------------
+// TrafficReplayer
+//------------------------------------------------------------------------------
+TrafficReplayer::TrafficReplayer()
+    : mpHeader( NULL ),
+    mpRecords( NULL ),
+    mMappedSize( 0 ),
+    mFirstSequenceIdx( 0 ),
+    mEndSequenceIdx( 0 ),
+    mNextSequenceIdx( 0 ),
+    mTimeUS( 0 )
+{
+    memset( &mStats, 0, sizeof( mStats ) );
+}
+
+//------------------------------------------------------------------------------
+TrafficReplayer::~TrafficReplayer()
+{
+    Close();
+}
+
+//------------------------------------------------------------------------------
+bool TrafficReplayer::Open( const char* filename )
+{
+    bool bResult = false;
+    struct stat fileStats;
+    void* pMapping = MAP_FAILED;
+
+    Close();
+
+    S32 fileDescriptor = open( filename, O_RDONLY );
+    if ( fileDescriptor < 0 )
+    {
+        fprintf( stderr, "Error: Unable to open traffic capture %s\n", filename );
+        goto Finished;
+    }
+
+    if ( 0 != fstat( fileDescriptor, &fileStats )
+        || fileStats.st_size < (off_t)sizeof( TrafficCaptureHeader ) )
+    {
+        fprintf( stderr, "Error: %s is too small to be a traffic capture\n", filename );
+        goto Finished;
+    }
+
+    pMapping = mmap( NULL, fileStats.st_size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0 );
+    if ( MAP_FAILED == pMapping )
+    {
+        fprintf( stderr, "Error: Unable to map traffic capture %s\n", filename );
+        goto Finished;
+    }
+
+    mpHeader = (const TrafficCaptureHeader*)pMapping;
+    mpRecords = (const TrafficRecord*)( mpHeader + 1 );
+    mMappedSize = (U32)fileStats.st_size;
+
+    if ( TrafficRecorder::CAPTURE_MAGIC != mpHeader->mMagic
+        || TrafficRecorder::CAPTURE_VERSION != mpHeader->mVersion
+        || sizeof( TrafficRecord ) != mpHeader->mRecordSize
+        || 0 == mpHeader->mNumRecordSlots
+        || mMappedSize < sizeof( TrafficCaptureHeader ) + (U64)mpHeader->mNumRecordSlots*sizeof( TrafficRecord ) )
+    {
+        fprintf( stderr, "Error: %s is not a valid traffic capture\n", filename );
+        goto Finished;
+    }
+
+    // Only the last mNumRecordSlots records are still in the ring
+    mEndSequenceIdx = mpHeader->mNumRecordsWritten;
+    mFirstSequenceIdx = 0;
+    if ( mEndSequenceIdx > mpHeader->mNumRecordSlots )
+    {
+        mFirstSequenceIdx = mEndSequenceIdx - mpHeader->mNumRecordSlots;
+    }
+    mNextSequenceIdx = mFirstSequenceIdx;
+    mTimeUS = mpHeader->mStartTimeUS;
+
+    memset( &mStats, 0, sizeof( mStats ) );
+    for ( U64 sequenceIdx = mFirstSequenceIdx; sequenceIdx < mEndSequenceIdx; sequenceIdx++ )
+    {
+        const TrafficRecord& record = mpRecords[ sequenceIdx % mpHeader->mNumRecordSlots ];
+        if ( (U32)( sequenceIdx + 1 ) == record.mSequence )
+        {
+            mStats.mNumRecords++;
+        }
+    }
+
+    bResult = true;
+
+Finished:
+    if ( fileDescriptor >= 0 )
+    {
+        close( fileDescriptor );
+    }
+
+    if ( !bResult && MAP_FAILED != pMapping )
+    {
+        munmap( pMapping, fileStats.st_size );
+        mpHeader = NULL;
+        mpRecords = NULL;
+        mMappedSize = 0;
+    }
+
+    return bResult;
+}
+
+//------------------------------------------------------------------------------
+void TrafficReplayer::Close()
+{
+    if ( NULL != mpHeader )
+    {
+        munmap( (void*)mpHeader, mMappedSize );
+        mpHeader = NULL;
+        mpRecords = NULL;
+        mMappedSize = 0;
+    }
+}
+
+//------------------------------------------------------------------------------
+bool TrafficReplayer::ReplayNextUpdate( CANChannel* pChannel )
+{
+    if ( NULL == mpHeader )
+    {
+        return false;
+    }
+
+    while ( mNextSequenceIdx < mEndSequenceIdx )
+    {
+        U64 sequenceIdx = mNextSequenceIdx++;
+        const TrafficRecord& record = mpRecords[ sequenceIdx % mpHeader->mNumRecordSlots ];
+        if ( (U32)( sequenceIdx + 1 ) != record.mSequence )
+        {
+            mStats.mNumRecordsSkipped++;
+            continue;
+        }
+
+        mTimeUS = record.mTimeUS;
+
+        if ( eTRT_Update == record.mType )
+        {
+            U64 startTimeNS = GetMonotonicTimeNanoseconds();
+            pChannel->Update( record.mTimeUS );
+            U64 updateTimeNS = GetMonotonicTimeNanoseconds() - startTimeNS;
+
+            mStats.mNumRecordsReplayed++;
+            mStats.mNumUpdates++;
+            mStats.mTotalUpdateTimeNS += updateTimeNS;
+            if ( updateTimeNS > mStats.mMaxUpdateTimeNS )
+            {
+                mStats.mMaxUpdateTimeNS = updateTimeNS;
+            }
+
+            return true;
+        }
+
+        ReplayRecord( pChannel, record );
+    }
+
+    return false;
+}
+
+//------------------------------------------------------------------------------
+void TrafficReplayer::ReplayRecord( CANChannel* pChannel, const TrafficRecord& record )
+{
+    bool bReplayed = true;
+    U8 data[ sizeof( record.mData ) ];
+    memcpy( data, record.mData, sizeof( data ) );
+
+    switch ( record.mType )
+    {
+        case eTRT_SdoWriteComplete:
+        case eTRT_SdoReadComplete:
+        {
+            // If the channel has gone down a different path to the recorded
+            // one then it may not be waiting for the completion
+            bool bWrite = ( eTRT_SdoWriteComplete == record.mType );
+            if ( !pChannel->IsSDOTransferActive( record.mNodeId, bWrite ) )
+            {
+                mStats.mNumUnmatchedCompletions++;
+                bReplayed = false;
+            }
+            else if ( bWrite )
+            {
+                pChannel->OnSDOFieldWriteComplete( record.mNodeId );
+            }
+            else
+            {
+                pChannel->OnSDOFieldReadComplete( record.mNodeId, data, record.mNumBytes );
+            }
+            break;
+        }
+        case eTRT_Emergency:
+        {
+            pChannel->OnCANOpenPostEmergency( record.mNodeId, record.mIndex, data[ 0 ] );
+            break;
+        }
+        case eTRT_Bootup:
+        {
+            pChannel->OnCANOpenPostSlaveBootup( record.mNodeId );
+            break;
+        }
+        case eTRT_PdoReceived:
+        {
+            pChannel->OnCANOpenPDOReceived( record.mIndex, data, record.mNumBytes );
+            break;
+        }
+        case eTRT_ClientCommand:
+        {
+            ReplayClientCommand( pChannel, record );
+            break;
+        }
+        default:
+        {
+            // Messages sent by the recorded channel
+            bReplayed = false;
+        }
+    }
+
+    if ( bReplayed )
+    {
+        mStats.mNumRecordsReplayed++;
+    }
+    else
+    {
+        mStats.mNumRecordsSkipped++;
+    }
+}
+
+//------------------------------------------------------------------------------
+void TrafficReplayer::ReplayClientCommand( CANChannel* pChannel, const TrafficRecord& record )
+{
+    S32 argument = ReadS32( record.mData );
+
+    switch ( record.mIndex )
+    {
+        case eTCC_SetMotorAngle:
+        {
+            pChannel->SetMotorAngle( record.mNodeId, argument );
+            break;
+        }
+        case eTCC_SetMotorProfileVelocity:
+        {
+            pChannel->SetMotorProfileVelocity( record.mNodeId, (U32)argument );
+            break;
+        }
+        case eTCC_SetMaximumFollowingError:
+        {
+            pChannel->SetMaximumFollowingError( record.mNodeId, (U32)argument );
+            break;
+        }
+        case eTCC_SendFaultReset:
+        {
+            pChannel->SendFaultReset( record.mNodeId );
+            break;
+        }
+        case eTCC_SetFeedbackMode:
+        {
+            pChannel->SetFeedbackMode( record.mNodeId, (CANMotorController::eFeedbackMode)argument );
+            break;
+        }
+        case eTCC_SetSetpointMode:
+        {
+            pChannel->SetSetpointMode( record.mNodeId, (CANMotorController::eSetpointMode)argument );
+            break;
+        }
+        case eTCC_ConfigurePositionControl:
+        {
+            pChannel->ConfigureAllMotorControllersForPositionControl();
+            break;
+        }
+        case eTCC_SetConfigurationMode:
+        {
+            pChannel->SetConfigurationMode( record.mNodeId, (CANMotorController::eConfigurationMode)argument );
+            break;
+        }
+        case eTCC_SetMaxNumNodesSettingUp:
+        {
+            pChannel->SetMaxNumNodesSettingUp( (U32)argument );
+            break;
+        }
+        case eTCC_SetDeferPollingDuringSetUp:
+        {
+            pChannel->SetDeferPollingDuringSetUp( 0 != argument );
+            break;
+        }
+        case eTCC_ConfigureInterpolatedPositionControl:
+        {
+            pChannel->ConfigureAllMotorControllersForInterpolatedPositionControl();
+            break;
+        }
+        case eTCC_QueueTrajectoryPoint:
+        {
+            TrajectoryPoint point = CANMotorController::UnpackTrajectoryPoint( record.mData );
+            pChannel->QueueTrajectoryPoints( record.mNodeId, &point, 1 );
+            break;
+        }
+        case eTCC_ConfigureVelocityControl:
+        {
+            pChannel->ConfigureAllMotorControllersForVelocityControl();
+            break;
+        }
+        case eTCC_ConfigureCurrentControl:
+        {
+            pChannel->ConfigureAllMotorControllersForCurrentControl();
+            break;
+        }
+        case eTCC_SetMotorVelocity:
+        {
+            pChannel->SetMotorVelocity( record.mNodeId, argument );
+            break;
+        }
+        case eTCC_SetMotorCurrent:
+        {
+            pChannel->SetMotorCurrent( record.mNodeId, (S16)argument );
+            break;
+        }
+        case eTCC_SetSetpointFilter:
+        {
+            SetpointFilter filter;
+            memcpy( &filter, record.mData, sizeof( filter ) );
+            pChannel->SetSetpointFilter( record.mNodeId, filter );
+            break;
+        }
+        case eTCC_SetBusLoadBudget:
+        {
+            float budget;
+            memcpy( &budget, record.mData, sizeof( budget ) );
+            pChannel->SetBusLoadBudget( budget );
+            break;
+        }
+        case eTCC_SetStatusWatchdogInterval:
+        {
+            pChannel->SetStatusWatchdogInterval( (U32)argument );
+            break;
+        }
+        default:
+        {
+            fprintf( stderr, "Warning: Unknown client command %i in traffic capture\n", record.mIndex );
+        }
+    }
+}
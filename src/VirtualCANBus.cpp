@@ -0,0 +1,1663 @@
+//------------------------------------------------------------------------------
+// File: VirtualCANBus.cpp
+// Desc: An implementation of the CAN Open interface which talks to simulated
+//       EPOS motor controllers on an in-process virtual bus, instead of using
+//       the CanOpenMaster library.
+//
+//       Each channel has its own bus with a virtual clock and a queue of
+//       timestamped events. Messages from the CANChannel and the nodes are
+//       turned into frames which become ready to send after the transmit
+//       latency. The bus sends one frame at a time, choosing the ready frame
+//       with the lowest COB-ID as CAN arbitration would, and the frame
+//       arrives once the time to send it at the bus bit rate has passed.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include "CANOpenInterface.h"
+#include "EPOSControl/VirtualCANBus.h"
+
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+static const S32 MAX_NUM_NODES = 128;
+static const S32 MAX_NUM_OBJECTS = 48;
+static const S32 MAX_NUM_EVENTS = 8192;
+static const S32 MAX_NUM_PENDING_FRAMES = 4096;
+static const S32 MAX_NUM_MAPPED_OBJECTS = 8;
+static const S32 INTERPOLATION_BUFFER_SIZE = 64;
+
+static const U16 NMT_START_NODE = 0x01;
+static const U16 NMT_RESET_NODE = 0x81;
+
+static const U16 NMT_COB_ID = 0x000;
+static const U16 SYNC_COB_ID = 0x080;
+static const U16 EMCY_COB_ID_BASE = 0x080;
+static const U16 TPDO_1_COB_ID_BASE = 0x180;
+static const U16 RPDO_1_COB_ID_BASE = 0x200;
+static const U16 SDO_RESPONSE_COB_ID_BASE = 0x580;
+static const U16 SDO_REQUEST_COB_ID_BASE = 0x600;
+static const U16 BOOTUP_COB_ID_BASE = 0x700;
+
+static const U8 SDO_FRAME_NUM_BYTES = 8;
+
+static const U32 STORE_PARAMETERS_SIGNATURE = 0x65766173;  // 'save'
+
+static const U32 BIT_RATES[] = 
+{
+    1000000,
+    500000,
+    250000,
+    125000,
+    100000,
+    50000,
+    20000,
+    10000,
+    5000
+};
+COMPILE_TIME_ASSERT( ARRAY_LENGTH( BIT_RATES ) == eBR_NumBaudRates );
+
+// Transmission types above this are event driven rather than synchronous
+static const U8 MAX_SYNC_TRANSMISSION_TYPE = 240;
+
+// Statuswords for each state of the CiA 402 state machine
+static const U16 STATUSWORD_SWITCH_ON_DISABLED = 0x0140;
+static const U16 STATUSWORD_READY_TO_SWITCH_ON = 0x0121;
+static const U16 STATUSWORD_SWITCHED_ON = 0x0123;
+static const U16 STATUSWORD_OPERATION_ENABLED = 0x0137;
+static const U16 STATUSWORD_FAULT = 0x0108;
+
+static const U16 STATUSWORD_TARGET_REACHED = 0x0400;
+static const U16 STATUSWORD_SETPOINT_ACKNOWLEDGE = 0x1000;
+static const U16 STATUSWORD_IP_MODE_ACTIVE = 0x1000;
+
+static const U16 CONTROLWORD_NEW_SETPOINT = 0x0010;
+static const U16 CONTROLWORD_ENABLE_IP_MODE = 0x0010;
+static const U16 CONTROLWORD_CHANGE_SET_IMMEDIATELY = 0x0020;
+static const U16 CONTROLWORD_RELATIVE = 0x0040;
+static const U16 CONTROLWORD_FAULT_RESET = 0x0080;
+static const U16 CONTROLWORD_HALT = 0x0100;
+
+static const S8 MODE_PROFILE_POSITION = 1;
+static const S8 MODE_INTERPOLATED_POSITION = 7;
+static const S8 MODE_PROFILE_VELOCITY = 3;
+static const S8 MODE_CURRENT = -3;
+
+// Bits of the Interpolation Buffer Status (0x20C4:1)
+static const U16 IP_BUFFER_STATUS_UNDERFLOW_WARNING = 0x0001;
+static const U16 IP_BUFFER_STATUS_OVERFLOW_ERROR = 0x0200;
+static const U16 IP_BUFFER_STATUS_ENABLED = 0x8000;
+
+//------------------------------------------------------------------------------
+// Types
+//------------------------------------------------------------------------------
+enum eDriveState
+{
+    eDS_SwitchOnDisabled,
+    eDS_ReadyToSwitchOn,
+    eDS_SwitchedOn,
+    eDS_OperationEnabled,
+    eDS_Fault
+};
+
+//------------------------------------------------------------------------------
+enum eEventType
+{
+    eET_FrameReady,         // A frame is ready to be sent on the bus
+    eET_NodeBooted,         // A node has finished booting
+    eET_MotionStep,         // The motion of the nodes is simulated
+    
+    // Frames arriving at the nodes
+    eET_NmtArrival,
+    eET_SyncArrival,
+    eET_RPDOArrival,
+    eET_SdoRequestArrival,
+    
+    // Frames arriving at the channel
+    eET_BootupArrival,
+    eET_SdoWriteResponseArrival,
+    eET_SdoReadResponseArrival,
+    eET_TPDOArrival,
+    eET_EmergencyArrival
+};
+
+//------------------------------------------------------------------------------
+struct VirtualEvent
+{
+    U64 mTimeUS;
+    U32 mSequenceIdx;       // Keeps events at the same time in the order they were queued
+    eEventType mType;
+    
+    // For frames, the type of event that happens when the frame arrives
+    eEventType mFrameType;
+    U16 mCobId;
+    U8 mFrameNumBytes;
+    
+    U8 mNodeId;
+    U16 mIndex;             // Object index for SDOs, command for NMT
+    U8 mSubIndex;
+    bool mbWrite;           // For SDO requests
+    U8 mData[ 8 ];
+    U8 mNumBytes;
+};
+
+//------------------------------------------------------------------------------
+struct VirtualObject
+{
+    U16 mIndex;
+    U8 mSubIndex;
+    U8 mNumBytes;
+    U32 mValue;
+};
+
+//------------------------------------------------------------------------------
+// A point in the buffer of a node in interpolated position mode
+struct InterpolationPoint
+{
+    S32 mPosition;
+    S32 mVelocity;      // In rpm
+    U8 mTimeMS;         // Time from the previous point
+};
+
+//------------------------------------------------------------------------------
+struct VirtualNode
+{
+    bool mbPresent;
+    bool mbBooted;
+    eNMT_State mNMTState;
+    eDriveState mDriveState;
+    U16 mControlword;
+    bool mbSetpointAcknowledged;
+
+    S32 mPosition;
+    S64 mPositionRemainder;     // Fraction of a count left over from the last motion step
+    S32 mTargetPosition;
+    bool mbMoving;
+    S32 mVelocity;              // In rpm, only simulated in profile velocity mode
+    U64 mLastSetpointTimeUS;
+    U32 mNumSetpoints;
+
+    // Interpolated position mode. The node moves along a cubic from the 
+    // start of the segment to the point at the head of the buffer.
+    InterpolationPoint mInterpolationBuffer[ INTERPOLATION_BUFFER_SIZE ];
+    S32 mInterpolationBufferStartIdx;
+    S32 mNumInterpolationPoints;
+    U16 mInterpolationBufferStatus;
+    bool mbInterpolationActive;
+    S32 mSegmentStartPosition;
+    S32 mSegmentStartVelocity;
+    U64 mSegmentElapsedUS;
+    U32 mNumInterpolationPointsReached;
+
+    U64 mSdoFreeTimeUS;         // Nodes only handle one SDO transfer at a time
+    U32 mNumShortSdoReadReplies;    // Replies to reads still to be cut short
+
+    bool mbRPDOPending;         // Synchronous RPDO waiting for a SYNC
+    U8 mPendingRPDOData[ 8 ];
+    U8 mPendingRPDONumBytes;
+
+    bool mbTPDOSent;
+    U8 mLastTPDOData[ 8 ];
+    U8 mLastTPDONumBytes;
+    U64 mLastTPDOTimeUS;
+
+    VirtualObject mObjects[ MAX_NUM_OBJECTS ];
+    S32 mNumObjects;
+};
+
+//------------------------------------------------------------------------------
+struct VirtualBus
+{
+    CANChannel* mpChannel;
+    VirtualCANBusConfig mConfig;
+    pthread_mutex_t mMutex;     // Recursive, as callbacks queue more messages
+
+    U64 mTimeUS;
+    U32 mNextSequenceIdx;
+    VirtualCANBusStats mStats;
+
+    VirtualEvent* mpEvents;     // Binary heap ordered by time
+    S32 mNumEvents;
+    
+    U32 mBitRate;
+    bool mbBusBusy;
+    VirtualEvent* mpPendingFrames;  // Frames which are ready but waiting for the bus
+    S32 mNumPendingFrames;
+
+    VirtualNode mNodes[ MAX_NUM_NODES ];
+};
+
+//------------------------------------------------------------------------------
+// Globals
+//------------------------------------------------------------------------------
+static bool gbCANOpenStarted = false;
+static bool gbConfigSet = false;
+static VirtualCANBusConfig gConfig;
+
+// The parameters saved by the nodes with Store Parameters. This is shared 
+// by all virtual buses and outlives them, in the same way that the 
+// non-volatile memory of a real node outlives the program talking to it.
+struct StoredParameters
+{
+    VirtualObject mObjects[ MAX_NUM_OBJECTS ];
+    S32 mNumObjects;
+};
+
+static pthread_mutex_t gStoredParametersMutex = PTHREAD_MUTEX_INITIALIZER;
+static StoredParameters gStoredParameters[ MAX_NUM_NODES ];
+
+//------------------------------------------------------------------------------
+// Event queue
+//------------------------------------------------------------------------------
+static bool IsEventEarlier( const VirtualEvent& a, const VirtualEvent& b )
+{
+    return a.mTimeUS < b.mTimeUS
+        || ( a.mTimeUS == b.mTimeUS && a.mSequenceIdx < b.mSequenceIdx );
+}
+
+//------------------------------------------------------------------------------
+static VirtualEvent* PushEvent( VirtualBus* pBus, eEventType type, U64 timeUS, U8 nodeId )
+{
+    if ( pBus->mNumEvents >= MAX_NUM_EVENTS )
+    {
+        pBus->mStats.mNumRejectedMessages++;
+        return NULL;
+    }
+
+    VirtualEvent event;
+    memset( &event, 0, sizeof( event ) );
+    event.mTimeUS = timeUS;
+    event.mSequenceIdx = pBus->mNextSequenceIdx++;
+    event.mType = type;
+    event.mNodeId = nodeId;
+
+    // Sift up
+    S32 eventIdx = pBus->mNumEvents++;
+    while ( eventIdx > 0 )
+    {
+        S32 parentIdx = ( eventIdx - 1 )/2;
+        if ( !IsEventEarlier( event, pBus->mpEvents[ parentIdx ] ) )
+        {
+            break;
+        }
+
+        pBus->mpEvents[ eventIdx ] = pBus->mpEvents[ parentIdx ];
+        eventIdx = parentIdx;
+    }
+
+    pBus->mpEvents[ eventIdx ] = event;
+    return &pBus->mpEvents[ eventIdx ];
+}
+
+//------------------------------------------------------------------------------
+static void PopEvent( VirtualBus* pBus, VirtualEvent* pEventOut )
+{
+    assert( pBus->mNumEvents > 0 );
+
+    *pEventOut = pBus->mpEvents[ 0 ];
+
+    // Sift the last event down from the top
+    pBus->mNumEvents--;
+    const VirtualEvent& lastEvent = pBus->mpEvents[ pBus->mNumEvents ];
+    S32 eventIdx = 0;
+    while ( true )
+    {
+        S32 childIdx = 2*eventIdx + 1;
+        if ( childIdx >= pBus->mNumEvents )
+        {
+            break;
+        }
+
+        if ( childIdx + 1 < pBus->mNumEvents
+            && IsEventEarlier( pBus->mpEvents[ childIdx + 1 ], pBus->mpEvents[ childIdx ] ) )
+        {
+            childIdx++;
+        }
+
+        if ( !IsEventEarlier( pBus->mpEvents[ childIdx ], lastEvent ) )
+        {
+            break;
+        }
+
+        pBus->mpEvents[ eventIdx ] = pBus->mpEvents[ childIdx ];
+        eventIdx = childIdx;
+    }
+
+    pBus->mpEvents[ eventIdx ] = lastEvent;
+}
+
+//------------------------------------------------------------------------------
+// Bus arbitration
+//------------------------------------------------------------------------------
+static U64 GetFrameTimeUS( VirtualBus* pBus, U8 numBytes )
+{
+    // A standard frame has 47 bits of framing, plus the data, plus worst case
+    // stuff bits over the part of the frame that is stuffed
+    U32 numBits = 47 + 8*numBytes + ( 34 + 8*numBytes - 1 )/4;
+    return ( (U64)numBits*1000000 + pBus->mBitRate - 1 )/pBus->mBitRate;
+}
+
+//------------------------------------------------------------------------------
+// Queues a frame which will be ready to send after the transmit latency. The
+// returned event should be filled in with the contents of the frame.
+static VirtualEvent* QueueFrame( VirtualBus* pBus, eEventType frameType, U16 cobId,
+                                 U8 nodeId, U8 frameNumBytes, U64 readyTimeUS )
+{
+    VirtualEvent* pEvent = PushEvent( pBus, eET_FrameReady, 
+        readyTimeUS + pBus->mConfig.mTransmitLatencyUS, nodeId );
+    if ( NULL != pEvent )
+    {
+        pEvent->mFrameType = frameType;
+        pEvent->mCobId = cobId;
+        pEvent->mFrameNumBytes = frameNumBytes;
+    }
+    
+    return pEvent;
+}
+
+//------------------------------------------------------------------------------
+// If the bus is free, starts sending the pending frame that would win
+// arbitration
+static void StartNextFrame( VirtualBus* pBus )
+{
+    if ( pBus->mbBusBusy || 0 == pBus->mNumPendingFrames )
+    {
+        return;
+    }
+    
+    S32 bestFrameIdx = 0;
+    for ( S32 frameIdx = 1; frameIdx < pBus->mNumPendingFrames; frameIdx++ )
+    {
+        const VirtualEvent& frame = pBus->mpPendingFrames[ frameIdx ];
+        const VirtualEvent& bestFrame = pBus->mpPendingFrames[ bestFrameIdx ];
+        if ( frame.mCobId < bestFrame.mCobId
+            || ( frame.mCobId == bestFrame.mCobId && frame.mSequenceIdx < bestFrame.mSequenceIdx ) )
+        {
+            bestFrameIdx = frameIdx;
+        }
+    }
+    
+    VirtualEvent frame = pBus->mpPendingFrames[ bestFrameIdx ];
+    pBus->mNumPendingFrames--;
+    pBus->mpPendingFrames[ bestFrameIdx ] = pBus->mpPendingFrames[ pBus->mNumPendingFrames ];
+    
+    U64 frameTimeUS = GetFrameTimeUS( pBus, frame.mFrameNumBytes );
+    VirtualEvent* pArrivalEvent = PushEvent( pBus, frame.mFrameType,
+        pBus->mTimeUS + frameTimeUS, frame.mNodeId );
+    if ( NULL == pArrivalEvent )
+    {
+        return;
+    }
+    
+    U64 arrivalTimeUS = pArrivalEvent->mTimeUS;
+    U32 sequenceIdx = pArrivalEvent->mSequenceIdx;
+    *pArrivalEvent = frame;
+    pArrivalEvent->mTimeUS = arrivalTimeUS;
+    pArrivalEvent->mSequenceIdx = sequenceIdx;
+    pArrivalEvent->mType = frame.mFrameType;
+    
+    pBus->mbBusBusy = true;
+    pBus->mStats.mBusBusyTimeUS += frameTimeUS;
+    if ( frame.mFrameType >= eET_BootupArrival )
+    {
+        pBus->mStats.mNumFramesFromNodes++;
+    }
+    else
+    {
+        pBus->mStats.mNumFramesToNodes++;
+    }
+}
+
+//------------------------------------------------------------------------------
+static void AddPendingFrame( VirtualBus* pBus, const VirtualEvent& frame )
+{
+    if ( pBus->mNumPendingFrames >= MAX_NUM_PENDING_FRAMES )
+    {
+        pBus->mStats.mNumRejectedMessages++;
+        return;
+    }
+    
+    pBus->mpPendingFrames[ pBus->mNumPendingFrames++ ] = frame;
+    StartNextFrame( pBus );
+}
+
+//------------------------------------------------------------------------------
+// Object dictionary
+//------------------------------------------------------------------------------
+static VirtualObject* FindObject( VirtualNode* pNode, U16 index, U8 subIndex )
+{
+    for ( S32 objectIdx = 0; objectIdx < pNode->mNumObjects; objectIdx++ )
+    {
+        VirtualObject* pObject = &pNode->mObjects[ objectIdx ];
+        if ( pObject->mIndex == index && pObject->mSubIndex == subIndex )
+        {
+            return pObject;
+        }
+    }
+
+    return NULL;
+}
+
+//------------------------------------------------------------------------------
+static U32 GetObjectValue( VirtualNode* pNode, U16 index, U8 subIndex, U32 defaultValue=0 )
+{
+    VirtualObject* pObject = FindObject( pNode, index, subIndex );
+    return ( NULL != pObject ? pObject->mValue : defaultValue );
+}
+
+//------------------------------------------------------------------------------
+static void SetObjectValue( VirtualNode* pNode, U16 index, U8 subIndex, U32 value, U8 numBytes )
+{
+    VirtualObject* pObject = FindObject( pNode, index, subIndex );
+    if ( NULL == pObject )
+    {
+        if ( pNode->mNumObjects >= MAX_NUM_OBJECTS )
+        {
+            fprintf( stderr, "Warning: Virtual node has run out of space for objects\n" );
+            return;
+        }
+
+        pObject = &pNode->mObjects[ pNode->mNumObjects++ ];
+        pObject->mIndex = index;
+        pObject->mSubIndex = subIndex;
+    }
+
+    pObject->mNumBytes = numBytes;
+    pObject->mValue = value;
+}
+
+//------------------------------------------------------------------------------
+static U16 GetStatusword( const VirtualNode* pNode )
+{
+    U16 statusword = STATUSWORD_SWITCH_ON_DISABLED;
+    switch ( pNode->mDriveState )
+    {
+        case eDS_SwitchOnDisabled: statusword = STATUSWORD_SWITCH_ON_DISABLED; break;
+        case eDS_ReadyToSwitchOn: statusword = STATUSWORD_READY_TO_SWITCH_ON; break;
+        case eDS_SwitchedOn: statusword = STATUSWORD_SWITCHED_ON; break;
+        case eDS_OperationEnabled: statusword = STATUSWORD_OPERATION_ENABLED; break;
+        case eDS_Fault: statusword = STATUSWORD_FAULT; break;
+        default:
+        {
+            assert( false && "Unhandled drive state" );
+        }
+    }
+
+    if ( eDS_OperationEnabled == pNode->mDriveState && !pNode->mbMoving )
+    {
+        statusword |= STATUSWORD_TARGET_REACHED;
+    }
+    if ( pNode->mbSetpointAcknowledged )
+    {
+        statusword |= STATUSWORD_SETPOINT_ACKNOWLEDGE;
+    }
+    if ( pNode->mbInterpolationActive )
+    {
+        statusword |= STATUSWORD_IP_MODE_ACTIVE;
+    }
+
+    return statusword;
+}
+
+//------------------------------------------------------------------------------
+// Reads an object, including those which reflect the state of the drive.
+// Returns the size of the object in bytes.
+static U8 ReadObject( VirtualNode* pNode, U16 index, U8 subIndex, U32* pValueOut )
+{
+    U8 numBytes = 4;
+
+    if ( 0x6041 == index )
+    {
+        *pValueOut = GetStatusword( pNode );
+        numBytes = 2;
+    }
+    else if ( 0x6064 == index )
+    {
+        *pValueOut = (U32)pNode->mPosition;
+    }
+    else if ( 0x606C == index )
+    {
+        *pValueOut = (U32)pNode->mVelocity;
+    }
+    else if ( 0x20C4 == index && 1 == subIndex )
+    {
+        *pValueOut = pNode->mInterpolationBufferStatus;
+        numBytes = 2;
+    }
+    else
+    {
+        // Unknown objects read as 0 as the CAN Open interface has no way
+        // of reporting an SDO abort
+        VirtualObject* pObject = FindObject( pNode, index, subIndex );
+        *pValueOut = ( NULL != pObject ? pObject->mValue : 0 );
+        numBytes = ( NULL != pObject ? pObject->mNumBytes : 4 );
+    }
+
+    return numBytes;
+}
+
+//------------------------------------------------------------------------------
+static void ApplyControlword( VirtualBus* pBus, VirtualNode* pNode, U16 controlword )
+{
+    U16 oldControlword = pNode->mControlword;
+    pNode->mControlword = controlword;
+
+    // Move through the CiA 402 state machine
+    if ( eDS_Fault == pNode->mDriveState )
+    {
+        if ( ( controlword & CONTROLWORD_FAULT_RESET )
+            && !( oldControlword & CONTROLWORD_FAULT_RESET ) )
+        {
+            pNode->mDriveState = eDS_SwitchOnDisabled;
+        }
+    }
+    else if ( !( controlword & 0x0002 ) )
+    {
+        pNode->mDriveState = eDS_SwitchOnDisabled;     // Disable voltage
+    }
+    else if ( 0x0006 == ( controlword & 0x000F ) )
+    {
+        pNode->mDriveState = eDS_ReadyToSwitchOn;      // Shutdown
+    }
+    else if ( 0x0007 == ( controlword & 0x000F ) )
+    {
+        if ( eDS_SwitchOnDisabled != pNode->mDriveState )
+        {
+            pNode->mDriveState = eDS_SwitchedOn;        // Switch on
+        }
+    }
+    else if ( 0x000F == ( controlword & 0x000F ) )
+    {
+        if ( eDS_SwitchOnDisabled != pNode->mDriveState )
+        {
+            pNode->mDriveState = eDS_OperationEnabled;  // Enable operation
+        }
+    }
+
+    if ( eDS_OperationEnabled != pNode->mDriveState )
+    {
+        pNode->mbMoving = false;
+        pNode->mbSetpointAcknowledged = false;
+        pNode->mbInterpolationActive = false;
+        return;
+    }
+
+    if ( MODE_INTERPOLATED_POSITION == (S8)GetObjectValue( pNode, 0x6060, 0 ) )
+    {
+        // Interpolation starts on a rising edge of the enable IP mode bit,
+        // from wherever the motor is, and stops when the bit is cleared
+        if ( !( controlword & CONTROLWORD_ENABLE_IP_MODE ) )
+        {
+            pNode->mbInterpolationActive = false;
+            pNode->mbMoving = false;
+        }
+        else if ( !( oldControlword & CONTROLWORD_ENABLE_IP_MODE )
+            && pNode->mNumInterpolationPoints > 0 )
+        {
+            pNode->mbInterpolationActive = true;
+            pNode->mbMoving = true;
+            pNode->mSegmentStartPosition = pNode->mPosition;
+            pNode->mSegmentStartVelocity = 0;
+            pNode->mSegmentElapsedUS = 0;
+            pNode->mInterpolationBufferStatus &= ~IP_BUFFER_STATUS_UNDERFLOW_WARNING;
+        }
+
+        return;
+    }
+
+    // A new setpoint is taken on a rising edge of the new setpoint bit. With
+    // change set immediately the EPOS also takes a new setpoint every time
+    // the bit is written as set, which is what the SDO setpoint path uses.
+    bool bNewSetpoint = ( controlword & CONTROLWORD_NEW_SETPOINT )
+        && ( !( oldControlword & CONTROLWORD_NEW_SETPOINT )
+            || ( controlword & CONTROLWORD_CHANGE_SET_IMMEDIATELY ) );
+
+    if ( bNewSetpoint
+        && MODE_PROFILE_POSITION == (S8)GetObjectValue( pNode, 0x6060, 0 ) )
+    {
+        S32 target = (S32)GetObjectValue( pNode, 0x607A, 0 );
+        if ( controlword & CONTROLWORD_RELATIVE )
+        {
+            target += pNode->mPosition;
+        }
+
+        pNode->mTargetPosition = target;
+        pNode->mbMoving = ( target != pNode->mPosition );
+        pNode->mbSetpointAcknowledged = true;
+        pNode->mLastSetpointTimeUS = pBus->mTimeUS;
+        pNode->mNumSetpoints++;
+    }
+    else if ( !( controlword & CONTROLWORD_NEW_SETPOINT ) )
+    {
+        pNode->mbSetpointAcknowledged = false;
+    }
+}
+
+//------------------------------------------------------------------------------
+// Saves the parameters of the node, leaving out the objects which are used
+// to command the drive
+static void StoreParameters( VirtualBus* pBus, VirtualNode* pNode )
+{
+    S32 nodeId = (S32)( pNode - pBus->mNodes );
+    StoredParameters* pStoredParameters = &gStoredParameters[ nodeId ];
+
+    pthread_mutex_lock( &gStoredParametersMutex );
+
+    pStoredParameters->mNumObjects = 0;
+    for ( S32 objectIdx = 0; objectIdx < pNode->mNumObjects; objectIdx++ )
+    {
+        const VirtualObject& object = pNode->mObjects[ objectIdx ];
+        if ( 0x6040 != object.mIndex && 0x607A != object.mIndex
+            && 0x60FF != object.mIndex && 0x2030 != object.mIndex )
+        {
+            pStoredParameters->mObjects[ pStoredParameters->mNumObjects++ ] = object;
+        }
+    }
+
+    pthread_mutex_unlock( &gStoredParametersMutex );
+}
+
+//------------------------------------------------------------------------------
+static void WriteObject( VirtualBus* pBus, VirtualNode* pNode,
+                         U16 index, U8 subIndex, U32 value, U8 numBytes )
+{
+    if ( 0x6041 == index || 0x6064 == index || 0x606C == index )
+    {
+        return;     // Read only
+    }
+
+    if ( 0x1010 == index )
+    {
+        if ( 1 == subIndex && STORE_PARAMETERS_SIGNATURE == value )
+        {
+            StoreParameters( pBus, pNode );
+        }
+
+        return;
+    }
+
+    if ( 0x60C4 == index && 6 == subIndex )
+    {
+        // Writing 0 clears the interpolation buffer and disables access to
+        // it, writing 1 enables access
+        if ( 0 == value )
+        {
+            pNode->mNumInterpolationPoints = 0;
+            pNode->mInterpolationBufferStatus = 0;
+        }
+        else
+        {
+            pNode->mInterpolationBufferStatus |= IP_BUFFER_STATUS_ENABLED;
+        }
+
+        return;
+    }
+
+    SetObjectValue( pNode, index, subIndex, value, numBytes );
+
+    if ( 0x6040 == index )
+    {
+        ApplyControlword( pBus, pNode, (U16)value );
+    }
+}
+
+//------------------------------------------------------------------------------
+static U32 UnpackValue( const U8* pData, U8 numBytes )
+{
+    U32 value = 0;
+    for ( S32 byteIdx = numBytes - 1; byteIdx >= 0; byteIdx-- )
+    {
+        value = ( value << 8 ) | pData[ byteIdx ];
+    }
+
+    return value;
+}
+
+//------------------------------------------------------------------------------
+static void PackValue( U32 value, U8* pData, U8 numBytes )
+{
+    for ( S32 byteIdx = 0; byteIdx < numBytes; byteIdx++ )
+    {
+        pData[ byteIdx ] = (U8)( value >> ( 8*byteIdx ) );
+    }
+}
+
+//------------------------------------------------------------------------------
+// Adds a PVT point, packed as Position (S32), Velocity (S24) and Time (U8),
+// to the interpolation buffer
+static void WriteInterpolationDataRecord( VirtualNode* pNode, const U8* pData )
+{
+    if ( !( pNode->mInterpolationBufferStatus & IP_BUFFER_STATUS_ENABLED ) )
+    {
+        return;
+    }
+
+    if ( pNode->mNumInterpolationPoints >= INTERPOLATION_BUFFER_SIZE )
+    {
+        pNode->mInterpolationBufferStatus |= IP_BUFFER_STATUS_OVERFLOW_ERROR;
+        return;
+    }
+
+    S32 pointIdx = ( pNode->mInterpolationBufferStartIdx + pNode->mNumInterpolationPoints )
+        % INTERPOLATION_BUFFER_SIZE;
+    InterpolationPoint* pPoint = &pNode->mInterpolationBuffer[ pointIdx ];
+
+    pPoint->mPosition = (S32)UnpackValue( &pData[ 0 ], 4 );
+    U32 velocity = UnpackValue( &pData[ 4 ], 3 );
+    if ( velocity & 0x00800000 )
+    {
+        velocity |= 0xFF000000;     // Sign extend
+    }
+    pPoint->mVelocity = (S32)velocity;
+    pPoint->mTimeMS = pData[ 7 ];
+
+    pNode->mNumInterpolationPoints++;
+}
+
+//------------------------------------------------------------------------------
+// Node behaviour
+//------------------------------------------------------------------------------
+static void ResetNode( VirtualNode* pNode, U8 nodeId )
+{
+    // The position is kept as the motor doesn't move during a reset
+    S32 position = pNode->mPosition;
+    bool bPresent = pNode->mbPresent;
+
+    memset( pNode, 0, sizeof( VirtualNode ) );
+    pNode->mbPresent = bPresent;
+    pNode->mNMTState = eNMTS_Initialisation;
+    pNode->mDriveState = eDS_SwitchOnDisabled;
+    pNode->mPosition = position;
+    pNode->mTargetPosition = position;
+
+    SetObjectValue( pNode, 0x6060, 0, 0, 1 );           // Modes of Operation
+    SetObjectValue( pNode, 0x6081, 0, 1000, 4 );        // Profile Velocity
+    SetObjectValue( pNode, 0x6083, 0, 10000, 4 );       // Profile Acceleration
+    SetObjectValue( pNode, 0x6084, 0, 10000, 4 );       // Profile Deceleration
+    SetObjectValue( pNode, 0x1400, 2, 255, 1 );         // RPDO 1 Transmission Type
+    SetObjectValue( pNode, 0x1600, 0, 0, 1 );           // RPDO 1 Num Mapped Objects
+    SetObjectValue( pNode, 0x1800, 2, 255, 1 );         // TPDO 1 Transmission Type
+    SetObjectValue( pNode, 0x1800, 3, 0, 2 );           // TPDO 1 Inhibit Time
+    SetObjectValue( pNode, 0x1A00, 0, 0, 1 );           // TPDO 1 Num Mapped Objects
+    SetObjectValue( pNode, 0x210C, 0, 0, 2 );           // Customer Storage
+
+    // Stored parameters replace the defaults
+    pthread_mutex_lock( &gStoredParametersMutex );
+
+    const StoredParameters& storedParameters = gStoredParameters[ nodeId ];
+    for ( S32 objectIdx = 0; objectIdx < storedParameters.mNumObjects; objectIdx++ )
+    {
+        const VirtualObject& object = storedParameters.mObjects[ objectIdx ];
+        SetObjectValue( pNode, object.mIndex, object.mSubIndex, object.mValue, object.mNumBytes );
+    }
+
+    pthread_mutex_unlock( &gStoredParametersMutex );
+}
+
+//------------------------------------------------------------------------------
+static void ApplyRPDO( VirtualBus* pBus, VirtualNode* pNode, const U8* pData, U8 numBytes )
+{
+    // Unpack the data into the mapped objects in order. Each mapping entry
+    // is the object index, sub index and size in bits.
+    U8 numMappedObjects = (U8)GetObjectValue( pNode, 0x1600, 0 );
+    U8 byteIdx = 0;
+    for ( U8 mappingIdx = 1; mappingIdx <= numMappedObjects && mappingIdx <= MAX_NUM_MAPPED_OBJECTS; mappingIdx++ )
+    {
+        U32 mapping = GetObjectValue( pNode, 0x1600, mappingIdx );
+        U8 objectNumBytes = (U8)( ( mapping & 0xFF )/8 );
+        if ( byteIdx + objectNumBytes > numBytes )
+        {
+            break;
+        }
+
+        // The Interpolation Data Record is 64 bits, too big for an object
+        if ( 0x20C1 == ( mapping >> 16 ) && 8 == objectNumBytes )
+        {
+            WriteInterpolationDataRecord( pNode, &pData[ byteIdx ] );
+            byteIdx += objectNumBytes;
+            continue;
+        }
+
+        WriteObject( pBus, pNode, (U16)( mapping >> 16 ), (U8)( mapping >> 8 ),
+            UnpackValue( &pData[ byteIdx ], objectNumBytes ), objectNumBytes );
+        byteIdx += objectNumBytes;
+    }
+}
+
+//------------------------------------------------------------------------------
+// Returns the number of bytes in the TPDO
+static U8 BuildTPDO( VirtualNode* pNode, U8* pDataOut )
+{
+    U8 numMappedObjects = (U8)GetObjectValue( pNode, 0x1A00, 0 );
+    U8 byteIdx = 0;
+    for ( U8 mappingIdx = 1; mappingIdx <= numMappedObjects && mappingIdx <= MAX_NUM_MAPPED_OBJECTS; mappingIdx++ )
+    {
+        U32 mapping = GetObjectValue( pNode, 0x1A00, mappingIdx );
+        U8 objectNumBytes = (U8)( ( mapping & 0xFF )/8 );
+        if ( byteIdx + objectNumBytes > 8 )
+        {
+            break;
+        }
+
+        U32 value;
+        ReadObject( pNode, (U16)( mapping >> 16 ), (U8)( mapping >> 8 ), &value );
+        PackValue( value, &pDataOut[ byteIdx ], objectNumBytes );
+        byteIdx += objectNumBytes;
+    }
+
+    return byteIdx;
+}
+
+//------------------------------------------------------------------------------
+static void SendTPDO( VirtualBus* pBus, U8 nodeId, const U8* pData, U8 numBytes )
+{
+    VirtualNode* pNode = &pBus->mNodes[ nodeId ];
+    VirtualEvent* pEvent = QueueFrame( pBus, eET_TPDOArrival, 
+        TPDO_1_COB_ID_BASE + nodeId, nodeId, numBytes, pBus->mTimeUS );
+    if ( NULL != pEvent )
+    {
+        memcpy( pEvent->mData, pData, numBytes );
+        pEvent->mNumBytes = numBytes;
+
+        memcpy( pNode->mLastTPDOData, pData, numBytes );
+        pNode->mLastTPDONumBytes = numBytes;
+        pNode->mLastTPDOTimeUS = pBus->mTimeUS;
+        pNode->mbTPDOSent = true;
+    }
+}
+
+//------------------------------------------------------------------------------
+static bool CanNodeUsePDOs( const VirtualNode* pNode )
+{
+    return pNode->mbPresent && pNode->mbBooted && eNMTS_Operational == pNode->mNMTState;
+}
+
+//------------------------------------------------------------------------------
+static void StepInterpolation( VirtualBus* pBus, VirtualNode* pNode )
+{
+    const VirtualCANBusConfig& config = pBus->mConfig;
+    pNode->mSegmentElapsedUS += config.mMotionStepUS;
+
+    // Move on past the points that have been reached
+    while ( pNode->mNumInterpolationPoints > 0 )
+    {
+        const InterpolationPoint& point = 
+            pNode->mInterpolationBuffer[ pNode->mInterpolationBufferStartIdx ];
+        U64 segmentTimeUS = 1000*(U64)point.mTimeMS;
+        if ( pNode->mSegmentElapsedUS < segmentTimeUS )
+        {
+            break;
+        }
+
+        pNode->mSegmentElapsedUS -= segmentTimeUS;
+        pNode->mSegmentStartPosition = point.mPosition;
+        pNode->mSegmentStartVelocity = point.mVelocity;
+        pNode->mPosition = point.mPosition;
+        pNode->mInterpolationBufferStartIdx = 
+            ( pNode->mInterpolationBufferStartIdx + 1 ) % INTERPOLATION_BUFFER_SIZE;
+        pNode->mNumInterpolationPoints--;
+        pNode->mNumInterpolationPointsReached++;
+    }
+
+    if ( 0 == pNode->mNumInterpolationPoints )
+    {
+        // Out of points, so hold the last one
+        pNode->mbInterpolationActive = false;
+        pNode->mbMoving = false;
+        pNode->mInterpolationBufferStatus |= IP_BUFFER_STATUS_UNDERFLOW_WARNING;
+        return;
+    }
+
+    // Interpolate with a cubic Hermite spline. Velocities are converted
+    // from rpm to counts per microsecond.
+    const InterpolationPoint& point = 
+        pNode->mInterpolationBuffer[ pNode->mInterpolationBufferStartIdx ];
+    double segmentTimeUS = 1000.0*point.mTimeMS;
+    double t = (double)pNode->mSegmentElapsedUS/segmentTimeUS;
+    double velocityScale = (double)config.mCountsPerRevolution/( 60.0*1000000.0 );
+    double startVelocity = pNode->mSegmentStartVelocity*velocityScale*segmentTimeUS;
+    double endVelocity = point.mVelocity*velocityScale*segmentTimeUS;
+
+    double t2 = t*t;
+    double t3 = t2*t;
+    double position = ( 2.0*t3 - 3.0*t2 + 1.0 )*pNode->mSegmentStartPosition
+        + ( t3 - 2.0*t2 + t )*startVelocity
+        + ( -2.0*t3 + 3.0*t2 )*point.mPosition
+        + ( t3 - t2 )*endVelocity;
+
+    pNode->mPosition = (S32)( position >= 0.0 ? position + 0.5 : position - 0.5 );
+}
+
+//------------------------------------------------------------------------------
+static void StepVelocity( VirtualBus* pBus, VirtualNode* pNode )
+{
+    const VirtualCANBusConfig& config = pBus->mConfig;
+
+    if ( eDS_OperationEnabled != pNode->mDriveState )
+    {
+        pNode->mVelocity = 0;
+        pNode->mbMoving = false;
+        return;
+    }
+
+    S32 targetVelocity = 0;
+    if ( !( pNode->mControlword & CONTROLWORD_HALT ) )
+    {
+        targetVelocity = (S32)GetObjectValue( pNode, 0x60FF, 0 );
+    }
+
+    // Ramp towards the target velocity using the profile acceleration, or 
+    // the deceleration when slowing down, which are in rpm/s
+    bool bSlowing = ( pNode->mVelocity > 0 && targetVelocity < pNode->mVelocity )
+        || ( pNode->mVelocity < 0 && targetVelocity > pNode->mVelocity );
+    U32 rate = GetObjectValue( pNode, ( bSlowing ? 0x6084 : 0x6083 ), 0 );
+    S64 maxChange = (S64)rate*config.mMotionStepUS/1000000;
+    if ( maxChange < 1 )
+    {
+        maxChange = 1;
+    }
+
+    S64 change = (S64)targetVelocity - (S64)pNode->mVelocity;
+    if ( change > maxChange )
+    {
+        change = maxChange;
+    }
+    else if ( change < -maxChange )
+    {
+        change = -maxChange;
+    }
+
+    pNode->mVelocity += (S32)change;
+    pNode->mbMoving = ( pNode->mVelocity != targetVelocity );
+
+    pNode->mPositionRemainder += (S64)pNode->mVelocity*config.mCountsPerRevolution*config.mMotionStepUS;
+    S64 stepCounts = pNode->mPositionRemainder/( 60*1000000LL );
+    pNode->mPositionRemainder -= stepCounts*( 60*1000000LL );
+    pNode->mPosition += (S32)stepCounts;
+}
+
+//------------------------------------------------------------------------------
+static void StepMotion( VirtualBus* pBus )
+{
+    const VirtualCANBusConfig& config = pBus->mConfig;
+
+    for ( S32 nodeId = 1; nodeId < MAX_NUM_NODES; nodeId++ )
+    {
+        VirtualNode* pNode = &pBus->mNodes[ nodeId ];
+        if ( !pNode->mbPresent || !pNode->mbBooted )
+        {
+            continue;
+        }
+
+        if ( pNode->mbInterpolationActive )
+        {
+            StepInterpolation( pBus, pNode );
+        }
+        else if ( MODE_PROFILE_VELOCITY == (S8)GetObjectValue( pNode, 0x6060, 0 ) )
+        {
+            StepVelocity( pBus, pNode );
+        }
+        else if ( pNode->mbMoving )
+        {
+            // Move towards the target at the profile velocity which is in rpm
+            S64 velocityRPM = (S64)GetObjectValue( pNode, 0x6081, 0 );
+            pNode->mPositionRemainder += velocityRPM*config.mCountsPerRevolution*config.mMotionStepUS;
+            S64 stepCounts = pNode->mPositionRemainder/( 60*1000000LL );
+            pNode->mPositionRemainder -= stepCounts*( 60*1000000LL );
+
+            S64 distance = (S64)pNode->mTargetPosition - (S64)pNode->mPosition;
+            if ( ( distance >= 0 ? distance : -distance ) <= stepCounts )
+            {
+                pNode->mPosition = pNode->mTargetPosition;
+                pNode->mPositionRemainder = 0;
+                pNode->mbMoving = false;
+            }
+            else
+            {
+                pNode->mPosition += (S32)( distance > 0 ? stepCounts : -stepCounts );
+            }
+        }
+
+        // Event driven TPDOs are sent when their contents change, but no more
+        // often than the inhibit time which is in multiples of 100us
+        U8 transmissionType = (U8)GetObjectValue( pNode, 0x1800, 2 );
+        if ( CanNodeUsePDOs( pNode )
+            && transmissionType > MAX_SYNC_TRANSMISSION_TYPE )
+        {
+            U8 data[ 8 ];
+            U8 numBytes = BuildTPDO( pNode, data );
+            U64 inhibitTimeUS = 100*(U64)GetObjectValue( pNode, 0x1800, 3 );
+
+            if ( numBytes > 0
+                && ( !pNode->mbTPDOSent
+                    || numBytes != pNode->mLastTPDONumBytes
+                    || 0 != memcmp( data, pNode->mLastTPDOData, numBytes ) )
+                && ( !pNode->mbTPDOSent
+                    || pBus->mTimeUS >= pNode->mLastTPDOTimeUS + inhibitTimeUS ) )
+            {
+                SendTPDO( pBus, nodeId, data, numBytes );
+            }
+        }
+    }
+
+    PushEvent( pBus, eET_MotionStep, pBus->mTimeUS + config.mMotionStepUS, 0 );
+}
+
+//------------------------------------------------------------------------------
+static void ProcessEvent( VirtualBus* pBus, const VirtualEvent& event )
+{
+    CANChannel* pChannel = pBus->mpChannel;
+    VirtualNode* pNode = &pBus->mNodes[ event.mNodeId ];
+
+    // When a frame arrives the bus becomes free for the next frame
+    if ( event.mType >= eET_NmtArrival )
+    {
+        pBus->mbBusBusy = false;
+    }
+
+    switch ( event.mType )
+    {
+        case eET_FrameReady:
+        {
+            AddPendingFrame( pBus, event );
+            break;
+        }
+        case eET_NodeBooted:
+        {
+            if ( pNode->mbPresent && !pNode->mbBooted )
+            {
+                pNode->mbBooted = true;
+                pNode->mNMTState = eNMTS_PreOperational;
+                QueueFrame( pBus, eET_BootupArrival, BOOTUP_COB_ID_BASE + event.mNodeId, 
+                    event.mNodeId, 1, pBus->mTimeUS );
+            }
+            break;
+        }
+        case eET_MotionStep:
+        {
+            StepMotion( pBus );
+            break;
+        }
+        case eET_NmtArrival:
+        {
+            for ( S32 nodeId = 1; nodeId < MAX_NUM_NODES; nodeId++ )
+            {
+                VirtualNode* pTargetNode = &pBus->mNodes[ nodeId ];
+                if ( ( 0 != event.mNodeId && nodeId != event.mNodeId )
+                    || !pTargetNode->mbPresent )
+                {
+                    continue;
+                }
+
+                if ( NMT_RESET_NODE == event.mIndex )
+                {
+                    ResetNode( pTargetNode, (U8)nodeId );
+                    PushEvent( pBus, eET_NodeBooted,
+                        pBus->mTimeUS + pBus->mConfig.mBootupTimeUS, nodeId );
+                }
+                else if ( NMT_START_NODE == event.mIndex && pTargetNode->mbBooted )
+                {
+                    pTargetNode->mNMTState = eNMTS_Operational;
+                }
+            }
+            break;
+        }
+        case eET_SyncArrival:
+        {
+            for ( S32 nodeId = 1; nodeId < MAX_NUM_NODES; nodeId++ )
+            {
+                VirtualNode* pTargetNode = &pBus->mNodes[ nodeId ];
+                if ( !CanNodeUsePDOs( pTargetNode ) )
+                {
+                    continue;
+                }
+
+                if ( pTargetNode->mbRPDOPending )
+                {
+                    pTargetNode->mbRPDOPending = false;
+                    ApplyRPDO( pBus, pTargetNode,
+                        pTargetNode->mPendingRPDOData, pTargetNode->mPendingRPDONumBytes );
+                }
+
+                U8 transmissionType = (U8)GetObjectValue( pTargetNode, 0x1800, 2 );
+                if ( transmissionType >= 1 && transmissionType <= MAX_SYNC_TRANSMISSION_TYPE )
+                {
+                    U8 data[ 8 ];
+                    U8 numBytes = BuildTPDO( pTargetNode, data );
+                    if ( numBytes > 0 )
+                    {
+                        SendTPDO( pBus, nodeId, data, numBytes );
+                    }
+                }
+            }
+            break;
+        }
+        case eET_RPDOArrival:
+        {
+            if ( CanNodeUsePDOs( pNode ) && GetObjectValue( pNode, 0x1600, 0 ) > 0 )
+            {
+                U8 transmissionType = (U8)GetObjectValue( pNode, 0x1400, 2 );
+                if ( transmissionType <= MAX_SYNC_TRANSMISSION_TYPE )
+                {
+                    // Synchronous, so wait for the next SYNC
+                    memcpy( pNode->mPendingRPDOData, event.mData, event.mNumBytes );
+                    pNode->mPendingRPDONumBytes = event.mNumBytes;
+                    pNode->mbRPDOPending = true;
+                }
+                else
+                {
+                    ApplyRPDO( pBus, pNode, event.mData, event.mNumBytes );
+                }
+            }
+            break;
+        }
+        case eET_SdoRequestArrival:
+        {
+            // Missing nodes never respond
+            if ( !pNode->mbPresent )
+            {
+                break;
+            }
+            
+            // Requests are handled one at a time, and the response is sent 
+            // once the node has finished processing the request
+            U64 startTimeUS = pBus->mTimeUS;
+            if ( pNode->mSdoFreeTimeUS > startTimeUS )
+            {
+                startTimeUS = pNode->mSdoFreeTimeUS;
+            }
+            U64 responseTimeUS = startTimeUS + pBus->mConfig.mSdoProcessingTimeUS;
+            pNode->mSdoFreeTimeUS = responseTimeUS;
+            
+            VirtualEvent* pResponse = QueueFrame( pBus, 
+                ( event.mbWrite ? eET_SdoWriteResponseArrival : eET_SdoReadResponseArrival ),
+                SDO_RESPONSE_COB_ID_BASE + event.mNodeId, event.mNodeId, 
+                SDO_FRAME_NUM_BYTES, responseTimeUS - pBus->mConfig.mTransmitLatencyUS );
+            if ( NULL == pResponse )
+            {
+                break;
+            }
+            
+            if ( event.mbWrite )
+            {
+                WriteObject( pBus, pNode, event.mIndex, event.mSubIndex,
+                    UnpackValue( event.mData, event.mNumBytes ), event.mNumBytes );
+            }
+            else
+            {
+                U32 value;
+                pResponse->mNumBytes = ReadObject( pNode, event.mIndex, event.mSubIndex, &value );
+                PackValue( value, pResponse->mData, pResponse->mNumBytes );
+                
+                if ( pNode->mNumShortSdoReadReplies > 0 )
+                {
+                    pNode->mNumShortSdoReadReplies--;
+                    pResponse->mNumBytes--;
+                }
+            }
+            break;
+        }
+        case eET_BootupArrival:
+        {
+            pChannel->OnCANOpenPostSlaveBootup( event.mNodeId );
+            break;
+        }
+        case eET_SdoWriteResponseArrival:
+        {
+            pBus->mStats.mNumSdoTransfers++;
+            pChannel->OnSDOFieldWriteComplete( event.mNodeId );
+            break;
+        }
+        case eET_SdoReadResponseArrival:
+        {
+            U8 data[ 4 ];
+            memcpy( data, event.mData, sizeof( data ) );
+
+            pBus->mStats.mNumSdoTransfers++;
+            pChannel->OnSDOFieldReadComplete( event.mNodeId, data, event.mNumBytes );
+            break;
+        }
+        case eET_TPDOArrival:
+        {
+            U8 data[ 8 ];
+            memcpy( data, event.mData, event.mNumBytes );
+            pChannel->OnCANOpenPDOReceived( event.mCobId, data, event.mNumBytes );
+            break;
+        }
+        case eET_EmergencyArrival:
+        {
+            pChannel->OnCANOpenPostEmergency( event.mNodeId, event.mIndex, event.mData[ 0 ] );
+            break;
+        }
+        default:
+        {
+            assert( false && "Unhandled event type" );
+        }
+    }
+    
+    StartNextFrame( pBus );
+}
+
+//------------------------------------------------------------------------------
+// Bus management
+//------------------------------------------------------------------------------
+static VirtualBus* FindBus( CANChannel* pChannel )
+{
+    return ( NULL != pChannel ? (VirtualBus*)pChannel->GetCOIHandle() : NULL );
+}
+
+//------------------------------------------------------------------------------
+static VirtualBus* CreateBus( CANChannel* pChannel, const VirtualCANBusConfig& config, U32 bitRate )
+{
+    VirtualBus* pBus = new VirtualBus;
+    memset( pBus, 0, sizeof( VirtualBus ) );
+
+    pBus->mpChannel = pChannel;
+    pBus->mConfig = config;
+    pBus->mpEvents = new VirtualEvent[ MAX_NUM_EVENTS ];
+    pBus->mpPendingFrames = new VirtualEvent[ MAX_NUM_PENDING_FRAMES ];
+    pBus->mBitRate = bitRate;
+
+    pthread_mutexattr_t mutexAttributes;
+    pthread_mutexattr_init( &mutexAttributes );
+    pthread_mutexattr_settype( &mutexAttributes, PTHREAD_MUTEX_RECURSIVE );
+    pthread_mutex_init( &pBus->mMutex, &mutexAttributes );
+    pthread_mutexattr_destroy( &mutexAttributes );
+
+    for ( S32 nodeIdx = 0; nodeIdx < config.mNumNodes; nodeIdx++ )
+    {
+        S32 nodeId = config.mFirstNodeId + nodeIdx;
+        if ( nodeId > 0 && nodeId < MAX_NUM_NODES )
+        {
+            pBus->mNodes[ nodeId ].mbPresent = true;
+            ResetNode( &pBus->mNodes[ nodeId ], (U8)nodeId );
+        }
+    }
+
+    PushEvent( pBus, eET_MotionStep, config.mMotionStepUS, 0 );
+
+    return pBus;
+}
+
+//------------------------------------------------------------------------------
+static void DestroyBus( VirtualBus* pBus )
+{
+    pthread_mutex_destroy( &pBus->mMutex );
+    delete [] pBus->mpEvents;
+    delete [] pBus->mpPendingFrames;
+    delete pBus;
+}
+
+//------------------------------------------------------------------------------
+// Virtual bus interface
+//------------------------------------------------------------------------------
+void VCB_GetDefaultConfig( VirtualCANBusConfig* pConfigOut )
+{
+    pConfigOut->mFirstNodeId = 1;
+    pConfigOut->mNumNodes = 18;
+    pConfigOut->mTransmitLatencyUS = 50;
+    pConfigOut->mSdoProcessingTimeUS = 200;
+    pConfigOut->mBootupTimeUS = 20000;
+    pConfigOut->mMotionStepUS = 1000;
+    pConfigOut->mCountsPerRevolution = 2000;
+}
+
+//------------------------------------------------------------------------------
+void VCB_SetConfig( const VirtualCANBusConfig& config )
+{
+    gConfig = config;
+    gbConfigSet = true;
+}
+
+//------------------------------------------------------------------------------
+void VCB_ClearStoredParameters()
+{
+    pthread_mutex_lock( &gStoredParametersMutex );
+    memset( gStoredParameters, 0, sizeof( gStoredParameters ) );
+    pthread_mutex_unlock( &gStoredParametersMutex );
+}
+
+//------------------------------------------------------------------------------
+bool VCB_AdvanceTime( CANChannel* pChannel, U32 microseconds )
+{
+    VirtualBus* pBus = FindBus( pChannel );
+    if ( NULL == pBus )
+    {
+        return false;
+    }
+
+    pthread_mutex_lock( &pBus->mMutex );
+
+    U64 endTimeUS = pBus->mTimeUS + microseconds;
+    while ( pBus->mNumEvents > 0
+        && pBus->mpEvents[ 0 ].mTimeUS <= endTimeUS )
+    {
+        VirtualEvent event;
+        PopEvent( pBus, &event );
+
+        pBus->mTimeUS = event.mTimeUS;
+        ProcessEvent( pBus, event );
+    }
+    pBus->mTimeUS = endTimeUS;
+
+    pthread_mutex_unlock( &pBus->mMutex );
+    return true;
+}
+
+//------------------------------------------------------------------------------
+U64 VCB_GetTimeUS( CANChannel* pChannel )
+{
+    U64 timeUS = 0;
+
+    VirtualBus* pBus = FindBus( pChannel );
+    if ( NULL != pBus )
+    {
+        pthread_mutex_lock( &pBus->mMutex );
+        timeUS = pBus->mTimeUS;
+        pthread_mutex_unlock( &pBus->mMutex );
+    }
+
+    return timeUS;
+}
+
+//------------------------------------------------------------------------------
+bool VCB_GetStats( CANChannel* pChannel, VirtualCANBusStats* pStatsOut )
+{
+    VirtualBus* pBus = FindBus( pChannel );
+    if ( NULL == pBus )
+    {
+        return false;
+    }
+
+    pthread_mutex_lock( &pBus->mMutex );
+    *pStatsOut = pBus->mStats;
+    pStatsOut->mTimeUS = pBus->mTimeUS;
+    pthread_mutex_unlock( &pBus->mMutex );
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+bool VCB_GetNodeState( CANChannel* pChannel, U8 nodeId, VirtualNodeState* pStateOut )
+{
+    VirtualBus* pBus = FindBus( pChannel );
+    if ( NULL == pBus || nodeId >= MAX_NUM_NODES || !pBus->mNodes[ nodeId ].mbPresent )
+    {
+        return false;
+    }
+
+    pthread_mutex_lock( &pBus->mMutex );
+    const VirtualNode& node = pBus->mNodes[ nodeId ];
+    pStateOut->mNMTState = node.mNMTState;
+    pStateOut->mStatusword = GetStatusword( &node );
+    pStateOut->mPosition = node.mPosition;
+    pStateOut->mTargetPosition = node.mTargetPosition;
+    pStateOut->mLastSetpointTimeUS = node.mLastSetpointTimeUS;
+    pStateOut->mNumSetpoints = node.mNumSetpoints;
+    pStateOut->mbInterpolationActive = node.mbInterpolationActive;
+    pStateOut->mNumInterpolationPoints = node.mNumInterpolationPoints;
+    pStateOut->mNumInterpolationPointsReached = node.mNumInterpolationPointsReached;
+    pStateOut->mInterpolationBufferStatus = node.mInterpolationBufferStatus;
+    pStateOut->mVelocity = node.mVelocity;
+    pStateOut->mTargetVelocity = (S32)GetObjectValue( (VirtualNode*)&node, 0x60FF, 0 );
+    pStateOut->mCurrentSetting = (S16)GetObjectValue( (VirtualNode*)&node, 0x2030, 0 );
+    pthread_mutex_unlock( &pBus->mMutex );
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+bool VCB_InjectFault( CANChannel* pChannel, U8 nodeId, U16 errCode, U8 errReg )
+{
+    VirtualBus* pBus = FindBus( pChannel );
+    if ( NULL == pBus || nodeId >= MAX_NUM_NODES || !pBus->mNodes[ nodeId ].mbPresent )
+    {
+        return false;
+    }
+
+    bool bResult = false;
+
+    pthread_mutex_lock( &pBus->mMutex );
+    VirtualNode* pNode = &pBus->mNodes[ nodeId ];
+    if ( pNode->mbBooted )
+    {
+        pNode->mDriveState = eDS_Fault;
+        pNode->mVelocity = 0;
+        pNode->mbMoving = false;
+
+        VirtualEvent* pEvent = QueueFrame( pBus, eET_EmergencyArrival, 
+            EMCY_COB_ID_BASE + nodeId, nodeId, 8, pBus->mTimeUS );
+        if ( NULL != pEvent )
+        {
+            pEvent->mIndex = errCode;
+            pEvent->mData[ 0 ] = errReg;
+            pEvent->mNumBytes = 1;
+        }
+
+        bResult = true;
+    }
+    pthread_mutex_unlock( &pBus->mMutex );
+
+    return bResult;
+}
+
+//------------------------------------------------------------------------------
+bool VCB_ShortenSdoReadReplies( CANChannel* pChannel, U8 nodeId, U32 numReplies )
+{
+    VirtualBus* pBus = FindBus( pChannel );
+    if ( NULL == pBus || nodeId >= MAX_NUM_NODES || !pBus->mNodes[ nodeId ].mbPresent )
+    {
+        return false;
+    }
+
+    pthread_mutex_lock( &pBus->mMutex );
+    pBus->mNodes[ nodeId ].mNumShortSdoReadReplies = numReplies;
+    pthread_mutex_unlock( &pBus->mMutex );
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+bool VCB_ResetNode( CANChannel* pChannel, U8 nodeId )
+{
+    VirtualBus* pBus = FindBus( pChannel );
+    if ( NULL == pBus || nodeId >= MAX_NUM_NODES || !pBus->mNodes[ nodeId ].mbPresent )
+    {
+        return false;
+    }
+
+    pthread_mutex_lock( &pBus->mMutex );
+    ResetNode( &pBus->mNodes[ nodeId ], nodeId );
+    PushEvent( pBus, eET_NodeBooted, pBus->mTimeUS + pBus->mConfig.mBootupTimeUS, nodeId );
+    pthread_mutex_unlock( &pBus->mMutex );
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// CAN Open interface
+//------------------------------------------------------------------------------
+bool COI_InitCANOpenInterface()
+{
+    if ( !gbConfigSet )
+    {
+        VCB_GetDefaultConfig( &gConfig );
+        gbConfigSet = true;
+    }
+
+    gbCANOpenStarted = true;
+    return gbCANOpenStarted;
+}
+
+//------------------------------------------------------------------------------
+void COI_DeinitCANOpenInterface()
+{
+    gbCANOpenStarted = false;
+}
+
+//------------------------------------------------------------------------------
+bool COI_InitCANChannel( CANChannel* pChannel, const char* /*driverLibraryName*/,
+                         const char* /*canDevice*/, eBaudRate baudRate )
+{
+    assert( baudRate >= 0 && baudRate < eBR_NumBaudRates );
+    assert( NULL != pChannel );
+
+    bool bResult = false;
+
+    if ( gbCANOpenStarted )
+    {
+        if ( NULL != FindBus( pChannel ) )
+        {
+            fprintf( stderr, "Error: Channel is already open\n" );
+            goto Finished;
+        }
+
+        VirtualBus* pBus = CreateBus( pChannel, gConfig, BIT_RATES[ baudRate ] );
+        pChannel->SetCOIHandle( pBus );
+
+        // Reset the nodes on the channel
+        pthread_mutex_lock( &pBus->mMutex );
+        VirtualEvent* pEvent = QueueFrame( pBus, eET_NmtArrival, NMT_COB_ID, 0, 2, pBus->mTimeUS );
+        if ( NULL != pEvent )
+        {
+            pEvent->mIndex = NMT_RESET_NODE;
+        }
+        pthread_mutex_unlock( &pBus->mMutex );
+
+        bResult = true;
+    }
+
+Finished:
+    return bResult;
+}
+
+//------------------------------------------------------------------------------
+void COI_DeinitCANChannel( CANChannel* pChannel )
+{
+    VirtualBus* pBus = FindBus( pChannel );
+    if ( NULL != pBus )
+    {
+        pChannel->SetCOIHandle( NULL );
+        DestroyBus( pBus );
+    }
+}
+
+//------------------------------------------------------------------------------
+// Messages are timed with the simulated clock so that latencies come out as
+// they would on a real bus
+U64 COI_GetTimeUS( CANChannel* pChannel )
+{
+    return VCB_GetTimeUS( pChannel );
+}
+
+//------------------------------------------------------------------------------
+bool COI_ProcessSDOField( CANChannel* pChannel, U8 nodeId, const SDOField& field )
+{
+    bool bFieldProcessed = false;
+
+    VirtualBus* pBus = FindBus( pChannel );
+    if ( NULL != pBus && nodeId < MAX_NUM_NODES )
+    {
+        assert( SDOField::eT_Write == field.mType || SDOField::eT_Read == field.mType );
+        
+        pthread_mutex_lock( &pBus->mMutex );
+        
+        VirtualEvent* pEvent = QueueFrame( pBus, eET_SdoRequestArrival, 
+            SDO_REQUEST_COB_ID_BASE + nodeId, nodeId, SDO_FRAME_NUM_BYTES, pBus->mTimeUS );
+        if ( NULL != pEvent )
+        {
+            pEvent->mIndex = field.mIndex;
+            pEvent->mSubIndex = field.mSubIndex;
+            pEvent->mbWrite = ( SDOField::eT_Write == field.mType );
+            if ( pEvent->mbWrite )
+            {
+                memcpy( pEvent->mData, field.mData, field.mNumBytes );
+                pEvent->mNumBytes = (U8)field.mNumBytes;
+            }
+
+            bFieldProcessed = true;
+        }
+
+        pthread_mutex_unlock( &pBus->mMutex );
+    }
+
+    return bFieldProcessed;
+}
+
+//------------------------------------------------------------------------------
+bool COI_ArePDOsSupported()
+{
+    return true;
+}
+
+//------------------------------------------------------------------------------
+bool COI_QueueNMTStartNode( CANChannel* pChannel, U8 nodeId )
+{
+    bool bMsgQueued = false;
+
+    VirtualBus* pBus = FindBus( pChannel );
+    if ( NULL != pBus )
+    {
+        pthread_mutex_lock( &pBus->mMutex );
+        VirtualEvent* pEvent = QueueFrame( pBus, eET_NmtArrival, NMT_COB_ID, nodeId, 2, pBus->mTimeUS );
+        if ( NULL != pEvent )
+        {
+            pEvent->mIndex = NMT_START_NODE;
+            bMsgQueued = true;
+        }
+        pthread_mutex_unlock( &pBus->mMutex );
+    }
+
+    return bMsgQueued;
+}
+
+//------------------------------------------------------------------------------
+bool COI_QueuePDO( CANChannel* pChannel, U16 cobId, const U8* pData, U8 numBytes )
+{
+    bool bMsgQueued = false;
+
+    VirtualBus* pBus = FindBus( pChannel );
+    if ( NULL != pBus && numBytes <= 8 )
+    {
+        pthread_mutex_lock( &pBus->mMutex );
+
+        // Only RPDO 1 is understood by the simulated nodes
+        U8 nodeId = 0;
+        if ( cobId > RPDO_1_COB_ID_BASE && cobId < RPDO_1_COB_ID_BASE + MAX_NUM_NODES )
+        {
+            nodeId = (U8)( cobId - RPDO_1_COB_ID_BASE );
+        }
+
+        VirtualEvent* pEvent = QueueFrame( pBus, eET_RPDOArrival, cobId, nodeId, numBytes, pBus->mTimeUS );
+        if ( NULL != pEvent )
+        {
+            memcpy( pEvent->mData, pData, numBytes );
+            pEvent->mNumBytes = numBytes;
+            bMsgQueued = true;
+        }
+
+        pthread_mutex_unlock( &pBus->mMutex );
+    }
+
+    return bMsgQueued;
+}
+
+//------------------------------------------------------------------------------
+bool COI_QueueSync( CANChannel* pChannel )
+{
+    bool bMsgQueued = false;
+
+    VirtualBus* pBus = FindBus( pChannel );
+    if ( NULL != pBus )
+    {
+        pthread_mutex_lock( &pBus->mMutex );
+        VirtualEvent* pEvent = QueueFrame( pBus, eET_SyncArrival, SYNC_COB_ID, 0, 0, pBus->mTimeUS );
+        bMsgQueued = ( NULL != pEvent );
+        pthread_mutex_unlock( &pBus->mMutex );
+    }
+
+    return bMsgQueued;
+}
@@ -0,0 +1,2044 @@
+//------------------------------------------------------------------------------
+// File: VirtualBusTests.cpp
+// Desc: Checks the bring up and setpoint handling of a CANChannel against the
+//       virtual CAN bus. The channel is updated by hand with the simulation
+//       advanced by a fixed step each time, so every run is the same. The
+//       exceptions are the tests of reading and updating channels on other
+//       threads.
+//
+//       Returns 0 if all of the tests pass. Usage: testVirtualBus
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "EPOSControl/EPOSControl.h"
+#include "EPOSControl/VirtualCANBus.h"
+#include "CANChannelRegistry.h"
+
+//------------------------------------------------------------------------------
+static const U32 UPDATE_PERIOD_US = 1000;
+static const S32 MAX_NUM_BRING_UP_UPDATES = 5000;
+static const S32 NUM_SETTLING_UPDATES = 200;
+static const U8 NUM_NODES = 4;
+
+// The position control configuration sets 12 distinct values with 16
+// commands, of which the 2 Controlword writes are always made. Against the
+// defaults of a node, a differential configuration finds every group
+// mismatched after 8 reads.
+static const U32 NUM_CONFIGURATION_COMMANDS = 16;
+static const U32 NUM_CONFIGURATION_VALUES = 12;
+static const U32 NUM_ALWAYS_WRITTEN_COMMANDS = 2;
+static const U32 NUM_DEFAULT_MISMATCH_READS = 8;
+
+// The furthest that a node moves between its TPDOs in a move to a few
+// thousand ticks, with some allowance for the TPDOs being delayed
+static const S32 MAX_FEEDBACK_ANGLE_ERROR = 500;
+
+// Update threads run at the rate at which the tests advance the simulation
+// in real time
+static const U32 UPDATE_THREAD_RATE_HZ = 1000000/UPDATE_PERIOD_US;
+static const S32 MAX_NUM_UPDATE_THREAD_STEPS = 5000;
+
+// The SDO processing time of the nodes on a slow bus, which is longer than
+// any SDO transfer takes on a bus with the default configuration
+static const U32 SLOW_SDO_PROCESSING_TIME_US = 5000;
+
+// Written to the directory that the tests are run from, and removed again
+static const char* CAPTURE_FILENAME = "VirtualBusTests.capture";
+
+// Bits 3 and 10 of the Statusword
+static const U16 STATUSWORD_FAULT = 0x0008;
+static const U16 STATUSWORD_TARGET_REACHED = 0x0400;
+
+// An emergency asks for the Statusword to be read straight away, so the
+// fault should be seen within a few updates
+static const S32 MAX_NUM_FAULT_REPORT_UPDATES = 20;
+
+// A ramp that's longer than the trajectory ring of a node, so that the ring
+// has to be topped up whilst the node follows it
+static const S32 NUM_TRAJECTORY_POINTS = CANMotorController::TRAJECTORY_RING_LENGTH + 64;
+static const U8 TRAJECTORY_POINT_TIME_MS = 5;
+static const S32 TRAJECTORY_TICKS_PER_POINT = 10;
+
+// Bit 9 of the Interpolation Buffer Status
+static const U16 IP_BUFFER_STATUS_OVERFLOW_ERROR = 0x0200;
+
+// Polling a few nodes as fast as possible keeps the bus busy, and a budget of
+// a few percent is soon exceeded. The channel's frames are all that's on the
+// virtual bus, so the estimate of the load should be close.
+static const S32 NUM_BUS_LOAD_UPDATES = 1000;
+static const float HIGH_BUS_LOAD = 0.5f;
+static const float LOW_BUS_LOAD_BUDGET = 0.05f;
+static const float MAX_BUS_LOAD_ERROR = 0.02f;
+
+// Short enough for the watchdog to expire a number of times over the updates
+static const U32 STATUS_WATCHDOG_INTERVAL_MS = 100;
+static const S32 NUM_WATCHDOG_UPDATES = 2000;
+
+#define CHECK( condition ) \
+    CheckCondition( ( condition ), #condition, __FILE__, __LINE__, &bPassed )
+
+//------------------------------------------------------------------------------
+static void CheckCondition( bool bCondition, const char* pConditionString,
+                            const char* pFilename, S32 lineNumber, bool* pbPassed )
+{
+    if ( !bCondition )
+    {
+        fprintf( stderr, "%s:%i: Check failed: %s\n", pFilename, lineNumber, pConditionString );
+        *pbPassed = false;
+    }
+}
+
+//------------------------------------------------------------------------------
+static CANChannel* OpenChannel( U32 bootupTimeUS=0, U32 updateRateHz=0 )
+{
+    VirtualCANBusConfig config;
+    VCB_GetDefaultConfig( &config );
+    config.mNumNodes = NUM_NODES;
+    if ( 0 != bootupTimeUS )
+    {
+        config.mBootupTimeUS = bootupTimeUS;
+    }
+    VCB_SetConfig( config );
+
+    return EPOS_OpenCANChannel( "virtual", "virtual", eBR_1M, -1, updateRateHz );
+}
+
+//------------------------------------------------------------------------------
+static void UpdateChannel( CANChannel* pChannel, S32 numUpdates )
+{
+    for ( S32 updateIdx = 0; updateIdx < numUpdates; updateIdx++ )
+    {
+        pChannel->Update();
+        VCB_AdvanceTime( pChannel, UPDATE_PERIOD_US );
+    }
+}
+
+//------------------------------------------------------------------------------
+// Returns false if the nodes didn't all reach eS_Running in time. Once they
+// have, the channel is updated for a while longer so that any configuration
+// store can finish.
+static bool BringUpNodes( CANChannel* pChannel )
+{
+    S32 updateIdx = 0;
+    while ( pChannel->GetNumRunningNodes() < NUM_NODES
+        && updateIdx < MAX_NUM_BRING_UP_UPDATES )
+    {
+        UpdateChannel( pChannel, 1 );
+        updateIdx++;
+    }
+
+    UpdateChannel( pChannel, NUM_SETTLING_UPDATES );
+    return ( pChannel->GetNumRunningNodes() == NUM_NODES );
+}
+
+//------------------------------------------------------------------------------
+static bool AllNodesAtAngle( CANChannel* pChannel, S32 angle )
+{
+    for ( U8 nodeId = 1; nodeId <= NUM_NODES; nodeId++ )
+    {
+        VirtualNodeState state;
+        if ( !VCB_GetNodeState( pChannel, nodeId, &state ) || angle != state.mPosition )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Moves every node and returns true if they all reach the angle
+static bool MoveAllNodes( CANChannel* pChannel, S32 angle )
+{
+    for ( U8 nodeId = 1; nodeId <= NUM_NODES; nodeId++ )
+    {
+        pChannel->SetMotorAngle( nodeId, angle );
+    }
+    UpdateChannel( pChannel, 5000 );
+
+    return AllNodesAtAngle( pChannel, angle );
+}
+
+//------------------------------------------------------------------------------
+// For channels with an update thread, advances the simulation in real time
+// until every node is running, or has reached the angle given, and returns
+// false if that doesn't happen in time
+static bool WaitForUpdateThread( CANChannel* pChannel, bool bWaitForAngle, S32 angle=0 )
+{
+    for ( S32 stepIdx = 0; stepIdx < MAX_NUM_UPDATE_THREAD_STEPS; stepIdx++ )
+    {
+        if ( bWaitForAngle ? AllNodesAtAngle( pChannel, angle )
+            : NUM_NODES == pChannel->GetNumRunningNodes() )
+        {
+            return true;
+        }
+
+        VCB_AdvanceTime( pChannel, UPDATE_PERIOD_US );
+        usleep( UPDATE_PERIOD_US );
+    }
+
+    return false;
+}
+
+//------------------------------------------------------------------------------
+// Returns the number of frames of the given type that the channel counts
+// over the updates
+static U32 CountFrames( CANChannel* pChannel, eBusFrameType frameType, S32 numUpdates )
+{
+    BusLoadStats startStats;
+    pChannel->GetBusLoadStats( &startStats );
+    UpdateChannel( pChannel, numUpdates );
+
+    BusLoadStats endStats;
+    pChannel->GetBusLoadStats( &endStats );
+    return endStats.mNumFrames[ frameType ] - startStats.mNumFrames[ frameType ];
+}
+
+//------------------------------------------------------------------------------
+// Updates the channel, and returns the largest difference seen between the
+// angle of a node in the snapshot and the angle of the simulated node
+static S32 TrackSnapshotAngles( CANChannel* pChannel, S32 numUpdates )
+{
+    S32 maxAngleError = 0;
+    MotorControllerSnapshot* pSnapshot = new MotorControllerSnapshot;
+
+    for ( S32 updateIdx = 0; updateIdx < numUpdates; updateIdx++ )
+    {
+        UpdateChannel( pChannel, 1 );
+        pChannel->GetMotorControllerSnapshot( pSnapshot );
+
+        for ( S32 controllerIdx = 0; controllerIdx < pSnapshot->mNumControllers; controllerIdx++ )
+        {
+            VirtualNodeState state;
+            VCB_GetNodeState( pChannel, pSnapshot->mNodeIds[ controllerIdx ], &state );
+            S32 angleError = abs( state.mPosition - pSnapshot->mAngles[ controllerIdx ] );
+            if ( !pSnapshot->mbAngleValid[ controllerIdx ] )
+            {
+                angleError = 0x7FFFFFFF;
+            }
+
+            maxAngleError = ( angleError > maxAngleError ? angleError : maxAngleError );
+        }
+    }
+
+    delete pSnapshot;
+    return maxAngleError;
+}
+
+//------------------------------------------------------------------------------
+// Returns the number of completed SDO transfers to an object on the channel
+static U32 GetNumObjectTransfers( CANChannel* pChannel, U16 index, U8 subIndex )
+{
+    SDOLatencyHistogram histogram;
+    if ( !pChannel->GetSDOLatencyStats().GetObjectHistogram( index, subIndex, &histogram ) )
+    {
+        return 0;
+    }
+
+    return histogram.mNumSamples;
+}
+
+//------------------------------------------------------------------------------
+// Brings up the nodes with the given configuration mode, and checks the
+// configuration counts of every node
+static bool CheckConfiguration( CANMotorController::eConfigurationMode configurationMode,
+                                const ConfigurationStats& expectedStats )
+{
+    bool bPassed = true;
+
+    CANChannel* pChannel = OpenChannel();
+    CHECK( NULL != pChannel );
+    if ( NULL == pChannel )
+    {
+        return false;
+    }
+
+    pChannel->SetConfigurationMode( CANChannel::ALL_MOTOR_CONTROLLERS, configurationMode );
+    pChannel->ConfigureAllMotorControllersForPositionControl();
+    CHECK( BringUpNodes( pChannel ) );
+
+    for ( U8 nodeId = 1; nodeId <= NUM_NODES; nodeId++ )
+    {
+        ConfigurationStats stats;
+        CHECK( pChannel->GetConfigurationStats( nodeId, &stats ) );
+        CHECK( expectedStats.mNumConfigurations == stats.mNumConfigurations );
+        CHECK( expectedStats.mNumReads == stats.mNumReads );
+        CHECK( expectedStats.mNumWrites == stats.mNumWrites );
+        CHECK( expectedStats.mNumWritesSkipped == stats.mNumWritesSkipped );
+        CHECK( expectedStats.mNumStores == stats.mNumStores );
+    }
+
+    CHECK( MoveAllNodes( pChannel, 1234 ) );
+
+    EPOS_CloseCANChannel( pChannel );
+    return bPassed;
+}
+
+//------------------------------------------------------------------------------
+static bool TestStoredAndDifferentialConfiguration()
+{
+    bool bPassed = true;
+    VCB_ClearStoredParameters();
+
+    // The nodes start with their defaults, so for a differential
+    // configuration every group differs and is written
+    ConfigurationStats expectedStats;
+    expectedStats.mNumConfigurations = 1;
+    expectedStats.mNumReads = NUM_DEFAULT_MISMATCH_READS;
+    expectedStats.mNumWrites = NUM_CONFIGURATION_COMMANDS;
+    expectedStats.mNumWritesSkipped = 0;
+    expectedStats.mNumStores = 0;
+    CHECK( CheckConfiguration( CANMotorController::eCM_Differential, expectedStats ) );
+
+    // A stored configuration reads the fingerprint, finds that it differs,
+    // writes everything and then stores it
+    expectedStats.mNumReads = 1;
+    expectedStats.mNumStores = 1;
+    CHECK( CheckConfiguration( CANMotorController::eCM_Stored, expectedStats ) );
+
+    // The nodes now reset to the stored configuration, so the fingerprint
+    // matches and only the commands are written
+    expectedStats.mNumWrites = NUM_ALWAYS_WRITTEN_COMMANDS;
+    expectedStats.mNumWritesSkipped = NUM_CONFIGURATION_COMMANDS - NUM_ALWAYS_WRITTEN_COMMANDS;
+    expectedStats.mNumStores = 0;
+    CHECK( CheckConfiguration( CANMotorController::eCM_Stored, expectedStats ) );
+
+    // A differential configuration reads every value to find the same
+    expectedStats.mNumReads = NUM_CONFIGURATION_VALUES;
+    CHECK( CheckConfiguration( CANMotorController::eCM_Differential, expectedStats ) );
+
+    VCB_ClearStoredParameters();
+    return bPassed;
+}
+
+//------------------------------------------------------------------------------
+static bool TestShortSdoReadReplies()
+{
+    bool bPassed = true;
+    VCB_ClearStoredParameters();
+
+    // Store the configuration so that the nodes boot with it
+    CANChannel* pChannel = OpenChannel();
+    CHECK( NULL != pChannel );
+    if ( NULL == pChannel )
+    {
+        return false;
+    }
+
+    pChannel->SetConfigurationMode( CANChannel::ALL_MOTOR_CONTROLLERS, CANMotorController::eCM_Stored );
+    pChannel->ConfigureAllMotorControllersForPositionControl();
+    CHECK( BringUpNodes( pChannel ) );
+    EPOS_CloseCANChannel( pChannel );
+
+    pChannel = OpenChannel();
+    CHECK( NULL != pChannel );
+    if ( NULL == pChannel )
+    {
+        return false;
+    }
+
+    // Cut the replies short once the nodes have booted, as a reset clears
+    // the count
+    UpdateChannel( pChannel, 50 );
+
+    // Node 1 gets fewer short replies than the retry limit, so the rejected
+    // reads are made again and every value is still found to match
+    const U32 NUM_SHORT_REPLIES = 2;
+    CHECK( VCB_ShortenSdoReadReplies( pChannel, 1, NUM_SHORT_REPLIES ) );
+
+    // Node 2 gets more, so after the retries the group being read is taken
+    // to be mismatched and is written
+    CHECK( VCB_ShortenSdoReadReplies( pChannel, 2, CANMotorController::MAX_NUM_CONFIGURATION_READ_RETRIES + 1 ) );
+
+    pChannel->SetConfigurationMode( CANChannel::ALL_MOTOR_CONTROLLERS, CANMotorController::eCM_Differential );
+    pChannel->ConfigureAllMotorControllersForPositionControl();
+    CHECK( BringUpNodes( pChannel ) );
+
+    ConfigurationStats stats;
+    CHECK( pChannel->GetConfigurationStats( 1, &stats ) );
+    CHECK( NUM_CONFIGURATION_VALUES + NUM_SHORT_REPLIES == stats.mNumReads );
+    CHECK( NUM_ALWAYS_WRITTEN_COMMANDS == stats.mNumWrites );
+
+    // The first group is the TPDO 1 mapping, which sets 3 values with 4
+    // commands. Its reads are given up on, and the rest are made as before.
+    const U32 NUM_TPDO1_MAPPING_COMMANDS = 4;
+    const U32 NUM_TPDO1_MAPPING_VALUES = 3;
+    CHECK( pChannel->GetConfigurationStats( 2, &stats ) );
+    CHECK( CANMotorController::MAX_NUM_CONFIGURATION_READ_RETRIES + 1
+        + NUM_CONFIGURATION_VALUES - NUM_TPDO1_MAPPING_VALUES == stats.mNumReads );
+    CHECK( NUM_ALWAYS_WRITTEN_COMMANDS + NUM_TPDO1_MAPPING_COMMANDS == stats.mNumWrites );
+
+    CHECK( MoveAllNodes( pChannel, -500 ) );
+
+    EPOS_CloseCANChannel( pChannel );
+    VCB_ClearStoredParameters();
+    return bPassed;
+}
+
+//------------------------------------------------------------------------------
+static bool TestSetpointDeadbandAndCoalescing()
+{
+    bool bPassed = true;
+
+    CANChannel* pChannel = OpenChannel();
+    CHECK( NULL != pChannel );
+    if ( NULL == pChannel )
+    {
+        return false;
+    }
+
+    SetpointFilter filter;
+    filter.mAngleDeadband = 10;
+    filter.mVelocityDeadband = 0;
+    filter.mCurrentDeadband = 0;
+    filter.mMinResendIntervalMS = 50;
+    pChannel->SetSetpointFilter( CANChannel::ALL_MOTOR_CONTROLLERS, filter );
+    pChannel->SetSetpointMode( CANChannel::ALL_MOTOR_CONTROLLERS, CANMotorController::eSM_SDO );
+    pChannel->ConfigureAllMotorControllersForPositionControl();
+    CHECK( BringUpNodes( pChannel ) );
+
+    // The first setpoint is sent, and the second is within the deadband
+    pChannel->SetMotorAngle( 1, 1000 );
+    UpdateChannel( pChannel, 1 );
+    pChannel->SetMotorAngle( 1, 1005 );
+    UpdateChannel( pChannel, 1 );
+
+    // The third is held back by the resend interval, and is replaced by
+    // the fourth before it can be sent
+    pChannel->SetMotorAngle( 1, 2000 );
+    UpdateChannel( pChannel, 1 );
+    pChannel->SetMotorAngle( 1, 3000 );
+    UpdateChannel( pChannel, 5000 );
+
+    SetpointStats stats;
+    CHECK( pChannel->GetSetpointStats( 1, &stats ) );
+    CHECK( 4 == stats.mNumSetpointsGiven );
+    CHECK( 2 == stats.mNumSetpointsSent );
+    CHECK( 1 == stats.mNumSetpointsCoalesced );
+    CHECK( 1 == stats.mNumSetpointsSuppressed );
+
+    VirtualNodeState state;
+    CHECK( VCB_GetNodeState( pChannel, 1, &state ) );
+    CHECK( 3000 == state.mPosition );
+
+    EPOS_CloseCANChannel( pChannel );
+    return bPassed;
+}
+
+//------------------------------------------------------------------------------
+static bool TestRebootDuringSetUp()
+{
+    bool bPassed = true;
+    VCB_ClearStoredParameters();
+
+    // The node boots quickly so that it's back before the rest have set up
+    CANChannel* pChannel = OpenChannel( 2000 );
+    CHECK( NULL != pChannel );
+    if ( NULL == pChannel )
+    {
+        return false;
+    }
+
+    pChannel->ConfigureAllMotorControllersForPositionControl();
+
+    // Reboot the node once part of its configuration has been written
+    ConfigurationStats stats;
+    memset( &stats, 0, sizeof( stats ) );
+    S32 updateIdx = 0;
+    while ( stats.mNumWrites < NUM_CONFIGURATION_COMMANDS/2
+        && updateIdx < MAX_NUM_BRING_UP_UPDATES )
+    {
+        UpdateChannel( pChannel, 1 );
+        pChannel->GetConfigurationStats( 1, &stats );
+        updateIdx++;
+    }
+
+    CHECK( 0 == pChannel->GetNumRunningNodes() );
+    CHECK( VCB_ResetNode( pChannel, 1 ) );
+    CHECK( BringUpNodes( pChannel ) );
+
+    // The configuration is started again once the node is back, and the
+    // node still ends up able to move
+    CHECK( pChannel->GetConfigurationStats( 1, &stats ) );
+    CHECK( 2 == stats.mNumConfigurations );
+    CHECK( MoveAllNodes( pChannel, 4321 ) );
+
+    EPOS_CloseCANChannel( pChannel );
+    return bPassed;
+}
+
+//------------------------------------------------------------------------------
+static bool TestTPDOFeedback()
+{
+    bool bPassed = true;
+
+    for ( S32 feedbackMode = CANMotorController::eFM_SDOPolling;
+        feedbackMode <= CANMotorController::eFM_TPDO; feedbackMode++ )
+    {
+        bool bTPDO = ( CANMotorController::eFM_TPDO == feedbackMode );
+
+        CANChannel* pChannel = OpenChannel();
+        CHECK( NULL != pChannel );
+        if ( NULL == pChannel )
+        {
+            return false;
+        }
+
+        pChannel->SetFeedbackMode( CANChannel::ALL_MOTOR_CONTROLLERS,
+            (CANMotorController::eFeedbackMode)feedbackMode );
+        pChannel->ConfigureAllMotorControllersForPositionControl();
+        CHECK( BringUpNodes( pChannel ) );
+
+        // Whilst the nodes are still, TPDO feedback only reads the angle
+        // when the TPDOs have been silent for a while, and reads the
+        // Statusword for the watchdog
+        U32 numIdleReads = CountFrames( pChannel, eBFT_SdoRequest, 1000 );
+        if ( bTPDO )
+        {
+            U32 numReadsPerNode = 1000000/CANMotorController::TPDO_SILENCE_POLL_INTERVAL_US
+                + 1000/CANChannel::DEFAULT_STATUS_WATCHDOG_INTERVAL_MS;
+            CHECK( numIdleReads <= NUM_NODES*( numReadsPerNode + 1 ) );
+        }
+        else
+        {
+            CHECK( numIdleReads > NUM_NODES*100 );
+        }
+
+        // With TPDOs, the reported angles follow the nodes as they move, to
+        // within the distance moved between TPDOs. Negative angles check that
+        // the feedback is decoded with its sign.
+        for ( U8 nodeId = 1; nodeId <= NUM_NODES; nodeId++ )
+        {
+            pChannel->SetMotorAngle( nodeId, -1000*nodeId );
+        }
+
+        BusLoadStats startStats;
+        pChannel->GetBusLoadStats( &startStats );
+        S32 maxAngleError = TrackSnapshotAngles( pChannel, 2000 );
+        CHECK( !bTPDO || maxAngleError <= MAX_FEEDBACK_ANGLE_ERROR );
+        CHECK( 0 == TrackSnapshotAngles( pChannel, 1 ) );
+
+        BusLoadStats endStats;
+        pChannel->GetBusLoadStats( &endStats );
+        U32 numTPDOs = endStats.mNumFrames[ eBFT_PdoReceived ] - startStats.mNumFrames[ eBFT_PdoReceived ];
+        CHECK( bTPDO ? numTPDOs > 0 : 0 == numTPDOs );
+
+        // Nodes are only made Operational for TPDO feedback
+        for ( U8 nodeId = 1; nodeId <= NUM_NODES; nodeId++ )
+        {
+            VirtualNodeState state;
+            CHECK( VCB_GetNodeState( pChannel, nodeId, &state ) );
+            CHECK( -1000*nodeId == state.mPosition );
+            CHECK( ( bTPDO ? eNMTS_Operational : eNMTS_PreOperational ) == state.mNMTState );
+        }
+
+        EPOS_CloseCANChannel( pChannel );
+    }
+
+    return bPassed;
+}
+
+//------------------------------------------------------------------------------
+static bool TestRPDOSetpoints()
+{
+    bool bPassed = true;
+
+    for ( S32 setpointMode = CANMotorController::eSM_SDO;
+        setpointMode <= CANMotorController::eSM_RPDO; setpointMode++ )
+    {
+        bool bRPDO = ( CANMotorController::eSM_RPDO == setpointMode );
+
+        CANChannel* pChannel = OpenChannel();
+        CHECK( NULL != pChannel );
+        if ( NULL == pChannel )
+        {
+            return false;
+        }
+
+        pChannel->SetSetpointMode( CANChannel::ALL_MOTOR_CONTROLLERS,
+            (CANMotorController::eSetpointMode)setpointMode );
+        pChannel->ConfigureAllMotorControllersForPositionControl();
+        CHECK( BringUpNodes( pChannel ) );
+
+        // RPDO setpoints replace the SDO writes to Target Position with
+        // RPDOs, each followed by a SYNC for the nodes to act on
+        U32 numStartTargetWrites = GetNumObjectTransfers( pChannel, 0x607A, 0 );
+        BusLoadStats startStats;
+        pChannel->GetBusLoadStats( &startStats );
+
+        CHECK( MoveAllNodes( pChannel, -3000 ) );
+        CHECK( MoveAllNodes( pChannel, 2000 ) );
+
+        U32 numTargetWrites = GetNumObjectTransfers( pChannel, 0x607A, 0 ) - numStartTargetWrites;
+        BusLoadStats endStats;
+        pChannel->GetBusLoadStats( &endStats );
+        U32 numRPDOs = endStats.mNumFrames[ eBFT_PdoSent ] - startStats.mNumFrames[ eBFT_PdoSent ];
+        U32 numSyncs = endStats.mNumFrames[ eBFT_Sync ] - startStats.mNumFrames[ eBFT_Sync ];
+        if ( bRPDO )
+        {
+            CHECK( 0 == numTargetWrites );
+            CHECK( numRPDOs >= 2*NUM_NODES );
+            CHECK( numSyncs > 0 && numSyncs <= numRPDOs );
+        }
+        else
+        {
+            CHECK( numTargetWrites >= 2*NUM_NODES );
+            CHECK( 0 == numRPDOs && 0 == numSyncs );
+        }
+
+        // Nodes are only made Operational for RPDO setpoints
+        for ( U8 nodeId = 1; nodeId <= NUM_NODES; nodeId++ )
+        {
+            VirtualNodeState state;
+            CHECK( VCB_GetNodeState( pChannel, nodeId, &state ) );
+            CHECK( ( bRPDO ? eNMTS_Operational : eNMTS_PreOperational ) == state.mNMTState );
+        }
+
+        EPOS_CloseCANChannel( pChannel );
+    }
+
+    return bPassed;
+}
+
+//------------------------------------------------------------------------------
+struct SnapshotReader
+{
+    CANChannel* mpChannel;
+    volatile bool mbStop;
+
+    U32 mNumSnapshots;
+    U32 mNumNewVersions;
+    U32 mNumBadSnapshots;
+};
+
+//------------------------------------------------------------------------------
+// Takes snapshots until told to stop, counting any that are inconsistent.
+// Every update publishes one snapshot just after incrementing the frame
+// index, so the version and frame index of a snapshot differ by a fixed
+// amount whilst the channel is open.
+static void* SnapshotReaderMain( void* pArg )
+{
+    SnapshotReader* pReader = (SnapshotReader*)pArg;
+    MotorControllerSnapshot* pSnapshot = new MotorControllerSnapshot;
+
+    pReader->mpChannel->GetMotorControllerSnapshot( pSnapshot );
+    U32 lastVersion = pSnapshot->mVersion;
+    U32 versionOffset = pSnapshot->mVersion - (U32)pSnapshot->mFrameIdx;
+
+    while ( !pReader->mbStop )
+    {
+        pReader->mpChannel->GetMotorControllerSnapshot( pSnapshot );
+        pReader->mNumSnapshots++;
+
+        bool bConsistent = ( pSnapshot->mVersion >= lastVersion
+            && pSnapshot->mVersion - (U32)pSnapshot->mFrameIdx == versionOffset
+            && pSnapshot->mNumControllers <= NUM_NODES );
+        for ( S32 controllerIdx = 0; controllerIdx < pSnapshot->mNumControllers; controllerIdx++ )
+        {
+            U8 lastNodeId = ( controllerIdx > 0 ? pSnapshot->mNodeIds[ controllerIdx - 1 ] : 0 );
+            bConsistent = bConsistent && pSnapshot->mNodeIds[ controllerIdx ] > lastNodeId
+                && pSnapshot->mNodeIds[ controllerIdx ] <= NUM_NODES;
+        }
+
+        if ( !bConsistent )
+        {
+            pReader->mNumBadSnapshots++;
+        }
+        else if ( pSnapshot->mVersion != lastVersion )
+        {
+            pReader->mNumNewVersions++;
+            lastVersion = pSnapshot->mVersion;
+        }
+    }
+
+    delete pSnapshot;
+    return NULL;
+}
+
+//------------------------------------------------------------------------------
+static bool TestConcurrentSnapshots()
+{
+    bool bPassed = true;
+
+    CANChannel* pChannel = OpenChannel();
+    CHECK( NULL != pChannel );
+    if ( NULL == pChannel )
+    {
+        return false;
+    }
+
+    // Until the first update, the snapshot is the one published when the
+    // channel was last closed
+    UpdateChannel( pChannel, 1 );
+
+    static const S32 NUM_READERS = 4;
+    SnapshotReader readers[ NUM_READERS ];
+    pthread_t readerThreads[ NUM_READERS ];
+    bool bReaderStarted[ NUM_READERS ];
+    for ( S32 readerIdx = 0; readerIdx < NUM_READERS; readerIdx++ )
+    {
+        SnapshotReader& reader = readers[ readerIdx ];
+        memset( &reader, 0, sizeof( reader ) );
+        reader.mpChannel = pChannel;
+
+        bReaderStarted[ readerIdx ] =
+            ( 0 == pthread_create( &readerThreads[ readerIdx ], NULL, SnapshotReaderMain, &reader ) );
+        CHECK( bReaderStarted[ readerIdx ] );
+    }
+
+    pChannel->ConfigureAllMotorControllersForPositionControl();
+    CHECK( BringUpNodes( pChannel ) );
+    CHECK( MoveAllNodes( pChannel, 3000 ) );
+
+    // A reader may not be scheduled whilst the updates run, so it's only
+    // checked that the readers saw new versions between them
+    U32 numNewVersions = 0;
+    for ( S32 readerIdx = 0; readerIdx < NUM_READERS; readerIdx++ )
+    {
+        readers[ readerIdx ].mbStop = true;
+        if ( bReaderStarted[ readerIdx ] )
+        {
+            pthread_join( readerThreads[ readerIdx ], NULL );
+        }
+
+        CHECK( 0 == readers[ readerIdx ].mNumBadSnapshots );
+        numNewVersions += readers[ readerIdx ].mNumNewVersions;
+    }
+    CHECK( numNewVersions > 1 );
+
+    // Once the updates stop, readers see the state of the last update
+    MotorControllerSnapshot* pSnapshot = new MotorControllerSnapshot;
+    pChannel->GetMotorControllerSnapshot( pSnapshot );
+    CHECK( NUM_NODES == pSnapshot->mNumControllers );
+    for ( S32 controllerIdx = 0; controllerIdx < pSnapshot->mNumControllers; controllerIdx++ )
+    {
+        CHECK( pSnapshot->mbAngleValid[ controllerIdx ] && 3000 == pSnapshot->mAngles[ controllerIdx ] );
+        CHECK( CANMotorController::eS_Running == pSnapshot->mStates[ controllerIdx ] );
+    }
+    delete pSnapshot;
+
+    EPOS_CloseCANChannel( pChannel );
+    return bPassed;
+}
+
+//------------------------------------------------------------------------------
+// Returns the Statusword of a node in the snapshot, or 0 if it isn't valid
+static U16 GetSnapshotStatusword( CANChannel* pChannel, U8 nodeId )
+{
+    U16 statusword = 0;
+    MotorControllerSnapshot* pSnapshot = new MotorControllerSnapshot;
+    pChannel->GetMotorControllerSnapshot( pSnapshot );
+
+    for ( S32 controllerIdx = 0; controllerIdx < pSnapshot->mNumControllers; controllerIdx++ )
+    {
+        if ( nodeId == pSnapshot->mNodeIds[ controllerIdx ]
+            && pSnapshot->mbStatusValid[ controllerIdx ] )
+        {
+            statusword = pSnapshot->mStatuswords[ controllerIdx ];
+        }
+    }
+
+    delete pSnapshot;
+    return statusword;
+}
+
+//------------------------------------------------------------------------------
+static bool TestEmergencyErrors()
+{
+    bool bPassed = true;
+
+    // Every entry in the table can be found, and the table is sorted
+    S32 numEntries = 0;
+    const EPOSErrorInfo* pTable = EPOS_GetErrorTable( &numEntries );
+    CHECK( NULL != pTable && numEntries > 0 );
+    for ( S32 entryIdx = 0; entryIdx < numEntries; entryIdx++ )
+    {
+        const EPOSErrorInfo& info = pTable[ entryIdx ];
+        if ( entryIdx > 0 )
+        {
+            const EPOSErrorInfo& lastInfo = pTable[ entryIdx - 1 ];
+            CHECK( lastInfo.mErrCode < info.mErrCode
+                || ( lastInfo.mErrCode == info.mErrCode && lastInfo.mErrReg < info.mErrReg ) );
+        }
+
+        CHECK( &info == EPOS_FindErrorInfo( info.mErrCode, info.mErrReg ) );
+        CHECK( info.mErrorClass == EPOS_GetErrorClass( info.mErrCode, info.mErrReg ) );
+        CHECK( info.mpMessage == EPOS_GetErrorMessage( info.mErrCode, info.mErrReg, NULL, 0 ) );
+    }
+
+    CHECK( eEEC_Current == EPOS_GetErrorClass( 0x2310, 0x02 ) );
+    CHECK( eEEC_Motion == EPOS_GetErrorClass( 0x8611, 0x20 ) );
+
+    // Unrecognised errors, including known codes with the wrong error
+    // register, are formatted into the buffer given
+    CHECK( NULL == EPOS_FindErrorInfo( 0x2310, 0x04 ) );
+    CHECK( eEEC_Unknown == EPOS_GetErrorClass( 0x1234, 0x56 ) );
+
+    char buffer[ 64 ];
+    char otherBuffer[ 64 ];
+    const char* pMessage = EPOS_GetErrorMessage( 0x1234, 0x56, buffer, sizeof( buffer ) );
+    const char* pOtherMessage = EPOS_GetErrorMessage( 0xABCD, 0xEF, otherBuffer, sizeof( otherBuffer ) );
+    CHECK( buffer == pMessage && 0 == strcmp( pMessage, "Unrecognised error message 0x1234 - 0x56" ) );
+    CHECK( otherBuffer == pOtherMessage && 0 == strcmp( pOtherMessage, "Unrecognised error message 0xABCD - 0xEF" ) );
+
+    char shortBuffer[ 8 ];
+    EPOS_GetErrorMessage( 0x1234, 0x56, shortBuffer, sizeof( shortBuffer ) );
+    CHECK( strlen( shortBuffer ) < sizeof( shortBuffer ) );
+
+    // An emergency from a node brings its fault into the snapshot, and a
+    // fault reset lets it move again
+    CANChannel* pChannel = OpenChannel();
+    CHECK( NULL != pChannel );
+    if ( NULL == pChannel )
+    {
+        return false;
+    }
+
+    pChannel->ConfigureAllMotorControllersForPositionControl();
+    CHECK( BringUpNodes( pChannel ) );
+
+    const U8 FAULTY_NODE_ID = 2;
+    BusLoadStats startStats;
+    pChannel->GetBusLoadStats( &startStats );
+    CHECK( VCB_InjectFault( pChannel, FAULTY_NODE_ID, 0x2310, 0x02 ) );
+
+    S32 updateIdx = 0;
+    while ( 0 == ( GetSnapshotStatusword( pChannel, FAULTY_NODE_ID ) & STATUSWORD_FAULT )
+        && updateIdx < MAX_NUM_FAULT_REPORT_UPDATES )
+    {
+        UpdateChannel( pChannel, 1 );
+        updateIdx++;
+    }
+    CHECK( 0 != ( GetSnapshotStatusword( pChannel, FAULTY_NODE_ID ) & STATUSWORD_FAULT ) );
+
+    BusLoadStats endStats;
+    pChannel->GetBusLoadStats( &endStats );
+    CHECK( 1 == endStats.mNumFrames[ eBFT_Emergency ] - startStats.mNumFrames[ eBFT_Emergency ] );
+
+    pChannel->SendFaultReset( FAULTY_NODE_ID );
+    CHECK( MoveAllNodes( pChannel, 1500 ) );
+    CHECK( 0 == ( GetSnapshotStatusword( pChannel, FAULTY_NODE_ID ) & STATUSWORD_FAULT ) );
+
+    EPOS_CloseCANChannel( pChannel );
+    return bPassed;
+}
+
+//------------------------------------------------------------------------------
+static bool TestChannelLookup()
+{
+    bool bPassed = true;
+
+    // Every open channel has its own bus, and so its own handle
+    CANChannel* pChannels[ CCR_MAX_NUM_CHANNELS ];
+    for ( S32 channelIdx = 0; channelIdx < CCR_MAX_NUM_CHANNELS; channelIdx++ )
+    {
+        pChannels[ channelIdx ] = OpenChannel();
+        CHECK( NULL != pChannels[ channelIdx ] );
+        if ( NULL == pChannels[ channelIdx ] )
+        {
+            return false;
+        }
+
+        CHECK( NULL != pChannels[ channelIdx ]->GetCOIHandle() );
+        for ( S32 otherChannelIdx = 0; otherChannelIdx < channelIdx; otherChannelIdx++ )
+        {
+            CHECK( pChannels[ otherChannelIdx ]->GetCOIHandle() != pChannels[ channelIdx ]->GetCOIHandle() );
+        }
+    }
+
+    // The registry finds the channel of each handle until the channel is
+    // removed, and a removed channel frees its slot
+    CCR_Clear();
+    for ( S32 channelIdx = 0; channelIdx < CCR_MAX_NUM_CHANNELS; channelIdx++ )
+    {
+        CHECK( CCR_AddChannel( pChannels[ channelIdx ], pChannels[ channelIdx ]->GetCOIHandle() ) );
+    }
+
+    S32 unusedHandle = 0;
+    CHECK( !CCR_AddChannel( pChannels[ 0 ], &unusedHandle ) );
+    CHECK( NULL == CCR_FindChannel( &unusedHandle ) );
+
+    const S32 REMOVED_CHANNEL_IDX = 5;
+    CCR_RemoveChannel( pChannels[ REMOVED_CHANNEL_IDX ]->GetCOIHandle() );
+    for ( S32 channelIdx = 0; channelIdx < CCR_MAX_NUM_CHANNELS; channelIdx++ )
+    {
+        CANChannel* pExpectedChannel = ( REMOVED_CHANNEL_IDX == channelIdx ? NULL : pChannels[ channelIdx ] );
+        CHECK( pExpectedChannel == CCR_FindChannel( pChannels[ channelIdx ]->GetCOIHandle() ) );
+    }
+
+    CHECK( CCR_AddChannel( pChannels[ REMOVED_CHANNEL_IDX ], &unusedHandle ) );
+    CHECK( pChannels[ REMOVED_CHANNEL_IDX ] == CCR_FindChannel( &unusedHandle ) );
+    CCR_Clear();
+
+    // Channels updated side by side only hear from their own nodes
+    static const S32 NUM_MOVING_CHANNELS = 3;
+    for ( S32 channelIdx = 0; channelIdx < NUM_MOVING_CHANNELS; channelIdx++ )
+    {
+        pChannels[ channelIdx ]->ConfigureAllMotorControllersForPositionControl();
+    }
+
+    S32 updateIdx = 0;
+    bool bAllRunning = false;
+    while ( !bAllRunning && updateIdx < MAX_NUM_BRING_UP_UPDATES )
+    {
+        bAllRunning = true;
+        for ( S32 channelIdx = 0; channelIdx < NUM_MOVING_CHANNELS; channelIdx++ )
+        {
+            UpdateChannel( pChannels[ channelIdx ], 1 );
+            bAllRunning = bAllRunning && NUM_NODES == pChannels[ channelIdx ]->GetNumRunningNodes();
+        }
+        updateIdx++;
+    }
+    CHECK( bAllRunning );
+
+    for ( S32 channelIdx = 0; channelIdx < NUM_MOVING_CHANNELS; channelIdx++ )
+    {
+        for ( U8 nodeId = 1; nodeId <= NUM_NODES; nodeId++ )
+        {
+            pChannels[ channelIdx ]->SetMotorAngle( nodeId, 1000*( channelIdx + 1 ) );
+        }
+    }
+
+    for ( updateIdx = 0; updateIdx < 5000; updateIdx++ )
+    {
+        for ( S32 channelIdx = 0; channelIdx < NUM_MOVING_CHANNELS; channelIdx++ )
+        {
+            UpdateChannel( pChannels[ channelIdx ], 1 );
+        }
+    }
+
+    for ( S32 channelIdx = 0; channelIdx < NUM_MOVING_CHANNELS; channelIdx++ )
+    {
+        for ( U8 nodeId = 1; nodeId <= NUM_NODES; nodeId++ )
+        {
+            VirtualNodeState state;
+            CHECK( VCB_GetNodeState( pChannels[ channelIdx ], nodeId, &state ) );
+            CHECK( 1000*( channelIdx + 1 ) == state.mPosition );
+        }
+    }
+
+    for ( S32 channelIdx = 0; channelIdx < CCR_MAX_NUM_CHANNELS; channelIdx++ )
+    {
+        EPOS_CloseCANChannel( pChannels[ channelIdx ] );
+        CHECK( NULL == pChannels[ channelIdx ]->GetCOIHandle() );
+    }
+
+    return bPassed;
+}
+
+//------------------------------------------------------------------------------
+static bool TestUpdateThread()
+{
+    bool bPassed = true;
+
+    CANChannel* pChannel = OpenChannel( 0, UPDATE_THREAD_RATE_HZ );
+    CHECK( NULL != pChannel );
+    if ( NULL == pChannel )
+    {
+        return false;
+    }
+
+    // The nodes are set up and moved by the update thread, with this thread
+    // only posting commands and running the simulation
+    CHECK( pChannel->IsUpdateThreadRunning() );
+    pChannel->ConfigureAllMotorControllersForPositionControl();
+    CHECK( WaitForUpdateThread( pChannel, false ) );
+
+    for ( U8 nodeId = 1; nodeId <= NUM_NODES; nodeId++ )
+    {
+        pChannel->SetMotorAngle( nodeId, 2500 );
+    }
+    CHECK( WaitForUpdateThread( pChannel, true, 2500 ) );
+
+    // Once stopped, the thread makes no more updates and can be restarted
+    pChannel->StopUpdateThread();
+    CHECK( !pChannel->IsUpdateThreadRunning() );
+
+    UpdateThreadStats stats;
+    pChannel->GetUpdateThreadStats( &stats );
+    CHECK( UPDATE_THREAD_RATE_HZ == stats.mUpdateRateHz );
+    CHECK( stats.mNumUpdates > 0 );
+    CHECK( stats.mMaxJitterUS >= stats.mMeanJitterUS );
+    CHECK( stats.mMaxUpdateTimeUS >= stats.mLastUpdateTimeUS );
+
+    usleep( 10*UPDATE_PERIOD_US );
+    UpdateThreadStats stoppedStats;
+    pChannel->GetUpdateThreadStats( &stoppedStats );
+    CHECK( stats.mNumUpdates == stoppedStats.mNumUpdates );
+
+    CHECK( pChannel->StartUpdateThread( UPDATE_THREAD_RATE_HZ ) );
+    for ( U8 nodeId = 1; nodeId <= NUM_NODES; nodeId++ )
+    {
+        pChannel->SetMotorAngle( nodeId, -500 );
+    }
+    CHECK( WaitForUpdateThread( pChannel, true, -500 ) );
+
+    // Closing the channel stops the thread
+    EPOS_CloseCANChannel( pChannel );
+    CHECK( !pChannel->IsUpdateThreadRunning() );
+
+    return bPassed;
+}
+
+//------------------------------------------------------------------------------
+// Checks that the counts of a histogram add up, and returns its median
+static U32 CheckLatencyHistogram( const SDOLatencyHistogram& histogram, bool* pbPassed )
+{
+    bool& bPassed = *pbPassed;
+
+    U32 numBucketSamples = 0;
+    for ( S32 bucketIdx = 0; bucketIdx < SDOLatencyHistogram::NUM_BUCKETS; bucketIdx++ )
+    {
+        numBucketSamples += histogram.mBucketCounts[ bucketIdx ];
+    }
+    CHECK( histogram.mNumSamples > 0 && numBucketSamples == histogram.mNumSamples );
+    CHECK( histogram.mTotalLatencyUS <= (U64)histogram.mMaxLatencyUS*histogram.mNumSamples );
+
+    U32 medianUS = SLS_GetLatencyPercentileUS( histogram, 50.0f );
+    U32 percentile99US = SLS_GetLatencyPercentileUS( histogram, 99.0f );
+    CHECK( medianUS > 0 && medianUS <= percentile99US );
+    CHECK( percentile99US <= SLS_GetLatencyPercentileUS( histogram, 100.0f ) );
+    CHECK( histogram.mMaxLatencyUS == SLS_GetLatencyPercentileUS( histogram, 100.0f ) );
+
+    return medianUS;
+}
+
+//------------------------------------------------------------------------------
+static bool TestSDOLatencyStats()
+{
+    bool bPassed = true;
+
+    // A bus with the default configuration is run alongside one with slow
+    // nodes, which should stand out from their latencies
+    CANChannel* pChannels[ 2 ];
+    for ( S32 channelIdx = 0; channelIdx < 2; channelIdx++ )
+    {
+        VirtualCANBusConfig config;
+        VCB_GetDefaultConfig( &config );
+        config.mNumNodes = NUM_NODES;
+        if ( 1 == channelIdx )
+        {
+            config.mSdoProcessingTimeUS = SLOW_SDO_PROCESSING_TIME_US;
+        }
+        VCB_SetConfig( config );
+
+        pChannels[ channelIdx ] = EPOS_OpenCANChannel( "virtual", "virtual", eBR_1M );
+        CHECK( NULL != pChannels[ channelIdx ] );
+        if ( NULL == pChannels[ channelIdx ] )
+        {
+            return false;
+        }
+
+        // Nothing is kept from the last time the channel was open
+        SDOLatencyHistogram histogram;
+        SDOObjectLatencyHistogram objectHistogram;
+        CHECK( pChannels[ channelIdx ]->GetSDOLatencyStats().GetNodeHistogram( 1, &histogram ) );
+        CHECK( 0 == histogram.mNumSamples );
+        CHECK( 0 == pChannels[ channelIdx ]->GetSDOLatencyStats().GetObjectHistograms( &objectHistogram, 1 ) );
+
+        pChannels[ channelIdx ]->ConfigureAllMotorControllersForPositionControl();
+        CHECK( BringUpNodes( pChannels[ channelIdx ] ) );
+        UpdateChannel( pChannels[ channelIdx ], 1000 );
+    }
+
+    for ( S32 channelIdx = 0; channelIdx < 2; channelIdx++ )
+    {
+        const SDOLatencyStats& stats = pChannels[ channelIdx ]->GetSDOLatencyStats();
+        bool bSlow = ( 1 == channelIdx );
+
+        // Every transfer is counted once for its node and once for its
+        // object
+        U32 numNodeSamples = 0;
+        for ( U8 nodeId = 1; nodeId <= NUM_NODES; nodeId++ )
+        {
+            SDOLatencyHistogram histogram;
+            CHECK( stats.GetNodeHistogram( nodeId, &histogram ) );
+            numNodeSamples += histogram.mNumSamples;
+
+            U32 medianUS = CheckLatencyHistogram( histogram, &bPassed );
+            CHECK( bSlow ? medianUS >= SLOW_SDO_PROCESSING_TIME_US : medianUS < SLOW_SDO_PROCESSING_TIME_US );
+        }
+
+        SDOLatencyHistogram histogram;
+        CHECK( stats.GetNodeHistogram( NUM_NODES + 1, &histogram ) && 0 == histogram.mNumSamples );
+        CHECK( !stats.GetNodeHistogram( SDOLatencyStats::MAX_NUM_NODES, &histogram ) );
+
+        SDOObjectLatencyHistogram objectHistograms[ SDOLatencyStats::MAX_NUM_OBJECTS ];
+        S32 numObjects = stats.GetObjectHistograms( objectHistograms, SDOLatencyStats::MAX_NUM_OBJECTS );
+        U32 numObjectSamples = stats.GetNumUntrackedObjectSamples();
+        for ( S32 objectIdx = 0; objectIdx < numObjects; objectIdx++ )
+        {
+            CheckLatencyHistogram( objectHistograms[ objectIdx ].mHistogram, &bPassed );
+            numObjectSamples += objectHistograms[ objectIdx ].mHistogram.mNumSamples;
+        }
+        CHECK( numObjectSamples == numNodeSamples );
+
+        // The angle is polled throughout, so it's the most read object
+        CHECK( stats.GetObjectHistogram( 0x6064, 0, &histogram ) );
+        for ( S32 objectIdx = 0; objectIdx < numObjects; objectIdx++ )
+        {
+            CHECK( objectHistograms[ objectIdx ].mHistogram.mNumSamples <= histogram.mNumSamples );
+        }
+    }
+
+    SDOLatencyHistogram emptyHistogram;
+    memset( &emptyHistogram, 0, sizeof( emptyHistogram ) );
+    CHECK( 0 == SLS_GetLatencyPercentileUS( emptyHistogram, 50.0f ) );
+
+    EPOS_CloseCANChannel( pChannels[ 0 ] );
+    EPOS_CloseCANChannel( pChannels[ 1 ] );
+    return bPassed;
+}
+
+//------------------------------------------------------------------------------
+static bool TestMotorControllerData()
+{
+    bool bPassed = true;
+
+    CANChannel* pChannel = OpenChannel();
+    CHECK( NULL != pChannel );
+    if ( NULL == pChannel )
+    {
+        return false;
+    }
+
+    pChannel->ConfigureAllMotorControllersForPositionControl();
+    CHECK( BringUpNodes( pChannel ) );
+
+    // Each node is sent to its own angle so that the angles can't be
+    // reported against the wrong nodes
+    for ( U8 nodeId = 1; nodeId <= NUM_NODES; nodeId++ )
+    {
+        pChannel->SetMotorAngle( nodeId, 500*nodeId );
+    }
+    UpdateChannel( pChannel, 5000 );
+
+    MotorControllerData data[ CANChannel::MAX_NUM_MOTOR_CONTROLLERS ];
+    S32 numControllers = 0;
+    pChannel->GetMotorControllerData( data, &numControllers );
+    CHECK( NUM_NODES == numControllers );
+    for ( S32 controllerIdx = 0; controllerIdx < numControllers; controllerIdx++ )
+    {
+        U8 nodeId = controllerIdx + 1;
+        CHECK( nodeId == data[ controllerIdx ].mNodeId );
+        CHECK( CANMotorController::eS_Running == data[ controllerIdx ].mState );
+        CHECK( data[ controllerIdx ].mbAngleValid && 500*nodeId == data[ controllerIdx ].mAngle );
+    }
+
+    // A node that resets is reported as being set up again until it's back
+    const U8 RESET_NODE_ID = 3;
+    CHECK( VCB_ResetNode( pChannel, RESET_NODE_ID ) );
+
+    bool bSeenSettingUp = false;
+    for ( S32 updateIdx = 0; updateIdx < MAX_NUM_BRING_UP_UPDATES && !bSeenSettingUp; updateIdx++ )
+    {
+        UpdateChannel( pChannel, 1 );
+        pChannel->GetMotorControllerData( data, &numControllers );
+        CHECK( NUM_NODES == numControllers );
+        bSeenSettingUp = ( CANMotorController::eS_SettingUp == data[ RESET_NODE_ID - 1 ].mState );
+    }
+    CHECK( bSeenSettingUp );
+
+    CHECK( BringUpNodes( pChannel ) );
+    pChannel->GetMotorControllerData( data, &numControllers );
+    CHECK( NUM_NODES == numControllers );
+    CHECK( RESET_NODE_ID == data[ RESET_NODE_ID - 1 ].mNodeId );
+    CHECK( CANMotorController::eS_Running == data[ RESET_NODE_ID - 1 ].mState );
+
+    EPOS_CloseCANChannel( pChannel );
+    return bPassed;
+}
+
+//------------------------------------------------------------------------------
+static bool TestBatchedMotorAngles()
+{
+    bool bPassed = true;
+
+    CANChannel* pChannel = OpenChannel();
+    CHECK( NULL != pChannel );
+    if ( NULL == pChannel )
+    {
+        return false;
+    }
+
+    pChannel->ConfigureAllMotorControllersForPositionControl();
+    CHECK( BringUpNodes( pChannel ) );
+
+    // A later angle for a node replaces an earlier one in the same batch,
+    // and entries that don't name a single valid node are ignored
+    const MotorAngleSetpoint SETPOINTS[] = {
+        { 1, 100 }, { 2, 200 }, { 3, 300 }, { 4, 400 }, { 2, -200 },
+        { CANChannel::ALL_MOTOR_CONTROLLERS, 999 },
+        { CANChannel::MAX_NUM_MOTOR_CONTROLLERS, 999 } };
+    const S32 EXPECTED_ANGLES[ NUM_NODES ] = { 100, -200, 300, 400 };
+    const S32 NUM_SETPOINTS = sizeof( SETPOINTS )/sizeof( SETPOINTS[ 0 ] );
+
+    SetpointStats startStats[ NUM_NODES + 1 ];
+    for ( U8 nodeId = 1; nodeId <= NUM_NODES; nodeId++ )
+    {
+        CHECK( pChannel->GetSetpointStats( nodeId, &startStats[ nodeId ] ) );
+    }
+
+    SetpointStats startTotalStats;
+    CHECK( pChannel->GetSetpointStats( CANChannel::ALL_MOTOR_CONTROLLERS, &startTotalStats ) );
+
+    // The whole batch is applied in the next update
+    pChannel->SetMotorAngles( SETPOINTS, NUM_SETPOINTS );
+    UpdateChannel( pChannel, 1 );
+
+    for ( U8 nodeId = 1; nodeId <= NUM_NODES; nodeId++ )
+    {
+        SetpointStats stats;
+        CHECK( pChannel->GetSetpointStats( nodeId, &stats ) );
+        CHECK( startStats[ nodeId ].mNumSetpointsGiven + 1 == stats.mNumSetpointsGiven );
+    }
+
+    SetpointStats totalStats;
+    CHECK( pChannel->GetSetpointStats( CANChannel::ALL_MOTOR_CONTROLLERS, &totalStats ) );
+    CHECK( startTotalStats.mNumSetpointsGiven + NUM_NODES == totalStats.mNumSetpointsGiven );
+
+    UpdateChannel( pChannel, 5000 );
+    for ( U8 nodeId = 1; nodeId <= NUM_NODES; nodeId++ )
+    {
+        VirtualNodeState state;
+        CHECK( VCB_GetNodeState( pChannel, nodeId, &state ) );
+        CHECK( EXPECTED_ANGLES[ nodeId - 1 ] == state.mPosition );
+    }
+
+    // An empty batch gives no setpoints
+    pChannel->SetMotorAngles( SETPOINTS, 0 );
+    UpdateChannel( pChannel, 1 );
+    SetpointStats endTotalStats;
+    CHECK( pChannel->GetSetpointStats( CANChannel::ALL_MOTOR_CONTROLLERS, &endTotalStats ) );
+    CHECK( totalStats.mNumSetpointsGiven == endTotalStats.mNumSetpointsGiven );
+
+    EPOS_CloseCANChannel( pChannel );
+    return bPassed;
+}
+
+//------------------------------------------------------------------------------
+struct CommandPoster
+{
+    CANChannel* mpChannel;
+    S32 mNumBatches;
+    S32 mFinalAngle;
+    volatile bool mbDone;
+};
+
+//------------------------------------------------------------------------------
+// Posts batches of angles as a client thread would, finishing with every
+// node being sent to the final angle
+static void* CommandPosterMain( void* pArg )
+{
+    CommandPoster* pPoster = (CommandPoster*)pArg;
+
+    MotorAngleSetpoint setpoints[ NUM_NODES ];
+    for ( S32 batchIdx = 0; batchIdx <= pPoster->mNumBatches; batchIdx++ )
+    {
+        for ( S32 setpointIdx = 0; setpointIdx < NUM_NODES; setpointIdx++ )
+        {
+            setpoints[ setpointIdx ].mNodeId = setpointIdx + 1;
+            setpoints[ setpointIdx ].mAngle = ( batchIdx < pPoster->mNumBatches ?
+                100*( ( batchIdx + setpointIdx )%10 ) : pPoster->mFinalAngle );
+        }
+
+        pPoster->mpChannel->SetMotorAngles( setpoints, NUM_NODES );
+        usleep( UPDATE_PERIOD_US/4 );
+    }
+
+    pPoster->mbDone = true;
+    return NULL;
+}
+
+//------------------------------------------------------------------------------
+static bool TestCommandsFromClientThreads()
+{
+    bool bPassed = true;
+
+    CANChannel* pChannel = OpenChannel( 0, UPDATE_THREAD_RATE_HZ );
+    CHECK( NULL != pChannel );
+    if ( NULL == pChannel )
+    {
+        return false;
+    }
+
+    pChannel->ConfigureAllMotorControllersForPositionControl();
+    CHECK( WaitForUpdateThread( pChannel, false ) );
+
+    // One client thread posts commands and another reads the snapshots,
+    // whilst the update thread runs and this thread runs the simulation
+    CommandPoster poster;
+    poster.mpChannel = pChannel;
+    poster.mNumBatches = 1000;
+    poster.mFinalAngle = -1250;
+    poster.mbDone = false;
+
+    SnapshotReader reader;
+    memset( &reader, 0, sizeof( reader ) );
+    reader.mpChannel = pChannel;
+
+    pthread_t posterThread;
+    pthread_t readerThread;
+    bool bPosterStarted = ( 0 == pthread_create( &posterThread, NULL, CommandPosterMain, &poster ) );
+    bool bReaderStarted = ( 0 == pthread_create( &readerThread, NULL, SnapshotReaderMain, &reader ) );
+    CHECK( bPosterStarted && bReaderStarted );
+
+    for ( S32 stepIdx = 0; stepIdx < MAX_NUM_UPDATE_THREAD_STEPS && bPosterStarted && !poster.mbDone; stepIdx++ )
+    {
+        VCB_AdvanceTime( pChannel, UPDATE_PERIOD_US );
+        usleep( UPDATE_PERIOD_US );
+    }
+    CHECK( poster.mbDone );
+
+    // The last batch isn't lost among the others
+    CHECK( WaitForUpdateThread( pChannel, true, poster.mFinalAngle ) );
+
+    reader.mbStop = true;
+    if ( bPosterStarted )
+    {
+        pthread_join( posterThread, NULL );
+    }
+    if ( bReaderStarted )
+    {
+        pthread_join( readerThread, NULL );
+    }
+    CHECK( 0 == reader.mNumBadSnapshots );
+    CHECK( reader.mNumNewVersions > 1 );
+
+    // Once the thread is stopped, commands wait for the client to update
+    // the channel
+    pChannel->StopUpdateThread();
+    for ( U8 nodeId = 1; nodeId <= NUM_NODES; nodeId++ )
+    {
+        pChannel->SetMotorAngle( nodeId, 0 );
+    }
+    VCB_AdvanceTime( pChannel, 100*UPDATE_PERIOD_US );
+    CHECK( AllNodesAtAngle( pChannel, poster.mFinalAngle ) );
+    CHECK( MoveAllNodes( pChannel, 0 ) );
+
+    EPOS_CloseCANChannel( pChannel );
+    return bPassed;
+}
+
+//------------------------------------------------------------------------------
+static bool TestTrafficReplay()
+{
+    bool bPassed = true;
+
+    // Record a session in which the nodes are brought up and moved
+    CANChannel* pChannel = OpenChannel();
+    CHECK( NULL != pChannel );
+    if ( NULL == pChannel )
+    {
+        return false;
+    }
+
+    CHECK( pChannel->StartTrafficRecording( CAPTURE_FILENAME ) );
+    CHECK( pChannel->IsTrafficRecording() );
+
+    pChannel->ConfigureAllMotorControllersForPositionControl();
+    S32 numUpdates = 0;
+    while ( pChannel->GetNumRunningNodes() < NUM_NODES && numUpdates < MAX_NUM_BRING_UP_UPDATES )
+    {
+        UpdateChannel( pChannel, 1 );
+        numUpdates++;
+    }
+
+    for ( U8 nodeId = 1; nodeId <= NUM_NODES; nodeId++ )
+    {
+        pChannel->SetMotorAngle( nodeId, -750*nodeId );
+    }
+    UpdateChannel( pChannel, 2000 );
+    numUpdates += 2000;
+
+    pChannel->StopTrafficRecording();
+    CHECK( !pChannel->IsTrafficRecording() );
+
+    MotorControllerSnapshot* pRecordedSnapshot = new MotorControllerSnapshot;
+    pChannel->GetMotorControllerSnapshot( pRecordedSnapshot );
+    EPOS_CloseCANChannel( pChannel );
+
+    // Replay it on a bus without any nodes, so that everything the channel
+    // hears comes from the capture
+    VirtualCANBusConfig config;
+    VCB_GetDefaultConfig( &config );
+    config.mNumNodes = 0;
+    VCB_SetConfig( config );
+
+    TrafficReplayer replayer;
+    CHECK( replayer.Open( CAPTURE_FILENAME ) );
+    pChannel = EPOS_OpenCANChannel( "virtual", "virtual", eBR_1M );
+    CHECK( NULL != pChannel );
+    if ( NULL == pChannel )
+    {
+        delete pRecordedSnapshot;
+        return false;
+    }
+
+    U64 lastTimeUS = replayer.GetTimeUS();
+    while ( replayer.ReplayNextUpdate( pChannel ) )
+    {
+        U64 timeStepUS = replayer.GetTimeUS() - lastTimeUS;
+        VCB_AdvanceTime( pChannel, (U32)( timeStepUS < UPDATE_PERIOD_US ? timeStepUS : UPDATE_PERIOD_US ) );
+        lastTimeUS = replayer.GetTimeUS();
+    }
+
+    // Every update is replayed, the channel is waiting for every SDO
+    // completion that's fed to it, and it ends up where the recorded
+    // channel did
+    const TrafficReplayStats& stats = replayer.GetStats();
+    CHECK( stats.mNumRecords > 0 );
+    CHECK( stats.mNumRecords == stats.mNumRecordsReplayed + stats.mNumRecordsSkipped );
+    CHECK( (U32)numUpdates == stats.mNumUpdates );
+    CHECK( 0 == stats.mNumUnmatchedCompletions );
+
+    MotorControllerSnapshot* pReplayedSnapshot = new MotorControllerSnapshot;
+    pChannel->GetMotorControllerSnapshot( pReplayedSnapshot );
+    CHECK( NUM_NODES == pReplayedSnapshot->mNumControllers );
+    CHECK( pRecordedSnapshot->mNumControllers == pReplayedSnapshot->mNumControllers );
+    for ( S32 controllerIdx = 0; controllerIdx < pReplayedSnapshot->mNumControllers; controllerIdx++ )
+    {
+        CHECK( pRecordedSnapshot->mNodeIds[ controllerIdx ] == pReplayedSnapshot->mNodeIds[ controllerIdx ] );
+        CHECK( pRecordedSnapshot->mStates[ controllerIdx ] == pReplayedSnapshot->mStates[ controllerIdx ] );
+        CHECK( pReplayedSnapshot->mbAngleValid[ controllerIdx ] );
+        CHECK( -750*pReplayedSnapshot->mNodeIds[ controllerIdx ] == pReplayedSnapshot->mAngles[ controllerIdx ] );
+    }
+
+    delete pRecordedSnapshot;
+    delete pReplayedSnapshot;
+    EPOS_CloseCANChannel( pChannel );
+    remove( CAPTURE_FILENAME );
+    return bPassed;
+}
+
+//------------------------------------------------------------------------------
+static bool TestNodeBringUp()
+{
+    bool bPassed = true;
+
+    CANChannel* pChannels[ 2 ];
+    for ( S32 channelIdx = 0; channelIdx < 2; channelIdx++ )
+    {
+        pChannels[ channelIdx ] = OpenChannel();
+        CHECK( NULL != pChannels[ channelIdx ] );
+        if ( NULL == pChannels[ channelIdx ] )
+        {
+            return false;
+        }
+    }
+
+    // Each node that starts to set up takes a place until it has finished,
+    // and there's always a place when there's no limit
+    CANChannel* pChannel = pChannels[ 0 ];
+    CHECK( CANChannel::DEFAULT_MAX_NUM_NODES_SETTING_UP == pChannel->GetMaxNumNodesSettingUp() );
+    pChannel->SetMaxNumNodesSettingUp( 2 );
+    CHECK( 2 == pChannel->GetMaxNumNodesSettingUp() );
+    CHECK( pChannel->TryStartNodeSetUp() );
+    CHECK( pChannel->TryStartNodeSetUp() );
+    CHECK( !pChannel->TryStartNodeSetUp() );
+    pChannel->OnNodeSetUpFinished();
+    CHECK( pChannel->TryStartNodeSetUp() );
+    CHECK( !pChannel->TryStartNodeSetUp() );
+    pChannel->OnNodeSetUpFinished();
+    pChannel->OnNodeSetUpFinished();
+
+    pChannel->SetMaxNumNodesSettingUp( 0 );
+    for ( S32 nodeIdx = 0; nodeIdx < NUM_NODES + 1; nodeIdx++ )
+    {
+        CHECK( pChannel->TryStartNodeSetUp() );
+    }
+    for ( S32 nodeIdx = 0; nodeIdx < NUM_NODES + 1; nodeIdx++ )
+    {
+        pChannel->OnNodeSetUpFinished();
+    }
+
+    // The second channel sets its nodes up one at a time, which is slower
+    // but still gets them all running
+    pChannels[ 1 ]->SetMaxNumNodesSettingUp( 1 );
+    for ( S32 channelIdx = 0; channelIdx < 2; channelIdx++ )
+    {
+        pChannels[ channelIdx ]->ConfigureAllMotorControllersForPositionControl();
+        CHECK( BringUpNodes( pChannels[ channelIdx ] ) );
+    }
+
+    // Every present node has been timed from when it booted until it was
+    // running, and the stats of the channel agree with the nodes' times
+    U64 maxTimeToRunningUS = 0;
+    U64 lastRunningTimeUS = 0;
+    for ( U8 nodeId = 1; nodeId <= NUM_NODES; nodeId++ )
+    {
+        NodeBringUpTimes times;
+        CHECK( pChannel->GetNodeBringUpTimes( nodeId, &times ) );
+        CHECK( times.mbPresent );
+        CHECK( times.mPresentTimeUS < times.mRunningTimeUS );
+
+        U64 timeToRunningUS = times.mRunningTimeUS - times.mPresentTimeUS;
+        maxTimeToRunningUS = ( timeToRunningUS > maxTimeToRunningUS ? timeToRunningUS : maxTimeToRunningUS );
+        lastRunningTimeUS = ( times.mRunningTimeUS > lastRunningTimeUS ? times.mRunningTimeUS : lastRunningTimeUS );
+    }
+
+    NodeBringUpTimes absentTimes;
+    CHECK( pChannel->GetNodeBringUpTimes( NUM_NODES + 1, &absentTimes ) );
+    CHECK( !absentTimes.mbPresent );
+    CHECK( 0 == absentTimes.mRunningTimeUS );
+    CHECK( !pChannel->GetNodeBringUpTimes( CANChannel::MAX_NUM_MOTOR_CONTROLLERS, &absentTimes ) );
+
+    BringUpStats stats;
+    pChannel->GetBringUpStats( &stats );
+    CHECK( NUM_NODES == stats.mNumNodesPresent );
+    CHECK( NUM_NODES == stats.mNumNodesRunning );
+    CHECK( maxTimeToRunningUS == stats.mMaxTimeToRunningUS );
+    CHECK( lastRunningTimeUS == stats.mLastRunningTimeUS );
+    CHECK( stats.mMeanTimeToRunningUS > 0 );
+    CHECK( stats.mMeanTimeToRunningUS <= stats.mMaxTimeToRunningUS );
+
+    // The library adds up the nodes of every channel
+    BringUpStats otherStats;
+    pChannels[ 1 ]->GetBringUpStats( &otherStats );
+    BringUpStats libraryStats;
+    EPOS_GetBringUpStats( &libraryStats );
+    CHECK( 2*NUM_NODES == libraryStats.mNumNodesPresent );
+    CHECK( 2*NUM_NODES == libraryStats.mNumNodesRunning );
+    CHECK( libraryStats.mMaxTimeToRunningUS == ( stats.mMaxTimeToRunningUS > otherStats.mMaxTimeToRunningUS
+        ? stats.mMaxTimeToRunningUS : otherStats.mMaxTimeToRunningUS ) );
+
+    CHECK( EPOS_WaitForRunningNodes( 2*NUM_NODES, 0 ) );
+    CHECK( !EPOS_WaitForRunningNodes( 2*NUM_NODES + 1, 20 ) );
+
+    // A rebooted node is timed again from when it's back
+    NodeBringUpTimes firstTimes;
+    CHECK( pChannel->GetNodeBringUpTimes( 1, &firstTimes ) );
+    CHECK( VCB_ResetNode( pChannel, 1 ) );
+
+    NodeBringUpTimes rebootTimes = firstTimes;
+    S32 updateIdx = 0;
+    while ( rebootTimes.mPresentTimeUS == firstTimes.mPresentTimeUS
+        && updateIdx < MAX_NUM_BRING_UP_UPDATES )
+    {
+        UpdateChannel( pChannel, 1 );
+        pChannel->GetNodeBringUpTimes( 1, &rebootTimes );
+        updateIdx++;
+    }
+    CHECK( rebootTimes.mPresentTimeUS > firstTimes.mRunningTimeUS );
+    CHECK( 0 == rebootTimes.mRunningTimeUS );
+    CHECK( NUM_NODES - 1 == pChannel->GetNumRunningNodes() );
+
+    CHECK( BringUpNodes( pChannel ) );
+    CHECK( pChannel->GetNodeBringUpTimes( 1, &rebootTimes ) );
+    CHECK( rebootTimes.mPresentTimeUS < rebootTimes.mRunningTimeUS );
+
+    for ( S32 channelIdx = 0; channelIdx < 2; channelIdx++ )
+    {
+        EPOS_CloseCANChannel( pChannels[ channelIdx ] );
+    }
+
+    return bPassed;
+}
+
+//------------------------------------------------------------------------------
+// Fills the points of a ramp from startPosition, which moves at a constant
+// speed and stops at the last point
+static void MakeRamp( S32 startPosition, S32 ticksPerPoint, TrajectoryPoint* pPointsOut )
+{
+    VirtualCANBusConfig config;
+    VCB_GetDefaultConfig( &config );
+
+    for ( S32 pointIdx = 0; pointIdx < NUM_TRAJECTORY_POINTS; pointIdx++ )
+    {
+        TrajectoryPoint& point = pPointsOut[ pointIdx ];
+        point.mPosition = startPosition + ( pointIdx + 1 )*ticksPerPoint;
+        point.mVelocity = ticksPerPoint*60*1000/( TRAJECTORY_POINT_TIME_MS*(S32)config.mCountsPerRevolution );
+        point.mTimeMS = TRAJECTORY_POINT_TIME_MS;
+    }
+    pPointsOut[ NUM_TRAJECTORY_POINTS - 1 ].mVelocity = 0;
+}
+
+//------------------------------------------------------------------------------
+// Keeps the rings of the nodes topped up with the points until every point
+// has been reached. pNumPointsQueued holds how many points each node already
+// has. Returns false if the points aren't all reached in time.
+static bool FollowTrajectory( CANChannel* pChannel, const TrajectoryPoint* pPoints,
+                              S32* pNumPointsQueued )
+{
+    S32 maxNumUpdates = MAX_NUM_BRING_UP_UPDATES
+        + NUM_TRAJECTORY_POINTS*TRAJECTORY_POINT_TIME_MS*1000/UPDATE_PERIOD_US;
+    for ( S32 updateIdx = 0; updateIdx < maxNumUpdates; updateIdx++ )
+    {
+        bool bAllReached = true;
+        for ( U8 nodeId = 1; nodeId <= NUM_NODES; nodeId++ )
+        {
+            S32& numPointsQueued = pNumPointsQueued[ nodeId ];
+            numPointsQueued += pChannel->QueueTrajectoryPoints( nodeId,
+                &pPoints[ numPointsQueued ], NUM_TRAJECTORY_POINTS - numPointsQueued );
+
+            bAllReached = bAllReached && NUM_TRAJECTORY_POINTS == numPointsQueued
+                && 0 == pChannel->GetNumTrajectoryPointsPending( nodeId );
+        }
+
+        if ( bAllReached )
+        {
+            return true;
+        }
+        UpdateChannel( pChannel, 1 );
+    }
+
+    return false;
+}
+
+//------------------------------------------------------------------------------
+static bool TestInterpolatedTrajectory()
+{
+    bool bPassed = true;
+
+    // Points survive being packed into the PVT format, including negative
+    // velocities
+    TrajectoryPoint point;
+    point.mPosition = -123456;
+    point.mVelocity = -4321;
+    point.mTimeMS = 20;
+
+    U8 data[ CANMotorController::PVT_RPDO_NUM_BYTES ];
+    CANMotorController::PackTrajectoryPoint( point, data );
+    TrajectoryPoint unpackedPoint = CANMotorController::UnpackTrajectoryPoint( data );
+    CHECK( point.mPosition == unpackedPoint.mPosition );
+    CHECK( point.mVelocity == unpackedPoint.mVelocity );
+    CHECK( point.mTimeMS == unpackedPoint.mTimeMS );
+
+    CANChannel* pChannel = OpenChannel();
+    CHECK( NULL != pChannel );
+    if ( NULL == pChannel )
+    {
+        return false;
+    }
+
+    pChannel->ConfigureAllMotorControllersForInterpolatedPositionControl();
+    CHECK( BringUpNodes( pChannel ) );
+    CHECK( 0 == pChannel->QueueTrajectoryPoints( CANChannel::ALL_MOTOR_CONTROLLERS, &point, 1 ) );
+
+    // A trajectory longer than the ring is only taken in part at first
+    static TrajectoryPoint points[ NUM_TRAJECTORY_POINTS ];
+    MakeRamp( 0, TRAJECTORY_TICKS_PER_POINT, points );
+
+    S32 numPointsQueued[ NUM_NODES + 1 ];
+    memset( numPointsQueued, 0, sizeof( numPointsQueued ) );
+    for ( U8 nodeId = 1; nodeId <= NUM_NODES; nodeId++ )
+    {
+        numPointsQueued[ nodeId ] = pChannel->QueueTrajectoryPoints( nodeId, points, NUM_TRAJECTORY_POINTS );
+        CHECK( numPointsQueued[ nodeId ] > 0 && numPointsQueued[ nodeId ] < NUM_TRAJECTORY_POINTS );
+        CHECK( (U32)numPointsQueued[ nodeId ] == pChannel->GetNumTrajectoryPointsPending( nodeId ) );
+    }
+
+    // Topped up as they go, the nodes reach every point without overflowing
+    // their buffers, and stop at the end
+    S32 endPosition = NUM_TRAJECTORY_POINTS*TRAJECTORY_TICKS_PER_POINT;
+    CHECK( FollowTrajectory( pChannel, points, numPointsQueued ) );
+    UpdateChannel( pChannel, NUM_SETTLING_UPDATES );
+    for ( U8 nodeId = 1; nodeId <= NUM_NODES; nodeId++ )
+    {
+        VirtualNodeState state;
+        CHECK( VCB_GetNodeState( pChannel, nodeId, &state ) );
+        CHECK( endPosition == state.mPosition );
+        CHECK( !state.mbInterpolationActive );
+        CHECK( (U32)NUM_TRAJECTORY_POINTS == state.mNumInterpolationPointsReached );
+        CHECK( 0 == ( state.mInterpolationBufferStatus & IP_BUFFER_STATUS_OVERFLOW_ERROR ) );
+    }
+
+    // Points added once the nodes have stopped start them again from where
+    // they are
+    MakeRamp( endPosition, -TRAJECTORY_TICKS_PER_POINT, points );
+    memset( numPointsQueued, 0, sizeof( numPointsQueued ) );
+    CHECK( FollowTrajectory( pChannel, points, numPointsQueued ) );
+    UpdateChannel( pChannel, NUM_SETTLING_UPDATES );
+    for ( U8 nodeId = 1; nodeId <= NUM_NODES; nodeId++ )
+    {
+        VirtualNodeState state;
+        CHECK( VCB_GetNodeState( pChannel, nodeId, &state ) );
+        CHECK( 0 == state.mPosition );
+        CHECK( (U32)( 2*NUM_TRAJECTORY_POINTS ) == state.mNumInterpolationPointsReached );
+        CHECK( 0 == ( state.mInterpolationBufferStatus & IP_BUFFER_STATUS_OVERFLOW_ERROR ) );
+    }
+
+    EPOS_CloseCANChannel( pChannel );
+    return bPassed;
+}
+
+//------------------------------------------------------------------------------
+// Returns the number of frames sent to the nodes over the updates. If
+// bGiveSetpoints is true then the setpoint is given to every node before
+// each update.
+static U32 CountFramesToNodes( CANChannel* pChannel, bool bGiveSetpoints, bool bCurrentControl,
+                               S32 setpoint, S32 numUpdates )
+{
+    VirtualCANBusStats startStats;
+    VCB_GetStats( pChannel, &startStats );
+    for ( S32 updateIdx = 0; updateIdx < numUpdates; updateIdx++ )
+    {
+        if ( bGiveSetpoints && bCurrentControl )
+        {
+            pChannel->SetMotorCurrent( CANChannel::ALL_MOTOR_CONTROLLERS, (S16)setpoint );
+        }
+        else if ( bGiveSetpoints )
+        {
+            pChannel->SetMotorVelocity( CANChannel::ALL_MOTOR_CONTROLLERS, setpoint );
+        }
+        UpdateChannel( pChannel, 1 );
+    }
+
+    VirtualCANBusStats endStats;
+    VCB_GetStats( pChannel, &endStats );
+    return endStats.mNumFramesToNodes - startStats.mNumFramesToNodes;
+}
+
+//------------------------------------------------------------------------------
+static bool TestVelocityAndCurrentControl()
+{
+    bool bPassed = true;
+
+    static const CANMotorController::eSetpointMode SETPOINT_MODES[] =
+    {
+        CANMotorController::eSM_SDO,
+        CANMotorController::eSM_RPDO,
+    };
+
+    for ( S32 modeIdx = 0; modeIdx < 2; modeIdx++ )
+    {
+        for ( S32 controlIdx = 0; controlIdx < 2; controlIdx++ )
+        {
+            bool bCurrentControl = ( 1 == controlIdx );
+            CANChannel* pChannel = OpenChannel();
+            CHECK( NULL != pChannel );
+            if ( NULL == pChannel )
+            {
+                return false;
+            }
+
+            pChannel->SetSetpointMode( CANChannel::ALL_MOTOR_CONTROLLERS, SETPOINT_MODES[ modeIdx ] );
+            if ( bCurrentControl )
+            {
+                pChannel->ConfigureAllMotorControllersForCurrentControl();
+            }
+            else
+            {
+                pChannel->ConfigureAllMotorControllersForVelocityControl();
+            }
+            CHECK( BringUpNodes( pChannel ) );
+
+            // Each node takes its own setpoint
+            for ( U8 nodeId = 1; nodeId <= NUM_NODES; nodeId++ )
+            {
+                if ( bCurrentControl )
+                {
+                    pChannel->SetMotorCurrent( nodeId, 100*nodeId );
+                }
+                else
+                {
+                    pChannel->SetMotorVelocity( nodeId, 200*nodeId );
+                }
+            }
+            UpdateChannel( pChannel, NUM_SETTLING_UPDATES );
+
+            for ( U8 nodeId = 1; nodeId <= NUM_NODES; nodeId++ )
+            {
+                VirtualNodeState state;
+                CHECK( VCB_GetNodeState( pChannel, nodeId, &state ) );
+                if ( bCurrentControl )
+                {
+                    CHECK( 100*nodeId == state.mCurrentSetting );
+                }
+                else
+                {
+                    CHECK( 200*nodeId == state.mTargetVelocity );
+                    CHECK( 200*nodeId == state.mVelocity );
+                }
+            }
+
+            // A setpoint that every node already has costs no more traffic
+            // than leaving the nodes alone, give or take the polling, which
+            // can drift by a frame or two between the two sets of updates
+            S32 setpoint = ( bCurrentControl ? -250 : -300 );
+            CountFramesToNodes( pChannel, true, bCurrentControl, setpoint, NUM_SETTLING_UPDATES );
+
+            SetpointStats startStats;
+            CHECK( pChannel->GetSetpointStats( CANChannel::ALL_MOTOR_CONTROLLERS, &startStats ) );
+            U32 numRepeatFrames = CountFramesToNodes( pChannel, true, bCurrentControl, setpoint, NUM_SETTLING_UPDATES );
+            U32 numIdleFrames = CountFramesToNodes( pChannel, false, bCurrentControl, setpoint, NUM_SETTLING_UPDATES );
+            CHECK( numRepeatFrames < numIdleFrames + NUM_NODES );
+
+            SetpointStats endStats;
+            CHECK( pChannel->GetSetpointStats( CANChannel::ALL_MOTOR_CONTROLLERS, &endStats ) );
+            CHECK( startStats.mNumSetpointsSent == endStats.mNumSetpointsSent );
+            CHECK( startStats.mNumSetpointsSuppressed + NUM_NODES*NUM_SETTLING_UPDATES
+                == endStats.mNumSetpointsSuppressed );
+
+            for ( U8 nodeId = 1; nodeId <= NUM_NODES; nodeId++ )
+            {
+                VirtualNodeState state;
+                CHECK( VCB_GetNodeState( pChannel, nodeId, &state ) );
+                CHECK( setpoint == ( bCurrentControl ? state.mCurrentSetting : state.mVelocity ) );
+            }
+
+            EPOS_CloseCANChannel( pChannel );
+        }
+    }
+
+    return bPassed;
+}
+
+//------------------------------------------------------------------------------
+// Returns the fraction of the time that the virtual bus was busy over the
+// updates, along with the channel's estimate of it
+static float MeasureBusLoad( CANChannel* pChannel, S32 numUpdates, float* pEstimatedLoadOut )
+{
+    VirtualCANBusStats startBusStats;
+    VCB_GetStats( pChannel, &startBusStats );
+    BusLoadStats startStats;
+    pChannel->GetBusLoadStats( &startStats );
+
+    UpdateChannel( pChannel, numUpdates );
+
+    VirtualCANBusStats endBusStats;
+    VCB_GetStats( pChannel, &endBusStats );
+    BusLoadStats endStats;
+    pChannel->GetBusLoadStats( &endStats );
+
+    float elapsedTimeUS = (float)( endBusStats.mTimeUS - startBusStats.mTimeUS );
+    *pEstimatedLoadOut = (float)( endStats.mNumBits - startStats.mNumBits )*1000000.0f
+        /( elapsedTimeUS*endStats.mBitRate );
+    return (float)( endBusStats.mBusBusyTimeUS - startBusStats.mBusBusyTimeUS )/elapsedTimeUS;
+}
+
+//------------------------------------------------------------------------------
+static bool TestBusLoadBudget()
+{
+    bool bPassed = true;
+
+    // Worst case bit stuffing is counted
+    CHECK( 55 == BusLoadEstimator::GetFrameNumBits( 0 ) );
+    CHECK( 135 == BusLoadEstimator::GetFrameNumBits( 8 ) );
+
+    CANChannel* pChannel = OpenChannel();
+    CHECK( NULL != pChannel );
+    if ( NULL == pChannel )
+    {
+        return false;
+    }
+
+    BusLoadStats stats;
+    pChannel->GetBusLoadStats( &stats );
+    CHECK( 1000000 == stats.mBitRate );
+    CHECK( stats.mBudget > 0.0f );
+
+    // With nothing held back, polling keeps the bus busy, and the estimate
+    // agrees with the virtual bus, which is only ever busy with the
+    // channel's frames
+    pChannel->SetBusLoadBudget( 0.0f );
+    pChannel->SetFeedbackMode( CANChannel::ALL_MOTOR_CONTROLLERS, CANMotorController::eFM_SDOPolling );
+    pChannel->ConfigureAllMotorControllersForPositionControl();
+    CHECK( BringUpNodes( pChannel ) );
+
+    float estimatedLoad = 0.0f;
+    float busLoad = MeasureBusLoad( pChannel, NUM_BUS_LOAD_UPDATES, &estimatedLoad );
+    CHECK( busLoad > HIGH_BUS_LOAD );
+    CHECK( estimatedLoad > busLoad - MAX_BUS_LOAD_ERROR && estimatedLoad < busLoad + MAX_BUS_LOAD_ERROR );
+    CHECK( pChannel->GetBusUtilisation() > busLoad - MAX_BUS_LOAD_ERROR
+        && pChannel->GetBusUtilisation() < busLoad + MAX_BUS_LOAD_ERROR );
+    CHECK( !pChannel->IsPollingDeferred() );
+
+    pChannel->GetBusLoadStats( &stats );
+    CHECK( 0.0f == stats.mBudget );
+    CHECK( 0 == stats.mNumWindowsOverBudget );
+    CHECK( stats.mNumWindows >= NUM_BUS_LOAD_UPDATES*UPDATE_PERIOD_US/BusLoadEstimator::WINDOW_US );
+    CHECK( stats.mPeakUtilisation >= stats.mUtilisation );
+
+    // Over budget, polling is deferred until the load drops again, and the
+    // nodes can still be moved
+    pChannel->SetBusLoadBudget( LOW_BUS_LOAD_BUDGET );
+    bool bPollingDeferred = false;
+    for ( S32 updateIdx = 0; updateIdx < NUM_BUS_LOAD_UPDATES && !bPollingDeferred; updateIdx++ )
+    {
+        UpdateChannel( pChannel, 1 );
+        bPollingDeferred = pChannel->IsPollingDeferred();
+    }
+    CHECK( bPollingDeferred );
+
+    float budgetedBusLoad = MeasureBusLoad( pChannel, NUM_BUS_LOAD_UPDATES, &estimatedLoad );
+    CHECK( budgetedBusLoad < 0.75f*busLoad );
+    CHECK( estimatedLoad > budgetedBusLoad - MAX_BUS_LOAD_ERROR
+        && estimatedLoad < budgetedBusLoad + MAX_BUS_LOAD_ERROR );
+
+    pChannel->GetBusLoadStats( &stats );
+    CHECK( LOW_BUS_LOAD_BUDGET == stats.mBudget );
+    CHECK( stats.mNumWindowsOverBudget > 0 );
+    CHECK( MoveAllNodes( pChannel, 3210 ) );
+
+    // Without the budget, polling is no longer held back once the next
+    // window has closed
+    pChannel->SetBusLoadBudget( 0.0f );
+    UpdateChannel( pChannel, 2*BusLoadEstimator::WINDOW_US/UPDATE_PERIOD_US );
+    CHECK( !pChannel->IsPollingDeferred() );
+    CHECK( MeasureBusLoad( pChannel, NUM_BUS_LOAD_UPDATES, &estimatedLoad ) > HIGH_BUS_LOAD );
+
+    EPOS_CloseCANChannel( pChannel );
+    return bPassed;
+}
+
+//------------------------------------------------------------------------------
+// Returns the number of times that the Statusword of every node was read over
+// the updates
+static U32 CountStatuswordReads( CANChannel* pChannel, S32 numUpdates )
+{
+    U32 numStartReads = GetNumObjectTransfers( pChannel, 0x6041, 0 );
+    UpdateChannel( pChannel, numUpdates );
+    return GetNumObjectTransfers( pChannel, 0x6041, 0 ) - numStartReads;
+}
+
+//------------------------------------------------------------------------------
+static bool TestStatusWatchdog()
+{
+    bool bPassed = true;
+
+    CANChannel* pChannel = OpenChannel();
+    CHECK( NULL != pChannel );
+    if ( NULL == pChannel )
+    {
+        return false;
+    }
+
+    CHECK( CANChannel::DEFAULT_STATUS_WATCHDOG_INTERVAL_MS == pChannel->GetStatusWatchdogInterval() );
+    pChannel->SetFeedbackMode( CANChannel::ALL_MOTOR_CONTROLLERS, CANMotorController::eFM_TPDO );
+    pChannel->ConfigureAllMotorControllersForPositionControl();
+    CHECK( BringUpNodes( pChannel ) );
+
+    // Idle nodes send no TPDOs, so the watchdog reads the Statusword of each
+    // node once per interval, give or take where the interval falls
+    pChannel->SetStatusWatchdogInterval( STATUS_WATCHDOG_INTERVAL_MS );
+    CHECK( STATUS_WATCHDOG_INTERVAL_MS == pChannel->GetStatusWatchdogInterval() );
+    UpdateChannel( pChannel, NUM_SETTLING_UPDATES );
+
+    U32 numExpectedReads = NUM_NODES*NUM_WATCHDOG_UPDATES*UPDATE_PERIOD_US/( 1000*STATUS_WATCHDOG_INTERVAL_MS );
+    U32 numReads = CountStatuswordReads( pChannel, NUM_WATCHDOG_UPDATES );
+    CHECK( numReads + NUM_NODES >= numExpectedReads && numReads <= numExpectedReads + NUM_NODES );
+
+    // Without the watchdog, the Statusword isn't read at all, and changes to
+    // it arrive in TPDO 1
+    pChannel->SetStatusWatchdogInterval( 0 );
+    UpdateChannel( pChannel, NUM_SETTLING_UPDATES );
+    CHECK( 0 == CountStatuswordReads( pChannel, NUM_WATCHDOG_UPDATES ) );
+
+    U32 numStartReads = GetNumObjectTransfers( pChannel, 0x6041, 0 );
+    for ( U8 nodeId = 1; nodeId <= NUM_NODES; nodeId++ )
+    {
+        pChannel->SetMotorAngle( nodeId, 2000 );
+    }
+
+    VirtualNodeState state;
+    memset( &state, 0, sizeof( state ) );
+    S32 updateIdx = 0;
+    while ( state.mPosition < 1000 && updateIdx < MAX_NUM_BRING_UP_UPDATES )
+    {
+        UpdateChannel( pChannel, 1 );
+        VCB_GetNodeState( pChannel, 1, &state );
+        updateIdx++;
+    }
+    CHECK( 0 == ( GetSnapshotStatusword( pChannel, 1 ) & STATUSWORD_TARGET_REACHED ) );
+
+    CHECK( MoveAllNodes( pChannel, 2000 ) );
+    for ( U8 nodeId = 1; nodeId <= NUM_NODES; nodeId++ )
+    {
+        CHECK( 0 != ( GetSnapshotStatusword( pChannel, nodeId ) & STATUSWORD_TARGET_REACHED ) );
+    }
+    CHECK( numStartReads == GetNumObjectTransfers( pChannel, 0x6041, 0 ) );
+
+    // Faults are seen within a few updates however far apart the updates
+    // are, rather than after a fixed number of them, and so is their reset
+    static const U32 UPDATE_PERIOD_MULTIPLES[] = { 1, 10, 50 };
+    const U8 FAULTY_NODE_ID = 2;
+    for ( S32 periodIdx = 0; periodIdx < 3; periodIdx++ )
+    {
+        U32 updatePeriodUS = UPDATE_PERIOD_MULTIPLES[ periodIdx ]*UPDATE_PERIOD_US;
+        CHECK( VCB_InjectFault( pChannel, FAULTY_NODE_ID, 0x8611, 0x20 ) );
+
+        updateIdx = 0;
+        while ( 0 == ( GetSnapshotStatusword( pChannel, FAULTY_NODE_ID ) & STATUSWORD_FAULT )
+            && updateIdx < MAX_NUM_FAULT_REPORT_UPDATES )
+        {
+            pChannel->Update();
+            VCB_AdvanceTime( pChannel, updatePeriodUS );
+            updateIdx++;
+        }
+        CHECK( 0 != ( GetSnapshotStatusword( pChannel, FAULTY_NODE_ID ) & STATUSWORD_FAULT ) );
+
+        pChannel->SendFaultReset( FAULTY_NODE_ID );
+        for ( updateIdx = 0; updateIdx < MAX_NUM_FAULT_REPORT_UPDATES; updateIdx++ )
+        {
+            pChannel->Update();
+            VCB_AdvanceTime( pChannel, updatePeriodUS );
+        }
+        CHECK( 0 == ( GetSnapshotStatusword( pChannel, FAULTY_NODE_ID ) & STATUSWORD_FAULT ) );
+    }
+
+    EPOS_CloseCANChannel( pChannel );
+    return bPassed;
+}
+
+//------------------------------------------------------------------------------
+struct Test
+{
+    const char* mName;
+    bool (*mTestFunction)();
+};
+
+static const Test TESTS[] = {
+    { "StoredAndDifferentialConfiguration", TestStoredAndDifferentialConfiguration },
+    { "ShortSdoReadReplies", TestShortSdoReadReplies },
+    { "SetpointDeadbandAndCoalescing", TestSetpointDeadbandAndCoalescing },
+    { "RebootDuringSetUp", TestRebootDuringSetUp },
+    { "TPDOFeedback", TestTPDOFeedback },
+    { "RPDOSetpoints", TestRPDOSetpoints },
+    { "ConcurrentSnapshots", TestConcurrentSnapshots },
+    { "EmergencyErrors", TestEmergencyErrors },
+    { "ChannelLookup", TestChannelLookup },
+    { "UpdateThread", TestUpdateThread },
+    { "SDOLatencyStats", TestSDOLatencyStats },
+    { "MotorControllerData", TestMotorControllerData },
+    { "BatchedMotorAngles", TestBatchedMotorAngles },
+    { "CommandsFromClientThreads", TestCommandsFromClientThreads },
+    { "TrafficReplay", TestTrafficReplay },
+    { "NodeBringUp", TestNodeBringUp },
+    { "InterpolatedTrajectory", TestInterpolatedTrajectory },
+    { "VelocityAndCurrentControl", TestVelocityAndCurrentControl },
+    { "BusLoadBudget", TestBusLoadBudget },
+    { "StatusWatchdog", TestStatusWatchdog },
+};
+
+//------------------------------------------------------------------------------
+int main( int argc, char** argv )
+{
+    if ( !EPOS_InitLibrary() )
+    {
+        fprintf( stderr, "Error: Unable to initialise EPOSControl\n" );
+        return 1;
+    }
+
+    S32 numTests = sizeof( TESTS )/sizeof( TESTS[ 0 ] );
+    S32 numFailures = 0;
+    for ( S32 testIdx = 0; testIdx < numTests; testIdx++ )
+    {
+        bool bPassed = TESTS[ testIdx ].mTestFunction();
+        printf( "%s: %s\n", TESTS[ testIdx ].mName, ( bPassed ? "PASSED" : "FAILED" ) );
+        if ( !bPassed )
+        {
+            numFailures++;
+        }
+    }
+
+    EPOS_DeinitLibrary();
+
+    printf( "%i of %i tests passed\n", numTests - numFailures, numTests );
+    return ( 0 == numFailures ? 0 : 1 );
+}